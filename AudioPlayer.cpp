@@ -3,32 +3,28 @@
 // 
 
 #include "AudioPlayer.h"
+#include <SD.h>
 
 
 
 AudioPlayer::AudioPlayer()
+	: _patchCord( _playSdWav1, 0, _mixer1, 0 ),
+	_patchCord2( _playSdWav1, 1, _mixer1, 3 ),
+	_patchCord3( _mixer1, 0, _mqs1, 0 ),
+	_patchCord4( _mixer1, 0, _mqs1, 1 )
 {
-
-	_patchCord = new AudioConnection( _playSdWav1, 0, _mixer1, 0 );
-	_patchCord2 = new AudioConnection( _playSdWav1, 1, _mixer1, 3 );
-	_patchCord3 = new AudioConnection( _mixer1, 0, _mqs1, 0 );
-	_patchCord4 = new AudioConnection( _mixer1, 0, _mqs1, 1 );
-
-
-}
-
-AudioPlayer::~AudioPlayer()
-{
-	delete _patchCord;
-	delete _patchCord2;
-	delete _patchCord3;
-	delete _patchCord4;
-
 }
 
 void AudioPlayer::play( const char* filepath )
 {
 	int position = _playQueue.size();
+	int prompt = findPrompt( filepath );
+
+	if ( _promptIndexValid && prompt >= 0 && (_promptIndex & (1UL << prompt)) == 0 )
+	{
+		Log.trace( "Skipping sound file missing from SD card: %s", filepath );
+		return;
+	}
 
 	if ( position < FILE_QUEUE_SIZE )
 	{
@@ -41,7 +37,16 @@ void AudioPlayer::play( const char* filepath )
 
 void AudioPlayer::tick()
 {
-	if ( (!_playSdWav1.isPlaying()) && _playQueue.size() > 0 )
+	// The player reads the WAV header in its interrupt, so it only reports playing some time after play() returns.
+	// Waiting here instead of in delay() keeps the deadline monitored tasks running while a prompt plays.
+	if ( _playStarted && millis() - _playStartMilliseconds < PLAY_START_MILLISECONDS )
+	{
+		return;
+	}
+
+	_playStarted = false;
+
+	if ( _storageReady && (!_playSdWav1.isPlaying()) && _playQueue.size() > 0 )
 	{
 		const char* filepath = _playQueue.dequeue();
 
@@ -54,13 +59,8 @@ void AudioPlayer::tick()
 			 }
 			 else
 			 {
-				 delay( 1000 );
-
-				 while ( _playSdWav1.isPlaying() )
-				 {
-					 // stop processing to allow the sound to play. Unfortunately haven't found a way to allow the audio interrupts to work without it.
-					 delay( 1000 );
-				 }
+				 _playStartMilliseconds = millis();
+				 _playStarted = true;
 			 }
 		 }
 
@@ -68,8 +68,47 @@ void AudioPlayer::tick()
 	}
 }
 
+void AudioPlayer::setStorageReady( bool storageReady )
+{
+	_storageReady = storageReady;
+}
+
+void AudioPlayer::setPromptIndex( uint32_t promptIndex )
+{
+	_promptIndex = promptIndex;
+	_promptIndexValid = true;
+}
+
+uint32_t AudioPlayer::indexPrompts()
+{
+	uint32_t promptIndex = 0;
 
+	for ( uint8_t i = 0; i < PROMPT_COUNT; i++ )
+	{
+		if ( SD.exists( PROMPTS[i] ) )
+		{
+			promptIndex |= 1UL << i;
+		}
+		else
+		{
+			Log.trace( "Sound file not found: %s", PROMPTS[i] );
+		}
+	}
 
+	setPromptIndex( promptIndex );
 
+	return promptIndex;
+}
 
+int AudioPlayer::findPrompt( const char* filepath )
+{
+	for ( uint8_t i = 0; i < PROMPT_COUNT; i++ )
+	{
+		if ( strcmp( PROMPTS[i], filepath ) == 0 )
+		{
+			return i;
+		}
+	}
 
+	return -1;
+}
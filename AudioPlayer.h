@@ -40,8 +40,22 @@ constexpr auto REPLAY_FROM_FILE_SOUND = "sounds/replay.wav";
 
 constexpr auto GPS_SIGNAL_LOW_SOUND = "sounds/gpslow.wav";
 
-constexpr int FILE_QUEUE_SIZE = 20;
+/**
+ * @brief Every prompt the player knows about, the position in this list is the prompt's bit in the prompt index.
+*/
+constexpr const char* PROMPTS[] = {
+	READY_SOUND, MAVLINK_GOOD_SOUND, MOTORS_ARMED_SOUND, EMERGENCY_STOP_SOUND, MAVLINK_BAD_SOUND, PROGRESS_STOPPED_SOUND,
+	WRONG_DIRECTION_SOUND, MISSION_END_SOUND, AUTO_MODE_SOUND, MANUAL_MODE_SOUND, HOLD_MODE_SOUND, ACRO_MODE_SOUND,
+	RTL_MODE_SOUND, SRTL_MODE_SOUND, GUIDED_MODE_SOUND, STEERING_MODE_SOUND, LOITER_MODE_SOUND, ENGINE_STOPPED_SOUND,
+	ENGINE_STARTING_SOUND, ENGINE_RUNNING_SOUND, NO_STORAGE_CARD_SOUND, NO_TEST_FILE, REPLAY_FROM_FILE_SOUND, GPS_SIGNAL_LOW_SOUND
+};
+constexpr uint8_t PROMPT_COUNT = sizeof( PROMPTS ) / sizeof( PROMPTS[0] );
+static_assert(PROMPT_COUNT <= 32, "The prompt index holds one bit per prompt in 32 bits");
+
+constexpr int FILE_QUEUE_SIZE = QUEUE_SIZE;
+constexpr int AUDIO_MEMORY_BLOCKS = 40;   ///< Audio library blocks of 128 samples reserved at boot
 constexpr int MAX_FILEPATH_SIZE = 255;
+constexpr uint32_t PLAY_START_MILLISECONDS = 1000; ///< Time the WAV player is given to report it is playing, the next prompt waits at least this long
 
 /**
  * @brief AudioPlayer plays WAV files from SD card. It will queue in FIFO order until done.
@@ -52,7 +66,6 @@ class AudioPlayer
 public:
 
 	AudioPlayer();
-	~AudioPlayer();
 
 	/**
 	 * @brief Plays the WAV file at the given file path on  SD card.
@@ -66,20 +79,44 @@ public:
 	*/
 	void tick();
 
+	/**
+	 * @brief Tell the player whether the SD card can be read. Prompts are queued until it can.
+	 * @param storageReady True once the SD card has been initialized.
+	*/
+	void setStorageReady( bool storageReady );
+
+	/**
+	 * @brief Use a prompt index from a previous boot so missing prompts are skipped without touching the SD card.
+	 * @param promptIndex One bit per entry in PROMPTS, set if the file exists.
+	*/
+	void setPromptIndex( uint32_t promptIndex );
+
+	/**
+	 * @brief Look up every prompt on the SD card and rebuild the prompt index.
+	 * @return The new prompt index.
+	*/
+	uint32_t indexPrompts();
+
 
 private:
+	static int findPrompt( const char* filepath );
 
+	bool _storageReady = false;
+	bool _promptIndexValid = false;
+	uint32_t _promptIndex = 0;
+	uint32_t _playStartMilliseconds = 0;
+	bool _playStarted = false;
 
 	Queue _playQueue;
 	AudioPlaySdWav  _playSdWav1;
 	AudioMixer4 _mixer1;
 	AudioOutputMQS  _mqs1;
-	char** _charPtrArray;
 
-	AudioConnection* _patchCord;
-	AudioConnection* _patchCord2;
-	AudioConnection* _patchCord3;
-	AudioConnection* _patchCord4;
+	// Declared after the objects they connect, which are constructed first
+	AudioConnection _patchCord;
+	AudioConnection _patchCord2;
+	AudioConnection _patchCord3;
+	AudioConnection _patchCord4;
 
 };
 #endif
@@ -3,56 +3,494 @@
 // 
 
 #include "Configuration.h"
+#include <EEPROM.h>
+#include <SD.h>
+#include <checksum.h>
+#include <ArduinoLog.h>
+
 constexpr unsigned int str2int( const char* str, int h = 0 )
 {
     return !str[h] ? 5381 : (str2int( str, h + 1 ) * 33) ^ str[h];
 }
 
-Configuration::Configuration()
+/**
+ * @brief Read a boolean setting, true is the only value that counts as true.
+*/
+static bool parseBoolean( const char* value )
+{
+    return strcmp( value, "true" ) == 0;
+}
+
+/**
+ * @brief Read a sweep setting, the seconds before an emergency stop and the lowest GPS fix type separated by a comma.
+*/
+static bool parseSweepSetting( const char* value, SweepSetting* setting )
 {
+    char* end;
+
+    setting->secondsBeforeEmergencyStop = strtoul( value, &end, 10 );
+
+    if ( end == value || *end != ',' )
+    {
+        return false;
+    }
+
+    value = end + 1;
+    long fixType = strtol( value, &end, 10 );
+
+    if ( end == value || fixType < GPS_FIX_TYPE_NO_GPS || fixType > GPS_FIX_TYPE_PPP )
+    {
+        return false;
+    }
 
+    setting->lowestGpsFixType = (GPS_FIX_TYPE)fixType;
+
+    return true;
+}
+
+Configuration::Configuration()
+{
+    memset( &_fileModifyTime, 0, sizeof( _fileModifyTime ) );
+    setDefaults();
 }
 
 bool Configuration::init( const char* configurationFilePath )
 {
-    const uint8_t CONFIG_LINE_LENGTH = 127;
+    // The line is read into a buffer on the stack, reading the file allocates nothing
+    char line[CONFIGURATION_LINE_SIZE];
+    char* value;
 
-    // The open configuration file.
-    SDConfigFile configFile;
+    File configFile = SD.open( configurationFilePath, FILE_READ );
 
-    if ( !configFile.begin( configurationFilePath, CONFIG_LINE_LENGTH ) )
+    if ( !configFile )
     {
         return false;
     }
 
-    while ( configFile.readNextSetting() )
+    // Settings missing from the file go back to their defaults rather than keeping persisted values
+    setDefaults();
+
+    while ( readSetting( &configFile, line, &value ) )
     {
-        const char* name = configFile.getName();
+        const char* name = line;
 
         switch ( str2int(name) )
         {
             case str2int("test"):
-                _testing = configFile.getBooleanValue();
+                _testing = parseBoolean( value );
                 break;
             case str2int("testFileName"):
-                _testFileName = configFile.copyValue();
+                // A shortened name could open a different file, keep the default instead
+                if ( strlen( value ) >= CONFIGURATION_FILE_NAME_SIZE )
+                {
+                    Log.error( "Test file name longer than %d characters: %s", CONFIGURATION_FILE_NAME_SIZE - 1, value );
+                }
+                else
+                {
+                    strcpy( _testFileName, value );
+                }
                 break;
             case str2int( "fileSpeedMilliseonds" ):
-                _fileSpeedMilliseconds = configFile.getIntValue();
+                _fileSpeedMilliseconds = atoi( value );
+                break;
+            case str2int( "replayStartMilliseconds" ):
+                _replayStartMilliseconds = strtoul( value, NULL, 10 );
+                break;
+            case str2int( "missionClock" ):
+                _missionClock = parseBoolean( value );
+                break;
+            case str2int( "stressTest" ):
+                _stressTest = parseBoolean( value );
+                break;
+            case str2int( "stressBurstMessages" ):
+                _stressLoad.burstMessages = max( atoi( value ), 1 );
+                break;
+            case str2int( "stressCorruptionPerMillion" ):
+                _stressLoad.corruptionPerMillion = strtoul( value, NULL, 10 );
+                break;
+            case str2int( "stressTruncationPercent" ):
+                _stressLoad.truncationPercent = min( atoi( value ), 100 );
+                break;
+            case str2int( "stressForeignPercent" ):
+                _stressLoad.foreignPercent = min( atoi( value ), 100 );
+                break;
+            case str2int( "simulator" ):
+                _simulator = parseBoolean( value );
+                break;
+            case str2int( "simulatorFault" ):
+                if ( !FlightControllerSimulator::parseFault( value, &_simulatorFault ) )
+                {
+                    Log.trace( "Ignored simulator fault: %s", value );
+                }
+                break;
+            case str2int( "simulatorFaultMilliseconds" ):
+                _simulatorFaultMilliseconds = strtoul( value, NULL, 10 );
+                break;
+            case str2int( "simulatorLoadMessagesPerSecond" ):
+                _simulatorLoadMessagesPerSecond = strtoul( value, NULL, 10 );
                 break;
             case str2int( "secondsBeforeEmergencyStop" ):
-                _secondsBeforeEmergencyStop = configFile.getIntValue();
+                _secondsBeforeEmergencyStop = atoi( value );
                 break;
             case str2int( "lowestGPSFixType" ):
-                _lowestGPSFixType = configFile.getIntValue();
+                _lowestGPSFixType = atoi( value );
+                break;
+            case str2int( "filterFrames" ):
+                _filterFrames = parseBoolean( value );
+                break;
+            case str2int( "flightControllerSystemId" ):
+                _flightControllerSystemId = atoi( value );
+                break;
+            case str2int( "staticDispatch" ):
+                _staticDispatch = parseBoolean( value );
+                break;
+            case str2int( "idleSleep" ):
+                _idleSleep = parseBoolean( value );
+                break;
+            case str2int( "corridorWidthMeters" ):
+                _corridorWidthMeters = atoi( value );
+                break;
+            case str2int( "maxBearingErrorDegrees" ):
+                _maxBearingErrorDegrees = atoi( value );
+                break;
+            case str2int( "divergenceMilliseconds" ):
+                _divergenceMilliseconds = atoi( value );
+                break;
+            case str2int( "safetyRule" ):
+                if ( _safetyRuleCount < CONFIGURATION_SAFETY_RULES && SafetyRuleEngine::parse( value, &_safetyRules[_safetyRuleCount] ) )
+                {
+                    _safetyRuleCount++;
+                }
+                else
+                {
+                    Log.trace( "Ignored safety rule: %s", value );
+                }
+                break;
+            case str2int( "sweep" ):
+                if ( _sweepSettingCount < THRESHOLD_SWEEP_CAPACITY && parseSweepSetting( value, &_sweepSettings[_sweepSettingCount] ) )
+                {
+                    _sweepSettingCount++;
+                }
+                else
+                {
+                    Log.trace( "Ignored sweep setting: %s", value );
+                }
+                break;
+            case str2int( "sweepFaultMilliseconds" ):
+                _sweepFaultMilliseconds = strtoul( value, NULL, 10 );
                 break;
         }
     }
-    configFile.end();
+
+    _fileSize = configFile.size();
+    memset( &_fileModifyTime, 0, sizeof( _fileModifyTime ) );
+    configFile.getModifyTime( _fileModifyTime );
+    configFile.close();
+
+    // A reload follows a change check that already hashed the file
+    if ( _fileFingerprint == 0 )
+    {
+        _fileFingerprint = fingerprint( configurationFilePath );
+    }
 
     return true;
 }
 
+bool Configuration::readSetting( File* file, char* line, char** value )
+{
+    int character;
+    uint8_t length = 0;
+
+    *value = NULL;
+
+    // Skip blank lines, leading blanks and comment lines up to the first character of the name
+    while ( true )
+    {
+        character = file->read();
+
+        if ( character < 0 )
+        {
+            return false;
+        }
+
+        if ( character == '#' )
+        {
+            while ( character >= 0 && character != '\r' && character != '\n' )
+            {
+                character = file->read();
+            }
+
+            continue;
+        }
+
+        if ( character != '\r' && character != '\n' && character != ' ' && character != '\t' )
+        {
+            break;
+        }
+    }
+
+    while ( character >= 0 && character != '\r' && character != '\n' )
+    {
+        if ( length >= CONFIGURATION_LINE_SIZE - 1 )
+        {
+            line[length] = 0;
+            Log.error( "Configuration line too long: %s", line );
+            return false;
+        }
+
+        if ( character == '=' && *value == NULL )
+        {
+            line[length++] = 0;
+            *value = &line[length];
+        }
+        else
+        {
+            line[length++] = character;
+        }
+
+        character = file->read();
+    }
+
+    line[length] = 0;
+
+    if ( *value == NULL || line[0] == 0 )
+    {
+        Log.error( "Configuration line is not name=value: %s", line );
+        return false;
+    }
+
+    return true;
+}
+
+bool Configuration::hasChanged( const char* configurationFilePath )
+{
+    uint8_t buffer[64];
+    uint16_t bytesLeft = CONFIGURATION_FINGERPRINT_SLICE_BYTES;
+    int bytesRead;
+
+    if ( !_fingerprintFile )
+    {
+        DateTimeFields modifyTime;
+
+        _fingerprintFile = SD.open( configurationFilePath, FILE_READ );
+
+        if ( !_fingerprintFile )
+        {
+            return false;
+        }
+
+        memset( &modifyTime, 0, sizeof( modifyTime ) );
+        _fingerprintFile.getModifyTime( modifyTime );
+
+        // Most checks end here, the contents are only hashed once the file was written
+        if ( _fingerprintFile.size() == _fileSize && memcmp( &modifyTime, &_fileModifyTime, sizeof( modifyTime ) ) == 0 )
+        {
+            _fingerprintFile.close();
+            _fingerprintFile = File();
+            return false;
+        }
+
+        _fileSize = _fingerprintFile.size();
+        _fileModifyTime = modifyTime;
+        _fingerprintCrc = X25_INIT_CRC;
+    }
+
+    while ( bytesLeft > 0 && (bytesRead = _fingerprintFile.read( buffer, min( bytesLeft, (uint16_t)sizeof( buffer ) ) )) > 0 )
+    {
+        for ( int i = 0; i < bytesRead; i++ )
+        {
+            crc_accumulate( buffer[i], &_fingerprintCrc );
+        }
+
+        bytesLeft -= bytesRead;
+    }
+
+    // The slice is spent, the rest of the file is hashed by the next call
+    if ( bytesLeft == 0 )
+    {
+        return false;
+    }
+
+    uint32_t fileFingerprint = (_fingerprintFile.size() << 16) ^ _fingerprintCrc;
+
+    _fingerprintFile.close();
+    _fingerprintFile = File();
+
+    if ( fileFingerprint == _fileFingerprint )
+    {
+        return false;
+    }
+
+    _fileFingerprint = fileFingerprint;
+
+    return true;
+}
+
+bool Configuration::isCheckingForChanges()
+{
+    return _fingerprintFile;
+}
+
+uint32_t Configuration::fingerprint( const char* configurationFilePath )
+{
+    uint8_t buffer[64];
+    uint16_t crc = X25_INIT_CRC;
+    File file = SD.open( configurationFilePath, FILE_READ );
+
+    if ( !file )
+    {
+        return 0;
+    }
+
+    uint32_t size = file.size();
+    int bytesRead;
+
+    while ( (bytesRead = file.read( buffer, sizeof( buffer ) )) > 0 )
+    {
+        for ( int i = 0; i < bytesRead; i++ )
+        {
+            crc_accumulate( buffer[i], &crc );
+        }
+    }
+
+    file.close();
+
+    return (size << 16) ^ crc;
+}
+
+bool Configuration::load()
+{
+    PersistedConfiguration persisted;
+
+    EEPROM.get( PERSISTED_CONFIGURATION_ADDRESS, persisted );
+
+    if ( persisted.magic != PERSISTED_CONFIGURATION_MAGIC ||
+        persisted.version != PERSISTED_CONFIGURATION_VERSION ||
+        persisted.checksum != crc_calculate( (const uint8_t*)&persisted, offsetof( PersistedConfiguration, checksum ) ) )
+    {
+        return false;
+    }
+
+    _testing = persisted.testing != 0;
+    memcpy( _testFileName, persisted.testFileName, CONFIGURATION_FILE_NAME_SIZE );
+    _testFileName[CONFIGURATION_FILE_NAME_SIZE - 1] = 0;
+    _fileSpeedMilliseconds = persisted.fileSpeedMilliseconds;
+    _replayStartMilliseconds = persisted.replayStartMilliseconds;
+    _missionClock = persisted.missionClock != 0;
+    _stressTest = persisted.stressTest != 0;
+    _stressLoad.burstMessages = persisted.stressBurstMessages;
+    _stressLoad.corruptionPerMillion = persisted.stressCorruptionPerMillion;
+    _stressLoad.truncationPercent = persisted.stressTruncationPercent;
+    _stressLoad.foreignPercent = persisted.stressForeignPercent;
+    _simulator = persisted.simulator != 0;
+    _simulatorFault = persisted.simulatorFault < SIMULATOR_FAULT_COUNT ? (SIMULATOR_FAULT)persisted.simulatorFault : SIMULATOR_FAULT_NONE;
+    _simulatorFaultMilliseconds = persisted.simulatorFaultMilliseconds;
+    _simulatorLoadMessagesPerSecond = persisted.simulatorLoadMessagesPerSecond;
+    _secondsBeforeEmergencyStop = persisted.secondsBeforeEmergencyStop;
+    _lowestGPSFixType = persisted.lowestGPSFixType;
+    _filterFrames = persisted.filterFrames != 0;
+    _flightControllerSystemId = persisted.flightControllerSystemId;
+    _staticDispatch = persisted.staticDispatch != 0;
+    _idleSleep = persisted.idleSleep != 0;
+    _promptIndex = persisted.promptIndex;
+    _corridorWidthMeters = persisted.corridorWidthMeters;
+    _maxBearingErrorDegrees = persisted.maxBearingErrorDegrees;
+    _divergenceMilliseconds = persisted.divergenceMilliseconds;
+    _safetyRuleCount = min( persisted.safetyRuleCount, CONFIGURATION_SAFETY_RULES );
+    memcpy( _safetyRules, persisted.safetyRules, sizeof( _safetyRules ) );
+    _sweepSettingCount = min( persisted.sweepSettingCount, THRESHOLD_SWEEP_CAPACITY );
+    memcpy( _sweepSettings, persisted.sweepSettings, sizeof( _sweepSettings ) );
+    _sweepFaultMilliseconds = persisted.sweepFaultMilliseconds;
+
+    return true;
+}
+
+bool Configuration::save()
+{
+    PersistedConfiguration persisted;
+    PersistedConfiguration stored;
+
+    toPersisted( &persisted );
+    EEPROM.get( PERSISTED_CONFIGURATION_ADDRESS, stored );
+
+    // Flash backed EEPROM wears out, only write when something changed
+    if ( memcmp( &persisted, &stored, sizeof( PersistedConfiguration ) ) == 0 )
+    {
+        return false;
+    }
+
+    EEPROM.put( PERSISTED_CONFIGURATION_ADDRESS, persisted );
+
+    return true;
+}
+
+void Configuration::setDefaults()
+{
+    _testing = false;
+    strcpy( _testFileName, "test.log" );
+    _fileSpeedMilliseconds = 10;
+    _replayStartMilliseconds = 0;
+    _missionClock = false;
+    _stressTest = false;
+    _stressLoad = TrafficLoad();
+    _simulator = false;
+    _simulatorFault = SIMULATOR_FAULT_NONE;
+    _simulatorFaultMilliseconds = 60000;
+    _simulatorLoadMessagesPerSecond = 0;
+    _secondsBeforeEmergencyStop = 10;
+    _lowestGPSFixType = 5;
+    _filterFrames = true;
+    _flightControllerSystemId = 0;
+    _staticDispatch = true;
+    _idleSleep = true;
+    _corridorWidthMeters = 0;
+    _maxBearingErrorDegrees = 0;
+    _divergenceMilliseconds = 1000;
+    _safetyRuleCount = 0;
+    memset( _safetyRules, 0, sizeof( _safetyRules ) );
+    _sweepSettingCount = 0;
+    memset( _sweepSettings, 0, sizeof( _sweepSettings ) );
+    _sweepFaultMilliseconds = 0;
+}
+
+void Configuration::toPersisted( PersistedConfiguration* persisted )
+{
+    memset( persisted, 0, sizeof( PersistedConfiguration ) );
+
+    persisted->magic = PERSISTED_CONFIGURATION_MAGIC;
+    persisted->version = PERSISTED_CONFIGURATION_VERSION;
+    persisted->testing = _testing;
+    strncpy( persisted->testFileName, _testFileName, CONFIGURATION_FILE_NAME_SIZE - 1 );
+    persisted->fileSpeedMilliseconds = _fileSpeedMilliseconds;
+    persisted->replayStartMilliseconds = _replayStartMilliseconds;
+    persisted->missionClock = _missionClock;
+    persisted->stressTest = _stressTest;
+    persisted->stressBurstMessages = _stressLoad.burstMessages;
+    persisted->stressCorruptionPerMillion = _stressLoad.corruptionPerMillion;
+    persisted->stressTruncationPercent = _stressLoad.truncationPercent;
+    persisted->stressForeignPercent = _stressLoad.foreignPercent;
+    persisted->simulator = _simulator;
+    persisted->simulatorFault = _simulatorFault;
+    persisted->simulatorFaultMilliseconds = _simulatorFaultMilliseconds;
+    persisted->simulatorLoadMessagesPerSecond = _simulatorLoadMessagesPerSecond;
+    persisted->secondsBeforeEmergencyStop = _secondsBeforeEmergencyStop;
+    persisted->lowestGPSFixType = _lowestGPSFixType;
+    persisted->filterFrames = _filterFrames;
+    persisted->flightControllerSystemId = _flightControllerSystemId;
+    persisted->staticDispatch = _staticDispatch;
+    persisted->idleSleep = _idleSleep;
+    persisted->promptIndex = _promptIndex;
+    persisted->corridorWidthMeters = _corridorWidthMeters;
+    persisted->maxBearingErrorDegrees = _maxBearingErrorDegrees;
+    persisted->divergenceMilliseconds = _divergenceMilliseconds;
+    persisted->safetyRuleCount = _safetyRuleCount;
+    memcpy( persisted->safetyRules, _safetyRules, sizeof( _safetyRules ) );
+    persisted->sweepSettingCount = _sweepSettingCount;
+    memcpy( persisted->sweepSettings, _sweepSettings, sizeof( _sweepSettings ) );
+    persisted->sweepFaultMilliseconds = _sweepFaultMilliseconds;
+    persisted->checksum = crc_calculate( (const uint8_t*)persisted, offsetof( PersistedConfiguration, checksum ) );
+}
+
 bool Configuration::getTesting()
 {
     return _testing;;
@@ -69,6 +507,52 @@ uint8_t Configuration::getFileSpeedMilliseconds()
 
 }
 
+uint32_t Configuration::getReplayStartMilliseconds()
+{
+    return _replayStartMilliseconds;
+}
+
+bool Configuration::getMissionClock()
+{
+    return _missionClock;
+}
+
+bool Configuration::getStressTest()
+{
+    return _stressTest;
+}
+
+TrafficLoad Configuration::getStressLoad()
+{
+    return _stressLoad;
+}
+
+bool Configuration::getSimulator()
+{
+    return _simulator;
+}
+
+SIMULATOR_FAULT Configuration::getSimulatorFault()
+{
+    return _simulatorFault;
+}
+
+uint32_t Configuration::getSimulatorFaultMilliseconds()
+{
+    return _simulatorFaultMilliseconds;
+}
+
+TrafficLoad Configuration::getSimulatorLoad()
+{
+    TrafficLoad load = _stressLoad;
+
+    // Only other systems, frames from the flight controller would contradict the simulated one
+    load.messagesPerSecond = _simulatorLoadMessagesPerSecond;
+    load.foreignPercent = 100;
+
+    return load;
+}
+
 uint32_t Configuration::getSecondsBeforeEmergencyStop()
 {
     return _secondsBeforeEmergencyStop;
@@ -79,3 +563,72 @@ uint8_t Configuration::getLowestGPSFixType()
     return _lowestGPSFixType;
 }
 
+bool Configuration::getFilterFrames()
+{
+    return _filterFrames;
+}
+
+uint8_t Configuration::getFlightControllerSystemId()
+{
+    return _flightControllerSystemId;
+}
+
+bool Configuration::getStaticDispatch()
+{
+    return _staticDispatch;
+}
+
+bool Configuration::getIdleSleep()
+{
+    return _idleSleep;
+}
+
+uint16_t Configuration::getCorridorWidthMeters()
+{
+    return _corridorWidthMeters;
+}
+
+uint16_t Configuration::getMaxBearingErrorDegrees()
+{
+    return _maxBearingErrorDegrees;
+}
+
+uint32_t Configuration::getDivergenceMilliseconds()
+{
+    return _divergenceMilliseconds;
+}
+
+uint8_t Configuration::getSafetyRuleCount()
+{
+    return _safetyRuleCount;
+}
+
+const SafetyRule* Configuration::getSafetyRules()
+{
+    return _safetyRules;
+}
+
+uint8_t Configuration::getSweepSettingCount()
+{
+    return _sweepSettingCount;
+}
+
+const SweepSetting* Configuration::getSweepSettings()
+{
+    return _sweepSettings;
+}
+
+uint32_t Configuration::getSweepFaultMilliseconds()
+{
+    return _sweepFaultMilliseconds;
+}
+
+uint32_t Configuration::getPromptIndex()
+{
+    return _promptIndex;
+}
+
+void Configuration::setPromptIndex( uint32_t promptIndex )
+{
+    _promptIndex = promptIndex;
+}
@@ -9,10 +9,61 @@
 	#include "WProgram.h"
 #endif
 
-#include <SDConfigFile.h>
+#include <SD.h>
+#include "SafetyRuleEngine.h"
+#include "TrafficGenerator.h"
+#include "ThresholdSweep.h"
+#include "FlightControllerSimulator.h"
+
+constexpr uint8_t CONFIGURATION_FILE_NAME_SIZE = 32;          ///< Longest test file name including terminator
+constexpr uint32_t PERSISTED_CONFIGURATION_MAGIC = 0x52424346; ///< "RBCF"
+constexpr uint16_t PERSISTED_CONFIGURATION_VERSION = 12;       ///< Change when PersistedConfiguration changes
+constexpr int PERSISTED_CONFIGURATION_ADDRESS = 0;             ///< EEPROM address of the persisted configuration
+constexpr uint8_t CONFIGURATION_SAFETY_RULES = 8;              ///< Safety rules config.ini can add to the built in rules
+constexpr uint8_t CONFIGURATION_LINE_SIZE = 128;               ///< Longest line of the configuration file including terminator
+constexpr uint16_t CONFIGURATION_FINGERPRINT_SLICE_BYTES = 1024; ///< Bytes of the configuration file hashed per change check, so the check never holds up the main loop for long
+
+/**
+ * @brief The last good configuration as it is stored in EEPROM, so monitoring can start before the SD card is read.
+*/
+struct __attribute__( (packed) ) PersistedConfiguration
+{
+	uint32_t magic;
+	uint16_t version;
+	uint8_t testing;
+	char testFileName[CONFIGURATION_FILE_NAME_SIZE];
+	uint8_t fileSpeedMilliseconds;
+	uint32_t replayStartMilliseconds;
+	uint8_t missionClock;
+	uint8_t stressTest;
+	uint8_t stressBurstMessages;
+	uint32_t stressCorruptionPerMillion;
+	uint8_t stressTruncationPercent;
+	uint8_t stressForeignPercent;
+	uint8_t simulator;
+	uint8_t simulatorFault;
+	uint32_t simulatorFaultMilliseconds;
+	uint32_t simulatorLoadMessagesPerSecond;
+	uint32_t secondsBeforeEmergencyStop;
+	uint8_t lowestGPSFixType;
+	uint8_t filterFrames;
+	uint8_t flightControllerSystemId;
+	uint8_t staticDispatch;
+	uint8_t idleSleep;
+	uint32_t promptIndex;
+	uint16_t corridorWidthMeters;
+	uint16_t maxBearingErrorDegrees;
+	uint32_t divergenceMilliseconds;
+	uint8_t safetyRuleCount;
+	SafetyRule safetyRules[CONFIGURATION_SAFETY_RULES];
+	uint8_t sweepSettingCount;
+	SweepSetting sweepSettings[THRESHOLD_SWEEP_CAPACITY];
+	uint32_t sweepFaultMilliseconds;
+	uint16_t checksum;   ///< CRC of everything above
+};
 
 /**
- * @brief Configuration reads configratuon file from SD card.
+ * @brief Configuration reads configratuon file from SD card. The last good configuration is persisted to EEPROM.
 */
 class Configuration
 {
@@ -27,6 +78,33 @@ public:
 	 * @return True if file is found
 	*/
 	bool init( const char* configurationFilePath );
+
+	/**
+	 * @brief Load the last good configuration from EEPROM.
+	 * @return True if a valid configuration was found, otherwise the defaults are kept.
+	*/
+	bool load();
+
+	/**
+	 * @brief Persist the current configuration to EEPROM. Nothing is written if it didn't change.
+	 * @return True if the EEPROM was written.
+	*/
+	bool save();
+
+	/**
+	 * @brief Check whether the configuration file changed since it was last read. Most checks stop at the size and modification
+	 * time of the file. When either changed the contents are hashed, so saving the file unchanged doesn't reload it. Each call hashes
+	 * CONFIGURATION_FINGERPRINT_SLICE_BYTES of the file, call it again while isCheckingForChanges() until the whole file is hashed.
+	 * @param configurationFilePath The path to the configuration file.
+	 * @return True if the whole file was hashed and it changed. The new fingerprint is kept, the file counts as read.
+	*/
+	bool hasChanged( const char* configurationFilePath );
+
+	/**
+	 * @brief Check if a change check is part way through the file.
+	 * @return True if hasChanged() has more of the file to hash.
+	*/
+	bool isCheckingForChanges();
 	
 	/**
 	 * @brief Read the testing value that was retrieved from the config file.
@@ -46,6 +124,56 @@ public:
     */
 	uint8_t getFileSpeedMilliseconds();
 
+	/**
+	 * @brief Read the replayStartMilliseconds value that was retrieved from the config file.
+	 * @return The mission time the test file replay starts at, 0 for the start of the file.
+	*/
+	uint32_t getReplayStartMilliseconds();
+
+	/**
+	 * @brief Read the missionClock value that was retrieved from the config file.
+	 * @return True if the test file replay runs on the recorded time as fast as it can be read.
+	*/
+	bool getMissionClock();
+
+	/**
+	 * @brief Read the stressTest value that was retrieved from the config file.
+	 * @return True if the flight controller port is fed by the traffic generator on Serial2 instead.
+	*/
+	bool getStressTest();
+
+	/**
+	 * @brief Read the stressBurstMessages, stressCorruptionPerMillion, stressTruncationPercent and stressForeignPercent values
+	 * that were retrieved from the config file.
+	 * @return The traffic generator load without the rate, which the stress harness steps through.
+	*/
+	TrafficLoad getStressLoad();
+
+	/**
+	 * @brief Read the simulator value that was retrieved from the config file.
+	 * @return True if the flight controller port is connected to the simulated flight controller on Serial2 instead.
+	*/
+	bool getSimulator();
+
+	/**
+	 * @brief Read the simulatorFault value that was retrieved from the config file.
+	 * @return The fault the simulated flight controller injects.
+	*/
+	SIMULATOR_FAULT getSimulatorFault();
+
+	/**
+	 * @brief Read the simulatorFaultMilliseconds value that was retrieved from the config file.
+	 * @return Time after the simulated mission started that the fault is injected at.
+	*/
+	uint32_t getSimulatorFaultMilliseconds();
+
+	/**
+	 * @brief Read the simulatorLoadMessagesPerSecond value that was retrieved from the config file.
+	 * @return The traffic from other systems sent alongside the simulated flight controller, with the burst size, corruption and
+	 * truncation of the stress test.
+	*/
+	TrafficLoad getSimulatorLoad();
+
 	/**
      * @brief Read the secondsBeforeEmergencyStop value that was retrieved from the config file.
      * @return The value retrieved.
@@ -54,12 +182,137 @@ public:
 
 	uint8_t getLowestGPSFixType();
 
+	/**
+	 * @brief Read the filterFrames value that was retrieved from the config file.
+	 * @return The value retrieved.
+	*/
+	bool getFilterFrames();
+
+	/**
+	 * @brief Read the flightControllerSystemId value that was retrieved from the config file.
+	 * @return The system id of the flight controller, 0 to take the first system that sends an autopilot heartbeat.
+	*/
+	uint8_t getFlightControllerSystemId();
+
+	/**
+	 * @brief Read the staticDispatch value that was retrieved from the config file.
+	 * @return The value retrieved.
+	*/
+	bool getStaticDispatch();
+
+	/**
+	 * @brief Read the idleSleep value that was retrieved from the config file.
+	 * @return The value retrieved.
+	*/
+	bool getIdleSleep();
+
+	/**
+	 * @brief Read the corridorWidthMeters value that was retrieved from the config file.
+	 * @return The value retrieved, 0 when the corridor isn't checked.
+	*/
+	uint16_t getCorridorWidthMeters();
+
+	/**
+	 * @brief Read the maxBearingErrorDegrees value that was retrieved from the config file.
+	 * @return The value retrieved, 0 when the heading isn't checked.
+	*/
+	uint16_t getMaxBearingErrorDegrees();
+
+	/**
+	 * @brief Read the divergenceMilliseconds value that was retrieved from the config file.
+	 * @return The value retrieved.
+	*/
+	uint32_t getDivergenceMilliseconds();
+
+	/**
+	 * @brief Read the number of safetyRule lines that were retrieved from the config file.
+	 * @return The number of rules.
+	*/
+	uint8_t getSafetyRuleCount();
+
+	/**
+	 * @brief Read the safetyRule lines that were retrieved from the config file.
+	 * @return The rules.
+	*/
+	const SafetyRule* getSafetyRules();
+
+	/**
+	 * @brief Read the number of sweep lines that were retrieved from the config file, 0 turns the threshold sweep off.
+	 * @return The number of settings.
+	*/
+	uint8_t getSweepSettingCount();
+
+	/**
+	 * @brief Read the sweep lines that were retrieved from the config file.
+	 * @return The settings.
+	*/
+	const SweepSetting* getSweepSettings();
+
+	/**
+	 * @brief Read the sweepFaultMilliseconds value that was retrieved from the config file.
+	 * @return The value retrieved.
+	*/
+	uint32_t getSweepFaultMilliseconds();
+
+	/**
+	 * @brief Read the index of prompts found on the SD card, one bit per prompt.
+	 * @return The prompt index.
+	*/
+	uint32_t getPromptIndex();
+
+	/**
+	 * @brief Set the index of prompts found on the SD card so it is persisted with the configuration.
+	 * @param promptIndex The prompt index.
+	*/
+	void setPromptIndex( uint32_t promptIndex );
+
 private:
-	bool _testing = false;
-	const char* _testFileName = "test.log";
-	uint8_t _fileSpeedMilliseconds = 10; ///< How fast to read the evetns from file. Don't go lower than 10 else the mission monitor will not keep up.
-	uint32_t _secondsBeforeEmergencyStop = 10;
-	uint8_t _lowestGPSFixType = 5;
+	void setDefaults();
+	void toPersisted( PersistedConfiguration* persisted );
+	static uint32_t fingerprint( const char* configurationFilePath );
+
+	/**
+	 * @brief Read the next name=value line of the configuration file, skipping blank lines and # comments.
+	 * @param file The open configuration file.
+	 * @param line Receives the line, the name is at the start.
+	 * @param value Receives the value, which follows the name in the line.
+	 * @return False at the end of the file or at a line that is too long or has no name.
+	*/
+	static bool readSetting( File* file, char* line, char** value );
+
+	// Settings read from the file, setDefaults() gives them their values before a file or EEPROM is read
+	bool _testing;
+	char _testFileName[CONFIGURATION_FILE_NAME_SIZE];
+	uint8_t _fileSpeedMilliseconds; ///< How fast to read the evetns from file. Don't go lower than 10 else the mission monitor will not keep up.
+	uint32_t _replayStartMilliseconds; ///< Mission time the test file replay starts at, found in the index of the file
+	bool _missionClock; ///< Replay on a clock moved by the recorded time instead of at the file speed
+	bool _stressTest; ///< Feed the flight controller port from the traffic generator, takes effect at the next power on
+	TrafficLoad _stressLoad; ///< Burst size, corruption, truncation and foreign share of the stress test
+	bool _simulator; ///< Connect the flight controller port to the simulated flight controller, takes effect at the next power on
+	SIMULATOR_FAULT _simulatorFault;
+	uint32_t _simulatorFaultMilliseconds; ///< Time after the simulated mission started that the fault is injected at
+	uint32_t _simulatorLoadMessagesPerSecond; ///< Traffic from other systems sent alongside the simulated flight controller
+	uint32_t _secondsBeforeEmergencyStop;
+	uint8_t _lowestGPSFixType;
+	bool _filterFrames; ///< Skip frames from other systems and unhandled messages by their header
+	uint8_t _flightControllerSystemId; ///< SYSID_THISMAV of the flight controller, 0 to find it by its heartbeat, takes effect at the next power on
+	bool _staticDispatch; ///< Bind the MAVLink reader to the event bus at compile time, takes effect at the next power on
+	bool _idleSleep; ///< Sleep until the next interrupt when no task is due instead of polling
+	uint16_t _corridorWidthMeters; ///< Width of the corridor around each mission leg, 0 turns the check off
+	uint16_t _maxBearingErrorDegrees; ///< Largest difference between the heading and where the flight controller steers, 0 turns the check off
+	uint32_t _divergenceMilliseconds; ///< How long the heading can be beyond its limit, or the rover outside the corridor
+	uint8_t _safetyRuleCount;
+	SafetyRule _safetyRules[CONFIGURATION_SAFETY_RULES]; ///< Rules added to the built in safety rules
+	uint8_t _sweepSettingCount;
+	SweepSetting _sweepSettings[THRESHOLD_SWEEP_CAPACITY]; ///< Settings the test file is evaluated under besides the configured one
+	uint32_t _sweepFaultMilliseconds; ///< Mission time the fault in the test file began, 0 if it has none
+
+	uint32_t _promptIndex = 0;
+	uint32_t _fileFingerprint = 0; ///< Size and CRC of the configuration file when it was last read
+	uint32_t _fileSize = 0; ///< Size of the configuration file when it was last checked
+	DateTimeFields _fileModifyTime; ///< Modification time of the configuration file when it was last checked
+	File _fingerprintFile; ///< The configuration file while a change check hashes it
+	uint16_t _fingerprintCrc = 0;
 };
 
 #endif
@@ -0,0 +1,473 @@
+//
+//
+//
+
+#include "CorridorIndex.h"
+#include "CrossTrackMonitor.h"
+
+constexpr uintptr_t PSRAM_START = 0x70000000;   ///< Start of the PSRAM address range, memory below it is the heap in RAM2
+
+
+CorridorIndex::CorridorIndex()
+{
+
+}
+
+CorridorIndex::~CorridorIndex()
+{
+	clear();
+}
+
+bool CorridorIndex::build( WaypointStore* waypointStore, uint16_t corridorWidthMeters )
+{
+	if ( !beginBuild( waypointStore, corridorWidthMeters ) )
+	{
+		return false;
+	}
+
+	while ( continueBuild( UINT32_MAX ) )
+	{
+	}
+
+	return _isBuilt;
+}
+
+bool CorridorIndex::beginBuild( WaypointStore* waypointStore, uint16_t corridorWidthMeters )
+{
+	int32_t latitude;
+	int32_t longitude;
+	uint16_t pointCount = 0;
+
+	clear();
+
+	for ( uint16_t seq = 0; seq < waypointStore->getCount(); seq++ )
+	{
+		if ( waypointStore->getPosition( seq, &latitude, &longitude ) )
+		{
+			pointCount++;
+		}
+	}
+
+	if ( pointCount < 2 || corridorWidthMeters == 0 )
+	{
+		return false;
+	}
+
+	_pointX = (float*)extmem_malloc( pointCount * sizeof( float ) );
+	_pointY = (float*)extmem_malloc( pointCount * sizeof( float ) );
+	_pointSequence = (uint16_t*)extmem_malloc( pointCount * sizeof( uint16_t ) );
+
+	if ( _pointX == NULL || _pointY == NULL || _pointSequence == NULL )
+	{
+		clear();
+		return false;
+	}
+
+	_halfWidth = corridorWidthMeters / 2.0f;
+
+	// Convert the waypoints to meters around the first one and find the area they cover
+	_maxX = 0;
+	_maxY = 0;
+
+	for ( uint16_t seq = 0; seq < waypointStore->getCount(); seq++ )
+	{
+		if ( !waypointStore->getPosition( seq, &latitude, &longitude ) )
+		{
+			continue;
+		}
+
+		if ( _pointCount == 0 )
+		{
+			_originLatitude = latitude;
+			_originLongitude = longitude;
+			_metersPerLongitudeUnit = METERS_PER_DEGREE_E7 * cosf( latitude * 1.0e-7f * (float)DEG_TO_RAD );
+		}
+
+		toLocal( latitude, longitude, &_pointX[_pointCount], &_pointY[_pointCount] );
+		_pointSequence[_pointCount] = seq;
+
+		_minX = min( _minX, _pointX[_pointCount] );
+		_minY = min( _minY, _pointY[_pointCount] );
+		_maxX = max( _maxX, _pointX[_pointCount] );
+		_maxY = max( _maxY, _pointY[_pointCount] );
+		_pointCount++;
+	}
+
+	_minX -= _halfWidth;
+	_minY -= _halfWidth;
+	_maxX += _halfWidth;
+	_maxY += _halfWidth;
+
+	// Cells about as wide as the corridor keep the lists short, larger missions get larger cells to stay within the cell budget
+	_cellMeters = max( (float)corridorWidthMeters, CORRIDOR_INDEX_MIN_CELL_METERS );
+	_cellMeters = max( _cellMeters, sqrtf( (_maxX - _minX) * (_maxY - _minY) / CORRIDOR_INDEX_MAX_CELLS ) );
+
+	_queryCount = 0;
+	_queryCycles = 0;
+
+	return prepareCells();
+}
+
+bool CorridorIndex::continueBuild( uint32_t cellBudget )
+{
+	uint32_t cellsVisited = 0;
+
+	while ( _buildState != CORRIDOR_BUILD_IDLE )
+	{
+		if ( _buildLeg + 1 < _pointCount )
+		{
+			if ( cellsVisited >= cellBudget )
+			{
+				return true;
+			}
+
+			cellsVisited += rasterize( _buildLeg++, _buildState == CORRIDOR_BUILD_FILL );
+		}
+		else if ( _buildState == CORRIDOR_BUILD_COUNT )
+		{
+			if ( allocateLists() )
+			{
+				continue;
+			}
+
+			if ( _pointX == NULL )
+			{
+				return false;
+			}
+
+			// Dense missions list too many legs per cell, larger cells list each leg fewer times
+			_cellMeters *= 1.5f;
+
+			if ( !prepareCells() )
+			{
+				return false;
+			}
+		}
+		else
+		{
+			extmem_free( _cellMarks );
+			_cellMarks = NULL;
+			_buildState = CORRIDOR_BUILD_IDLE;
+			_isBuilt = true;
+		}
+	}
+
+	return false;
+}
+
+bool CorridorIndex::isBuilding()
+{
+	return _buildState != CORRIDOR_BUILD_IDLE;
+}
+
+bool CorridorIndex::prepareCells()
+{
+	extmem_free( _cellStart );
+	extmem_free( _cellLegs );
+	extmem_free( _cellMarks );
+	_cellStart = NULL;
+	_cellLegs = NULL;
+	_cellMarks = NULL;
+	_entryCount = 0;
+
+	while ( true )
+	{
+		_columns = (uint16_t)((_maxX - _minX) / _cellMeters) + 1;
+		_rows = (uint16_t)((_maxY - _minY) / _cellMeters) + 1;
+
+		if ( (uint32_t)_columns * _rows <= CORRIDOR_INDEX_MAX_CELLS )
+		{
+			break;
+		}
+
+		_cellMeters *= 1.1f;
+	}
+
+	uint32_t cellCount = (uint32_t)_columns * _rows;
+
+	_cellMarks = (uint16_t*)extmem_malloc( cellCount * sizeof( uint16_t ) );
+	_cellStart = (uint16_t*)extmem_malloc( (cellCount + 1) * sizeof( uint16_t ) );
+
+	if ( _cellMarks == NULL || _cellStart == NULL )
+	{
+		clear();
+		return false;
+	}
+
+	// First pass counts the legs of every cell
+	memset( _cellStart, 0, (cellCount + 1) * sizeof( uint16_t ) );
+	memset( _cellMarks, 0xFF, cellCount * sizeof( uint16_t ) ); // No leg marked yet
+	_buildState = CORRIDOR_BUILD_COUNT;
+	_buildLeg = 0;
+
+	return true;
+}
+
+bool CorridorIndex::allocateLists()
+{
+	uint32_t cellCount = (uint32_t)_columns * _rows;
+
+	// Turn the counts into the end of each list, the second pass fills every list backwards which leaves the start behind
+	for ( uint32_t cell = 0; cell < cellCount; cell++ )
+	{
+		_entryCount += _cellStart[cell];
+
+		if ( _entryCount > CORRIDOR_INDEX_MAX_ENTRIES )
+		{
+			return false;
+		}
+
+		_cellStart[cell] = _entryCount;
+	}
+
+	_cellStart[cellCount] = _entryCount;
+	_cellLegs = (uint16_t*)extmem_malloc( _entryCount * sizeof( uint16_t ) );
+
+	if ( _cellLegs == NULL )
+	{
+		clear();
+		return false;
+	}
+
+	memset( _cellMarks, 0xFF, cellCount * sizeof( uint16_t ) );
+	_buildState = CORRIDOR_BUILD_FILL;
+	_buildLeg = 0;
+
+	return true;
+}
+
+uint32_t CorridorIndex::rasterize( uint16_t leg, bool fill )
+{
+	uint32_t cellsVisited = 0;
+	float x0 = _pointX[leg];
+	float y0 = _pointY[leg];
+	float dx = _pointX[leg + 1] - x0;
+	float dy = _pointY[leg + 1] - y0;
+	uint16_t pieces = (uint16_t)(sqrtf( dx * dx + dy * dy ) / _cellMeters) + 1;
+
+	// The bounding box of a whole diagonal leg covers far more cells than its corridor, so walk it one cell long piece at a time
+	for ( uint16_t piece = 0; piece < pieces; piece++ )
+	{
+		float ax = x0 + dx * piece / pieces;
+		float ay = y0 + dy * piece / pieces;
+		float bx = x0 + dx * (piece + 1) / pieces;
+		float by = y0 + dy * (piece + 1) / pieces;
+
+		int32_t firstColumn = max( (int32_t)0, (int32_t)((min( ax, bx ) - _halfWidth - _minX) / _cellMeters) );
+		int32_t lastColumn = min( (int32_t)_columns - 1, (int32_t)((max( ax, bx ) + _halfWidth - _minX) / _cellMeters) );
+		int32_t firstRow = max( (int32_t)0, (int32_t)((min( ay, by ) - _halfWidth - _minY) / _cellMeters) );
+		int32_t lastRow = min( (int32_t)_rows - 1, (int32_t)((max( ay, by ) + _halfWidth - _minY) / _cellMeters) );
+
+		for ( int32_t row = firstRow; row <= lastRow; row++ )
+		{
+			for ( int32_t column = firstColumn; column <= lastColumn; column++ )
+			{
+				uint32_t cell = (uint32_t)row * _columns + column;
+
+				cellsVisited++;
+
+				// Neighboring pieces overlap, list the leg once per cell
+				if ( _cellMarks[cell] == leg )
+				{
+					continue;
+				}
+
+				_cellMarks[cell] = leg;
+
+				if ( fill )
+				{
+					_cellLegs[--_cellStart[cell]] = leg;
+				}
+				else
+				{
+					_cellStart[cell]++;
+				}
+			}
+		}
+	}
+
+	return cellsVisited;
+}
+
+void CorridorIndex::clear()
+{
+	extmem_free( _pointX );
+	extmem_free( _pointY );
+	extmem_free( _pointSequence );
+	extmem_free( _cellStart );
+	extmem_free( _cellLegs );
+	extmem_free( _cellMarks );
+
+	_pointX = NULL;
+	_pointY = NULL;
+	_pointSequence = NULL;
+	_cellStart = NULL;
+	_cellLegs = NULL;
+	_cellMarks = NULL;
+	_pointCount = 0;
+	_entryCount = 0;
+	_columns = 0;
+	_rows = 0;
+	_minX = 0;
+	_minY = 0;
+	_isBuilt = false;
+	_buildState = CORRIDOR_BUILD_IDLE;
+}
+
+bool CorridorIndex::isBuilt()
+{
+	return _isBuilt;
+}
+
+bool CorridorIndex::contains( int32_t latitude, int32_t longitude, uint16_t firstLeg, uint16_t lastLeg )
+{
+	if ( !_isBuilt )
+	{
+		return false;
+	}
+
+	uint32_t startCycles = ARM_DWT_CYCCNT;
+	bool inside = false;
+	float x;
+	float y;
+
+	toLocal( latitude, longitude, &x, &y );
+
+	int32_t column = (int32_t)floorf( (x - _minX) / _cellMeters );
+	int32_t row = (int32_t)floorf( (y - _minY) / _cellMeters );
+
+	// Outside the grid is further than half the corridor from every leg
+	if ( column >= 0 && column < _columns && row >= 0 && row < _rows )
+	{
+		uint32_t cell = (uint32_t)row * _columns + column;
+		float halfWidthSquared = _halfWidth * _halfWidth;
+
+		for ( uint32_t entry = _cellStart[cell]; entry < _cellStart[cell + 1] && !inside; entry++ )
+		{
+			uint16_t leg = _cellLegs[entry];
+
+			if ( leg < firstLeg || leg > lastLeg )
+			{
+				continue;
+			}
+
+			float dx = _pointX[leg + 1] - _pointX[leg];
+			float dy = _pointY[leg + 1] - _pointY[leg];
+			float px = x - _pointX[leg];
+			float py = y - _pointY[leg];
+			float lengthSquared = dx * dx + dy * dy;
+			float t = lengthSquared > 0 ? (px * dx + py * dy) / lengthSquared : 0;
+
+			// Closest point on the leg, the corridor is rounded at the waypoints
+			t = constrain( t, 0.0f, 1.0f );
+			px -= t * dx;
+			py -= t * dy;
+
+			inside = px * px + py * py <= halfWidthSquared;
+		}
+	}
+
+	_queryCycles += ARM_DWT_CYCCNT - startCycles;
+	_queryCount++;
+
+	return inside;
+}
+
+uint16_t CorridorIndex::getLeg( uint16_t seq )
+{
+	uint16_t first = 0;
+	uint16_t last = _pointCount;
+
+	// Find the first point at or after the item
+	while ( first < last )
+	{
+		uint16_t middle = (first + last) / 2;
+
+		if ( _pointSequence[middle] < seq )
+		{
+			first = middle + 1;
+		}
+		else
+		{
+			last = middle;
+		}
+	}
+
+	return constrain( first, 1, getLegCount() ) - 1;
+}
+
+uint16_t CorridorIndex::benchmark( WaypointStore* waypointStore, uint32_t* averageCycles, uint32_t* mostCycles )
+{
+	uint32_t queryCount = _queryCount;
+	uint64_t queryCycles = _queryCycles;
+	uint16_t stride = max( _pointCount / CORRIDOR_INDEX_BENCHMARK_QUERIES, 1 );
+	uint16_t queries = 0;
+	uint64_t totalCycles = 0;
+	int32_t latitude;
+	int32_t longitude;
+
+	*mostCycles = 0;
+
+	for ( uint16_t point = 0; point < _pointCount && queries < CORRIDOR_INDEX_BENCHMARK_QUERIES; point += stride )
+	{
+		waypointStore->getPosition( _pointSequence[point], &latitude, &longitude );
+
+		uint32_t startCycles = ARM_DWT_CYCCNT;
+		contains( latitude, longitude, 0, getLegCount() - 1 );
+		uint32_t cycles = ARM_DWT_CYCCNT - startCycles;
+
+		totalCycles += cycles;
+		*mostCycles = max( *mostCycles, cycles );
+		queries++;
+	}
+
+	*averageCycles = queries == 0 ? 0 : (uint32_t)(totalCycles / queries);
+
+	// Only the checks of the rover count towards the average
+	_queryCount = queryCount;
+	_queryCycles = queryCycles;
+
+	return queries;
+}
+
+void CorridorIndex::toLocal( int32_t latitude, int32_t longitude, float* x, float* y )
+{
+	*x = (longitude - _originLongitude) * _metersPerLongitudeUnit;
+	*y = (latitude - _originLatitude) * METERS_PER_DEGREE_E7;
+}
+
+uint16_t CorridorIndex::getLegCount()
+{
+	return _pointCount > 0 ? _pointCount - 1 : 0;
+}
+
+uint32_t CorridorIndex::getCellCount()
+{
+	return (uint32_t)_columns * _rows;
+}
+
+uint32_t CorridorIndex::getEntryCount()
+{
+	return _entryCount;
+}
+
+uint32_t CorridorIndex::getMemoryBytes()
+{
+	return _pointCount * (2 * sizeof( float ) + sizeof( uint16_t )) + (getCellCount() + 1) * sizeof( uint16_t ) + _entryCount * sizeof( uint16_t );
+}
+
+bool CorridorIndex::isInExternalMemory()
+{
+	return (uintptr_t)_pointX >= PSRAM_START && (uintptr_t)_pointY >= PSRAM_START
+		&& (uintptr_t)_cellStart >= PSRAM_START && (_entryCount == 0 || (uintptr_t)_cellLegs >= PSRAM_START);
+}
+
+float CorridorIndex::getCellMeters()
+{
+	return _cellMeters;
+}
+
+uint32_t CorridorIndex::getAverageQueryCycles()
+{
+	return _queryCount == 0 ? 0 : (uint32_t)(_queryCycles / _queryCount);
+}
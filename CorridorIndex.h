@@ -0,0 +1,170 @@
+// CorridorIndex.h
+
+#ifndef _CORRIDORINDEX_h
+#define _CORRIDORINDEX_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "WaypointStore.h"
+
+constexpr uint32_t CORRIDOR_INDEX_MAX_CELLS = 8192;   ///< Grid cells allowed, the cells grow when the mission covers a large area
+constexpr float CORRIDOR_INDEX_MIN_CELL_METERS = 1.0f;
+constexpr uint32_t CORRIDOR_INDEX_MAX_ENTRIES = 65535;   ///< Legs listed over all cells, the cells grow until the lists fit
+constexpr uint32_t CORRIDOR_INDEX_BUILD_SLICE_CELLS = 16384; ///< Cells visited per build step, about a millisecond, so a large mission doesn't hold up the main loop
+constexpr uint16_t CORRIDOR_INDEX_BENCHMARK_QUERIES = 256;   ///< Checks timed when an index is built, spread over the waypoints
+
+/**
+ * @brief CorridorIndex answers whether a position is inside the corridor around a range of legs of the mission.
+ * The legs are rasterized once into a uniform grid over the mission, each cell listing the legs whose corridor touches it.
+ * The lists are packed one after the other with an offset per cell, so the index is three arrays and no per-cell allocations.
+ * A check only measures the distance to the few legs listed in the cell under the rover, however long the mission is, and
+ * skips those outside the range, so a pass of a mowing pattern next to the current one doesn't count as on course.
+ * The arrays are taken from PSRAM when it is fitted, otherwise from the heap. They are the only memory the firmware takes from the heap,
+ * each mission monitor holds an index and the threshold sweep runs several monitors, so arrays reserved at compile time wouldn't fit.
+ * A large mission takes a while to rasterize, so the build can be spread over several ticks with beginBuild() and continueBuild().
+*/
+class CorridorIndex
+{
+public:
+	CorridorIndex();
+	~CorridorIndex();
+
+	/**
+	 * @brief Build the index from a complete mission.
+	 * @param waypointStore The mission.
+	 * @param corridorWidthMeters Width of the corridor around each leg.
+	 * @return False if the mission has no legs or there isn't enough memory.
+	*/
+	bool build( WaypointStore* waypointStore, uint16_t corridorWidthMeters );
+
+	/**
+	 * @brief Start building the index from a complete mission. The waypoints are read here, the legs are rasterized by continueBuild().
+	 * @param waypointStore The mission.
+	 * @param corridorWidthMeters Width of the corridor around each leg.
+	 * @return False if the mission has no legs or there isn't enough memory.
+	*/
+	bool beginBuild( WaypointStore* waypointStore, uint16_t corridorWidthMeters );
+
+	/**
+	 * @brief Rasterize legs until a budget of cells is spent. The budget is counted in cells rather than time so a replayed
+	 * mission is built at the same ticks however fast it is read.
+	 * @param cellBudget Cells to visit at most, the leg being rasterized when the budget runs out is finished.
+	 * @return True while the build isn't finished, isBuilt() then tells whether it succeeded.
+	*/
+	bool continueBuild( uint32_t cellBudget );
+
+	bool isBuilding();
+
+	/**
+	 * @brief Release the index.
+	*/
+	void clear();
+
+	bool isBuilt();
+
+	/**
+	 * @brief Check if a position is inside the corridor of a range of legs.
+	 * @param latitude Latitude in 1e-7 degrees.
+	 * @param longitude Longitude in 1e-7 degrees.
+	 * @param firstLeg The first leg of the range.
+	 * @param lastLeg The last leg of the range.
+	 * @return True if the position is within half the corridor width of a leg in the range.
+	*/
+	bool contains( int32_t latitude, int32_t longitude, uint16_t firstLeg, uint16_t lastLeg );
+
+	/**
+	 * @brief Find the leg that ends at a mission item. Items without a position belong to the leg of the next item that has one.
+	 * @param seq The sequence number of the mission item.
+	 * @return The leg, the last leg for items after the last waypoint.
+	*/
+	uint16_t getLeg( uint16_t seq );
+
+	/**
+	 * @brief Time checks at up to CORRIDOR_INDEX_BENCHMARK_QUERIES waypoints against every leg, the cost of the longest cell lists.
+	 * The checks don't count towards getAverageQueryCycles().
+	 * @param waypointStore The mission the index was built from.
+	 * @param averageCycles Receives the average processor cycles per check.
+	 * @param mostCycles Receives the most processor cycles a check took.
+	 * @return The number of checks timed.
+	*/
+	uint16_t benchmark( WaypointStore* waypointStore, uint32_t* averageCycles, uint32_t* mostCycles );
+
+	uint16_t getLegCount();
+	uint32_t getCellCount();
+	uint32_t getEntryCount();
+	uint32_t getMemoryBytes();
+
+	/**
+	 * @brief Check where the arrays were taken from, PSRAM runs out like the heap and then the heap is used instead.
+	 * @return True if every array is in PSRAM, false if any of them is on the heap.
+	*/
+	bool isInExternalMemory();
+	float getCellMeters();
+
+	/**
+	 * @brief Get the average cost of contains() since the index was built.
+	 * @return Processor cycles per check.
+	*/
+	uint32_t getAverageQueryCycles();
+
+private:
+	void toLocal( int32_t latitude, int32_t longitude, float* x, float* y );
+
+	/**
+	 * @brief Visit the cells touched by the corridor of a leg, in two passes: counting, then filling the lists.
+	 * @return The number of cells visited.
+	*/
+	uint32_t rasterize( uint16_t leg, bool fill );
+
+	/**
+	 * @brief Size the grid for the current cell size and start counting the legs of every cell.
+	 * @return False if there isn't enough memory, the index is cleared.
+	*/
+	bool prepareCells();
+
+	/**
+	 * @brief Turn the counts into the cell lists and start filling them.
+	 * @return False if the lists don't fit or there isn't enough memory, the index is cleared when the memory ran out.
+	*/
+	bool allocateLists();
+
+	enum CORRIDOR_BUILD : uint8_t
+	{
+		CORRIDOR_BUILD_IDLE,
+		CORRIDOR_BUILD_COUNT,
+		CORRIDOR_BUILD_FILL
+	};
+
+	bool _isBuilt = false;
+	CORRIDOR_BUILD _buildState = CORRIDOR_BUILD_IDLE;
+	uint16_t _buildLeg = 0;        ///< Next leg to rasterize in the current pass
+	int32_t _originLatitude = 0;
+	int32_t _originLongitude = 0;
+	float _metersPerLongitudeUnit = 0;
+	float _halfWidth = 0;
+	float _minX = 0;               ///< Corner of the grid in meters from the origin
+	float _minY = 0;
+	float _maxX = 0;               ///< Far corner of the area the corridor covers
+	float _maxY = 0;
+	float _cellMeters = 0;
+	uint16_t _columns = 0;
+	uint16_t _rows = 0;
+	uint16_t _pointCount = 0;
+	uint32_t _entryCount = 0;
+
+	float* _pointX = NULL;         ///< Waypoints with a position in meters east of the origin, leg n runs from point n to point n + 1
+	float* _pointY = NULL;         ///< Meters north of the origin
+	uint16_t* _pointSequence = NULL; ///< Mission item of each point, ascending
+	uint16_t* _cellStart = NULL;   ///< Offset of the first leg of each cell in _cellLegs, one extra entry marks the end
+	uint16_t* _cellLegs = NULL;
+	uint16_t* _cellMarks = NULL;   ///< Last leg listed in each cell while building
+
+	uint32_t _queryCount = 0;
+	uint64_t _queryCycles = 0;
+};
+
+#endif
@@ -0,0 +1,60 @@
+//
+//
+//
+
+#include "CpuMonitor.h"
+#include <ArduinoLog.h>
+
+
+void CpuMonitor::onBytesWaiting()
+{
+	if ( !_bytesWaiting )
+	{
+		_bytesWaiting = true;
+		_wakeCycles = ARM_DWT_CYCCNT;
+	}
+}
+
+void CpuMonitor::onBytesHandled()
+{
+	if ( !_bytesWaiting )
+	{
+		return;
+	}
+
+	uint32_t latencyCycles = ARM_DWT_CYCCNT - _wakeCycles;
+
+	_bytesWaiting = false;
+	_periodLatencyCycles += latencyCycles;
+	_periodWakes++;
+
+	if ( latencyCycles > _worstLatencyCycles )
+	{
+		_worstLatencyCycles = latencyCycles;
+	}
+}
+
+void CpuMonitor::publish( uint32_t totalMicroseconds, uint32_t schedulerMicroseconds, uint32_t sleepMicroseconds )
+{
+	if ( totalMicroseconds == 0 )
+	{
+		return;
+	}
+
+	uint32_t taskMicroseconds = totalMicroseconds - schedulerMicroseconds - sleepMicroseconds;
+
+	// Shares in thousandths so a lightly loaded processor doesn't read 0
+	Log.trace( "CPU: %u/1000 in tasks, %u/1000 in the scheduler, %u/1000 asleep",
+		(uint32_t)((uint64_t)taskMicroseconds * 1000 / totalMicroseconds),
+		(uint32_t)((uint64_t)schedulerMicroseconds * 1000 / totalMicroseconds),
+		(uint32_t)((uint64_t)sleepMicroseconds * 1000 / totalMicroseconds) );
+
+	Log.trace( "CPU: %u wakes with bytes waiting, %u cycles from wake to read on average, %u at most",
+		_periodWakes,
+		_periodWakes == 0 ? 0 : (uint32_t)(_periodLatencyCycles / _periodWakes),
+		_worstLatencyCycles );
+
+	_periodLatencyCycles = 0;
+	_periodWakes = 0;
+	_worstLatencyCycles = 0;
+}
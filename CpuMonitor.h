@@ -0,0 +1,48 @@
+// CpuMonitor.h
+
+#ifndef _CPUMONITOR_h
+#define _CPUMONITOR_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+constexpr uint32_t CPU_MONITOR_PUBLISH_MILLISECONDS = 10000; ///< How often processor use is written to the log
+
+/**
+ * @brief CpuMonitor reports how the processor time is split between tasks, the scheduler and sleep, and how long bytes
+ * from the flight controller wait between waking the processor and being read. The scheduler measures its own time,
+ * so the figures are passed in, and the wake to handle latency is measured in processor cycles.
+*/
+class CpuMonitor
+{
+public:
+	/**
+	 * @brief Note that the processor woke up with bytes waiting. Only the first wake before they are read counts.
+	*/
+	void onBytesWaiting();
+
+	/**
+	 * @brief Note that the waiting bytes were read, which ends the latency measurement.
+	*/
+	void onBytesHandled();
+
+	/**
+	 * @brief Write processor use and the wake to handle latency to the log, then start a new period.
+	 * @param totalMicroseconds Time since the scheduler counters were reset.
+	 * @param schedulerMicroseconds Time spent by the scheduler itself.
+	 * @param sleepMicroseconds Time spent asleep.
+	*/
+	void publish( uint32_t totalMicroseconds, uint32_t schedulerMicroseconds, uint32_t sleepMicroseconds );
+
+private:
+	bool _bytesWaiting = false;
+	uint32_t _wakeCycles = 0;
+	uint64_t _periodLatencyCycles = 0;
+	uint32_t _periodWakes = 0;
+	uint32_t _worstLatencyCycles = 0;
+};
+
+#endif
@@ -0,0 +1,102 @@
+//
+//
+//
+
+#include "CrossTrackMonitor.h"
+
+
+CrossTrackMonitor::CrossTrackMonitor()
+{
+
+}
+
+void CrossTrackMonitor::setLeg( int32_t startLatitude, int32_t startLongitude, int32_t endLatitude, int32_t endLongitude )
+{
+	_originLatitude = startLatitude;
+	_originLongitude = startLongitude;
+	_metersPerLongitudeUnit = METERS_PER_DEGREE_E7 * cosf( startLatitude * 1.0e-7f * (float)DEG_TO_RAD );
+
+	float north = (endLatitude - startLatitude) * METERS_PER_DEGREE_E7;
+	float east = (endLongitude - startLongitude) * _metersPerLongitudeUnit;
+
+	_legLength = sqrtf( north * north + east * east );
+
+	// A leg with no length has no direction, measure the distance from its start instead
+	if ( _legLength > 0 )
+	{
+		_directionNorth = north / _legLength;
+		_directionEast = east / _legLength;
+	}
+	else
+	{
+		_directionNorth = 1;
+		_directionEast = 0;
+	}
+
+	_crossTrackError = 0;
+	_alongTrackDistance = 0;
+	_hasLeg = true;
+}
+
+void CrossTrackMonitor::clearLeg()
+{
+	_hasLeg = false;
+	_crossTrackError = 0;
+	_alongTrackDistance = 0;
+}
+
+bool CrossTrackMonitor::hasLeg()
+{
+	return _hasLeg;
+}
+
+float CrossTrackMonitor::update( int32_t latitude, int32_t longitude )
+{
+	if ( !_hasLeg )
+	{
+		return 0;
+	}
+
+	float north = (latitude - _originLatitude) * METERS_PER_DEGREE_E7;
+	float east = (longitude - _originLongitude) * _metersPerLongitudeUnit;
+
+	_alongTrackDistance = north * _directionNorth + east * _directionEast;
+	_crossTrackError = east * _directionNorth - north * _directionEast;
+
+	if ( _legLength == 0 )
+	{
+		_crossTrackError = sqrtf( north * north + east * east );
+	}
+
+	return _crossTrackError;
+}
+
+float CrossTrackMonitor::getCrossTrackError()
+{
+	return _crossTrackError;
+}
+
+float CrossTrackMonitor::getAlongTrackDistance()
+{
+	return _alongTrackDistance;
+}
+
+float CrossTrackMonitor::getLegLength()
+{
+	return _legLength;
+}
+
+void CrossTrackMonitor::project( int32_t latitude, int32_t longitude, float bearingDegrees, float distanceMeters, int32_t* projectedLatitude, int32_t* projectedLongitude )
+{
+	float bearing = bearingDegrees * (float)DEG_TO_RAD;
+	float metersPerLongitudeUnit = METERS_PER_DEGREE_E7 * cosf( latitude * 1.0e-7f * (float)DEG_TO_RAD );
+
+	*projectedLatitude = latitude + (int32_t)lroundf( distanceMeters * cosf( bearing ) / METERS_PER_DEGREE_E7 );
+	*projectedLongitude = longitude;
+
+	// Longitude is meaningless at the poles
+	if ( metersPerLongitudeUnit > 0 )
+	{
+		*projectedLongitude += (int32_t)lroundf( distanceMeters * sinf( bearing ) / metersPerLongitudeUnit );
+	}
+}
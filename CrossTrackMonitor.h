@@ -0,0 +1,93 @@
+// CrossTrackMonitor.h
+
+#ifndef _CROSSTRACKMONITOR_h
+#define _CROSSTRACKMONITOR_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+constexpr float METERS_PER_DEGREE_E7 = 0.011131949f; ///< Meters per 1e-7 degree of latitude, or of longitude at the equator
+
+/**
+ * @brief CrossTrackMonitor measures how far the rover is from the straight line of the current mission leg.
+ * Everything that depends only on the leg is calculated once when the leg is set, in a local tangent plane centered on
+ * the start of the leg, so each position update costs a handful of multiply-adds.
+*/
+class CrossTrackMonitor
+{
+public:
+	CrossTrackMonitor();
+
+	/**
+	 * @brief Set the leg the rover should be following.
+	 * @param startLatitude Latitude of the start of the leg in 1e-7 degrees.
+	 * @param startLongitude Longitude of the start of the leg in 1e-7 degrees.
+	 * @param endLatitude Latitude of the end of the leg in 1e-7 degrees.
+	 * @param endLongitude Longitude of the end of the leg in 1e-7 degrees.
+	*/
+	void setLeg( int32_t startLatitude, int32_t startLongitude, int32_t endLatitude, int32_t endLongitude );
+
+	/**
+	 * @brief Forget the current leg, updates are ignored until a new leg is set.
+	*/
+	void clearLeg();
+
+	/**
+	 * @brief Check if a leg has been set.
+	 * @return True if there is a leg.
+	*/
+	bool hasLeg();
+
+	/**
+	 * @brief Measure a new rover position against the leg.
+	 * @param latitude Latitude in 1e-7 degrees.
+	 * @param longitude Longitude in 1e-7 degrees.
+	 * @return The cross track error in meters, positive to the right of the leg.
+	*/
+	float update( int32_t latitude, int32_t longitude );
+
+	/**
+	 * @brief Get the cross track error of the last update.
+	 * @return Meters from the line of the leg, positive to the right.
+	*/
+	float getCrossTrackError();
+
+	/**
+	 * @brief Get the distance along the leg of the last update.
+	 * @return Meters from the start of the leg measured along the leg.
+	*/
+	float getAlongTrackDistance();
+
+	/**
+	 * @brief Get the length of the leg.
+	 * @return The length in meters.
+	*/
+	float getLegLength();
+
+	/**
+	 * @brief Find the position at a distance and bearing from another position. Accurate enough for the length of a leg.
+	 * @param latitude Latitude to start from in 1e-7 degrees.
+	 * @param longitude Longitude to start from in 1e-7 degrees.
+	 * @param bearingDegrees Bearing to travel in degrees from north.
+	 * @param distanceMeters Distance to travel in meters.
+	 * @param projectedLatitude Receives the latitude of the projected position.
+	 * @param projectedLongitude Receives the longitude of the projected position.
+	*/
+	static void project( int32_t latitude, int32_t longitude, float bearingDegrees, float distanceMeters, int32_t* projectedLatitude, int32_t* projectedLongitude );
+
+private:
+	bool _hasLeg = false;
+	int32_t _originLatitude = 0;
+	int32_t _originLongitude = 0;
+	float _metersPerLongitudeUnit = 0;   ///< Longitude scale at the start of the leg
+	float _directionNorth = 0;           ///< Unit vector along the leg
+	float _directionEast = 0;
+	float _legLength = 0;
+	float _crossTrackError = 0;
+	float _alongTrackDistance = 0;
+};
+
+#endif
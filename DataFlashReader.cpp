@@ -0,0 +1,401 @@
+//
+//
+//
+
+#include "DataFlashReader.h"
+#include <ArduinoLog.h>
+
+constexpr uint8_t DATAFLASH_FMT_LENGTH = 89;       ///< Header, type, length, name[4], format[16], labels[64]
+constexpr uint8_t DATAFLASH_FMT_NAME = 5;          ///< Offsets in the FMT record
+constexpr uint8_t DATAFLASH_FMT_FORMAT = 9;
+constexpr uint8_t DATAFLASH_FMT_LABELS = 25;
+constexpr uint8_t DATAFLASH_NAME_SIZE = 4;
+constexpr uint8_t DATAFLASH_FORMAT_SIZE = 16;
+constexpr uint8_t DATAFLASH_LABELS_SIZE = 64;
+
+constexpr const char* DATAFLASH_KIND_NAMES[DATAFLASH_KIND_COUNT] = { "MODE", "NTUN", "GPS", "GPS2", "POS", "ATT", "CMD" };
+
+/**
+ * @brief The fields read from each record type, by label. A field the log doesn't have reads as 0.
+*/
+constexpr const char* DATAFLASH_FIELD_LABELS[DATAFLASH_KIND_COUNT][DATAFLASH_MAX_FIELDS] =
+{
+	{ "ModeNum", NULL, NULL, NULL },
+	{ "WpDist", "WpBrg", "XT", NULL },
+	{ "Status", "Lat", "Lng", "I" },
+	{ "Status", "Lat", "Lng", NULL },
+	{ "Lat", "Lng", NULL, NULL },
+	{ "Yaw", NULL, NULL, NULL },
+	{ "CNum", NULL, NULL, NULL }
+};
+
+/**
+ * @brief Size of a field from its format character, 0 for a character the reader doesn't know.
+*/
+static uint8_t getFieldSize( char format )
+{
+	switch ( format )
+	{
+		case 'b': case 'B': case 'M':
+			return 1;
+		case 'h': case 'H': case 'c': case 'C':
+			return 2;
+		case 'i': case 'I': case 'f': case 'e': case 'E': case 'L': case 'n':
+			return 4;
+		case 'd': case 'q': case 'Q':
+			return 8;
+		case 'N':
+			return 16;
+		case 'Z': case 'a':
+			return 64;
+		default:
+			return 0;
+	}
+}
+
+DataFlashReader::DataFlashReader( const char* dataFlashLogFilePath, MAVLinkEventReceiver* mavlinkEventReceiver, uint8_t fileSpeedMilliseconds )
+	: FileMAVLinkReader( dataFlashLogFilePath, mavlinkEventReceiver, fileSpeedMilliseconds )
+{
+	_receiver = mavlinkEventReceiver;
+
+	memset( _recordLengths, 0, sizeof( _recordLengths ) );
+	memset( _recordKinds, DATAFLASH_KIND_NONE, sizeof( _recordKinds ) );
+	_recordLengths[DATAFLASH_FMT_TYPE] = DATAFLASH_FMT_LENGTH;
+
+	// TimeUS counts from the start of the flight controller, it is mission time as it is
+	_clockAnchored = true;
+}
+
+bool DataFlashReader::isDataFlashLog( const char* filePath )
+{
+	const char* extension = strrchr( filePath, '.' );
+
+	return extension != NULL && strcasecmp( extension, ".bin" ) == 0;
+}
+
+bool DataFlashReader::receiveMAVLinkMessages()
+{
+	while ( readRecord() )
+	{
+		if ( _recordType == DATAFLASH_FMT_TYPE )
+		{
+			readFormat();
+			continue;
+		}
+
+		DATAFLASH_KIND kind = (DATAFLASH_KIND)_recordKinds[_recordType];
+
+		if ( kind == DATAFLASH_KIND_NONE || !_schemas[kind].known )
+		{
+			continue;
+		}
+
+		uint64_t timeMicroseconds;
+		memcpy( &timeMicroseconds, _record + DATAFLASH_HEADER_SIZE, sizeof( timeMicroseconds ) );
+		_systemBootTimeMilliseconds = timeMicroseconds / 1000;
+		advanceMissionClock( _systemBootTimeMilliseconds );
+
+		bool eventSent = dispatchRecord( kind );
+
+		// The monitor follows the mode and the link health from heartbeats, which the log doesn't have
+		if ( _hasMode && _systemBootTimeMilliseconds >= _nextHeartbeatMilliseconds )
+		{
+			eventSent = sendHeartbeat() || eventSent;
+		}
+
+		if ( eventSent )
+		{
+			// TimeUS stands in for the tlog timestamps when the replay follows the log clock
+			_nextFrameMicroseconds = timeMicroseconds;
+			return true;
+		}
+	}
+
+	if ( _recordsSkipped > 0 || _bytesDiscarded > 0 )
+	{
+		Log.trace( "DataFlash log ended, %u records of undescribed types skipped, %u bytes discarded", _recordsSkipped, _bytesDiscarded );
+		_recordsSkipped = 0;
+		_bytesDiscarded = 0;
+	}
+
+	return false;
+}
+
+bool DataFlashReader::readRecord()
+{
+	uint8_t byte = 0;
+	uint8_t previous = 0;
+
+	// Find the two header bytes, anything else in between is damage to the log
+	while ( true )
+	{
+		if ( !readByte( &byte ) )
+		{
+			return false;
+		}
+
+		if ( previous == DATAFLASH_HEADER_1 && byte == DATAFLASH_HEADER_2 )
+		{
+			break;
+		}
+
+		if ( previous != 0 || byte != DATAFLASH_HEADER_1 )
+		{
+			_bytesDiscarded++;
+		}
+
+		previous = byte;
+	}
+
+	if ( !readByte( &_recordType ) )
+	{
+		return false;
+	}
+
+	uint8_t length = _recordLengths[_recordType];
+
+	if ( length < DATAFLASH_HEADER_SIZE )
+	{
+		// Without its FMT the length is unknown, look for the next header
+		_recordsSkipped++;
+		return true;
+	}
+
+	for ( uint8_t i = DATAFLASH_HEADER_SIZE; i < length; i++ )
+	{
+		if ( !readByte( &_record[i] ) )
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void DataFlashReader::readFormat()
+{
+	uint8_t type = _record[DATAFLASH_HEADER_SIZE];
+	uint8_t length = _record[DATAFLASH_HEADER_SIZE + 1];
+
+	_recordLengths[type] = length;
+
+	char name[DATAFLASH_NAME_SIZE + 1] = {};
+	memcpy( name, _record + DATAFLASH_FMT_NAME, DATAFLASH_NAME_SIZE );
+
+	uint8_t kind = 0;
+
+	while ( kind < DATAFLASH_KIND_COUNT && strcmp( name, DATAFLASH_KIND_NAMES[kind] ) != 0 )
+	{
+		kind++;
+	}
+
+	if ( kind == DATAFLASH_KIND_COUNT )
+	{
+		return;
+	}
+
+	char format[DATAFLASH_FORMAT_SIZE + 1] = {};
+	char labels[DATAFLASH_LABELS_SIZE + 1] = {};
+	memcpy( format, _record + DATAFLASH_FMT_FORMAT, DATAFLASH_FORMAT_SIZE );
+	memcpy( labels, _record + DATAFLASH_FMT_LABELS, DATAFLASH_LABELS_SIZE );
+
+	DataFlashSchema* schema = &_schemas[kind];
+
+	schema->type = type;
+	schema->known = format[0] == 'Q';   // Every record used starts with TimeUS
+	memset( schema->offsets, 0, sizeof( schema->offsets ) );
+	memset( schema->formats, 0, sizeof( schema->formats ) );
+	_recordKinds[type] = kind;
+
+	// Walk the labels and formats side by side, adding up the field sizes
+	uint8_t offset = DATAFLASH_HEADER_SIZE;
+	char* label = labels;
+
+	for ( uint8_t i = 0; format[i] != 0 && label != NULL; i++ )
+	{
+		char* next = strchr( label, ',' );
+
+		if ( next != NULL )
+		{
+			*next++ = 0;
+		}
+
+		for ( uint8_t field = 0; field < DATAFLASH_MAX_FIELDS; field++ )
+		{
+			if ( DATAFLASH_FIELD_LABELS[kind][field] != NULL && strcmp( label, DATAFLASH_FIELD_LABELS[kind][field] ) == 0 )
+			{
+				schema->offsets[field] = offset;
+				schema->formats[field] = format[i];
+			}
+		}
+
+		uint8_t size = getFieldSize( format[i] );
+
+		if ( size == 0 )
+		{
+			Log.trace( "DataFlash %s has field format %c, the fields after it are skipped", name, format[i] );
+			break;
+		}
+
+		offset += size;
+		label = next;
+	}
+}
+
+bool DataFlashReader::hasField( DATAFLASH_KIND kind, uint8_t field )
+{
+	return _schemas[kind].offsets[field] != 0;
+}
+
+int32_t DataFlashReader::getField( DATAFLASH_KIND kind, uint8_t field, int32_t scale )
+{
+	const DataFlashSchema& schema = _schemas[kind];
+	const uint8_t* data = _record + schema.offsets[field];
+	double value = 0;
+
+	if ( schema.offsets[field] == 0 )
+	{
+		return 0;
+	}
+
+	switch ( schema.formats[field] )
+	{
+		case 'b': value = *(const int8_t*)data; break;
+		case 'B': case 'M': value = *data; break;
+		case 'h': { int16_t raw; memcpy( &raw, data, sizeof( raw ) ); value = raw; } break;
+		case 'H': { uint16_t raw; memcpy( &raw, data, sizeof( raw ) ); value = raw; } break;
+		case 'c': { int16_t raw; memcpy( &raw, data, sizeof( raw ) ); value = raw / 100.0; } break;
+		case 'C': { uint16_t raw; memcpy( &raw, data, sizeof( raw ) ); value = raw / 100.0; } break;
+		case 'i': case 'L': { int32_t raw; memcpy( &raw, data, sizeof( raw ) ); value = raw; } break;
+		case 'I': { uint32_t raw; memcpy( &raw, data, sizeof( raw ) ); value = raw; } break;
+		case 'e': { int32_t raw; memcpy( &raw, data, sizeof( raw ) ); value = raw / 100.0; } break;
+		case 'E': { uint32_t raw; memcpy( &raw, data, sizeof( raw ) ); value = raw / 100.0; } break;
+		case 'f': { float raw; memcpy( &raw, data, sizeof( raw ) ); value = raw; } break;
+		case 'd': { double raw; memcpy( &raw, data, sizeof( raw ) ); value = raw; } break;
+		default: return 0;
+	}
+
+	return (int32_t)round( value * scale );
+}
+
+bool DataFlashReader::dispatchRecord( DATAFLASH_KIND kind )
+{
+	switch ( kind )
+	{
+		case DATAFLASH_KIND_MODE:
+			_mode = getField( kind, 0 );
+			_hasMode = true;
+			_nextHeartbeatMilliseconds = _systemBootTimeMilliseconds;   // The mode change goes out with a heartbeat right away
+			return false;
+
+		case DATAFLASH_KIND_NTUN:
+			{
+				mavlink_nav_controller_output_t navControllerOutput = {};
+
+				navControllerOutput.wp_dist = constrain( getField( kind, 0 ), 0, UINT16_MAX );
+				navControllerOutput.target_bearing = getField( kind, 1 );
+				navControllerOutput.nav_bearing = navControllerOutput.target_bearing;
+				navControllerOutput.xtrack_error = getField( kind, 2, 100 ) / 100.0f;
+
+				_receiver->onNavControllerOutput( navControllerOutput );
+				return true;
+			}
+
+		case DATAFLASH_KIND_GPS:
+			if ( hasField( kind, 3 ) && getField( kind, 3 ) == 1 )
+			{
+				// Logs since ArduPilot 4.1 keep both GPS in GPS records, told apart by instance
+				mavlink_gps2_raw_t gps2Raw = {};
+
+				gps2Raw.time_usec = (uint64_t)_systemBootTimeMilliseconds * 1000;
+				gps2Raw.fix_type = getField( kind, 0 );
+				gps2Raw.lat = getField( kind, 1 );
+				gps2Raw.lon = getField( kind, 2 );
+
+				_receiver->onGPS2Raw( gps2Raw );
+			}
+			else
+			{
+				mavlink_gps_raw_int_t gpsRawInt = {};
+
+				gpsRawInt.time_usec = (uint64_t)_systemBootTimeMilliseconds * 1000;
+				gpsRawInt.fix_type = getField( kind, 0 );
+				gpsRawInt.lat = getField( kind, 1 );
+				gpsRawInt.lon = getField( kind, 2 );
+
+				_receiver->onGPSRawInt( gpsRawInt );
+			}
+			return true;
+
+		case DATAFLASH_KIND_GPS2:
+			{
+				mavlink_gps2_raw_t gps2Raw = {};
+
+				gps2Raw.time_usec = (uint64_t)_systemBootTimeMilliseconds * 1000;
+				gps2Raw.fix_type = getField( kind, 0 );
+				gps2Raw.lat = getField( kind, 1 );
+				gps2Raw.lon = getField( kind, 2 );
+
+				_receiver->onGPS2Raw( gps2Raw );
+				return true;
+			}
+
+		case DATAFLASH_KIND_POS:
+			{
+				mavlink_global_position_int_t globalPositionInt = {};
+
+				globalPositionInt.time_boot_ms = _systemBootTimeMilliseconds;
+				globalPositionInt.lat = getField( kind, 0 );
+				globalPositionInt.lon = getField( kind, 1 );
+				globalPositionInt.hdg = _heading;
+
+				_receiver->onGlobalPositionInt( globalPositionInt );
+				return true;
+			}
+
+		case DATAFLASH_KIND_ATT:
+			{
+				int32_t yaw = getField( kind, 0, 100 ) % 36000;
+				_heading = yaw < 0 ? yaw + 36000 : yaw;
+				return false;
+			}
+
+		case DATAFLASH_KIND_CMD:
+			{
+				uint16_t seq = getField( kind, 0 );
+
+				if ( seq == _missionCurrent )
+				{
+					return false;
+				}
+
+				mavlink_mission_current_t missionCurrent = {};
+
+				missionCurrent.seq = seq;
+				_missionCurrent = seq;
+
+				_receiver->onMissionCurrent( missionCurrent );
+				return true;
+			}
+
+		default:
+			return false;
+	}
+}
+
+bool DataFlashReader::sendHeartbeat()
+{
+	mavlink_heartbeat_t heartbeat = {};
+
+	heartbeat.type = MAV_TYPE_GROUND_ROVER;
+	heartbeat.autopilot = MAV_AUTOPILOT_ARDUPILOTMEGA;
+	heartbeat.base_mode = MAV_MODE_FLAG_CUSTOM_MODE_ENABLED;
+	heartbeat.custom_mode = _mode;
+	heartbeat.system_status = MAV_STATE_ACTIVE;
+	heartbeat.mavlink_version = 3;
+
+	_nextHeartbeatMilliseconds = _systemBootTimeMilliseconds + DATAFLASH_HEARTBEAT_MILLISECONDS;
+	_receiver->onHeatbeat( heartbeat );
+
+	return true;
+}
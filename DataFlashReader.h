@@ -0,0 +1,111 @@
+// DataFlashReader.h
+
+#ifndef _DATAFLASHREADER_h
+#define _DATAFLASHREADER_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "FileMAVLinkReader.h"
+
+constexpr uint8_t DATAFLASH_HEADER_1 = 0xA3;               ///< First byte of every record
+constexpr uint8_t DATAFLASH_HEADER_2 = 0x95;               ///< Second byte of every record
+constexpr uint8_t DATAFLASH_HEADER_SIZE = 3;               ///< The two header bytes and the record type
+constexpr uint8_t DATAFLASH_FMT_TYPE = 128;                ///< Type of the FMT records that describe the other types
+constexpr uint8_t DATAFLASH_MAX_FIELDS = 4;                ///< Fields read from a record type, after TimeUS
+constexpr uint32_t DATAFLASH_HEARTBEAT_MILLISECONDS = 1000; ///< Log time between two synthesized heartbeats
+
+/**
+ * @brief The record types the reader turns into events.
+*/
+enum DATAFLASH_KIND : uint8_t
+{
+	DATAFLASH_KIND_MODE,
+	DATAFLASH_KIND_NTUN,
+	DATAFLASH_KIND_GPS,
+	DATAFLASH_KIND_GPS2,
+	DATAFLASH_KIND_POS,
+	DATAFLASH_KIND_ATT,
+	DATAFLASH_KIND_CMD,
+	DATAFLASH_KIND_COUNT,
+	DATAFLASH_KIND_NONE = 0xFF
+};
+
+/**
+ * @brief Where the fields read from a record type are, taken from its FMT record.
+*/
+struct DataFlashSchema
+{
+	uint8_t type = 0;
+	bool known = false;
+	uint8_t offsets[DATAFLASH_MAX_FIELDS];   ///< Offset from the start of the record, 0 if the type has no such field
+	char formats[DATAFLASH_MAX_FIELDS];      ///< Format character of each field
+};
+
+/**
+ * @brief DataFlashReader replays an ArduPilot DataFlash .bin log from the SD card, for testing like FileMAVLinkReader does with a tlog.
+ * The log describes its own record types with FMT records. The reader keeps the length of every type, to step over the records it
+ * doesn't use, and the offsets of the few fields it needs in a small schema table. The mode, navigation, GPS, position, attitude
+ * and mission command records are turned into the MAVLink events a flight controller would send, with the log time as mission time,
+ * and a heartbeat is synthesized every second of log time. The log is read once from start to end, a record at a time.
+*/
+class DataFlashReader : public FileMAVLinkReader
+{
+public:
+	/**
+	 * @brief Constructor.
+	 * @param dataFlashLogFilePath The .bin file. Use 8.3 file naming convention to support SD API.
+	 * @param mavlinkEventReceiver The event receiver that gets the events synthesized from the log.
+	 * @param fileSpeedMilliseconds The time between two events.
+	*/
+	DataFlashReader( const char* dataFlashLogFilePath, MAVLinkEventReceiver* mavlinkEventReceiver, uint8_t fileSpeedMilliseconds );
+
+	/**
+	 * @brief Read records until one of them is turned into an event.
+	 * @return True if an event was sent.
+	*/
+	virtual bool receiveMAVLinkMessages();
+
+	/**
+	 * @brief Read a single byte of the log, a DataFlash log has no MAVLink frames or tlog timestamps to look for.
+	*/
+	virtual bool readByte( uint8_t* buffer )
+	{
+		return readFileByte( buffer );
+	}
+
+	/**
+	 * @brief Tell whether a file name is a DataFlash log.
+	 * @param filePath The file name.
+	 * @return True if it ends with .bin.
+	*/
+	static bool isDataFlashLog( const char* filePath );
+
+private:
+	bool readRecord();
+	void readFormat();
+	bool dispatchRecord( DATAFLASH_KIND kind );
+	bool sendHeartbeat();
+	int32_t getField( DATAFLASH_KIND kind, uint8_t field, int32_t scale = 1 );
+	bool hasField( DATAFLASH_KIND kind, uint8_t field );
+
+	MAVLinkEventReceiver* _receiver;
+	uint8_t _recordLengths[256];             ///< Length of every type described so far, 0 for types not described yet
+	uint8_t _recordKinds[256];               ///< DATAFLASH_KIND of every type
+	DataFlashSchema _schemas[DATAFLASH_KIND_COUNT];
+	uint8_t _record[256];
+	uint8_t _recordType = 0;
+	uint32_t _recordsSkipped = 0;
+	uint32_t _bytesDiscarded = 0;
+
+	bool _hasMode = false;
+	uint8_t _mode = 0;
+	uint16_t _heading = UINT16_MAX;          ///< Yaw from the last ATT record in centidegrees
+	uint16_t _missionCurrent = UINT16_MAX;
+	uint32_t _nextHeartbeatMilliseconds = 0;
+};
+
+#endif
@@ -0,0 +1,151 @@
+//
+//
+//
+
+#include "DeadlineMonitor.h"
+#include <ArduinoLog.h>
+#include <imxrt.h>
+
+constexpr uint16_t WATCHDOG_TIMEOUT_FIELD = WATCHDOG_TIMEOUT_MILLISECONDS / 500 - 1; // WDOG1 counts down in half seconds from the field plus one
+static_assert(WATCHDOG_TIMEOUT_MILLISECONDS >= 500 && WATCHDOG_TIMEOUT_MILLISECONDS <= 128000, "The watchdog timeout is between 0.5 and 128 seconds");
+
+DeadlineMonitor* DeadlineMonitor::_instance = NULL;
+
+void DeadlineMonitor::begin( ServoRelay* servoRelay )
+{
+	_servoRelay = servoRelay;
+	_instance = this;
+
+	if ( SRC_SRSR & SRC_SRSR_WDOG_RST_B )
+	{
+		Log.error( "The watchdog reset the board, the main loop stopped for more than %u milliseconds", WATCHDOG_TIMEOUT_MILLISECONDS );
+		SRC_SRSR = SRC_SRSR_WDOG_RST_B;
+	}
+
+	// Reset the whole chip on timeout, without the WDOG_B pin or a software reset. The enable bit is write once.
+	CCM_CCGR3 |= CCM_CCGR3_WDOG1( CCM_CCGR_ON );
+	WDOG1_WMCR = 0;
+	WDOG1_WCR = WDOG_WCR_WT( WATCHDOG_TIMEOUT_FIELD ) | WDOG_WCR_WDE | WDOG_WCR_WDA | WDOG_WCR_SRS;
+	feed();
+
+	_checkTimer.priority( DEADLINE_CHECK_PRIORITY );
+	_checkTimer.begin( &DeadlineMonitor::checkDeadlines, DEADLINE_CHECK_MICROSECONDS );
+
+	Log.trace( "Watchdog resets the board after %u milliseconds, deadlines checked every %u microseconds", WATCHDOG_TIMEOUT_MILLISECONDS, DEADLINE_CHECK_MICROSECONDS );
+}
+
+uint8_t DeadlineMonitor::addTask( const char* name, uint32_t deadlineMilliseconds )
+{
+	if ( _taskCount >= DEADLINE_MONITOR_CAPACITY )
+	{
+		Log.error( "Deadline monitor is full, %s has no deadline", name );
+		return DEADLINE_MONITOR_CAPACITY;
+	}
+
+	DeadlineTask* task = &_tasks[_taskCount];
+
+	task->name = name;
+	task->deadlineMicroseconds = deadlineMilliseconds * 1000;
+	task->lastRunMicroseconds = micros();
+	task->missed = false;
+	task->misses = 0;
+	task->worstCutMicroseconds = 0;
+
+	// The interrupt only looks at tasks below the count, so the task is complete before it is counted
+	return _taskCount++;
+}
+
+void DeadlineMonitor::onTaskRun( uint8_t task )
+{
+	if ( task < _taskCount )
+	{
+		_tasks[task].lastRunMicroseconds = micros();
+		_tasks[task].missed = false;
+	}
+}
+
+void DeadlineMonitor::feed()
+{
+	WDOG1_WSR = 0x5555;
+	WDOG1_WSR = 0xAAAA;
+}
+
+uint32_t DeadlineMonitor::takeMissedDeadlines()
+{
+	__disable_irq();
+	uint32_t missedDeadlines = _missedDeadlines;
+	_missedDeadlines = 0;
+	__enable_irq();
+
+	return missedDeadlines;
+}
+
+const char* DeadlineMonitor::getTaskName( uint8_t task )
+{
+	return task < _taskCount ? _tasks[task].name : "";
+}
+
+void DeadlineMonitor::checkDeadlines()
+{
+	DeadlineMonitor* monitor = _instance;
+	uint32_t now = micros();
+
+	for ( uint8_t i = 0; i < monitor->_taskCount; i++ )
+	{
+		DeadlineTask* task = &monitor->_tasks[i];
+		uint32_t late = now - task->lastRunMicroseconds;
+
+		if ( task->missed || late <= task->deadlineMicroseconds )
+		{
+			continue;
+		}
+
+		// The main loop may be the one that is stuck, so the power is cut here rather than in failMission()
+		if ( monitor->_servoRelay->isPowerOn() )
+		{
+			monitor->_servoRelay->cutPower();
+		}
+
+		late -= task->deadlineMicroseconds;
+
+		if ( late > task->worstCutMicroseconds )
+		{
+			task->worstCutMicroseconds = late;
+		}
+
+		task->missed = true;
+		task->misses++;
+		monitor->_missedDeadlines |= 1UL << i;
+	}
+}
+
+uint32_t DeadlineMonitor::getMisses()
+{
+	uint32_t misses = 0;
+
+	for ( uint8_t i = 0; i < _taskCount; i++ )
+	{
+		misses += _tasks[i].misses;
+	}
+
+	return misses;
+}
+
+void DeadlineMonitor::tick( uint32_t timeMilliseconds )
+{
+	if ( timeMilliseconds - _lastPublishMilliseconds < DEADLINE_MONITOR_PUBLISH_MILLISECONDS )
+	{
+		return;
+	}
+
+	_lastPublishMilliseconds = timeMilliseconds;
+
+	for ( uint8_t i = 0; i < _taskCount; i++ )
+	{
+		Log.trace( "Deadline %s: %u milliseconds, missed %u times, power cut %u microseconds after the deadline at most",
+			_tasks[i].name,
+			_tasks[i].deadlineMicroseconds / 1000,
+			_tasks[i].misses,
+			_tasks[i].worstCutMicroseconds );
+	}
+}
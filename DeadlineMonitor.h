@@ -0,0 +1,106 @@
+// DeadlineMonitor.h
+
+#ifndef _DEADLINEMONITOR_h
+#define _DEADLINEMONITOR_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "ServoRelay.h"
+
+constexpr uint8_t DEADLINE_MONITOR_CAPACITY = 4;                     ///< Tasks that can have a deadline
+constexpr uint32_t DEADLINE_CHECK_MICROSECONDS = 10000;               ///< How often the timer interrupt checks the deadlines
+constexpr uint8_t DEADLINE_CHECK_PRIORITY = 32;                       ///< Interrupt priority of the check, above the serial ports and the audio library
+constexpr uint32_t WATCHDOG_TIMEOUT_MILLISECONDS = 2000;              ///< Time without feed() before the watchdog resets the board
+constexpr uint32_t DEADLINE_MONITOR_PUBLISH_MILLISECONDS = 10000;     ///< How often deadline misses are written to the log
+
+/**
+ * @brief A task with a deadline.
+*/
+struct DeadlineTask
+{
+	const char* name;
+	uint32_t deadlineMicroseconds;
+	volatile uint32_t lastRunMicroseconds;
+	volatile bool missed;                       ///< Set by the interrupt, cleared when the task runs again
+	volatile uint32_t misses;
+	volatile uint32_t worstCutMicroseconds;     ///< Most time from the deadline passing to the power being cut
+};
+
+/**
+ * @brief DeadlineMonitor makes sure a hung main loop can't leave the rover powered.
+ * Each critical task declares a deadline and reports every run with onTaskRun(). A timer interrupt checks the deadlines
+ * every DEADLINE_CHECK_MICROSECONDS and cuts the power relay itself when one is missed, so the cut doesn't wait for the
+ * main loop that is stuck. The main loop then fails the mission for the tasks returned by takeMissedDeadlines().
+ * If the main loop stops feeding it, the WDOG1 hardware watchdog resets the board, which stops the PWM signal and the relay
+ * starts off after the reset.
+*/
+class DeadlineMonitor
+{
+public:
+	/**
+	 * @brief Start the watchdog and the deadline check. Once started the watchdog can't be stopped.
+	 * @param servoRelay The relay to cut when a deadline is missed.
+	*/
+	void begin( ServoRelay* servoRelay );
+
+	/**
+	 * @brief Give a task a deadline. The deadline counts from the moment the task is added.
+	 * @param name The name of the task.
+	 * @param deadlineMilliseconds Most time allowed between two runs of the task.
+	 * @return The index of the task for onTaskRun(), or DEADLINE_MONITOR_CAPACITY when the monitor is full.
+	*/
+	uint8_t addTask( const char* name, uint32_t deadlineMilliseconds );
+
+	/**
+	 * @brief Note that a task ran.
+	 * @param task The index returned by addTask().
+	*/
+	void onTaskRun( uint8_t task );
+
+	/**
+	 * @brief Restart the watchdog timeout. Call it from the main loop.
+	*/
+	void feed();
+
+	/**
+	 * @brief Get the tasks that missed their deadline since the last call.
+	 * @return One bit per task index.
+	*/
+	uint32_t takeMissedDeadlines();
+
+	/**
+	 * @brief Get the name of a task.
+	 * @param task The index of the task.
+	 * @return The name.
+	*/
+	const char* getTaskName( uint8_t task );
+
+	/**
+	 * @brief Get how many deadlines were missed since the start, by all tasks together.
+	*/
+	uint32_t getMisses();
+
+	/**
+	 * @brief Write the deadline misses and the worst time to cut the power to the log when the publish period is over.
+	 * @param timeMilliseconds The current time in milliseconds.
+	*/
+	void tick( uint32_t timeMilliseconds );
+
+private:
+	static void checkDeadlines();
+
+	static DeadlineMonitor* _instance;
+
+	IntervalTimer _checkTimer;
+	ServoRelay* _servoRelay = NULL;
+	DeadlineTask _tasks[DEADLINE_MONITOR_CAPACITY];
+	volatile uint8_t _taskCount = 0;
+	volatile uint32_t _missedDeadlines = 0;
+	uint32_t _lastPublishMilliseconds = 0;
+};
+
+#endif
@@ -0,0 +1,92 @@
+//
+//
+//
+
+#include "DivergenceDetector.h"
+
+
+DivergenceDetector::DivergenceDetector()
+{
+	reset();
+}
+
+void DivergenceDetector::reset()
+{
+	_bearing = Check();
+	_hasTime = false;
+	_isDiverging = false;
+}
+
+void DivergenceDetector::setLimits( float maxBearingErrorDegrees, uint32_t persistenceMilliseconds )
+{
+	_maxBearingErrorDegrees = maxBearingErrorDegrees;
+	_persistenceMilliseconds = persistenceMilliseconds;
+}
+
+void DivergenceDetector::update( uint32_t timeMilliseconds, float bearingErrorDegrees )
+{
+	// The weight of a new reading follows the time since the last one, so the filter behaves the same at any stream rate
+	float elapsed = _hasTime ? (float)(timeMilliseconds - _lastTimeMilliseconds) : DIVERGENCE_FILTER_MILLISECONDS;
+	float weight = elapsed / (DIVERGENCE_FILTER_MILLISECONDS + elapsed);
+
+	_lastTimeMilliseconds = timeMilliseconds;
+	_hasTime = true;
+
+	if ( !isnan( bearingErrorDegrees ) )
+	{
+		_isDiverging = updateCheck( &_bearing, fabsf( wrapDegrees( bearingErrorDegrees ) ), _maxBearingErrorDegrees, timeMilliseconds, weight );
+	}
+}
+
+bool DivergenceDetector::updateCheck( Check* check, float error, float limit, uint32_t timeMilliseconds, float weight )
+{
+	check->filtered = check->hasValue ? check->filtered + weight * (error - check->filtered) : error;
+	check->hasValue = true;
+
+	if ( limit <= 0 )
+	{
+		return false;
+	}
+
+	if ( check->filtered <= limit )
+	{
+		check->armed = true;
+		check->exceeded = false;
+		return false;
+	}
+
+	if ( !check->armed )
+	{
+		return false;
+	}
+
+	if ( !check->exceeded )
+	{
+		check->exceeded = true;
+		check->exceededSinceMilliseconds = timeMilliseconds;
+	}
+
+	return timeMilliseconds - check->exceededSinceMilliseconds >= _persistenceMilliseconds;
+}
+
+bool DivergenceDetector::isDiverging()
+{
+	return _isDiverging;
+}
+
+float DivergenceDetector::getBearingError()
+{
+	return _bearing.filtered;
+}
+
+float DivergenceDetector::wrapDegrees( float degrees )
+{
+	degrees = fmodf( degrees + 180.0f, 360.0f );
+
+	if ( degrees < 0 )
+	{
+		degrees += 360.0f;
+	}
+
+	return degrees - 180.0f;
+}
@@ -0,0 +1,84 @@
+// DivergenceDetector.h
+
+#ifndef _DIVERGENCEDETECTOR_h
+#define _DIVERGENCEDETECTOR_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+constexpr float DIVERGENCE_FILTER_MILLISECONDS = 500.0f;   ///< Time constant of the filter, long enough to ride out a single bad reading
+
+/**
+ * @brief DivergenceDetector compares the heading of the rover with the heading the flight controller is steering to, nav_bearing of
+ * each NAV_CONTROLLER_OUTPUT, and tells when the difference has been beyond its limit for longer than the persistence window.
+ * Unlike the bearing to the waypoint, nav_bearing doesn't swing as the rover passes a waypoint or steers around an obstacle.
+ * The error is smoothed by an exponential filter that only keeps the last filtered value, so an update costs a few
+ * multiplications. The check is only armed once the error has been inside the limit on the current leg, so the turn
+ * toward a new waypoint or the way back to the line after a mode change isn't mistaken for a runaway. Leaving the course
+ * sideways is the corridor check's job.
+*/
+class DivergenceDetector
+{
+public:
+	DivergenceDetector();
+
+	/**
+	 * @brief Forget the filtered error and disarm the check, used when the rover starts a new leg.
+	*/
+	void reset();
+
+	/**
+	 * @brief Set the limit of the check.
+	 * @param maxBearingErrorDegrees Largest bearing error allowed, 0 turns the check off.
+	 * @param persistenceMilliseconds How long the error must stay beyond its limit before the rover is diverging.
+	*/
+	void setLimits( float maxBearingErrorDegrees, uint32_t persistenceMilliseconds );
+
+	/**
+	 * @brief Add the error of a NAV_CONTROLLER_OUTPUT.
+	 * @param timeMilliseconds Mission time of the reading.
+	 * @param bearingErrorDegrees Heading of the rover minus nav_bearing, NAN if the heading isn't known.
+	*/
+	void update( uint32_t timeMilliseconds, float bearingErrorDegrees );
+
+	/**
+	 * @brief Check if the rover has been heading away from where it is steered to for the persistence window.
+	 * @return True if the armed check has been beyond its limit long enough.
+	*/
+	bool isDiverging();
+
+	float getBearingError();
+
+	/**
+	 * @brief Wrap an angle to the range -180 to 180 degrees.
+	*/
+	static float wrapDegrees( float degrees );
+
+private:
+	struct Check
+	{
+		float filtered = 0;
+		bool hasValue = false;
+		bool armed = false;
+		bool exceeded = false;
+		uint32_t exceededSinceMilliseconds = 0;
+	};
+
+	/**
+	 * @brief Filter one error and follow how long it has been beyond its limit.
+	 * @return True if the check is armed and the error has been beyond the limit for the persistence window.
+	*/
+	bool updateCheck( Check* check, float error, float limit, uint32_t timeMilliseconds, float weight );
+
+	float _maxBearingErrorDegrees = 0;
+	uint32_t _persistenceMilliseconds = 0;
+	uint32_t _lastTimeMilliseconds = 0;
+	bool _hasTime = false;
+	bool _isDiverging = false;
+	Check _bearing;
+};
+
+#endif
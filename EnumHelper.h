@@ -9,7 +9,7 @@
 #include "WProgram.h"
 #endif
 
-#include <mavlink_2_ardupilot.h>
+#include "MAVLinkDialect.h"
 
 class EnumHelper
 {
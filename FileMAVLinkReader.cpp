@@ -12,7 +12,7 @@
  *
 */
 FileMAVLinkReader::FileMAVLinkReader( const char* mavlinkLogFilePath, MAVLinkEventReceiver* mavlinkEvebtReceiver, uint8_t fileSpeedMilliseconds )
-	: MAVLinkReader( mavlinkEvebtReceiver )
+	: MAVLinkReader( mavlinkEvebtReceiver, mavlinkLogFilePath )
 {
 	_nextIntervalMAVLinkMilliseconds = fileSpeedMilliseconds;
 	_mavlinkLogFilePath = mavlinkLogFilePath;
@@ -29,30 +29,442 @@ FileMAVLinkReader::FileMAVLinkReader( const char* mavlinkLogFilePath, MAVLinkEve
 }
 
 
-bool FileMAVLinkReader::readByte( uint8_t* buffer )
+bool FileMAVLinkReader::readBlock()
 {
-	return _mavlinkFile.readBytes( buffer, 1 ) == 1;
+	uint16_t remaining = _blockLength - _blockPosition;
+
+	memmove( _block, _block + _blockPosition, remaining );
+	_blockOffset += _blockPosition;
+	_blockPosition = 0;
+
+	int bytesRead = _mavlinkFile ? _mavlinkFile.read( _block + remaining, FILE_READ_BLOCK_SIZE - remaining ) : 0;
+	_blockLength = remaining + (bytesRead > 0 ? bytesRead : 0);
+
+	return _blockLength > 0;
+}
+
+void FileMAVLinkReader::seekFile( uint32_t fileOffset )
+{
+	_mavlinkFile.seek( fileOffset );
+	_blockOffset = fileOffset;
+	_blockLength = 0;
+	_blockPosition = 0;
+	_frameBytesRemaining = 0;
+	_timestampRead = false;
+}
+
+uint32_t FileMAVLinkReader::getFilePosition()
+{
+	return _blockOffset + _blockPosition;
+}
+
+bool FileMAVLinkReader::hasFileBytes()
+{
+	return _blockPosition < _blockLength || _mavlinkFile.available() > 0;
+}
+
+void FileMAVLinkReader::readTimestamp()
+{
+	if ( _blockLength - _blockPosition < TLOG_TIMESTAMP_SIZE )
+	{
+		readBlock();
+	}
+
+	if ( _blockLength - _blockPosition < TLOG_TIMESTAMP_SIZE )
+	{
+		return;
+	}
+
+	uint64_t timestamp = 0;
+
+	for ( uint8_t i = 0; i < TLOG_TIMESTAMP_SIZE; i++ )
+	{
+		timestamp = (timestamp << 8) | _block[_blockPosition + i];
+	}
+
+	// Logs other than tlogs have the next frame here, its first bytes don't make a timestamp in this century
+	if ( timestamp < TLOG_EARLIEST_TIMESTAMP || timestamp > TLOG_LATEST_TIMESTAMP )
+	{
+		return;
+	}
+
+	_blockPosition += TLOG_TIMESTAMP_SIZE;
+	_nextFrameMicroseconds = timestamp;
+	_timestampRead = true;
+	_timestampsRead++;
+}
+
+void FileMAVLinkReader::startFrame()
+{
+	uint8_t startByte = _block[_blockPosition];
+
+	if ( startByte != MAVLINK_STX && startByte != MAVLINK_STX_MAVLINK1 )
+	{
+		return;
+	}
+
+	// The length and the incompatibility flags follow the start byte
+	if ( _blockLength - _blockPosition < 3 )
+	{
+		readBlock();
+	}
+
+	if ( _blockLength - _blockPosition < 3 )
+	{
+		return;
+	}
+
+	uint8_t payloadLength = _block[_blockPosition + 1];
+
+	if ( startByte == MAVLINK_STX_MAVLINK1 )
+	{
+		_frameBytesRemaining = MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1 + payloadLength + MAVLINK_NUM_CHECKSUM_BYTES;
+	}
+	else
+	{
+		bool isSigned = (_block[_blockPosition + 2] & MAVLINK_IFLAG_SIGNED) != 0;
+		_frameBytesRemaining = MAVLINK_NUM_HEADER_BYTES + payloadLength + MAVLINK_NUM_CHECKSUM_BYTES + (isSigned ? MAVLINK_SIGNATURE_BLOCK_LEN : 0);
+	}
+
+	// The timestamp read after the last frame belongs to this one
+	_frameMicroseconds = _nextFrameMicroseconds;
+	_nextFrameMicroseconds = 0;
+	_timestampRead = false;
+
+	// A tlog frame was recorded at its timestamp, the mission clock gets there before the frame is handed on
+	if ( _clockAnchored && _frameMicroseconds != 0 )
+	{
+		advanceMissionClock( getRecordedTime( _frameMicroseconds ) );
+	}
+}
+
+void FileMAVLinkReader::checkReplay()
+{
+	// No start byte follows the last frame of the log
+	flushFrameFilter();
+
+	if ( _replayChecked || _timestampsRead == 0 )
+	{
+		return;
+	}
+
+	_replayChecked = true;
+
+	uint32_t bytesDiscarded = _linkStatistics.getBytesDiscarded();
+
+	if ( bytesDiscarded > 0 )
+	{
+		Log.error( "Replay check: %u bytes outside frames after %u tlog timestamps, %u frames filtered",
+			bytesDiscarded,
+			_timestampsRead,
+			_linkStatistics.getFramesFiltered() );
+	}
+	else
+	{
+		Log.trace( "Replay check: %u tlog timestamps taken out, %u frames filtered, no bytes outside frames",
+			_timestampsRead,
+			_linkStatistics.getFramesFiltered() );
+	}
+}
+
+bool FileMAVLinkReader::isNextFrameDue()
+{
+	if ( _nextFrameMicroseconds == 0 )
+	{
+		return true;
+	}
+
+	if ( _logClockOriginMicroseconds == 0 || _nextFrameMicroseconds < _logClockOriginMicroseconds )
+	{
+		// The log clock starts at the first frame, and again when the log jumps back in time
+		_logClockOriginMicroseconds = _nextFrameMicroseconds;
+		_localClockOriginMilliseconds = millis();
+	}
+
+	return (_nextFrameMicroseconds - _logClockOriginMicroseconds) / 1000 <= millis() - _localClockOriginMilliseconds;
+}
+
+bool FileMAVLinkReader::readMessage()
+{
+	bool messageReceived = receiveMAVLinkMessages();
+
+	if ( messageReceived )
+	{
+		if ( _frameMicroseconds == 0 )
+		{
+			// Without timestamps the mission clock follows the boot time in the messages
+			advanceMissionClock( _systemBootTimeMilliseconds );
+		}
+		else if ( !_clockAnchored && _systemBootTimeMilliseconds != 0 )
+		{
+			// The first boot time ties the tlog timestamps to mission time
+			_clockAnchored = true;
+			_clockAnchorMilliseconds = _systemBootTimeMilliseconds;
+			_clockAnchorMicroseconds = _frameMicroseconds;
+			advanceMissionClock( _systemBootTimeMilliseconds );
+		}
+	}
+	else if ( !hasFileBytes() )
+	{
+		checkReplay();
+	}
+
+	updateIndex( messageReceived );
+
+	return messageReceived;
 }
 
 void FileMAVLinkReader::tick()
 {
 	unsigned long currentMillisMAVLink = millis();
 
+	if ( !_replayStarted )
+	{
+		startReplay();
+	}
+
+	if ( _fastForward )
+	{
+		// Skip ahead to the replay start, a bounded number of messages at a time so the other tasks keep running
+		for ( uint16_t i = 0; i < FAST_FORWARD_MESSAGES && _fastForward; i++ )
+		{
+			readMessage();
+
+			if ( getMissionTime() >= _replayStartMilliseconds || !hasFileBytes() )
+			{
+				uint32_t elapsedMilliseconds = millis() - _fastForwardStartMilliseconds;
+				uint32_t bytesRead = getFilePosition() - _fastForwardStartOffset;
+
+				_fastForward = false;
+				_logClockOriginMicroseconds = 0;
+				Log.trace( "Replaying from mission time %u milliseconds, skipped %u bytes in %u milliseconds, %u bytes per second",
+					getMissionTime(),
+					bytesRead,
+					elapsedMilliseconds,
+					elapsedMilliseconds == 0 ? bytesRead : (uint32_t)((uint64_t)bytesRead * 1000 / elapsedMilliseconds) );
+			}
+		}
+	}
+	else if ( _missionClock != NULL )
+	{
+		// Time comes from the log, so the log is read as fast as the card allows, a bounded number of messages at a time
+		for ( uint16_t i = 0; i < FAST_FORWARD_MESSAGES; i++ )
+		{
+			if ( !readMessage() )
+			{
+				logReplayEnd();
+				break;
+			}
+		}
+	}
+	else if ( _nextIntervalMAVLinkMilliseconds == 0 )
+	{
+		// Follow the tlog timestamps, catching up a bounded number of messages at a time
+		for ( uint16_t i = 0; i < FAST_FORWARD_MESSAGES && isNextFrameDue(); i++ )
+		{
+			if ( !readMessage() )
+			{
+				break;
+			}
+		}
+	}
 	// If ready to read next message
-	if ( currentMillisMAVLink - _previousMAVLinkMilliseconds >= _nextIntervalMAVLinkMilliseconds )
+	else if ( currentMillisMAVLink - _previousMAVLinkMilliseconds >= _nextIntervalMAVLinkMilliseconds )
 	{
-		receiveMAVLinkMessages();
+		readMessage();
 		_previousMAVLinkMilliseconds = currentMillisMAVLink;
 
 
 	}
 
+	MAVLinkReader::tick();
+
+}
+
+void FileMAVLinkReader::setSnapshotCallbacks( SaveSnapshotCallback saveSnapshot, RestoreSnapshotCallback restoreSnapshot, uint16_t snapshotSize, uint32_t snapshotKey )
+{
+	_saveSnapshot = saveSnapshot;
+	_restoreSnapshot = restoreSnapshot;
+	_snapshotSize = snapshotSize;
+	_snapshotKey = snapshotKey;
+}
+
+void FileMAVLinkReader::setMissionCallbacks( MissionGenerationCallback missionGeneration, SaveMissionCallback saveMission, RestoreMissionCallback restoreMission )
+{
+	_missionGeneration = missionGeneration;
+	_saveMission = saveMission;
+	_restoreMission = restoreMission;
+}
+
+void FileMAVLinkReader::setMissionClock( MissionClock* missionClock )
+{
+	_missionClock = missionClock;
+}
+
+bool FileMAVLinkReader::hasBytes()
+{
+	// On the mission clock the reader runs again right away until the log is read
+	return _missionClock != NULL && !_replayEnded && hasFileBytes();
+}
+
+void FileMAVLinkReader::setReplayStart( uint32_t missionTimeMilliseconds )
+{
+	_replayStartMilliseconds = missionTimeMilliseconds;
+}
+
+void FileMAVLinkReader::startReplay()
+{
+	_replayStarted = true;
+	_fastForward = _replayStartMilliseconds > 0;
+	_fastForwardStartMilliseconds = millis();
+
+	// A tlog starts with the timestamp of the first frame
+	readTimestamp();
+
+	if ( !_mavlinkFile || _saveSnapshot == NULL || _snapshotSize > TLOG_SNAPSHOT_CAPACITY )
+	{
+		return;
+	}
+
+	uint32_t startMilliseconds = millis();
+
+	if ( !_tlogIndex.open( _mavlinkLogFilePath, _mavlinkFile.size(), _snapshotSize, _snapshotKey ) )
+	{
+		// Replaying from the start builds the index for next time
+		_tlogIndex.beginBuild();
+		return;
+	}
+
+	if ( _replayStartMilliseconds == 0 )
+	{
+		return;
+	}
+
+	TlogIndexEntry entry;
+
+	if ( !_tlogIndex.find( _replayStartMilliseconds, &entry, _snapshot ) )
+	{
+		Log.trace( "No tlog index entry before mission time %u milliseconds, replaying from the start", _replayStartMilliseconds );
+		return;
+	}
+
+	// The mission first, the monitor builds its corridor from it when its state is restored
+	if ( _restoreMission != NULL && entry.missionOffset != TLOG_INDEX_NO_MISSION && !_tlogIndex.restoreMission( entry.missionOffset, _restoreMission ) )
+	{
+		Log.trace( "The mission at mission time %u milliseconds can't be restored, replaying from the start", entry.missionTimeMilliseconds );
+		return;
+	}
+
+	// The entry is on a message boundary, the parser is between frames there
+	_restoreSnapshot( _snapshot );
+	seekFile( entry.fileOffset );
+	_fastForwardStartOffset = entry.fileOffset;
+	_systemBootTimeMilliseconds = entry.missionTimeMilliseconds;
+	_clockAnchored = entry.clockAnchorMicroseconds != 0;
+	_clockAnchorMilliseconds = entry.clockAnchorMilliseconds;
+	_clockAnchorMicroseconds = entry.clockAnchorMicroseconds;
+
+	// Frames of the flight controller are let through from the first one, as they were when the entry was written
+	if ( entry.flightControllerSystemId != 0 )
+	{
+		_flightControllerSystemId = entry.flightControllerSystemId;
+		_flightControllerComponentId = entry.flightControllerComponentId;
+		_flightControllerFound = true;
+	}
+
+	if ( _missionClock != NULL )
+	{
+		_missionClock->reset( entry.missionTimeMilliseconds );
+	}
+
+	// The entry is in front of the tlog timestamp of the next message
+	readTimestamp();
+
+	Log.trace( "Restored the snapshot at mission time %u milliseconds, offset %u, in %u milliseconds",
+		entry.missionTimeMilliseconds,
+		entry.fileOffset,
+		millis() - startMilliseconds );
+}
+
+void FileMAVLinkReader::updateIndex( bool messageReceived )
+{
+	if ( !_tlogIndex.isBuilding() )
+	{
+		return;
+	}
+
+	if ( messageReceived && getMissionTime() >= _nextIndexMilliseconds )
+	{
+		TlogIndexEntry entry;
+
+		entry.missionTimeMilliseconds = getMissionTime();
+		entry.fileOffset = getFilePosition() - (_timestampRead ? TLOG_TIMESTAMP_SIZE : 0);   // In front of the timestamp of the next message
+		entry.clockAnchorMilliseconds = _clockAnchored ? _clockAnchorMilliseconds : 0;
+		entry.clockAnchorMicroseconds = _clockAnchored ? _clockAnchorMicroseconds : 0;
+		entry.flightControllerSystemId = _flightControllerFound ? _flightControllerSystemId : 0;
+		entry.flightControllerComponentId = _flightControllerFound ? _flightControllerComponentId : 0;
+
+		// The mission is only written again when it changed, most entries point at the same record
+		if ( _missionGeneration != NULL && (!_missionSaved || _missionGeneration() != _savedMissionGeneration) )
+		{
+			_savedMissionGeneration = _missionGeneration();
+			_missionOffset = _tlogIndex.addMission( _saveMission );
+			_missionSaved = true;
+		}
+
+		entry.missionOffset = _missionOffset;
+
+		_saveSnapshot( _snapshot );
+		_tlogIndex.add( entry, _snapshot );
+
+		_nextIndexMilliseconds = entry.missionTimeMilliseconds + TLOG_INDEX_INTERVAL_MILLISECONDS;
+	}
+	else if ( !messageReceived && !hasFileBytes() )
+	{
+		_tlogIndex.finishBuild();
+	}
 }
 
 
 uint32_t FileMAVLinkReader::getMissionTime()
 {
+	if ( _missionClock != NULL )
+	{
+		return _missionClock->now();
+	}
 
 	 return _systemBootTimeMilliseconds;
 
 }
+
+void FileMAVLinkReader::advanceMissionClock( uint32_t missionTimeMilliseconds )
+{
+	if ( _missionClock != NULL )
+	{
+		_missionClock->advanceTo( missionTimeMilliseconds );
+	}
+}
+
+uint32_t FileMAVLinkReader::getRecordedTime( uint64_t frameMicroseconds )
+{
+	if ( frameMicroseconds < _clockAnchorMicroseconds )
+	{
+		return _clockAnchorMilliseconds;
+	}
+
+	return _clockAnchorMilliseconds + (uint32_t)((frameMicroseconds - _clockAnchorMicroseconds) / 1000);
+}
+
+void FileMAVLinkReader::logReplayEnd()
+{
+	if ( _replayEnded )
+	{
+		return;
+	}
+
+	_replayEnded = true;
+	Log.trace( "Replay ended at mission time %u milliseconds after %u milliseconds, the mission clock timer ran %u times",
+		getMissionTime(),
+		millis() - _fastForwardStartMilliseconds,
+		_missionClock->getTimerRuns() );
+}
@@ -12,8 +12,20 @@
 #endif
 
 #include "MAVLinkReader.h"
+#include "TlogIndex.h"
+#include "MissionClock.h"
 #include <SD.h>
 
+constexpr uint16_t FAST_FORWARD_MESSAGES = 100;     ///< Messages read per tick at most while skipping ahead or catching up with the log clock
+constexpr uint16_t FILE_READ_BLOCK_SIZE = 4096;     ///< Bytes read from the SD card at once, the parser reads them straight from the block
+constexpr uint8_t TLOG_TIMESTAMP_SIZE = 8;          ///< Big endian microseconds since 1970 in front of every frame of a Mission Planner tlog
+constexpr uint64_t TLOG_EARLIEST_TIMESTAMP = 946684800000000ULL;   ///< 2000-01-01, earlier values aren't taken for a timestamp
+constexpr uint64_t TLOG_LATEST_TIMESTAMP = 4102444800000000ULL;    ///< 2100-01-01
+
+typedef void (*SaveSnapshotCallback)( uint8_t* snapshot );
+typedef void (*RestoreSnapshotCallback)( const uint8_t* snapshot );
+typedef uint32_t (*MissionGenerationCallback)();     ///< Changes whenever the mission held by the receivers changes
+
 /**
  * @brief This class reads a telemetry file from SD card for testing. Mission Planner .tlog has been tested.
 */
@@ -25,17 +37,39 @@ public:
 	 * @brief Constructor.
 	 * @param mavlinkLogFilePath The file to MAVLink file. Use 8.3 file naming convention to support SD API.
 	 * @param mavlinkEvebtReceiver The event receiver that will capture MAVLink messages read from the file.
-	 * @param fileSpeedMilliseconds The speed at which to read the MAVLink file during testing.
+	 * @param fileSpeedMilliseconds The speed at which to read the MAVLink file during testing, 0 to follow the tlog timestamps.
 	 * 
 	*/
 	FileMAVLinkReader( const char* mavlinkLogFilePath, MAVLinkEventReceiver* mavlinkEvebtReceiver, uint8_t fileSpeedMilliseconds );
 
 	/**
-	 * @brief Read a single byte from the MAVLink source.
+	 * @brief Read a single byte from the MAVLink source. The tlog timestamp in front of every frame is taken out here, when the
+	 * last byte of a frame is read, whether the frame is then delivered, skipped by the header filter or fails its CRC check.
 	 * @param buffer A buffer to read the byte into.
 	 * @return True if a byte was read.
 	*/
-	virtual bool readByte( uint8_t* buffer );
+	virtual bool readByte( uint8_t* buffer )
+	{
+		if ( _blockPosition >= _blockLength && !readBlock() )
+		{
+			return false;
+		}
+
+		if ( _frameBytesRemaining == 0 )
+		{
+			startFrame();
+		}
+
+		*buffer = _block[_blockPosition++];
+
+		if ( _frameBytesRemaining > 0 && --_frameBytesRemaining == 0 )
+		{
+			// A frame just ended, a tlog has the timestamp of the next one here
+			readTimestamp();
+		}
+
+		return true;
+	}
 
 	/**
 	 * @brief Used by the scheduling system to give FileMAVLinkReader execution time.
@@ -49,12 +83,175 @@ public:
 	*/
 	virtual uint32_t getMissionTime();
 
+	/**
+	 * @brief Run the replay on a mission clock. The clock is moved to the recorded time of every message before the message is
+	 * handed on, the tlog timestamp or else the boot time in the messages, and the log is read as fast as the card allows.
+	 * The file speed doesn't apply.
+	 * @param missionClock The clock, also the mission time of the reader.
+	*/
+	void setMissionClock( MissionClock* missionClock );
+
+	/**
+	 * @brief Tell whether the reader has more to do right away.
+	 * @return True on the mission clock until the log is read.
+	*/
+	virtual bool hasBytes();
+
+	/**
+	 * @brief Keep an index of the log with snapshots of the receiver state, so a replay can start part way through the log.
+	 * The index is built while the log is replayed from the start and used by the replays after that.
+	 * @param saveSnapshot Saves the receiver state.
+	 * @param restoreSnapshot Restores the receiver state.
+	 * @param snapshotSize The size of the state, up to TLOG_SNAPSHOT_CAPACITY.
+	 * @param snapshotKey Checksum of the settings the state depends on, the index is rebuilt when it changes.
+	*/
+	void setSnapshotCallbacks( SaveSnapshotCallback saveSnapshot, RestoreSnapshotCallback restoreSnapshot, uint16_t snapshotSize, uint32_t snapshotKey );
+
+	/**
+	 * @brief Keep the mission the receivers downloaded in the index too. It is saved once each time its generation changes, and
+	 * restored before the snapshot, so a replay started part way through has the mission a replay from the start would have.
+	 * @param missionGeneration Tells when the mission changed.
+	 * @param saveMission Writes the mission to the mission file of the index.
+	 * @param restoreMission Reads it back.
+	*/
+	void setMissionCallbacks( MissionGenerationCallback missionGeneration, SaveMissionCallback saveMission, RestoreMissionCallback restoreMission );
+
+	/**
+	 * @brief Start the replay at a mission time. The state at that time is restored from the index entry before it and the
+	 * messages in between are read without delay. Without an index the whole log before it is read without delay.
+	 * @param missionTimeMilliseconds The mission time, 0 to replay from the start.
+	*/
+	void setReplayStart( uint32_t missionTimeMilliseconds );
+
 protected:
+	/**
+	 * @brief Restore the state from the index or start building the index, before the first message is read.
+	*/
+	void startReplay();
+
+	/**
+	 * @brief Add an index entry when the interval is over, and finish the index at the end of the log.
+	 * @param messageReceived True if a message was just read.
+	*/
+	void updateIndex( bool messageReceived );
+
+	/**
+	 * @brief Read a message and add an index entry if one is due.
+	 * @return True if a message was read.
+	*/
+	bool readMessage();
+
+	/**
+	 * @brief Read a single byte from the block, for logs that have no tlog timestamps.
+	*/
+	bool readFileByte( uint8_t* buffer )
+	{
+		if ( _blockPosition >= _blockLength && !readBlock() )
+		{
+			return false;
+		}
+
+		*buffer = _block[_blockPosition++];
+		return true;
+	}
+
+	/**
+	 * @brief Take the length of the frame that starts at the next byte from its header, so its end is known without the parser.
+	 * The timestamp read in front of it becomes the time of the frame, and the mission clock is moved there before the frame
+	 * is handed on. A byte that doesn't start a frame is passed on as it is.
+	*/
+	void startFrame();
+
+	/**
+	 * @brief Check at the end of the log that no tlog timestamp reached the parser, which would show as bytes outside frames.
+	*/
+	void checkReplay();
+
+	/**
+	 * @brief Refill the block from the file, keeping the bytes not read yet.
+	 * @return False if there were no bytes left to read.
+	*/
+	bool readBlock();
+
+	/**
+	 * @brief Read the tlog timestamp in front of the next frame, if there is one. The bytes would otherwise go through the header
+	 * filter and the parser as noise, and a timestamp byte that looks like the start of a frame swallows the frames after it.
+	*/
+	void readTimestamp();
+
+	/**
+	 * @brief Tell whether the log clock has reached the timestamp of the next frame, when the replay follows the tlog timestamps.
+	*/
+	bool isNextFrameDue();
+
+	/**
+	 * @brief Move the mission clock, if there is one, to the recorded time of a message.
+	*/
+	void advanceMissionClock( uint32_t missionTimeMilliseconds );
+
+	/**
+	 * @brief Get the mission time a tlog timestamp stands for.
+	*/
+	uint32_t getRecordedTime( uint64_t frameMicroseconds );
+
+	void logReplayEnd();
+
+	/**
+	 * @brief Move to an offset in the file.
+	*/
+	void seekFile( uint32_t fileOffset );
+
+	uint32_t getFilePosition();
+	bool hasFileBytes();
+
 	const char* _mavlinkLogFilePath;
 	File _mavlinkFile;
 	unsigned long _previousMAVLinkMilliseconds = 0;
 	unsigned long _nextIntervalMAVLinkMilliseconds = 1;
 
+	// Block the parser reads from
+	uint8_t _block[FILE_READ_BLOCK_SIZE];
+	uint16_t _blockLength = 0;
+	uint16_t _blockPosition = 0;
+	uint32_t _blockOffset = 0;           ///< File offset of the first byte in the block
+
+	// Log clock from the tlog timestamps
+	uint16_t _frameBytesRemaining = 0;   ///< Bytes of the current frame not read yet, 0 between frames
+	bool _timestampRead = false;         ///< The timestamp of the next frame was read, the next record starts in front of it
+	uint32_t _timestampsRead = 0;
+	bool _replayChecked = false;
+	uint64_t _nextFrameMicroseconds = 0; ///< Timestamp of the next frame, 0 if the log has none
+	uint64_t _frameMicroseconds = 0;     ///< Timestamp of the frame being read
+	uint64_t _logClockOriginMicroseconds = 0;
+	uint32_t _localClockOriginMilliseconds = 0;
+
+	// Mission clock, tied to the tlog timestamps by the first boot time in the log
+	MissionClock* _missionClock = NULL;
+	bool _clockAnchored = false;
+	uint32_t _clockAnchorMilliseconds = 0;
+	uint64_t _clockAnchorMicroseconds = 0;
+	bool _replayEnded = false;
+
+	// Index and replay start
+	TlogIndex _tlogIndex;
+	SaveSnapshotCallback _saveSnapshot = NULL;
+	RestoreSnapshotCallback _restoreSnapshot = NULL;
+	uint16_t _snapshotSize = 0;
+	uint32_t _snapshotKey = 0;
+	MissionGenerationCallback _missionGeneration = NULL;
+	SaveMissionCallback _saveMission = NULL;
+	RestoreMissionCallback _restoreMission = NULL;
+	bool _missionSaved = false;            ///< A mission record was written since the index build started
+	uint32_t _savedMissionGeneration = 0;
+	uint32_t _missionOffset = TLOG_INDEX_NO_MISSION;
+	uint32_t _replayStartMilliseconds = 0;
+	bool _replayStarted = false;
+	bool _fastForward = false;
+	uint32_t _nextIndexMilliseconds = 0;
+	uint32_t _fastForwardStartMilliseconds = 0;
+	uint32_t _fastForwardStartOffset = 0;
+	alignas(max_align_t) uint8_t _snapshot[TLOG_SNAPSHOT_CAPACITY];
+
 
 };
 
@@ -0,0 +1,531 @@
+//
+//
+//
+
+#include "FlightControllerSimulator.h"
+#include <ArduinoLog.h>
+#include "EnumHelper.h"
+#include "CrossTrackMonitor.h"
+
+constexpr uint8_t SIMULATOR_SYSTEM_ID = 1;
+constexpr uint8_t SIMULATOR_COMPONENT_ID = MAV_COMP_ID_AUTOPILOT1;
+
+constexpr const char* FAULT_NAMES[SIMULATOR_FAULT_COUNT] = { "none", "heartbeatLoss", "gpsLoss", "wrongDirection", "stall", "drift" };
+
+/**
+ * @brief Corners of the square the mission drives around, in meters north and east of home.
+*/
+constexpr float SQUARE_NORTH[] = { SIMULATOR_LEG_METERS, SIMULATOR_LEG_METERS, 0, 0 };
+constexpr float SQUARE_EAST[] = { 0, SIMULATOR_LEG_METERS, SIMULATOR_LEG_METERS, 0 };
+
+/**
+ * @brief Get a mission item, item 0 is home and the others go around the square.
+*/
+static void getWaypoint( uint16_t seq, float* north, float* east )
+{
+	*north = seq == 0 ? 0 : SQUARE_NORTH[(seq - 1) % 4];
+	*east = seq == 0 ? 0 : SQUARE_EAST[(seq - 1) % 4];
+}
+
+/**
+ * @brief Get the latitude and longitude, in degrees * 1e7, of a point north and east of home. Flat is close enough for a few hundred meters.
+*/
+static int32_t toLatitude( float north )
+{
+	return SIMULATOR_HOME_LATITUDE + (int32_t)(north / METERS_PER_DEGREE_E7);
+}
+
+static int32_t toLongitude( float east )
+{
+	return SIMULATOR_HOME_LONGITUDE + (int32_t)(east / (METERS_PER_DEGREE_E7 * cosf( SIMULATOR_HOME_LATITUDE * 1.0e-7f * (float)DEG_TO_RAD )));
+}
+
+static float wrapDegrees( float degrees )
+{
+	while ( degrees < 0 )
+	{
+		degrees += 360.0f;
+	}
+
+	while ( degrees >= 360.0f )
+	{
+		degrees -= 360.0f;
+	}
+
+	return degrees;
+}
+
+void FlightControllerSimulator::begin( HardwareSerial* serial, ServoRelay* servoRelay, SIMULATOR_FAULT fault, uint32_t faultMilliseconds, uint32_t baudRate )
+{
+	_serial = serial;
+	_servoRelay = servoRelay;
+	_fault = fault;
+	_faultMilliseconds = faultMilliseconds;
+	_serial->begin( baudRate, SERIAL_8N1 );
+	_serial->addMemoryForRead( _readBuffer, SIMULATOR_READ_BUFFER_SIZE );
+
+	// The streams ArduPilot puts these messages in, all of them off until the bolt asks for them
+	_streams[0] = { MAVLINK_MSG_ID_GLOBAL_POSITION_INT, MAV_DATA_STREAM_POSITION, 0, 0 };
+	_streams[1] = { MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT, MAV_DATA_STREAM_EXTENDED_STATUS, 0, 0 };
+	_streams[2] = { MAVLINK_MSG_ID_GPS_RAW_INT, MAV_DATA_STREAM_EXTENDED_STATUS, 0, 0 };
+	_streams[3] = { MAVLINK_MSG_ID_GPS2_RAW, MAV_DATA_STREAM_EXTENDED_STATUS, 0, 0 };
+	_streams[4] = { MAVLINK_MSG_ID_MISSION_CURRENT, MAV_DATA_STREAM_EXTENDED_STATUS, 0, 0 };
+
+	_beginMilliseconds = millis();
+	_lastMoveMicroseconds = micros();
+
+	Log.trace( "Simulated flight controller started, fault %s at %u milliseconds into the mission", getFaultName( _fault ), _faultMilliseconds );
+}
+
+void FlightControllerSimulator::tick()
+{
+	if ( _serial == NULL )
+	{
+		return;
+	}
+
+	uint32_t timeMilliseconds = millis();
+	uint32_t timeMicroseconds = micros();
+
+	receiveMessages();
+
+	if ( !_missionStarted && timeMilliseconds - _beginMilliseconds >= SIMULATOR_START_MILLISECONDS )
+	{
+		// The operator starts the mission
+		Log.trace( "Simulated mission of %d items started", SIMULATOR_WAYPOINT_COUNT );
+		_missionStarted = true;
+		_missionStartMilliseconds = timeMilliseconds;
+		_roverMode = ROVER_MODE_AUTO;
+	}
+
+	if ( _missionStarted && !_faultInjected && _fault != SIMULATOR_FAULT_NONE && timeMilliseconds - _missionStartMilliseconds >= _faultMilliseconds )
+	{
+		injectFault();
+	}
+
+	if ( _faultActive && _fault == SIMULATOR_FAULT_GPS_LOSS && timeMicroseconds - _faultChangeMicroseconds >= SIMULATOR_GPS_LOSS_MILLISECONDS * 1000 )
+	{
+		// The bolt should resume the mission
+		Log.trace( "Simulator: GPS fix is back" );
+		_faultActive = false;
+		_lastFaultChange = "the GPS fix came back";
+		_faultChangeMicroseconds = timeMicroseconds;
+	}
+
+	// The time between the fault and the relay being cut, seen from the rover
+	if ( _faultInjected && !_powerCutReported && !_servoRelay->isPowerOn() )
+	{
+		_powerCutReported = true;
+		Log.trace( "Simulator: power relay cut %u microseconds after %s, %u messages dropped on a full write buffer", timeMicroseconds - _faultChangeMicroseconds, _lastFaultChange, _messagesBlocked );
+	}
+
+	move( timeMicroseconds );
+	sendStreams( timeMicroseconds );
+}
+
+void FlightControllerSimulator::receiveMessages()
+{
+	mavlink_message_t message;
+	mavlink_status_t status;
+
+	while ( _serial->available() > 0 )
+	{
+		if ( mavlink_parse_char( SIMULATOR_CHANNEL, _serial->read(), &message, &status ) )
+		{
+			handleMessage( message );
+		}
+	}
+}
+
+void FlightControllerSimulator::handleMessage( const mavlink_message_t& message )
+{
+	switch ( message.msgid )
+	{
+		case MAVLINK_MSG_ID_SET_MODE:
+			{
+				mavlink_set_mode_t setMode;
+				mavlink_msg_set_mode_decode( &message, &setMode );
+
+				if ( setMode.target_system == SIMULATOR_SYSTEM_ID )
+				{
+					changeMode( (ROVER_MODE)setMode.custom_mode, "SET_MODE" );
+				}
+			}
+			break;
+
+		case MAVLINK_MSG_ID_REQUEST_DATA_STREAM:
+			{
+				mavlink_request_data_stream_t requestDataStream;
+				mavlink_msg_request_data_stream_decode( &message, &requestDataStream );
+
+				if ( requestDataStream.target_system == SIMULATOR_SYSTEM_ID )
+				{
+					setStreamRate( requestDataStream.req_stream_id, requestDataStream.req_message_rate, requestDataStream.start_stop != 0 );
+				}
+			}
+			break;
+
+		case MAVLINK_MSG_ID_COMMAND_LONG:
+			{
+				mavlink_command_long_t commandLong;
+				mavlink_msg_command_long_decode( &message, &commandLong );
+
+				if ( commandLong.target_system != SIMULATOR_SYSTEM_ID && commandLong.target_system != 0 )
+				{
+					break;
+				}
+
+				uint8_t result = MAV_RESULT_UNSUPPORTED;
+
+				if ( commandLong.command == MAV_CMD_SET_MESSAGE_INTERVAL )
+				{
+					result = setMessageInterval( (uint32_t)commandLong.param1, (int32_t)commandLong.param2 ) ? MAV_RESULT_ACCEPTED : MAV_RESULT_DENIED;
+				}
+				else if ( commandLong.command == MAV_CMD_DO_SET_MODE )
+				{
+					changeMode( (ROVER_MODE)commandLong.param2, "DO_SET_MODE" );
+					result = MAV_RESULT_ACCEPTED;
+				}
+
+				mavlink_message_t ack;
+				mavlink_msg_command_ack_pack_chan( SIMULATOR_SYSTEM_ID, SIMULATOR_COMPONENT_ID, SIMULATOR_CHANNEL, &ack, commandLong.command, result, 0, 0, message.sysid, message.compid );
+				write( &ack );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_MISSION_REQUEST_LIST:
+			{
+				mavlink_mission_count_t missionCount = {};
+				missionCount.target_system = message.sysid;
+				missionCount.target_component = message.compid;
+				missionCount.count = SIMULATOR_WAYPOINT_COUNT;
+				missionCount.mission_type = MAV_MISSION_TYPE_MISSION;
+
+				mavlink_message_t reply;
+				mavlink_msg_mission_count_encode_chan( SIMULATOR_SYSTEM_ID, SIMULATOR_COMPONENT_ID, SIMULATOR_CHANNEL, &reply, &missionCount );
+				write( &reply );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_MISSION_REQUEST_INT:
+			sendMissionItem( mavlink_msg_mission_request_int_get_seq( &message ) );
+			break;
+
+		default:
+			break;
+	}
+}
+
+void FlightControllerSimulator::changeMode( ROVER_MODE roverMode, const char* messageName )
+{
+	if ( _faultInjected )
+	{
+		Log.trace( "Simulator: %s %s received %u microseconds after %s", messageName, EnumHelper::convert( roverMode ), micros() - _faultChangeMicroseconds, _lastFaultChange );
+	}
+	else
+	{
+		Log.trace( "Simulator: %s %s received", messageName, EnumHelper::convert( roverMode ) );
+	}
+
+	_roverMode = roverMode;
+}
+
+void FlightControllerSimulator::setStreamRate( uint8_t streamId, uint16_t rateHz, bool start )
+{
+	for ( SimulatorStream& stream : _streams )
+	{
+		if ( streamId == MAV_DATA_STREAM_ALL || streamId == stream.streamId )
+		{
+			stream.intervalMicroseconds = start && rateHz > 0 ? 1000000 / rateHz : 0;
+		}
+	}
+
+	Log.trace( "Simulator: stream %d set to %d Hz", streamId, start ? rateHz : 0 );
+}
+
+bool FlightControllerSimulator::setMessageInterval( uint32_t msgid, int32_t intervalMicroseconds )
+{
+	for ( SimulatorStream& stream : _streams )
+	{
+		if ( stream.msgid == msgid )
+		{
+			// -1 turns the message off and 0 asks for its default rate
+			stream.intervalMicroseconds = intervalMicroseconds < 0 ? 0 : (intervalMicroseconds == 0 ? SIMULATOR_DEFAULT_INTERVAL_MICROSECONDS : intervalMicroseconds);
+			Log.trace( "Simulator: message %u every %u microseconds", msgid, stream.intervalMicroseconds );
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void FlightControllerSimulator::injectFault()
+{
+	_faultInjected = true;
+	_faultActive = true;
+	_lastFaultChange = "the fault";
+	_faultChangeMicroseconds = micros();
+
+	Log.trace( "Simulator: %s fault injected in %s mode, %d meters from destination %d",
+		getFaultName( _fault ),
+		EnumHelper::convert( _roverMode ),
+		(int32_t)getDistanceToWaypoint(),
+		_currentSeq );
+}
+
+void FlightControllerSimulator::move( uint32_t timeMicroseconds )
+{
+	float seconds = (timeMicroseconds - _lastMoveMicroseconds) / 1000000.0f;
+	_lastMoveMicroseconds = timeMicroseconds;
+
+	// Only auto drives, and nothing does once the bolt has cut the power
+	bool driving = _roverMode == ROVER_MODE_AUTO && _currentSeq < SIMULATOR_WAYPOINT_COUNT && _servoRelay->isPowerOn() &&
+		!(_faultActive && _fault == SIMULATOR_FAULT_STALL);
+
+	if ( !driving )
+	{
+		_speedMetersPerSecond = 0;
+		return;
+	}
+
+	float targetHeading = getBearingToWaypoint();
+
+	if ( _faultActive && _fault == SIMULATOR_FAULT_WRONG_DIRECTION )
+	{
+		targetHeading += 180.0f;
+	}
+	else if ( _faultActive && _fault == SIMULATOR_FAULT_DRIFT )
+	{
+		targetHeading += SIMULATOR_DRIFT_DEGREES;
+	}
+
+	float turn = wrapDegrees( targetHeading - _headingDegrees + 180.0f ) - 180.0f;
+	float maxTurn = SIMULATOR_TURN_DEGREES_PER_SECOND * seconds;
+
+	_headingDegrees = wrapDegrees( _headingDegrees + constrain( turn, -maxTurn, maxTurn ) );
+	_speedMetersPerSecond = SIMULATOR_SPEED_METERS_PER_SECOND;
+	_north += _speedMetersPerSecond * seconds * cosf( _headingDegrees * (float)DEG_TO_RAD );
+	_east += _speedMetersPerSecond * seconds * sinf( _headingDegrees * (float)DEG_TO_RAD );
+
+	if ( getDistanceToWaypoint() <= SIMULATOR_ACCEPTANCE_METERS )
+	{
+		sendMessage( MAVLINK_MSG_ID_MISSION_ITEM_REACHED );
+		_currentSeq++;
+
+		if ( _currentSeq >= SIMULATOR_WAYPOINT_COUNT )
+		{
+			Log.trace( "Simulated mission complete, %u messages dropped on a full write buffer", _messagesBlocked );
+			_roverMode = ROVER_MODE_HOLD;
+		}
+	}
+}
+
+void FlightControllerSimulator::sendStreams( uint32_t timeMicroseconds )
+{
+	if ( timeMicroseconds - _lastHeartbeatMicroseconds >= SIMULATOR_HEARTBEAT_MICROSECONDS )
+	{
+		_lastHeartbeatMicroseconds = timeMicroseconds;
+		sendMessage( MAVLINK_MSG_ID_HEARTBEAT );
+	}
+
+	for ( SimulatorStream& stream : _streams )
+	{
+		if ( stream.intervalMicroseconds != 0 && timeMicroseconds - stream.lastMicroseconds >= stream.intervalMicroseconds )
+		{
+			stream.lastMicroseconds = timeMicroseconds;
+			sendMessage( stream.msgid );
+		}
+	}
+}
+
+void FlightControllerSimulator::sendMessage( uint32_t msgid )
+{
+	mavlink_message_t message;
+	uint8_t fixType = _faultActive && _fault == SIMULATOR_FAULT_GPS_LOSS ? GPS_FIX_TYPE_NO_FIX : GPS_FIX_TYPE_RTK_FIXED;
+
+	switch ( msgid )
+	{
+		case MAVLINK_MSG_ID_HEARTBEAT:
+			{
+				mavlink_heartbeat_t heartbeat = {};
+				heartbeat.type = MAV_TYPE_GROUND_ROVER;
+				heartbeat.autopilot = MAV_AUTOPILOT_ARDUPILOTMEGA;
+				heartbeat.base_mode = MAV_MODE_FLAG_CUSTOM_MODE_ENABLED | MAV_MODE_FLAG_SAFETY_ARMED;
+				heartbeat.custom_mode = _roverMode;
+				heartbeat.system_status = MAV_STATE_ACTIVE;
+				mavlink_msg_heartbeat_encode_chan( SIMULATOR_SYSTEM_ID, SIMULATOR_COMPONENT_ID, SIMULATOR_CHANNEL, &message, &heartbeat );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
+			{
+				mavlink_global_position_int_t globalPositionInt = {};
+				globalPositionInt.time_boot_ms = millis();
+				globalPositionInt.lat = toLatitude( _north );
+				globalPositionInt.lon = toLongitude( _east );
+				globalPositionInt.vx = (int16_t)(_speedMetersPerSecond * cosf( _headingDegrees * (float)DEG_TO_RAD ) * 100);
+				globalPositionInt.vy = (int16_t)(_speedMetersPerSecond * sinf( _headingDegrees * (float)DEG_TO_RAD ) * 100);
+				globalPositionInt.hdg = (uint16_t)(_headingDegrees * 100);
+				mavlink_msg_global_position_int_encode_chan( SIMULATOR_SYSTEM_ID, SIMULATOR_COMPONENT_ID, SIMULATOR_CHANNEL, &message, &globalPositionInt );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT:
+			{
+				mavlink_nav_controller_output_t navControllerOutput = {};
+				navControllerOutput.target_bearing = (int16_t)getBearingToWaypoint();
+				navControllerOutput.nav_bearing = navControllerOutput.target_bearing;
+				navControllerOutput.wp_dist = (uint16_t)getDistanceToWaypoint();
+				navControllerOutput.xtrack_error = getCrossTrackError();
+				mavlink_msg_nav_controller_output_encode_chan( SIMULATOR_SYSTEM_ID, SIMULATOR_COMPONENT_ID, SIMULATOR_CHANNEL, &message, &navControllerOutput );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_GPS_RAW_INT:
+			{
+				mavlink_gps_raw_int_t gpsRawInt = {};
+				gpsRawInt.time_usec = micros();
+				gpsRawInt.fix_type = fixType;
+				gpsRawInt.satellites_visible = fixType == GPS_FIX_TYPE_NO_FIX ? 0 : 20;
+				mavlink_msg_gps_raw_int_encode_chan( SIMULATOR_SYSTEM_ID, SIMULATOR_COMPONENT_ID, SIMULATOR_CHANNEL, &message, &gpsRawInt );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_GPS2_RAW:
+			{
+				mavlink_gps2_raw_t gps2Raw = {};
+				gps2Raw.time_usec = micros();
+				gps2Raw.fix_type = fixType;
+				gps2Raw.satellites_visible = fixType == GPS_FIX_TYPE_NO_FIX ? 0 : 18;
+				mavlink_msg_gps2_raw_encode_chan( SIMULATOR_SYSTEM_ID, SIMULATOR_COMPONENT_ID, SIMULATOR_CHANNEL, &message, &gps2Raw );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_MISSION_CURRENT:
+			{
+				mavlink_mission_current_t missionCurrent = {};
+				missionCurrent.seq = min( _currentSeq, (uint16_t)(SIMULATOR_WAYPOINT_COUNT - 1) );
+				mavlink_msg_mission_current_encode_chan( SIMULATOR_SYSTEM_ID, SIMULATOR_COMPONENT_ID, SIMULATOR_CHANNEL, &message, &missionCurrent );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_MISSION_ITEM_REACHED:
+			{
+				mavlink_mission_item_reached_t missionItemReached = {};
+				missionItemReached.seq = _currentSeq;
+				mavlink_msg_mission_item_reached_encode_chan( SIMULATOR_SYSTEM_ID, SIMULATOR_COMPONENT_ID, SIMULATOR_CHANNEL, &message, &missionItemReached );
+			}
+			break;
+
+		default:
+			return;
+	}
+
+	write( &message );
+}
+
+void FlightControllerSimulator::sendMissionItem( uint16_t seq )
+{
+	if ( seq >= SIMULATOR_WAYPOINT_COUNT )
+	{
+		return;
+	}
+
+	float north;
+	float east;
+	getWaypoint( seq, &north, &east );
+
+	mavlink_mission_item_int_t missionItemInt = {};
+	missionItemInt.seq = seq;
+	missionItemInt.frame = seq == 0 ? MAV_FRAME_GLOBAL_INT : MAV_FRAME_GLOBAL_RELATIVE_ALT_INT;
+	missionItemInt.command = MAV_CMD_NAV_WAYPOINT;
+	missionItemInt.autocontinue = 1;
+	missionItemInt.x = toLatitude( north );
+	missionItemInt.y = toLongitude( east );
+	missionItemInt.mission_type = MAV_MISSION_TYPE_MISSION;
+
+	mavlink_message_t message;
+	mavlink_msg_mission_item_int_encode_chan( SIMULATOR_SYSTEM_ID, SIMULATOR_COMPONENT_ID, SIMULATOR_CHANNEL, &message, &missionItemInt );
+	write( &message );
+}
+
+void FlightControllerSimulator::write( mavlink_message_t* message )
+{
+	// A cut link sends nothing at all
+	if ( _faultActive && _fault == SIMULATOR_FAULT_HEARTBEAT_LOSS )
+	{
+		return;
+	}
+
+	uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
+	uint16_t length = mavlink_msg_to_send_buffer( buffer, message );
+
+	// Writing more than fits would block the loop and the bolt with it, a message that doesn't fit is dropped as a saturated link would
+	if ( _serial->availableForWrite() < length )
+	{
+		_messagesBlocked++;
+		return;
+	}
+
+	_serial->write( buffer, length );
+}
+
+float FlightControllerSimulator::getBearingToWaypoint()
+{
+	float north;
+	float east;
+	getWaypoint( _currentSeq, &north, &east );
+
+	return wrapDegrees( atan2f( east - _east, north - _north ) * (float)RAD_TO_DEG );
+}
+
+float FlightControllerSimulator::getDistanceToWaypoint()
+{
+	float north;
+	float east;
+	getWaypoint( _currentSeq, &north, &east );
+
+	return sqrtf( (north - _north) * (north - _north) + (east - _east) * (east - _east) );
+}
+
+float FlightControllerSimulator::getCrossTrackError()
+{
+	float startNorth;
+	float startEast;
+	float endNorth;
+	float endEast;
+	getWaypoint( _currentSeq - 1, &startNorth, &startEast );
+	getWaypoint( _currentSeq, &endNorth, &endEast );
+
+	float legNorth = endNorth - startNorth;
+	float legEast = endEast - startEast;
+	float legLength = sqrtf( legNorth * legNorth + legEast * legEast );
+
+	if ( legLength == 0 )
+	{
+		return 0;
+	}
+
+	// Positive to the right of the leg
+	return ((_north - startNorth) * legEast - (_east - startEast) * legNorth) / legLength;
+}
+
+bool FlightControllerSimulator::parseFault( const char* name, SIMULATOR_FAULT* fault )
+{
+	for ( uint8_t i = 0; i < SIMULATOR_FAULT_COUNT; i++ )
+	{
+		if ( strcmp( name, FAULT_NAMES[i] ) == 0 )
+		{
+			*fault = (SIMULATOR_FAULT)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const char* FlightControllerSimulator::getFaultName( SIMULATOR_FAULT fault )
+{
+	return fault < SIMULATOR_FAULT_COUNT ? FAULT_NAMES[fault] : "unknown";
+}
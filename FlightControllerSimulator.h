@@ -0,0 +1,140 @@
+// FlightControllerSimulator.h
+
+#ifndef _FLIGHTCONTROLLERSIMULATOR_h
+#define _FLIGHTCONTROLLERSIMULATOR_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "MAVLinkDialect.h"
+#include "ServoRelay.h"
+
+constexpr mavlink_channel_t SIMULATOR_CHANNEL = MAVLINK_COMM_1;       ///< Sequence numbers and parser of the simulator, the reader parses on channel 0
+constexpr size_t SIMULATOR_READ_BUFFER_SIZE = 512;                      ///< Extra receive buffer for the messages of the bolt
+constexpr uint8_t SIMULATOR_STREAM_COUNT = 5;                           ///< Messages that can be streamed
+constexpr uint32_t SIMULATOR_HEARTBEAT_MICROSECONDS = 1000000;          ///< Heartbeats are sent whatever streams were asked for
+constexpr uint32_t SIMULATOR_DEFAULT_INTERVAL_MICROSECONDS = 200000;    ///< Interval of a message set to its default rate, 5 Hz
+constexpr uint32_t SIMULATOR_START_MILLISECONDS = 5000;                 ///< Time in hold before the mission starts, for the streams to be asked for
+constexpr uint8_t SIMULATOR_WAYPOINT_COUNT = 9;                         ///< Mission items, home and two rounds of a square
+constexpr float SIMULATOR_LEG_METERS = 30.0f;                           ///< Side of the square
+constexpr float SIMULATOR_SPEED_METERS_PER_SECOND = 2.0f;
+constexpr float SIMULATOR_TURN_DEGREES_PER_SECOND = 90.0f;
+constexpr float SIMULATOR_ACCEPTANCE_METERS = 2.0f;                     ///< Distance a waypoint counts as reached at
+constexpr float SIMULATOR_DRIFT_DEGREES = 45.0f;                        ///< Heading error of the drift fault
+constexpr uint32_t SIMULATOR_GPS_LOSS_MILLISECONDS = 15000;             ///< How long the GPS loss fault lasts, so the mission can be resumed
+constexpr int32_t SIMULATOR_HOME_LATITUDE = 473977420;                  ///< Degrees * 1e7
+constexpr int32_t SIMULATOR_HOME_LONGITUDE = 85455940;                  ///< Degrees * 1e7
+
+/**
+ * @brief Faults the simulator can inject into the mission.
+*/
+enum SIMULATOR_FAULT
+{
+	SIMULATOR_FAULT_NONE,
+	SIMULATOR_FAULT_HEARTBEAT_LOSS,    ///< Nothing more is sent, as if the link was cut
+	SIMULATOR_FAULT_GPS_LOSS,          ///< The fix drops to none for SIMULATOR_GPS_LOSS_MILLISECONDS
+	SIMULATOR_FAULT_WRONG_DIRECTION,   ///< The rover drives away from the waypoint
+	SIMULATOR_FAULT_STALL,             ///< The rover stops while the mission carries on
+	SIMULATOR_FAULT_DRIFT,             ///< The rover steers SIMULATOR_DRIFT_DEGREES off the bearing to the waypoint
+	SIMULATOR_FAULT_COUNT
+};
+
+/**
+ * @brief A message the simulator streams and the stream REQUEST_DATA_STREAM turns it on with.
+*/
+struct SimulatorStream
+{
+	uint32_t msgid;
+	uint8_t streamId;
+	uint32_t intervalMicroseconds;    ///< 0 when the message isn't streamed
+	uint32_t lastMicroseconds;
+};
+
+/**
+ * @brief FlightControllerSimulator stands in for the flight controller on a serial port wired to the port the reader listens on, in both
+ * directions, so the loop through the bolt is closed. It sends heartbeats, streams the messages asked for with REQUEST_DATA_STREAM or
+ * MAV_CMD_SET_MESSAGE_INTERVAL at the rates asked for, answers the mission protocol and changes mode on SET_MODE. A simple rover drives
+ * the mission in auto mode, at a fixed speed and turn rate, and stops when the bolt cuts the power relay. At a set time after the mission
+ * started a fault is injected. The log then shows how long after the fault each SET_MODE arrived and the power relay was cut, the round
+ * trip through the reader, the event bus, the mission monitor and back over the link.
+*/
+class FlightControllerSimulator
+{
+public:
+	/**
+	 * @brief Start the simulated flight controller on a serial port.
+	 * @param serial The port, the simulator opens it.
+	 * @param servoRelay The relays of the mission monitor, the rover only moves while the power is on.
+	 * @param fault The fault to inject.
+	 * @param faultMilliseconds Time after the mission started to inject the fault at.
+	 * @param baudRate Speed of the flight controller link.
+	*/
+	void begin( HardwareSerial* serial, ServoRelay* servoRelay, SIMULATOR_FAULT fault, uint32_t faultMilliseconds, uint32_t baudRate );
+
+	/**
+	 * @brief Read the messages of the bolt, move the rover and send what is due.
+	*/
+	void tick();
+
+	/**
+	 * @brief Find a fault by its name in config.ini.
+	 * @param name The name, e.g. gpsLoss.
+	 * @param fault Receives the fault.
+	 * @return False if there is no fault of that name.
+	*/
+	static bool parseFault( const char* name, SIMULATOR_FAULT* fault );
+
+	/**
+	 * @brief Get the name of a fault in config.ini.
+	*/
+	static const char* getFaultName( SIMULATOR_FAULT fault );
+
+private:
+	void receiveMessages();
+	void handleMessage( const mavlink_message_t& message );
+	void changeMode( ROVER_MODE roverMode, const char* messageName );
+	void setStreamRate( uint8_t streamId, uint16_t rateHz, bool start );
+	bool setMessageInterval( uint32_t msgid, int32_t intervalMicroseconds );
+	void injectFault();
+	void move( uint32_t timeMicroseconds );
+	void sendStreams( uint32_t timeMicroseconds );
+	void sendMessage( uint32_t msgid );
+	void sendMissionItem( uint16_t seq );
+	void write( mavlink_message_t* message );
+	float getBearingToWaypoint();
+	float getDistanceToWaypoint();
+	float getCrossTrackError();
+
+	HardwareSerial* _serial = NULL;
+	ServoRelay* _servoRelay = NULL;
+	SimulatorStream _streams[SIMULATOR_STREAM_COUNT];
+	uint8_t _readBuffer[SIMULATOR_READ_BUFFER_SIZE];
+
+	SIMULATOR_FAULT _fault = SIMULATOR_FAULT_NONE;
+	uint32_t _faultMilliseconds = 0;
+	bool _faultInjected = false;
+	bool _faultActive = false;
+	const char* _lastFaultChange = NULL;    ///< What the latencies in the log are measured from, the fault starting or ending
+	uint32_t _faultChangeMicroseconds = 0;
+	bool _powerCutReported = false;
+	uint32_t _messagesBlocked = 0;    ///< Messages dropped because the write buffer of the port was full
+
+	ROVER_MODE _roverMode = ROVER_MODE_HOLD;
+	bool _missionStarted = false;
+	uint32_t _beginMilliseconds = 0;
+	uint32_t _missionStartMilliseconds = 0;
+	uint32_t _lastMoveMicroseconds = 0;
+	uint32_t _lastHeartbeatMicroseconds = 0;
+
+	// The rover, in meters north and east of home
+	float _north = 0;
+	float _east = 0;
+	float _headingDegrees = 0;
+	float _speedMetersPerSecond = 0;
+	uint16_t _currentSeq = 1;
+};
+
+#endif
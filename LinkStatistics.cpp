@@ -0,0 +1,244 @@
+//
+//
+//
+
+#include "LinkStatistics.h"
+#include <ArduinoLog.h>
+
+
+LinkStatistics::LinkStatistics( const char* sourceName )
+{
+	_sourceName = sourceName;
+
+	memset( _systemSlots, LINK_STATISTICS_NO_SLOT, sizeof( _systemSlots ) );
+	memset( _messageFrames, 0, sizeof( _messageFrames ) );
+	memset( _messageBytes, 0, sizeof( _messageBytes ) );
+}
+
+void LinkStatistics::onByte()
+{
+	_bytesReceived++;
+	_periodBytes++;
+}
+
+void LinkStatistics::onFrame( uint8_t sysid, uint8_t compid, uint8_t sequence, uint32_t msgid, uint16_t length )
+{
+	uint16_t messageSlot = msgid < LINK_STATISTICS_MESSAGE_IDS ? msgid : LINK_STATISTICS_MESSAGE_IDS;
+	LinkComponentStatistics* component = getComponent( sysid, compid );
+
+	_bytesFramed += length;
+	_periodFrames++;
+	_messageFrames[messageSlot]++;
+	_messageBytes[messageSlot] += length;
+
+	// A jump in the sequence number means frames were lost on the way, the sequence wraps at 256
+	if ( component->sequenceValid )
+	{
+		component->framesLost += (uint8_t)(sequence - component->lastSequence - 1);
+	}
+
+	// Sequence numbers of the overflow entry come from several components and can't be compared
+	component->lastSequence = sequence;
+	component->sequenceValid = component != &_components[LINK_STATISTICS_MAX_COMPONENTS];
+	component->framesReceived++;
+}
+
+void LinkStatistics::onFrameFiltered( uint8_t sysid, uint8_t compid, uint8_t sequence, uint32_t msgid, uint16_t length )
+{
+	// The header is enough to keep the sequence and rate counters going
+	onFrame( sysid, compid, sequence, msgid, length );
+
+	_framesFiltered++;
+	_bytesFiltered += length;
+}
+
+void LinkStatistics::onCrcError( uint8_t sysid, uint8_t compid, uint16_t length )
+{
+	_bytesFramed += length;
+	_crcErrors++;
+	getComponent( sysid, compid )->crcErrors++;
+}
+
+void LinkStatistics::addParseCycles( uint32_t cycles )
+{
+	_periodParseCycles += cycles;
+}
+
+void LinkStatistics::addDispatchCycles( uint32_t cycles )
+{
+	_periodDispatchCycles += cycles;
+	_periodDispatches++;
+}
+
+void LinkStatistics::tick( uint32_t timeMilliseconds )
+{
+	uint32_t elapsedMilliseconds = timeMilliseconds - _lastPublishMilliseconds;
+
+	if ( elapsedMilliseconds >= LINK_STATISTICS_PUBLISH_MILLISECONDS )
+	{
+		publish( elapsedMilliseconds );
+		_lastPublishMilliseconds = timeMilliseconds;
+	}
+}
+
+void LinkStatistics::publish( uint32_t elapsedMilliseconds )
+{
+	if ( elapsedMilliseconds == 0 )
+	{
+		return;
+	}
+
+	uint32_t bytesDiscarded = getBytesDiscarded();
+
+	Log.trace( "Link %s: %u bytes/s, %u frames/s, %u bytes discarded, %u CRC errors in the last %u milliseconds",
+		_sourceName,
+		_periodBytes * 1000 / elapsedMilliseconds,
+		_periodFrames * 1000 / elapsedMilliseconds,
+		bytesDiscarded - _bytesDiscardedAtPeriodStart,
+		_crcErrors - _crcErrorsAtPeriodStart,
+		elapsedMilliseconds );
+
+	// Cycles per byte is the figure to compare with the header filter turned on and off
+	Log.trace( "Link %s: %u frames filtered by header, %u bytes skipped, %u parse cycles per byte",
+		_sourceName,
+		_framesFiltered - _framesFilteredAtPeriodStart,
+		_bytesFiltered - _bytesFilteredAtPeriodStart,
+		_periodBytes == 0 ? 0 : (uint32_t)(_periodParseCycles / _periodBytes) );
+
+	// Cycles per frame is the figure to compare between static and virtual dispatch
+	Log.trace( "Link %s: %u parse cycles per frame, %u of them dispatching",
+		_sourceName,
+		_periodDispatches == 0 ? 0 : (uint32_t)(_periodParseCycles / _periodDispatches),
+		_periodDispatches == 0 ? 0 : (uint32_t)(_periodDispatchCycles / _periodDispatches) );
+
+	for ( uint8_t i = 0; i <= LINK_STATISTICS_MAX_COMPONENTS; i++ )
+	{
+		LinkComponentStatistics* component = &_components[i];
+
+		if ( component->framesReceived == 0 && component->crcErrors == 0 )
+		{
+			continue;
+		}
+
+		Log.trace( "Link %s system %d component %d%s: %u frames received, %u frames lost, %u CRC errors",
+			_sourceName,
+			component->sysid,
+			component->compid,
+			i == LINK_STATISTICS_MAX_COMPONENTS ? " and others" : "",
+			component->framesReceived,
+			component->framesLost,
+			component->crcErrors );
+	}
+
+	for ( uint16_t i = 0; i <= LINK_STATISTICS_MESSAGE_IDS; i++ )
+	{
+		if ( _messageFrames[i] == 0 )
+		{
+			continue;
+		}
+
+		Log.trace( "Link %s message %d%s: %u frames/s, %u bytes/s",
+			_sourceName,
+			i,
+			i == LINK_STATISTICS_MESSAGE_IDS ? " and above" : "",
+			_messageFrames[i] * 1000 / elapsedMilliseconds,
+			_messageBytes[i] * 1000 / elapsedMilliseconds );
+
+		_messageFrames[i] = 0;
+		_messageBytes[i] = 0;
+	}
+
+	_periodBytes = 0;
+	_periodFrames = 0;
+	_bytesDiscardedAtPeriodStart = bytesDiscarded;
+	_crcErrorsAtPeriodStart = _crcErrors;
+	_framesFilteredAtPeriodStart = _framesFiltered;
+	_bytesFilteredAtPeriodStart = _bytesFiltered;
+	_periodParseCycles = 0;
+	_periodDispatchCycles = 0;
+	_periodDispatches = 0;
+}
+
+uint32_t LinkStatistics::getBytesReceived()
+{
+	return _bytesReceived;
+}
+
+uint32_t LinkStatistics::getBytesDiscarded()
+{
+	// Everything that didn't end up in a frame was skipped while looking for the start of the next one
+	return _bytesReceived - _bytesFramed;
+}
+
+uint32_t LinkStatistics::getCrcErrors()
+{
+	return _crcErrors;
+}
+
+uint32_t LinkStatistics::getFramesLost()
+{
+	uint32_t framesLost = 0;
+
+	for ( uint8_t i = 0; i <= LINK_STATISTICS_MAX_COMPONENTS; i++ )
+	{
+		framesLost += _components[i].framesLost;
+	}
+
+	return framesLost;
+}
+
+uint32_t LinkStatistics::getFramesFiltered()
+{
+	return _framesFiltered;
+}
+
+LinkComponentStatistics* LinkStatistics::getComponent( uint8_t sysid, uint8_t compid )
+{
+	uint8_t slot = _systemSlots[sysid];
+	uint8_t* link = &_systemSlots[sysid];
+
+	// A system rarely has more than a couple of components on the link, the chain stays short
+	while ( slot != LINK_STATISTICS_NO_SLOT )
+	{
+		if ( _components[slot].compid == compid )
+		{
+			return &_components[slot];
+		}
+
+		link = &_components[slot].nextSlot;
+		slot = *link;
+	}
+
+	if ( _componentCount < LINK_STATISTICS_MAX_COMPONENTS )
+	{
+		slot = _componentCount++;
+		_components[slot].sysid = sysid;
+		_components[slot].compid = compid;
+		*link = slot;
+
+		return &_components[slot];
+	}
+
+	// Too many components on the link, the overflow entry reports the first component that didn't fit
+	LinkComponentStatistics* overflow = &_components[LINK_STATISTICS_MAX_COMPONENTS];
+
+	if ( overflow->framesReceived == 0 && overflow->crcErrors == 0 )
+	{
+		overflow->sysid = sysid;
+		overflow->compid = compid;
+	}
+
+	return overflow;
+}
+
+uint16_t LinkStatistics::frameLength( const mavlink_message_t* mavlinkMessage )
+{
+	if ( mavlinkMessage->magic == MAVLINK_STX_MAVLINK1 )
+	{
+		return MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1 + mavlinkMessage->len + MAVLINK_NUM_CHECKSUM_BYTES;
+	}
+
+	uint16_t signatureLength = (mavlinkMessage->incompat_flags & MAVLINK_IFLAG_SIGNED) ? MAVLINK_SIGNATURE_BLOCK_LEN : 0;
+
+	return MAVLINK_NUM_NON_PAYLOAD_BYTES + mavlinkMessage->len + signatureLength;
+}
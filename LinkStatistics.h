@@ -0,0 +1,155 @@
+// LinkStatistics.h
+
+#ifndef _LINKSTATISTICS_h
+#define _LINKSTATISTICS_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "MAVLinkDialect.h"
+
+constexpr uint8_t LINK_STATISTICS_MAX_COMPONENTS = 8;         ///< Number of distinct system and component id pairs tracked per link, extra components are counted as "other"
+constexpr uint16_t LINK_STATISTICS_MESSAGE_IDS = 256;         ///< Message ids below this value are counted individually, the rest share one bucket
+constexpr uint32_t LINK_STATISTICS_PUBLISH_MILLISECONDS = 10000; ///< How often the statistics are written to the log
+constexpr uint8_t LINK_STATISTICS_NO_SLOT = 0xFF;
+
+/**
+ * @brief Counters kept for every component seen on a link. Each component numbers its frames itself,
+ * so the sequence numbers of two components of the same system can't be compared.
+*/
+struct LinkComponentStatistics
+{
+	uint8_t sysid = 0;
+	uint8_t compid = 0;
+	uint8_t nextSlot = LINK_STATISTICS_NO_SLOT; ///< Next entry with the same system id
+	uint8_t lastSequence = 0;
+	bool sequenceValid = false;
+	uint32_t framesReceived = 0;
+	uint32_t framesLost = 0;       ///< Frames missing according to sequence number gaps
+	uint32_t crcErrors = 0;
+};
+
+/**
+ * @brief LinkStatistics collects the health of a single MAVLink byte source: sequence gaps and CRC failures per component,
+ * bytes thrown away while the parser resynchronizes, and frame and byte rates per message id.
+ * Every update is constant time so it can run inside the parse loop. The totals are written to the log periodically.
+*/
+class LinkStatistics
+{
+public:
+	/**
+	 * @brief Constructor
+	 * @param sourceName The name used to identify the link in the log.
+	*/
+	LinkStatistics( const char* sourceName );
+
+	/**
+	 * @brief Count a byte read from the link.
+	*/
+	void onByte();
+
+	/**
+	 * @brief Count a frame that passed the CRC check.
+	 * @param sysid The system id from the frame header.
+	 * @param compid The component id from the frame header.
+	 * @param sequence The sequence number from the frame header.
+	 * @param msgid The message id from the frame header.
+	 * @param length The length of the whole frame in bytes.
+	*/
+	void onFrame( uint8_t sysid, uint8_t compid, uint8_t sequence, uint32_t msgid, uint16_t length );
+
+	/**
+	 * @brief Count a frame that was skipped by the header filter without being checked or decoded.
+	 * @param sysid The system id from the frame header.
+	 * @param compid The component id from the frame header.
+	 * @param sequence The sequence number from the frame header.
+	 * @param msgid The message id from the frame header.
+	 * @param length The length of the whole frame in bytes.
+	*/
+	void onFrameFiltered( uint8_t sysid, uint8_t compid, uint8_t sequence, uint32_t msgid, uint16_t length );
+
+	/**
+	 * @brief Count a frame that failed the CRC check. Its bytes are counted as discarded.
+	 * @param sysid The system id from the frame header, the header may itself be corrupt.
+	 * @param compid The component id from the frame header.
+	 * @param length The length of the whole frame in bytes.
+	*/
+	void onCrcError( uint8_t sysid, uint8_t compid, uint16_t length );
+
+	/**
+	 * @brief Add processor cycles spent reading and parsing the link.
+	 * @param cycles The number of cycles.
+	*/
+	void addParseCycles( uint32_t cycles );
+
+	/**
+	 * @brief Add processor cycles spent decoding a message and running the handler of the receiver, part of the parse cycles.
+	 * @param cycles The number of cycles.
+	*/
+	void addDispatchCycles( uint32_t cycles );
+
+	/**
+	 * @brief Calculate the length of a complete frame on the wire.
+	 * @param mavlinkMessage The framed message.
+	 * @return The length in bytes including header, checksum and signature.
+	*/
+	static uint16_t frameLength( const mavlink_message_t* mavlinkMessage );
+
+	/**
+	 * @brief Publish the statistics when the publishing period has elapsed.
+	 * @param timeMilliseconds The current time of the link in milliseconds.
+	*/
+	void tick( uint32_t timeMilliseconds );
+
+	/**
+	 * @brief Write the statistics to the log and start a new rate period.
+	 * @param elapsedMilliseconds The length of the period the rates are calculated for.
+	*/
+	void publish( uint32_t elapsedMilliseconds );
+
+	uint32_t getBytesReceived();
+	uint32_t getBytesDiscarded();
+	uint32_t getCrcErrors();
+	uint32_t getFramesLost();
+	uint32_t getFramesFiltered();
+
+private:
+	/**
+	 * @brief Find the counters of a component, the entries of a system are chained from the slot of its system id.
+	 * @return The entry of the component, the overflow entry when the table is full.
+	*/
+	LinkComponentStatistics* getComponent( uint8_t sysid, uint8_t compid );
+
+	const char* _sourceName;
+	uint32_t _lastPublishMilliseconds = 0;
+
+	// Totals since start
+	uint32_t _bytesReceived = 0;
+	uint32_t _bytesFramed = 0;      ///< Bytes that belonged to a complete frame, good or bad CRC
+	uint32_t _crcErrors = 0;
+	uint32_t _framesFiltered = 0;
+	uint32_t _bytesFiltered = 0;
+
+	// Totals for the current rate period
+	uint32_t _periodBytes = 0;
+	uint32_t _periodFrames = 0;
+	uint32_t _bytesDiscardedAtPeriodStart = 0;
+	uint32_t _crcErrorsAtPeriodStart = 0;
+	uint32_t _framesFilteredAtPeriodStart = 0;
+	uint32_t _bytesFilteredAtPeriodStart = 0;
+	uint64_t _periodParseCycles = 0;
+	uint64_t _periodDispatchCycles = 0;
+	uint32_t _periodDispatches = 0;
+
+	uint8_t _systemSlots[256];      ///< First entry of each system id
+	uint8_t _componentCount = 0;
+	LinkComponentStatistics _components[LINK_STATISTICS_MAX_COMPONENTS + 1]; ///< Last entry collects components that didn't fit
+
+	uint16_t _messageFrames[LINK_STATISTICS_MESSAGE_IDS + 1]; ///< Last entry collects message ids that didn't fit
+	uint32_t _messageBytes[LINK_STATISTICS_MESSAGE_IDS + 1];
+};
+
+#endif
@@ -0,0 +1,42 @@
+//
+//
+//
+
+#include "MAVLinkDialect.h"
+#include <ArduinoLog.h>
+
+const MAVLinkDialectTable MAVLINK_DIALECT_TABLE = makeMAVLinkDialectTable();
+
+void logMAVLinkDialect()
+{
+	uint32_t missingEntries = 0;
+	uint32_t startCycles = ARM_DWT_CYCCNT;
+
+	for ( uint16_t round = 0; round < MAVLINK_DIALECT_LOOKUP_ROUNDS; round++ )
+	{
+		for ( uint32_t msgid : MAVLINK_DIALECT_MESSAGE_IDS )
+		{
+			// Read back through volatile so the lookup isn't worked out at compile time
+			volatile uint32_t lookupMsgid = msgid;
+			if ( mavlink_get_msg_entry( lookupMsgid ) == NULL )
+			{
+				missingEntries++;
+			}
+		}
+	}
+
+	uint32_t lookupCycles = (ARM_DWT_CYCCNT - startCycles) / ((uint32_t)MAVLINK_DIALECT_LOOKUP_ROUNDS * MAVLINK_DIALECT_MESSAGE_COUNT);
+
+	if ( missingEntries > 0 )
+	{
+		Log.error( "MAVLink dialect: %u lookups found no entry", missingEntries );
+	}
+
+#if MAVLINK_FULL_DIALECT
+	Log.trace( "MAVLink dialect: full, %u messages in a %u byte table per parser, %u cycles per lookup",
+		MAVLINK_FULL_DIALECT_MESSAGE_COUNT, sizeof( MAVLINK_FULL_DIALECT_ENTRIES ), lookupCycles );
+#else
+	Log.trace( "MAVLink dialect: trimmed, %u of %u messages in a %u byte table, %u cycles per lookup",
+		MAVLINK_DIALECT_MESSAGE_COUNT, MAVLINK_FULL_DIALECT_MESSAGE_COUNT, sizeof( MAVLINK_DIALECT_TABLE ), lookupCycles );
+#endif
+}
@@ -0,0 +1,169 @@
+// MAVLinkDialect.h
+
+#ifndef _MAVLINKDIALECT_h
+#define _MAVLINKDIALECT_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#ifndef MAVLINK_FULL_DIALECT
+#define MAVLINK_FULL_DIALECT 0   ///< Set to 1 to look messages up in the whole ardupilotmega dialect, to compare flash, RAM and lookup cycles
+#endif
+
+#if !MAVLINK_FULL_DIALECT
+// The parser asks for the entry of every frame it receives, the lookup of the trimmed dialect replaces the bisection of the full one
+#include <mavlink_types.h>
+#define MAVLINK_GET_MSG_ENTRY
+extern "C"
+{
+	static inline const mavlink_msg_entry_t* mavlink_get_msg_entry( uint32_t msgid );
+}
+#endif
+
+#include <mavlink_2_ardupilot.h>
+
+constexpr uint16_t MAVLINK_DIALECT_INDEX_SIZE = 256;   ///< Message ids the direct index covers, as many as the header filter can subscribe to
+constexpr uint8_t MAVLINK_DIALECT_NO_ENTRY = 0xFF;     ///< Index value of a message outside the trimmed dialect
+constexpr uint16_t MAVLINK_DIALECT_LOOKUP_ROUNDS = 100; ///< Times every message is looked up when the lookup cost is measured
+
+/**
+ * @brief The messages of the trimmed dialect, those the bolt subscribes to and those it sends, which the simulated flight controller
+ * parses at the other end of the link. Frames of any other message can't have their CRC checked and are dropped by the parser.
+ * Add a message here before subscribing to it or sending it.
+*/
+constexpr uint32_t MAVLINK_DIALECT_MESSAGE_IDS[] = {
+	MAVLINK_MSG_ID_HEARTBEAT,
+	MAVLINK_MSG_ID_SYS_STATUS,
+	MAVLINK_MSG_ID_SYSTEM_TIME,
+	MAVLINK_MSG_ID_SET_MODE,
+	MAVLINK_MSG_ID_PARAM_REQUEST_READ,
+	MAVLINK_MSG_ID_PARAM_REQUEST_LIST,
+	MAVLINK_MSG_ID_PARAM_VALUE,
+	MAVLINK_MSG_ID_PARAM_SET,
+	MAVLINK_MSG_ID_GPS_RAW_INT,
+	MAVLINK_MSG_ID_RAW_IMU,
+	MAVLINK_MSG_ID_MISSION_CURRENT,
+	MAVLINK_MSG_ID_MISSION_REQUEST_LIST,
+	MAVLINK_MSG_ID_MISSION_COUNT,
+	MAVLINK_MSG_ID_MISSION_ITEM_REACHED,
+	MAVLINK_MSG_ID_MISSION_ACK,
+	MAVLINK_MSG_ID_GLOBAL_POSITION_INT,
+	MAVLINK_MSG_ID_RC_CHANNELS,
+	MAVLINK_MSG_ID_REQUEST_DATA_STREAM,
+	MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT,
+	MAVLINK_MSG_ID_MISSION_REQUEST_INT,
+	MAVLINK_MSG_ID_MISSION_ITEM_INT,
+	MAVLINK_MSG_ID_COMMAND_LONG,
+	MAVLINK_MSG_ID_GPS2_RAW,
+	MAVLINK_MSG_ID_GPS_INPUT
+};
+
+constexpr uint8_t MAVLINK_DIALECT_MESSAGE_COUNT = sizeof( MAVLINK_DIALECT_MESSAGE_IDS ) / sizeof( MAVLINK_DIALECT_MESSAGE_IDS[0] );
+
+/**
+ * @brief The entries of the whole dialect as generated from its XML. It is only read at compile time, to build the trimmed table.
+*/
+constexpr mavlink_msg_entry_t MAVLINK_FULL_DIALECT_ENTRIES[] = MAVLINK_MESSAGE_CRCS;
+
+constexpr uint16_t MAVLINK_FULL_DIALECT_MESSAGE_COUNT = sizeof( MAVLINK_FULL_DIALECT_ENTRIES ) / sizeof( MAVLINK_FULL_DIALECT_ENTRIES[0] );
+
+/**
+ * @brief The trimmed dialect, an entry per message and an index from the message id to its entry.
+*/
+struct MAVLinkDialectTable
+{
+	uint8_t index[MAVLINK_DIALECT_INDEX_SIZE];
+	mavlink_msg_entry_t entries[MAVLINK_DIALECT_MESSAGE_COUNT];
+};
+
+/**
+ * @brief Find a message in the whole dialect.
+ * @return The position of its entry, MAVLINK_FULL_DIALECT_MESSAGE_COUNT if the dialect has no such message.
+*/
+constexpr uint16_t findFullDialectEntry( uint32_t msgid )
+{
+	for ( uint16_t i = 0; i < MAVLINK_FULL_DIALECT_MESSAGE_COUNT; i++ )
+	{
+		if ( MAVLINK_FULL_DIALECT_ENTRIES[i].msgid == msgid )
+		{
+			return i;
+		}
+	}
+
+	return MAVLINK_FULL_DIALECT_MESSAGE_COUNT;
+}
+
+/**
+ * @brief Check that every message of the trimmed dialect is in the whole dialect, is listed once and fits the direct index.
+*/
+constexpr bool isMAVLinkDialectValid()
+{
+	for ( uint8_t i = 0; i < MAVLINK_DIALECT_MESSAGE_COUNT; i++ )
+	{
+		if ( MAVLINK_DIALECT_MESSAGE_IDS[i] >= MAVLINK_DIALECT_INDEX_SIZE || findFullDialectEntry( MAVLINK_DIALECT_MESSAGE_IDS[i] ) == MAVLINK_FULL_DIALECT_MESSAGE_COUNT )
+		{
+			return false;
+		}
+
+		for ( uint8_t j = 0; j < i; j++ )
+		{
+			if ( MAVLINK_DIALECT_MESSAGE_IDS[j] == MAVLINK_DIALECT_MESSAGE_IDS[i] )
+			{
+				return false;
+			}
+		}
+	}
+
+	return MAVLINK_DIALECT_MESSAGE_COUNT < MAVLINK_DIALECT_NO_ENTRY;
+}
+
+static_assert(isMAVLinkDialectValid(), "A message of the trimmed dialect is missing from the full dialect, listed twice or beyond the direct index");
+
+/**
+ * @brief Generate the trimmed dialect from the entries of the whole dialect, at compile time.
+*/
+constexpr MAVLinkDialectTable makeMAVLinkDialectTable()
+{
+	MAVLinkDialectTable table = {};
+
+	for ( uint16_t msgid = 0; msgid < MAVLINK_DIALECT_INDEX_SIZE; msgid++ )
+	{
+		table.index[msgid] = MAVLINK_DIALECT_NO_ENTRY;
+	}
+
+	for ( uint8_t i = 0; i < MAVLINK_DIALECT_MESSAGE_COUNT; i++ )
+	{
+		table.entries[i] = MAVLINK_FULL_DIALECT_ENTRIES[findFullDialectEntry( MAVLINK_DIALECT_MESSAGE_IDS[i] )];
+		table.index[MAVLINK_DIALECT_MESSAGE_IDS[i]] = i;
+	}
+
+	return table;
+}
+
+/**
+ * @brief The trimmed dialect, one copy for every parser. The full dialect keeps a copy of its table in each source file that parses.
+*/
+extern const MAVLinkDialectTable MAVLINK_DIALECT_TABLE;
+
+#if !MAVLINK_FULL_DIALECT
+static inline const mavlink_msg_entry_t* mavlink_get_msg_entry( uint32_t msgid )
+{
+	if ( msgid >= MAVLINK_DIALECT_INDEX_SIZE || MAVLINK_DIALECT_TABLE.index[msgid] == MAVLINK_DIALECT_NO_ENTRY )
+	{
+		return NULL;
+	}
+
+	return &MAVLINK_DIALECT_TABLE.entries[MAVLINK_DIALECT_TABLE.index[msgid]];
+}
+#endif
+
+/**
+ * @brief Write which dialect the parsers look messages up in to the log, with the size of its table and the cycles a lookup of each
+ * message of the trimmed dialect takes on average, the cost the parser pays for every frame.
+*/
+void logMAVLinkDialect();
+
+#endif
@@ -0,0 +1,176 @@
+//
+//
+//
+
+#include "MAVLinkEventBus.h"
+#include <ArduinoLog.h>
+#include "MissionMonitor.h"
+#include "MissionDownloader.h"
+#include "ThresholdSweep.h"
+#include "StressHarness.h"
+
+
+MAVLinkEventBus::MAVLinkEventBus()
+{
+	memset( _subscribers, 0, sizeof( _subscribers ) );
+	memset( _messageSubscribers, 0, sizeof( _messageSubscribers ) );
+	memset( _messageMask, 0, sizeof( _messageMask ) );
+}
+
+bool MAVLinkEventBus::subscribe( MAVLinkEventReceiver* receiver, uint8_t receiverClass, const char* name, const uint32_t* msgids, uint8_t count )
+{
+	if ( _subscriberCount >= MAVLINK_EVENT_BUS_CAPACITY )
+	{
+		Log.error( "Event bus is full, %s not subscribed", name );
+		return false;
+	}
+
+	MAVLinkEventSubscriber* subscriber = &_subscribers[_subscriberCount];
+
+	subscriber->receiver = receiver;
+	subscriber->receiverClass = receiverClass;
+	subscriber->name = name;
+
+	for ( uint8_t i = 0; i < count; i++ )
+	{
+		if ( msgids[i] >= FRAME_FILTER_MESSAGE_IDS )
+		{
+			Log.error( "Message id %u can't be delivered by the event bus", msgids[i] );
+			continue;
+		}
+
+		_messageSubscribers[msgids[i]] |= 1 << _subscriberCount;
+		_messageMask[msgids[i] >> 5] |= 1UL << (msgids[i] & 31);
+	}
+
+	_subscriberCount++;
+
+	return true;
+}
+
+const uint32_t* MAVLinkEventBus::getMessageMask()
+{
+	return _messageMask;
+}
+
+void MAVLinkEventBus::tick()
+{
+	uint32_t timeMilliseconds = millis();
+
+	if ( timeMilliseconds - _lastPublishMilliseconds < MAVLINK_EVENT_BUS_PUBLISH_MILLISECONDS )
+	{
+		return;
+	}
+
+	_lastPublishMilliseconds = timeMilliseconds;
+
+	for ( uint8_t i = 0; i < _subscriberCount; i++ )
+	{
+		MAVLinkEventSubscriber* subscriber = &_subscribers[i];
+
+		Log.trace( "Event bus %s: %u messages, %u cycles each, %u cycles at most",
+			subscriber->name,
+			subscriber->periodDeliveries,
+			subscriber->periodDeliveries == 0 ? 0 : (uint32_t)(subscriber->periodCycles / subscriber->periodDeliveries),
+			subscriber->worstCycles );
+
+		subscriber->periodDeliveries = 0;
+		subscriber->periodCycles = 0;
+		subscriber->worstCycles = 0;
+	}
+}
+
+void MAVLinkEventBus::onHeatbeat( mavlink_heartbeat_t mavlink_heartbeat )
+{
+	deliver( MAVLINK_MSG_ID_HEARTBEAT, mavlink_heartbeat, []( auto* receiver, const mavlink_heartbeat_t& message ) { receiver->onHeatbeat( message ); } );
+}
+
+void MAVLinkEventBus::onSysStatus( mavlink_sys_status_t mavlink_sys_status )
+{
+	deliver( MAVLINK_MSG_ID_SYS_STATUS, mavlink_sys_status, []( auto* receiver, const mavlink_sys_status_t& message ) { receiver->onSysStatus( message ); } );
+}
+
+void MAVLinkEventBus::onParamValue( mavlink_param_value_t mavlink_param_value )
+{
+	deliver( MAVLINK_MSG_ID_PARAM_VALUE, mavlink_param_value, []( auto* receiver, const mavlink_param_value_t& message ) { receiver->onParamValue( message ); } );
+}
+
+void MAVLinkEventBus::onRawIMU( mavlink_raw_imu_t mavlink_raw_imu )
+{
+	deliver( MAVLINK_MSG_ID_RAW_IMU, mavlink_raw_imu, []( auto* receiver, const mavlink_raw_imu_t& message ) { receiver->onRawIMU( message ); } );
+}
+
+void MAVLinkEventBus::onGPSInput( mavlink_gps_input_t mavlink_gps_input )
+{
+	deliver( MAVLINK_MSG_ID_GPS_INPUT, mavlink_gps_input, []( auto* receiver, const mavlink_gps_input_t& message ) { receiver->onGPSInput( message ); } );
+}
+
+void MAVLinkEventBus::onNavControllerOutput( mavlink_nav_controller_output_t mavlink_nav_controller )
+{
+	deliver( MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT, mavlink_nav_controller, []( auto* receiver, const mavlink_nav_controller_output_t& message ) { receiver->onNavControllerOutput( message ); } );
+}
+
+void MAVLinkEventBus::onMissionItemReached( mavlink_mission_item_reached_t mavlink_mission_item_reached )
+{
+	deliver( MAVLINK_MSG_ID_MISSION_ITEM_REACHED, mavlink_mission_item_reached, []( auto* receiver, const mavlink_mission_item_reached_t& message ) { receiver->onMissionItemReached( message ); } );
+}
+
+void MAVLinkEventBus::onGPSRawInt( mavlink_gps_raw_int_t mavlink_gps_raw_int )
+{
+	deliver( MAVLINK_MSG_ID_GPS_RAW_INT, mavlink_gps_raw_int, []( auto* receiver, const mavlink_gps_raw_int_t& message ) { receiver->onGPSRawInt( message ); } );
+}
+
+void MAVLinkEventBus::onGPS2Raw( mavlink_gps2_raw_t mavlink_gps2_raw )
+{
+	deliver( MAVLINK_MSG_ID_GPS2_RAW, mavlink_gps2_raw, []( auto* receiver, const mavlink_gps2_raw_t& message ) { receiver->onGPS2Raw( message ); } );
+}
+
+void MAVLinkEventBus::onGlobalPositionInt( mavlink_global_position_int_t mavlink_global_position_int )
+{
+	deliver( MAVLINK_MSG_ID_GLOBAL_POSITION_INT, mavlink_global_position_int, []( auto* receiver, const mavlink_global_position_int_t& message ) { receiver->onGlobalPositionInt( message ); } );
+}
+
+void MAVLinkEventBus::onMissionCurrent( mavlink_mission_current_t mavlink_mission_current )
+{
+	deliver( MAVLINK_MSG_ID_MISSION_CURRENT, mavlink_mission_current, []( auto* receiver, const mavlink_mission_current_t& message ) { receiver->onMissionCurrent( message ); } );
+}
+
+void MAVLinkEventBus::onMissionCount( mavlink_mission_count_t mavlink_mission_count )
+{
+	deliver( MAVLINK_MSG_ID_MISSION_COUNT, mavlink_mission_count, []( auto* receiver, const mavlink_mission_count_t& message ) { receiver->onMissionCount( message ); } );
+}
+
+void MAVLinkEventBus::onMissionItemInt( mavlink_mission_item_int_t mavlink_mission_item_int )
+{
+	deliver( MAVLINK_MSG_ID_MISSION_ITEM_INT, mavlink_mission_item_int, []( auto* receiver, const mavlink_mission_item_int_t& message ) { receiver->onMissionItemInt( message ); } );
+}
+
+void MAVLinkEventBus::onMissionAck( mavlink_mission_ack_t mavlink_mission_ack )
+{
+	deliver( MAVLINK_MSG_ID_MISSION_ACK, mavlink_mission_ack, []( auto* receiver, const mavlink_mission_ack_t& message ) { receiver->onMissionAck( message ); } );
+}
+
+void MAVLinkEventBus::onRCChannels( mavlink_rc_channels_t mavlink_rc_channels )
+{
+	deliver( MAVLINK_MSG_ID_RC_CHANNELS, mavlink_rc_channels, []( auto* receiver, const mavlink_rc_channels_t& message ) { receiver->onRCChannels( message ); } );
+}
+
+void MAVLinkEventBus::onSystemTime( mavlink_system_time_t mavlink_system_time )
+{
+	deliver( MAVLINK_MSG_ID_SYSTEM_TIME, mavlink_system_time, []( auto* receiver, const mavlink_system_time_t& message ) { receiver->onSystemTime( message ); } );
+}
+
+void MAVLinkEventBus::onParamRequestRead( mavlink_param_request_read_t mavlink_param_request_read )
+{
+	deliver( MAVLINK_MSG_ID_PARAM_REQUEST_READ, mavlink_param_request_read, []( auto* receiver, const mavlink_param_request_read_t& message ) { receiver->onParamRequestRead( message ); } );
+}
+
+void MAVLinkEventBus::onParamRequestList( mavlink_param_request_list_t mavlink_param_request_list )
+{
+	deliver( MAVLINK_MSG_ID_PARAM_REQUEST_LIST, mavlink_param_request_list, []( auto* receiver, const mavlink_param_request_list_t& message ) { receiver->onParamRequestList( message ); } );
+}
+
+void MAVLinkEventBus::onParamSet( mavlink_param_set_t mavlink_param_set )
+{
+	deliver( MAVLINK_MSG_ID_PARAM_SET, mavlink_param_set, []( auto* receiver, const mavlink_param_set_t& message ) { receiver->onParamSet( message ); } );
+}
@@ -0,0 +1,197 @@
+// MAVLinkEventBus.h
+
+#ifndef _MAVLINKEVENTBUS_h
+#define _MAVLINKEVENTBUS_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "MAVLinkEventReceiver.h"
+#include "MAVLinkReader.h"
+
+class MissionMonitor;
+class MissionDownloader;
+class ThresholdSweep;
+class StressHarness;
+
+constexpr uint8_t MAVLINK_EVENT_BUS_CAPACITY = 8;                ///< Subscribers the bus can hold, one bit per subscriber in the delivery table
+constexpr uint32_t MAVLINK_EVENT_BUS_PUBLISH_MILLISECONDS = 10000; ///< How often the cost of every subscriber is written to the log
+
+/**
+ * @brief A list of receiver classes.
+*/
+template <class... Receivers>
+struct MAVLinkEventReceiverList
+{
+};
+
+/**
+ * @brief The receiver classes the event bus calls directly. The bus knows the class of every subscriber, so it calls the handlers
+ * of these directly and the compiler can inline them, rather than going through the virtual table. The classes are final, so the
+ * call reaches the handler of the object itself. Any other receiver can subscribe too, its handlers are called through the
+ * virtual table. Only the bus's own source file needs the declarations of these classes.
+*/
+typedef MAVLinkEventReceiverList<MissionMonitor, MissionDownloader, ThresholdSweep, StressHarness> MAVLinkEventBusReceivers;
+
+/**
+ * @brief Find the position of a receiver class in a list, at compile time. A class that isn't in the list gets the length of the list.
+*/
+template <class Receiver, class List>
+struct MAVLinkEventReceiverIndex;
+
+template <class Receiver>
+struct MAVLinkEventReceiverIndex<Receiver, MAVLinkEventReceiverList<>>
+{
+	static constexpr uint8_t value = 0;
+};
+
+template <class Receiver, class... Others>
+struct MAVLinkEventReceiverIndex<Receiver, MAVLinkEventReceiverList<Receiver, Others...>>
+{
+	static constexpr uint8_t value = 0;
+};
+
+template <class Receiver, class First, class... Others>
+struct MAVLinkEventReceiverIndex<Receiver, MAVLinkEventReceiverList<First, Others...>>
+{
+	static constexpr uint8_t value = 1 + MAVLinkEventReceiverIndex<Receiver, MAVLinkEventReceiverList<Others...>>::value;
+};
+
+/**
+ * @brief A subscriber of the event bus and the cost of delivering messages to it.
+*/
+struct MAVLinkEventSubscriber
+{
+	MAVLinkEventReceiver* receiver;
+	uint8_t receiverClass;     ///< Position of the class of the receiver in MAVLinkEventBusReceivers, past the end for other classes
+	const char* name;
+	uint32_t periodDeliveries;
+	uint64_t periodCycles;
+	uint32_t worstCycles;      ///< Longest single delivery in the period
+};
+
+/**
+ * @brief MAVLinkEventBus lets several event receivers share one MAVLink reader. The reader decodes a message once and the bus
+ * hands the same decoded message to every subscriber of its message id, in the order they subscribed.
+ * Each message id keeps a mask of its subscribers, so a message costs one direct call per subscriber that wants it and nothing
+ * for the others. Subscribers live in a fixed table, nothing is allocated once they are registered.
+ * The processor cycles spent in each subscriber are counted separately and written to the log periodically.
+*/
+class MAVLinkEventBus final : public MAVLinkEventReceiver
+{
+public:
+	MAVLinkEventBus();
+
+	/**
+	 * @brief Register a receiver for a list of message ids. Messages are delivered in the order receivers subscribed.
+	 * @param receiver The receiver, called directly if its class is in MAVLinkEventBusReceivers, through the virtual table otherwise.
+	 * @param name The name of the receiver in the log.
+	 * @param msgids The message ids the receiver handles.
+	 * @return False if the bus is full.
+	*/
+	template <class Receiver, size_t Count>
+	bool subscribe( Receiver* receiver, const char* name, const uint32_t( &msgids )[Count] )
+	{
+		return subscribe( receiver, MAVLinkEventReceiverIndex<Receiver, MAVLinkEventBusReceivers>::value, name, msgids, Count );
+	}
+
+	/**
+	 * @brief Get the message ids any subscriber handles, for the header filter of the reader.
+	 * @return Bit per message id, FRAME_FILTER_MESSAGE_IDS bits.
+	*/
+	const uint32_t* getMessageMask();
+
+	virtual void onHeatbeat( mavlink_heartbeat_t mavlink_heartbeat );
+	virtual void onSysStatus( mavlink_sys_status_t mavlink_sys_status );
+	virtual void onParamValue( mavlink_param_value_t mavlink_param_value );
+	virtual void onRawIMU( mavlink_raw_imu_t mavlink_raw_imu );
+	virtual void onGPSInput( mavlink_gps_input_t mavlink_gps_input );
+	virtual void onNavControllerOutput( mavlink_nav_controller_output_t mavlink_nav_controller );
+	virtual void onMissionItemReached( mavlink_mission_item_reached_t mavlink_mission_item_reached );
+	virtual void onGPSRawInt( mavlink_gps_raw_int_t mavlink_gps_raw_int );
+	virtual void onGPS2Raw( mavlink_gps2_raw_t mavlink_gps2_raw );
+	virtual void onGlobalPositionInt( mavlink_global_position_int_t mavlink_global_position_int );
+	virtual void onMissionCurrent( mavlink_mission_current_t mavlink_mission_current );
+	virtual void onMissionCount( mavlink_mission_count_t mavlink_mission_count );
+	virtual void onMissionItemInt( mavlink_mission_item_int_t mavlink_mission_item_int );
+	virtual void onMissionAck( mavlink_mission_ack_t mavlink_mission_ack );
+	virtual void onRCChannels( mavlink_rc_channels_t mavlink_rc_channels );
+	virtual void onSystemTime( mavlink_system_time_t mavlink_system_time );
+	virtual void onParamRequestRead( mavlink_param_request_read_t mavlink_param_request_read );
+	virtual void onParamRequestList( mavlink_param_request_list_t mavlink_param_request_list );
+	virtual void onParamSet( mavlink_param_set_t mavlink_param_set );
+
+	/**
+	 * @brief Write the cost of every subscriber to the log when the publish period is over.
+	*/
+	virtual void tick();
+
+private:
+	bool subscribe( MAVLinkEventReceiver* receiver, uint8_t receiverClass, const char* name, const uint32_t* msgids, uint8_t count );
+
+	/**
+	 * @brief Hand a decoded message to the subscribers of its id and count the cycles each one takes.
+	 * @param msgid The message id.
+	 * @param message The decoded message, shared by all subscribers.
+	 * @param handler Calls the handler of the message on a receiver of any class in MAVLinkEventBusReceivers, or on MAVLinkEventReceiver.
+	*/
+	template <class Message, class Handler>
+	void deliver( uint32_t msgid, const Message& message, Handler handler )
+	{
+		uint8_t subscribers = msgid < FRAME_FILTER_MESSAGE_IDS ? _messageSubscribers[msgid] : 0;
+
+		while ( subscribers != 0 )
+		{
+			uint8_t i = __builtin_ctz( subscribers );
+			MAVLinkEventSubscriber* subscriber = &_subscribers[i];
+			uint32_t startCycles = ARM_DWT_CYCCNT;
+
+			subscribers &= ~(1 << i);
+			call( subscriber->receiver, subscriber->receiverClass, message, handler, MAVLinkEventBusReceivers() );
+
+			uint32_t cycles = ARM_DWT_CYCCNT - startCycles;
+
+			subscriber->periodCycles += cycles;
+			subscriber->periodDeliveries++;
+
+			if ( cycles > subscriber->worstCycles )
+			{
+				subscriber->worstCycles = cycles;
+			}
+		}
+	}
+
+	/**
+	 * @brief Call a handler on a receiver as the class it was subscribed as, found by comparing its position with each class of the list.
+	 * A receiver whose class isn't in the list is called through the virtual table.
+	*/
+	template <class Message, class Handler, class Receiver, class... Others>
+	static void call( MAVLinkEventReceiver* receiver, uint8_t receiverClass, const Message& message, Handler& handler, MAVLinkEventReceiverList<Receiver, Others...> )
+	{
+		if ( receiverClass == 0 )
+		{
+			handler( static_cast<Receiver*>( receiver ), message );
+		}
+		else
+		{
+			call( receiver, receiverClass - 1, message, handler, MAVLinkEventReceiverList<Others...>() );
+		}
+	}
+
+	template <class Message, class Handler>
+	static void call( MAVLinkEventReceiver* receiver, uint8_t receiverClass, const Message& message, Handler& handler, MAVLinkEventReceiverList<> )
+	{
+		handler( receiver, message );
+	}
+
+	MAVLinkEventSubscriber _subscribers[MAVLINK_EVENT_BUS_CAPACITY];
+	uint8_t _subscriberCount = 0;
+	uint8_t _messageSubscribers[FRAME_FILTER_MESSAGE_IDS];          ///< Bit per subscriber of each message id
+	uint32_t _messageMask[FRAME_FILTER_MESSAGE_IDS / 32];           ///< Bit per message id with at least one subscriber
+	uint32_t _lastPublishMilliseconds = 0;
+};
+
+#endif
@@ -9,38 +9,52 @@
 #include "WProgram.h"
 #endif
 
-#include <mavlink_2_ardupilot.h>
+#include "MAVLinkDialect.h"
 
 
+/**
+ * @brief Receives the events of a MAVLinkReader. The handlers do nothing by default and are defined here so that a reader
+ * bound to a receiver at compile time can inline them, the handlers the receiver doesn't override then cost nothing.
+*/
 class MAVLinkEventReceiver
 {
 
 public:
 	MAVLinkEventReceiver();
 
-	virtual void onHeatbeat( mavlink_heartbeat_t  mavlink_heartbeat );
-	virtual void onSysStatus( mavlink_sys_status_t  mavlink_sys_status );
-	virtual void onParamValue( mavlink_param_value_t  mavlink_param_value );
-	virtual void onRawIMU( mavlink_raw_imu_t mavlink_raw_imu );
-	virtual void onGPSInput( mavlink_gps_input_t mavlink_gps_input );
-	virtual void onNavControllerOutput( mavlink_nav_controller_output_t mavlink_nav_controller );
-	virtual void onMissionItemReached( mavlink_mission_item_reached_t mavlink_mission_item_reached );
-	virtual void onGPSRawInt( mavlink_gps_raw_int_t mavlink_gps_raw_int );
-	virtual void onGPS2Raw( mavlink_gps2_raw_t mavlink_gps2_raw );
-	virtual void onMissionCurrent( mavlink_mission_current_t mavlink_mission_current );
-	virtual void onRCChannels( mavlink_rc_channels_t mavlink_rc_channels );
-	virtual void onSystemTime( mavlink_system_time_t mavlink_system_time );
+	virtual void onHeatbeat( mavlink_heartbeat_t  mavlink_heartbeat ) {}
+	virtual void onSysStatus( mavlink_sys_status_t  mavlink_sys_status ) {}
+	virtual void onParamValue( mavlink_param_value_t  mavlink_param_value ) {}
+	virtual void onRawIMU( mavlink_raw_imu_t mavlink_raw_imu ) {}
+	virtual void onGPSInput( mavlink_gps_input_t mavlink_gps_input ) {}
+	virtual void onNavControllerOutput( mavlink_nav_controller_output_t mavlink_nav_controller ) {}
+	virtual void onMissionItemReached( mavlink_mission_item_reached_t mavlink_mission_item_reached ) {}
+	virtual void onGPSRawInt( mavlink_gps_raw_int_t mavlink_gps_raw_int ) {}
+	virtual void onGPS2Raw( mavlink_gps2_raw_t mavlink_gps2_raw ) {}
+	virtual void onGlobalPositionInt( mavlink_global_position_int_t mavlink_global_position_int ) {}
+	virtual void onMissionCurrent( mavlink_mission_current_t mavlink_mission_current ) {}
+	virtual void onMissionCount( mavlink_mission_count_t mavlink_mission_count ) {}
+	virtual void onMissionItemInt( mavlink_mission_item_int_t mavlink_mission_item_int ) {}
+	virtual void onMissionAck( mavlink_mission_ack_t mavlink_mission_ack ) {}
+	virtual void onRCChannels( mavlink_rc_channels_t mavlink_rc_channels ) {}
+	virtual void onSystemTime( mavlink_system_time_t mavlink_system_time ) {}
+	virtual void onParamRequestRead( mavlink_param_request_read_t mavlink_param_request_read ) {}
+	virtual void onParamRequestList( mavlink_param_request_list_t mavlink_param_request_list ) {}
+	virtual void onParamSet( mavlink_param_set_t mavlink_param_set ) {}
 	virtual void setMissionTimeCallback( uint32_t( *missionTimeCallback ) () );
 	virtual void setSendModeChangeCallback( void(*sendModeChangeCallback) (ROVER_MODE roverMode) );
+	virtual void setSendParamValueCallback( void(*sendParamValueCallback) (const char* parameterId, float value, uint16_t index, uint16_t count) );
 
 	virtual void tick();
 
 protected:
 	long long getMissionTime();
 	void sendModeChange( ROVER_MODE roverMode );
+	void sendParamValue( const char* parameterId, float value, uint16_t index, uint16_t count );
 
-	uint32_t( *_missionTimeCallback ) ();
-	void( *_sendModeChangeCallback ) (ROVER_MODE roverMode);
+	uint32_t( *_missionTimeCallback ) () = NULL;
+	void( *_sendModeChangeCallback ) (ROVER_MODE roverMode) = NULL;
+	void( *_sendParamValueCallback ) (const char* parameterId, float value, uint16_t index, uint16_t count) = NULL;
 
 };
 
@@ -14,162 +14,394 @@
  */
 
 #include "MAVLinkReader.h"
+#include <ArduinoLog.h>
 
 
 
-MAVLinkReader::MAVLinkReader( MAVLinkEventReceiver* mavlinkEventReceiver )
+/**
+ * @brief Messages that have a handler in dispatchMessage(), the header filter skips everything else
+*/
+constexpr uint32_t HANDLED_MESSAGE_IDS[] = {
+	MAVLINK_MSG_ID_HEARTBEAT,
+	MAVLINK_MSG_ID_SYS_STATUS,
+	MAVLINK_MSG_ID_SYSTEM_TIME,
+	MAVLINK_MSG_ID_PARAM_VALUE,
+	MAVLINK_MSG_ID_GPS_RAW_INT,
+	MAVLINK_MSG_ID_RAW_IMU,
+	MAVLINK_MSG_ID_GLOBAL_POSITION_INT,
+	MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT,
+	MAVLINK_MSG_ID_MISSION_CURRENT,
+	MAVLINK_MSG_ID_MISSION_ITEM_REACHED,
+	MAVLINK_MSG_ID_MISSION_COUNT,
+	MAVLINK_MSG_ID_MISSION_ITEM_INT,
+	MAVLINK_MSG_ID_MISSION_ACK,
+	MAVLINK_MSG_ID_RC_CHANNELS,
+	MAVLINK_MSG_ID_GPS2_RAW,
+	MAVLINK_MSG_ID_GPS_INPUT
+};
+
+/**
+ * @brief Messages sent to Restraining Bolt itself, usually by a ground station, so they are accepted from any system
+*/
+constexpr uint32_t ANY_SOURCE_MESSAGE_IDS[] = {
+	MAVLINK_MSG_ID_PARAM_REQUEST_READ,
+	MAVLINK_MSG_ID_PARAM_REQUEST_LIST,
+	MAVLINK_MSG_ID_PARAM_SET
+};
+
+
+MAVLinkReader::MAVLinkReader( MAVLinkEventReceiver* mavlinkEventReceiver, const char* sourceName )
+	: _linkStatistics( sourceName )
 {
 	_mavlinkEventReceiver = mavlinkEventReceiver;
+	memset( &_mavlinkStatus, 0, sizeof( _mavlinkStatus ) );
+	memset( _subscribedMessages, 0, sizeof( _subscribedMessages ) );
+	memset( _anySourceSubscribedMessages, 0, sizeof( _anySourceSubscribedMessages ) );
+
+	for ( uint32_t msgid : HANDLED_MESSAGE_IDS )
+	{
+		subscribe( msgid );
+	}
+
+	for ( uint32_t msgid : ANY_SOURCE_MESSAGE_IDS )
+	{
+		subscribe( msgid, true );
+	}
 }
 
 
 bool MAVLinkReader::receiveMAVLinkMessages()
 {
+	// Every byte goes through the virtual readByte() and every message through the virtual handlers of the receiver
+	return receiveMessages( _mavlinkEventReceiver, [this]( uint8_t* byteBuffer ) { return readByte( byteBuffer ); } );
+}
 
-	uint8_t byteBuffer = 0;
-
-	while ( readByte( &byteBuffer ) )
+bool MAVLinkReader::filterByte( uint8_t byteBuffer, mavlink_message_t* mavlinkMessage )
+{
+	switch ( _frameFilterState )
 	{
-		mavlink_message_t mavlinkMessage;
-		mavlink_status_t status;
+		case FRAME_FILTER_PARSE:
+			{
+				bool messageReceived = parseByte( byteBuffer, mavlinkMessage );
 
-		// Try to get a new message
-		if ( mavlink_parse_char( MAVLINK_COMM_0, byteBuffer, &mavlinkMessage, &status ) == MAVLINK_FRAMING_OK )
-		{
-			// Handle message
-			switch ( mavlinkMessage.msgid )
+				// Hand control back to the filter once the parser is looking for a new frame
+				if ( mavlink_get_channel_status( MAVLINK_COMM_0 )->parse_state <= MAVLINK_PARSE_STATE_IDLE )
+				{
+					_frameFilterState = FRAME_FILTER_IDLE;
+				}
+
+				return messageReceived;
+			}
+
+		case FRAME_FILTER_SKIP:
+			_skipBuffer[_skipLength++] = byteBuffer;
+
+			if ( --_skipBytesRemaining == 0 )
 			{
-				case MAVLINK_MSG_ID_HEARTBEAT: // #0: Heartbeat
-					{
+				_frameFilterState = FRAME_FILTER_SKIP_END;
+			}
+			return false;
 
-						mavlink_heartbeat_t heartbeat;
-						mavlink_msg_heartbeat_decode( &mavlinkMessage, &heartbeat );
+		case FRAME_FILTER_SKIP_END:
+			_frameFilterState = FRAME_FILTER_IDLE;
 
-						_mavlinkEventReceiver->onHeatbeat( heartbeat );
+			if ( byteBuffer == MAVLINK_STX || byteBuffer == MAVLINK_STX_MAVLINK1 )
+			{
+				// The next frame starts where the header said the skipped one ends
+				_linkStatistics.onFrameFiltered( _skipSysid, _skipCompid, _skipSequence, _skipMsgid, _skipFrameLength );
+				return filterByte( byteBuffer, mavlinkMessage );
+			}
 
-					}
-					break;
-				case MAVLINK_MSG_ID_SYSTEM_TIME: // #2: SYSTEM_TIME
+			// The length byte was noise, a start byte in the skipped bytes may begin a real frame
+			resynchronize( byteBuffer );
+			return false;
+
+		case FRAME_FILTER_HEADER:
+			{
+				_frameHeader[_frameHeaderLength++] = byteBuffer;
+
+				uint8_t headerLength = _frameHeader[0] == MAVLINK_STX_MAVLINK1 ? MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1 : MAVLINK_NUM_HEADER_BYTES;
+
+				if ( _frameHeaderLength < headerLength )
+				{
+					return false;
+				}
+
+				if ( acceptFrameHeader() )
+				{
+					// The header bytes were held back, replay them into the parser. A frame can't complete inside its header.
+					for ( uint8_t i = 0; i < _frameHeaderLength; i++ )
 					{
-						mavlink_system_time_t system_time;
-						mavlink_msg_system_time_decode( &mavlinkMessage, &system_time );
-						_systemBootTimeMilliseconds = system_time.time_boot_ms;
-						_mavlinkEventReceiver->onSystemTime( system_time );
+						parseByte( _frameHeader[i], mavlinkMessage );
 					}
-					break;
 
-				case MAVLINK_MSG_ID_SYS_STATUS: // #1: SYS_STATUS
-					{
-						mavlink_sys_status_t sys_status;
-						mavlink_msg_sys_status_decode( &mavlinkMessage, &sys_status );
+					bool parserIdle = mavlink_get_channel_status( MAVLINK_COMM_0 )->parse_state <= MAVLINK_PARSE_STATE_IDLE;
+					_frameFilterState = parserIdle ? FRAME_FILTER_IDLE : FRAME_FILTER_PARSE;
+				}
+				else
+				{
+					// The header is held back with the rest of the frame in case the filter has to resynchronize
+					memcpy( _skipBuffer, _frameHeader, _frameHeaderLength );
+					_skipLength = _frameHeaderLength;
+					_frameFilterState = FRAME_FILTER_SKIP;
+				}
+
+				return false;
+			}
 
-						_mavlinkEventReceiver->onSysStatus( sys_status );
-					}
-					break;
+		case FRAME_FILTER_IDLE:
+		default:
+			// Anything between frames is dropped, the same as the parser would do
+			if ( byteBuffer == MAVLINK_STX || byteBuffer == MAVLINK_STX_MAVLINK1 )
+			{
+				_frameHeader[0] = byteBuffer;
+				_frameHeaderLength = 1;
+				_frameFilterState = FRAME_FILTER_HEADER;
+			}
+			return false;
+	}
+}
 
-				case MAVLINK_MSG_ID_PARAM_VALUE: // #22: PARAM_VALUE
-					{
-						mavlink_param_value_t param_value;
-						mavlink_msg_param_value_decode( &mavlinkMessage, &param_value );
+bool MAVLinkReader::acceptFrameHeader()
+{
+	uint8_t payloadLength = _frameHeader[1];
+	uint8_t incompatFlags = 0;
+	uint8_t sequence, sysid, compid;
+	uint32_t msgid;
+	uint16_t headerLength;
 
-						_mavlinkEventReceiver->onParamValue( param_value );
-					}
-					break;
+	if ( _frameHeader[0] == MAVLINK_STX_MAVLINK1 )
+	{
+		sequence = _frameHeader[2];
+		sysid = _frameHeader[3];
+		compid = _frameHeader[4];
+		msgid = _frameHeader[5];
+		headerLength = MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1;
+	}
+	else
+	{
+		incompatFlags = _frameHeader[2];
+		sequence = _frameHeader[4];
+		sysid = _frameHeader[5];
+		compid = _frameHeader[6];
+		msgid = _frameHeader[7] | ((uint32_t)_frameHeader[8] << 8) | ((uint32_t)_frameHeader[9] << 16);
+		headerLength = MAVLINK_NUM_HEADER_BYTES;
+
+		// Let the parser deal with headers it doesn't understand, it knows how to resynchronize
+		if ( (incompatFlags & ~MAVLINK_IFLAG_MASK) != 0 )
+		{
+			return true;
+		}
+	}
 
-				case MAVLINK_MSG_ID_RAW_IMU: // #27: RAW_IMU
-					{
-						mavlink_raw_imu_t imuRaw;
-						mavlink_msg_raw_imu_decode( &mavlinkMessage, &imuRaw );
+	if ( isSubscribed( msgid, sysid, compid ) )
+	{
+		return true;
+	}
 
-						_mavlinkEventReceiver->onRawIMU( imuRaw );
-					}
-					break;
+	uint16_t signatureLength = (incompatFlags & MAVLINK_IFLAG_SIGNED) ? MAVLINK_SIGNATURE_BLOCK_LEN : 0;
 
-				case MAVLINK_MSG_ID_GPS_RAW_INT: // 24
-					{
-						mavlink_gps_raw_int_t gpsRaw;
-						mavlink_msg_gps_raw_int_decode( &mavlinkMessage, &gpsRaw );
+	_skipBytesRemaining = payloadLength + MAVLINK_NUM_CHECKSUM_BYTES + signatureLength;
+	_skipFrameLength = headerLength + _skipBytesRemaining;
+	_skipSysid = sysid;
+	_skipCompid = compid;
+	_skipSequence = sequence;
+	_skipMsgid = msgid;
 
-						_mavlinkEventReceiver->onGPSRawInt( gpsRaw );
+	return false;
+}
 
-					}
-					break;
+void MAVLinkReader::resynchronize( uint8_t byteBuffer )
+{
+	uint16_t start = 1;
 
-				case MAVLINK_MSG_ID_GPS2_RAW:  //124 
-					{
-						mavlink_gps2_raw_t gpsRaw;
-						mavlink_msg_gps2_raw_decode( &mavlinkMessage, &gpsRaw );
+	while ( start < _skipLength && _skipBuffer[start] != MAVLINK_STX && _skipBuffer[start] != MAVLINK_STX_MAVLINK1 )
+	{
+		start++;
+	}
 
-						_mavlinkEventReceiver->onGPS2Raw( gpsRaw );
+	// The bytes in front of the start byte stay discarded, the rest and the byte after them are filtered again
+	uint16_t resyncLength = _skipLength - start + 1;
 
-					}
-					break;
+	if ( _replayPosition < _replayLength )
+	{
+		// The skipped frame came from the replay buffer, its bytes are right before the replay position
+		_replayPosition -= resyncLength;
+	}
+	else
+	{
+		memcpy( _replayBuffer, _skipBuffer + start, _skipLength - start );
+		_replayBuffer[resyncLength - 1] = byteBuffer;
+		_replayLength = resyncLength;
+		_replayPosition = 0;
+	}
+}
 
-				case MAVLINK_MSG_ID_GPS_INPUT: // 232
-					{
-						mavlink_gps_input_t  gpsInput;
-						mavlink_msg_gps_input_decode( &mavlinkMessage, &gpsInput );
+void MAVLinkReader::flushFrameFilter()
+{
+	if ( _frameFilterState == FRAME_FILTER_SKIP_END )
+	{
+		_linkStatistics.onFrameFiltered( _skipSysid, _skipCompid, _skipSequence, _skipMsgid, _skipFrameLength );
+		_frameFilterState = FRAME_FILTER_IDLE;
+	}
+}
 
-						_mavlinkEventReceiver->onGPSInput( gpsInput );
-					}
-					break;
+void MAVLinkReader::setFlightControllerSystemId( uint8_t systemId )
+{
+	_flightControllerSystemId = systemId;
+	_flightControllerComponentId = 0;
+	_flightControllerFound = false;
+}
 
+bool MAVLinkReader::isFlightControllerFound()
+{
+	return _flightControllerFound;
+}
 
-				case MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT: // #62
-					{
-						mavlink_nav_controller_output_t navOutput;
-						mavlink_msg_nav_controller_output_decode( &mavlinkMessage, &navOutput );
+bool MAVLinkReader::isFlightControllerHeartbeat( const mavlink_message_t* mavlinkMessage, const mavlink_heartbeat_t& heartbeat )
+{
+	if ( _flightControllerFound )
+	{
+		return mavlinkMessage->sysid == _flightControllerSystemId && mavlinkMessage->compid == _flightControllerComponentId;
+	}
 
-						_mavlinkEventReceiver->onNavControllerOutput( navOutput );
-					}
-					break;
+	// Ground stations, companion computers and gimbals send heartbeats too, without an autopilot
+	if ( heartbeat.autopilot == MAV_AUTOPILOT_INVALID || (_flightControllerSystemId != 0 && mavlinkMessage->sysid != _flightControllerSystemId) )
+	{
+		return false;
+	}
 
-				case MAVLINK_MSG_ID_MISSION_ITEM_REACHED:
-					{
-						mavlink_mission_item_reached_t itemReached;
-						mavlink_msg_mission_item_reached_decode( &mavlinkMessage, &itemReached );
+	_flightControllerSystemId = mavlinkMessage->sysid;
+	_flightControllerComponentId = mavlinkMessage->compid;
+	_flightControllerFound = true;
+	Log.trace( "Flight controller found, system id %u, component id %u", _flightControllerSystemId, _flightControllerComponentId );
 
-						_mavlinkEventReceiver->onMissionItemReached( itemReached );
+	return true;
+}
 
-					}
-					break;
+bool MAVLinkReader::isSubscribed( uint32_t msgid, uint8_t sysid, uint8_t compid )
+{
+	if ( msgid >= FRAME_FILTER_MESSAGE_IDS )
+	{
+		return false;
+	}
 
-				case MAVLINK_MSG_ID_MISSION_CURRENT:
-					{
-						mavlink_mission_current_t current;
-						mavlink_msg_mission_current_decode( &mavlinkMessage, &current );
+	uint32_t bit = 1UL << (msgid & 31);
 
-						_mavlinkEventReceiver->onMissionCurrent( current );
+	if ( _anySourceSubscribedMessages[msgid >> 5] & bit )
+	{
+		return true;
+	}
 
-					}
-					break;
-				case MAVLINK_MSG_ID_RC_CHANNELS:
-					{
-						mavlink_rc_channels_t rcChannels;
-						mavlink_msg_rc_channels_decode( &mavlinkMessage, &rcChannels );
+	if ( !_flightControllerFound )
+	{
+		// The flight controller is found by its heartbeat, nothing else can be told apart until then
+		return msgid == MAVLINK_MSG_ID_HEARTBEAT && (_flightControllerSystemId == 0 || sysid == _flightControllerSystemId);
+	}
 
-						_systemBootTimeMilliseconds = rcChannels.time_boot_ms;
-						_mavlinkEventReceiver->onRCChannels( rcChannels );
-					}
-					break;
-				default:
-					//Log.trace("Got unhandled message id: %d", mavlinkMessage.msgid);
-					break;
+	return sysid == _flightControllerSystemId && compid == _flightControllerComponentId && (_subscribedMessages[msgid >> 5] & bit);
+}
 
-			}
+bool MAVLinkReader::isFromFlightController( const mavlink_message_t* mavlinkMessage )
+{
+	return _flightControllerFound && mavlinkMessage->sysid == _flightControllerSystemId && mavlinkMessage->compid == _flightControllerComponentId;
+}
 
-			return true;
+bool MAVLinkReader::isTargeted( uint8_t targetSystem, uint8_t targetComponent )
+{
+	// Zero is a broadcast to every system or component
+	return (targetSystem == _systemId || targetSystem == 0) && (targetComponent == _componentId || targetComponent == 0);
+}
+
+void MAVLinkReader::subscribe( uint32_t msgid, bool anySource )
+{
+	if ( msgid >= FRAME_FILTER_MESSAGE_IDS )
+	{
+		Log.error( "Message id %u can't be subscribed to by the header filter", msgid );
+		return;
+	}
 
+	if ( anySource )
+	{
+		_anySourceSubscribedMessages[msgid >> 5] |= 1UL << (msgid & 31);
+	}
+	else
+	{
+		_subscribedMessages[msgid >> 5] |= 1UL << (msgid & 31);
+	}
+}
+
+void MAVLinkReader::setSubscribedMessages( const uint32_t* messageMask )
+{
+	memcpy( _subscribedMessages, messageMask, sizeof( _subscribedMessages ) );
+
+	// Mission time follows the flight controller clock whether or not a receiver wants these
+	subscribe( MAVLINK_MSG_ID_SYSTEM_TIME );
+	subscribe( MAVLINK_MSG_ID_RC_CHANNELS );
+}
+
+void MAVLinkReader::setFrameFilter( bool enabled )
+{
+	// Every reload of the configuration sets the filter again, a frame held back by the filter must survive that
+	if ( enabled == _frameFilterEnabled )
+	{
+		return;
+	}
+
+	// The parser may be part way through a frame, the filter takes over once it is looking for the next one
+	_frameFilterEnabled = enabled;
+	_frameFilterState = FRAME_FILTER_PARSE;
+}
+
+bool MAVLinkReader::parseByte( uint8_t byteBuffer, mavlink_message_t* mavlinkMessage )
+{
+	// Try to get a new message
+	uint8_t framingResult = mavlink_frame_char( MAVLINK_COMM_0, byteBuffer, mavlinkMessage, &_mavlinkStatus );
+
+	if ( framingResult == MAVLINK_FRAMING_BAD_CRC || framingResult == MAVLINK_FRAMING_BAD_SIGNATURE )
+	{
+		// A message outside the dialect has no CRC extra to check it with, it wasn't corrupted but skipped
+		bool outsideDialect = framingResult == MAVLINK_FRAMING_BAD_CRC && mavlink_get_msg_entry( mavlinkMessage->msgid ) == NULL;
+
+		if ( outsideDialect )
+		{
+			_linkStatistics.onFrameFiltered( mavlinkMessage->sysid, mavlinkMessage->compid, mavlinkMessage->seq, mavlinkMessage->msgid, LinkStatistics::frameLength( mavlinkMessage ) );
+		}
+		else
+		{
+			_linkStatistics.onCrcError( mavlinkMessage->sysid, mavlinkMessage->compid, LinkStatistics::frameLength( mavlinkMessage ) );
+		}
+
+		// Same recovery as mavlink_parse_char(), the byte that ended the bad frame may start the next one.
+		// A frame outside the dialect ended where its header said, its last byte is a checksum byte.
+		mavlink_status_t* channelStatus = mavlink_get_channel_status( MAVLINK_COMM_0 );
+		channelStatus->msg_received = MAVLINK_FRAMING_INCOMPLETE;
+		channelStatus->parse_state = MAVLINK_PARSE_STATE_IDLE;
+
+		if ( byteBuffer == MAVLINK_STX && !outsideDialect )
+		{
+			mavlink_message_t* channelMessage = mavlink_get_channel_buffer( MAVLINK_COMM_0 );
+			channelStatus->parse_state = MAVLINK_PARSE_STATE_GOT_STX;
+			channelMessage->len = 0;
+			mavlink_start_checksum( channelMessage );
 		}
 
+		return false;
 	}
 
-	return false;
+	if ( framingResult != MAVLINK_FRAMING_OK )
+	{
+		return false;
+	}
+
+	_linkStatistics.onFrame( mavlinkMessage->sysid, mavlinkMessage->compid, mavlinkMessage->seq, mavlinkMessage->msgid, LinkStatistics::frameLength( mavlinkMessage ) );
+
+	return true;
 }
 
 void MAVLinkReader::tick()
 {
-	
+	_linkStatistics.tick( getMissionTime() );
 }
 
 uint32_t MAVLinkReader::getMissionTime()
@@ -180,6 +412,11 @@ uint32_t MAVLinkReader::getMissionTime()
 }
 
 
+LinkStatistics* MAVLinkReader::getLinkStatistics()
+{
+	return &_linkStatistics;
+}
+
 bool MAVLinkReader::readByte( uint8_t* buffer )
 {
 	return false;
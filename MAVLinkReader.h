@@ -12,6 +12,21 @@
 #endif
 
 #include "MAVLinkEventReceiver.h"
+#include "LinkStatistics.h"
+
+constexpr uint16_t FRAME_FILTER_MESSAGE_IDS = 256; ///< Message ids the header filter can subscribe to, frames with higher ids are skipped
+
+/**
+ * @brief States of the header filter that sits in front of the MAVLink parser.
+*/
+enum FRAME_FILTER_STATE
+{
+	FRAME_FILTER_IDLE,    ///< Looking for the start of a frame
+	FRAME_FILTER_HEADER,  ///< Collecting the header of a frame
+	FRAME_FILTER_PARSE,   ///< The frame was accepted, bytes go to the parser
+	FRAME_FILTER_SKIP,    ///< The frame was rejected, bytes are held back until the end of the frame
+	FRAME_FILTER_SKIP_END ///< The frame ended, the next byte tells whether its length was right
+};
 
 /**
  * @brief Base class for reading MAVLink message from a byte source. The messages captured create events to be sent to a MAVLinkEventReceiver
@@ -23,9 +38,10 @@ public:
 	/**
 	 * @brief Constructor
 	 * @param mavlinkEventReceiver The event receiver to send events to when a message is received.
+	 * @param sourceName The name of the byte source used when publishing link statistics.
 	 *
 	*/
-	MAVLinkReader( MAVLinkEventReceiver* mavlinkEventReceiver );
+	MAVLinkReader( MAVLinkEventReceiver* mavlinkEventReceiver, const char* sourceName = "MAVLink" );
 
 	/**
 	 * @brief Base function for reading MAVLink bytes from source
@@ -34,30 +50,444 @@ public:
 	virtual bool receiveMAVLinkMessages();
 
 	/**
-	 * @brief Semd a MavLink message to change the rover mode to the flight controller
+	 * @brief Semd a MavLink message to change the rover mode to the flight controller. Until the flight controller is found the
+	 * last mode asked for is held back and sent once it is.
 	 * @param roverMode 
 	*/
 	virtual void sendChangeMode( ROVER_MODE roverMode ) {};
 
+	/**
+	 * @brief Send the value of one of Restraining Bolt's own parameters to the ground station
+	 * @param parameterId The parameter name, up to 16 characters
+	 * @param value The parameter value
+	 * @param index The index of the parameter
+	 * @param count The number of parameters
+	*/
+	virtual void sendParamValue( const char* parameterId, float value, uint16_t index, uint16_t count ) {};
+
+	/**
+	 * @brief Send a mission protocol message to the flight controller
+	 * @param msgid MAVLINK_MSG_ID_MISSION_REQUEST_LIST, MAVLINK_MSG_ID_MISSION_REQUEST_INT or MAVLINK_MSG_ID_MISSION_ACK
+	 * @param seq The item to request
+	 * @param type The result to acknowledge
+	*/
+	virtual void sendMissionMessage( uint32_t msgid, uint16_t seq, uint8_t type ) {};
+
 	/**
 	 * @brief This is used by the scheduling system to give the MAVLink reader execution time
 	*/
 	virtual void tick();
 
+	/**
+	 * @brief Tell whether bytes are waiting to be read, so a sleeping processor can run the reader as soon as they arrive.
+	 * @return True if the source has bytes waiting, always false for sources that aren't driven by interrupts.
+	*/
+	virtual bool hasBytes() { return false; };
+
 	/**
 	 * @brief Get the mission time in milliseconds
 	 * @return Milliseconds for mission time
 	*/
 	virtual uint32_t getMissionTime();
 
+	/**
+	 * @brief Get the health statistics of the link being read
+	 * @return The link statistics
+	*/
+	LinkStatistics* getLinkStatistics();
+
+	/**
+	 * @brief Turn the header filter on or off. When on, frames that are not from the flight controller or
+	 * that have no handler are skipped by their length without CRC checking or decoding. The length isn't checked either,
+	 * so unless a start byte follows the skipped frame the filter resynchronizes on the first start byte inside it.
+	 * Setting the value it already has leaves the filter as it is.
+	 * @param enabled True to filter frames by header.
+	*/
+	void setFrameFilter( bool enabled );
+
+	/**
+	 * @brief Count a frame the header filter is still holding back at the end of the byte source, which no start byte will follow.
+	*/
+	void flushFrameFilter();
+
+	/**
+	 * @brief Set the system id of the flight controller. Its component id is taken from its first autopilot heartbeat.
+	 * @param systemId The system id, SYSID_THISMAV of the autopilot, 0 to take the first system that sends an autopilot heartbeat.
+	*/
+	void setFlightControllerSystemId( uint8_t systemId );
+
+	/**
+	 * @brief Check if the flight controller was found, messages other than heartbeats are only read and sent once it is.
+	 * @return True once an autopilot heartbeat gave the ids of the flight controller.
+	*/
+	bool isFlightControllerFound();
+
+	/**
+	 * @brief Add a message id to the messages the header filter lets through.
+	 * @param msgid The message id.
+	 * @param anySource True to accept the message from any system, not just the flight controller.
+	*/
+	void subscribe( uint32_t msgid, bool anySource = false );
+
+	/**
+	 * @brief Replace the message ids the header filter lets through from the flight controller, e.g. with those the subscribers
+	 * of an event bus handle. The messages the reader keeps its own time from stay subscribed.
+	 * @param messageMask Bit per message id, FRAME_FILTER_MESSAGE_IDS bits.
+	*/
+	void setSubscribedMessages( const uint32_t* messageMask );
+
 protected:
 	virtual bool readByte( uint8_t* buffer );
+
+	/**
+	 * @brief Pass a byte to the MAVLink parser.
+	 * @param byteBuffer The byte to parse.
+	 * @param mavlinkMessage Receives the message when a frame completes.
+	 * @return True if a frame completed.
+	*/
+	bool parseByte( uint8_t byteBuffer, mavlink_message_t* mavlinkMessage );
+
+	/**
+	 * @brief Run a byte through the header filter, bytes of accepted frames are passed on to parseByte().
+	 * @param byteBuffer The byte to filter.
+	 * @param mavlinkMessage Receives the message when a frame completes.
+	 * @return True if a frame completed.
+	*/
+	bool filterByte( uint8_t byteBuffer, mavlink_message_t* mavlinkMessage );
+
+	/**
+	 * @brief Read bytes until a message is received and dispatch it. The byte source and the receiver are template parameters,
+	 * so a reader that knows their types at compile time gets direct calls that can be inlined into the loop.
+	 * @param receiver The receiver to dispatch the message to.
+	 * @param readSourceByte Reads a byte from the source, returns false when there are none.
+	 * @return True if a message was dispatched.
+	*/
+	template <class Receiver, class ByteSource>
+	bool receiveMessages( Receiver* receiver, ByteSource readSourceByte );
+
+	/**
+	 * @brief Decode a message and send the event to the receiver.
+	 * @param mavlinkMessage The message to decode and dispatch.
+	 * @param receiver The receiver of the event.
+	*/
+	template <class Receiver>
+	void dispatchMessage( mavlink_message_t* mavlinkMessage, Receiver* receiver );
+
+	bool isSubscribed( uint32_t msgid, uint8_t sysid, uint8_t compid );
+	bool isTargeted( uint8_t targetSystem, uint8_t targetComponent );
+
+	/**
+	 * @brief Tell whether a heartbeat is from the flight controller, finding the flight controller if it isn't known yet.
+	 * Until then the header filter lets heartbeats through from every system.
+	 * @param mavlinkMessage The heartbeat frame.
+	 * @param heartbeat The decoded heartbeat.
+	 * @return True if the heartbeat is from the flight controller.
+	*/
+	bool isFlightControllerHeartbeat( const mavlink_message_t* mavlinkMessage, const mavlink_heartbeat_t& heartbeat );
+
+	/**
+	 * @brief Tell whether a message is from the flight controller. Without the header filter messages from every system are decoded.
+	 * @param mavlinkMessage The message.
+	 * @return True if the flight controller was found and sent the message.
+	*/
+	bool isFromFlightController( const mavlink_message_t* mavlinkMessage );
+
 	uint32_t _systemBootTimeMilliseconds = 0;
+	mavlink_status_t _mavlinkStatus;     ///< Parser status, kept between calls so its counters survive
+	LinkStatistics _linkStatistics;
+
+	uint8_t _systemId = 4;                                           ///< ID 4 for this companion computer. 1 flight controller, 255 ground station
+	uint8_t _componentId = MAV_COMP_ID_PERIPHERAL;                   ///< The component sending the message
+	uint8_t _flightControllerSystemId = 0;                           ///< Id # of the flight controller, 0 until it is found
+	uint8_t _flightControllerComponentId = 0;                        ///< Component id of the flight controller autopilot, 0 until it is found
+	bool _flightControllerFound = false;                             ///< The ids were taken from an autopilot heartbeat
 
 private:
+	bool acceptFrameHeader();
+	void resynchronize( uint8_t byteBuffer );
+
 	MAVLinkEventReceiver* _mavlinkEventReceiver;
 
+	// Header filter fields
+	bool _frameFilterEnabled = true;
+	FRAME_FILTER_STATE _frameFilterState = FRAME_FILTER_IDLE;
+	uint8_t _frameHeader[MAVLINK_NUM_HEADER_BYTES];
+	uint8_t _frameHeaderLength = 0;
+	uint16_t _skipBytesRemaining = 0;
+	uint8_t _skipBuffer[MAVLINK_MAX_PACKET_LEN];     ///< Bytes of the frame being skipped, header included
+	uint16_t _skipLength = 0;
+	uint8_t _replayBuffer[MAVLINK_MAX_PACKET_LEN + 1]; ///< Bytes run through the filter again after a skip with a wrong length
+	uint16_t _replayLength = 0;
+	uint16_t _replayPosition = 0;
+	uint8_t _skipSysid = 0;
+	uint8_t _skipCompid = 0;
+	uint8_t _skipSequence = 0;
+	uint32_t _skipMsgid = 0;
+	uint16_t _skipFrameLength = 0;
+	uint32_t _subscribedMessages[FRAME_FILTER_MESSAGE_IDS / 32];          ///< Bit per message id accepted from the flight controller
+	uint32_t _anySourceSubscribedMessages[FRAME_FILTER_MESSAGE_IDS / 32]; ///< Bit per message id accepted from any system
+
 };
 
-#endif
+template <class Receiver, class ByteSource>
+bool MAVLinkReader::receiveMessages( Receiver* receiver, ByteSource readSourceByte )
+{
+	mavlink_message_t mavlinkMessage;
+	uint8_t byteBuffer = 0;
+	bool messageReceived = false;
+	uint32_t startCycles = ARM_DWT_CYCCNT;
+
+	while ( !messageReceived )
+	{
+		// Bytes the filter held back and gave up are read again before new ones, they were counted when they arrived
+		if ( _replayPosition < _replayLength )
+		{
+			byteBuffer = _replayBuffer[_replayPosition++];
+		}
+		else if ( readSourceByte( &byteBuffer ) )
+		{
+			_linkStatistics.onByte();
+		}
+		else
+		{
+			break;
+		}
+
+		if ( _frameFilterEnabled )
+		{
+			messageReceived = filterByte( byteBuffer, &mavlinkMessage );
+		}
+		else
+		{
+			messageReceived = parseByte( byteBuffer, &mavlinkMessage );
+		}
+	}
+
+	if ( messageReceived )
+	{
+		uint32_t dispatchCycles = ARM_DWT_CYCCNT;
+
+		dispatchMessage( &mavlinkMessage, receiver );
+		_linkStatistics.addDispatchCycles( ARM_DWT_CYCCNT - dispatchCycles );
+	}
+
+	_linkStatistics.addParseCycles( ARM_DWT_CYCCNT - startCycles );
+
+	return messageReceived;
+}
+
+template <class Receiver>
+void MAVLinkReader::dispatchMessage( mavlink_message_t* mavlinkMessage, Receiver* receiver )
+{
+	switch ( mavlinkMessage->msgid )
+	{
+		case MAVLINK_MSG_ID_HEARTBEAT: // #0: Heartbeat
+			{
+
+				mavlink_heartbeat_t heartbeat;
+				mavlink_msg_heartbeat_decode( mavlinkMessage, &heartbeat );
+
+				// Heartbeats of ground stations, companions and other vehicles would be taken for the mode of the rover
+				if ( isFlightControllerHeartbeat( mavlinkMessage, heartbeat ) )
+				{
+					receiver->onHeatbeat( heartbeat );
+				}
+
+			}
+			break;
+		case MAVLINK_MSG_ID_SYSTEM_TIME: // #2: SYSTEM_TIME
+			{
+				mavlink_system_time_t system_time;
+				mavlink_msg_system_time_decode( mavlinkMessage, &system_time );
+				_systemBootTimeMilliseconds = system_time.time_boot_ms;
+				receiver->onSystemTime( system_time );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_SYS_STATUS: // #1: SYS_STATUS
+			{
+				mavlink_sys_status_t sys_status;
+				mavlink_msg_sys_status_decode( mavlinkMessage, &sys_status );
+
+				receiver->onSysStatus( sys_status );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_PARAM_VALUE: // #22: PARAM_VALUE
+			{
+				mavlink_param_value_t param_value;
+				mavlink_msg_param_value_decode( mavlinkMessage, &param_value );
+
+				receiver->onParamValue( param_value );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_PARAM_REQUEST_READ: // #20: PARAM_REQUEST_READ
+			{
+				mavlink_param_request_read_t paramRequestRead;
+				mavlink_msg_param_request_read_decode( mavlinkMessage, &paramRequestRead );
+
+				if ( isTargeted( paramRequestRead.target_system, paramRequestRead.target_component ) )
+				{
+					receiver->onParamRequestRead( paramRequestRead );
+				}
+			}
+			break;
+
+		case MAVLINK_MSG_ID_PARAM_REQUEST_LIST: // #21: PARAM_REQUEST_LIST
+			{
+				mavlink_param_request_list_t paramRequestList;
+				mavlink_msg_param_request_list_decode( mavlinkMessage, &paramRequestList );
+
+				if ( isTargeted( paramRequestList.target_system, paramRequestList.target_component ) )
+				{
+					receiver->onParamRequestList( paramRequestList );
+				}
+			}
+			break;
+
+		case MAVLINK_MSG_ID_PARAM_SET: // #23: PARAM_SET
+			{
+				mavlink_param_set_t paramSet;
+				mavlink_msg_param_set_decode( mavlinkMessage, &paramSet );
+
+				if ( isTargeted( paramSet.target_system, paramSet.target_component ) )
+				{
+					receiver->onParamSet( paramSet );
+				}
+			}
+			break;
+
+		case MAVLINK_MSG_ID_RAW_IMU: // #27: RAW_IMU
+			{
+				mavlink_raw_imu_t imuRaw;
+				mavlink_msg_raw_imu_decode( mavlinkMessage, &imuRaw );
+
+				receiver->onRawIMU( imuRaw );
+			}
+			break;
 
+		case MAVLINK_MSG_ID_GPS_RAW_INT: // 24
+			{
+				mavlink_gps_raw_int_t gpsRaw;
+				mavlink_msg_gps_raw_int_decode( mavlinkMessage, &gpsRaw );
+
+				receiver->onGPSRawInt( gpsRaw );
+
+			}
+			break;
+
+		case MAVLINK_MSG_ID_GLOBAL_POSITION_INT: // #33
+			{
+				mavlink_global_position_int_t globalPosition;
+				mavlink_msg_global_position_int_decode( mavlinkMessage, &globalPosition );
+
+				receiver->onGlobalPositionInt( globalPosition );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_GPS2_RAW:  //124 
+			{
+				mavlink_gps2_raw_t gpsRaw;
+				mavlink_msg_gps2_raw_decode( mavlinkMessage, &gpsRaw );
+
+				receiver->onGPS2Raw( gpsRaw );
+
+			}
+			break;
+
+		case MAVLINK_MSG_ID_GPS_INPUT: // 232
+			{
+				mavlink_gps_input_t  gpsInput;
+				mavlink_msg_gps_input_decode( mavlinkMessage, &gpsInput );
+
+				receiver->onGPSInput( gpsInput );
+			}
+			break;
+
+
+		case MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT: // #62
+			{
+				mavlink_nav_controller_output_t navOutput;
+				mavlink_msg_nav_controller_output_decode( mavlinkMessage, &navOutput );
+
+				receiver->onNavControllerOutput( navOutput );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_MISSION_ITEM_REACHED:
+			{
+				mavlink_mission_item_reached_t itemReached;
+				mavlink_msg_mission_item_reached_decode( mavlinkMessage, &itemReached );
+
+				receiver->onMissionItemReached( itemReached );
+
+			}
+			break;
+
+		case MAVLINK_MSG_ID_MISSION_CURRENT:
+			{
+				mavlink_mission_current_t current;
+				mavlink_msg_mission_current_decode( mavlinkMessage, &current );
+
+				receiver->onMissionCurrent( current );
+
+			}
+			break;
+		// Mission messages from the flight controller are passed on whoever they are for, the mission is the same whether we or
+		// a ground station asked for it. A ground station uploading a mission sends the same messages to the flight controller.
+		case MAVLINK_MSG_ID_MISSION_COUNT: // #44
+			{
+				mavlink_mission_count_t missionCount;
+				mavlink_msg_mission_count_decode( mavlinkMessage, &missionCount );
+
+				if ( isFromFlightController( mavlinkMessage ) )
+				{
+					receiver->onMissionCount( missionCount );
+				}
+			}
+			break;
+
+		case MAVLINK_MSG_ID_MISSION_ITEM_INT: // #73
+			{
+				mavlink_mission_item_int_t missionItem;
+				mavlink_msg_mission_item_int_decode( mavlinkMessage, &missionItem );
+
+				if ( isFromFlightController( mavlinkMessage ) )
+				{
+					receiver->onMissionItemInt( missionItem );
+				}
+			}
+			break;
+
+		case MAVLINK_MSG_ID_MISSION_ACK: // #47
+			{
+				mavlink_mission_ack_t missionAck;
+				mavlink_msg_mission_ack_decode( mavlinkMessage, &missionAck );
+
+				// An accepted upload tells that the mission changed whoever uploaded it, a refusal only matters if it answers our requests
+				if ( isFromFlightController( mavlinkMessage ) &&
+					(missionAck.type == MAV_MISSION_ACCEPTED || isTargeted( missionAck.target_system, missionAck.target_component )) )
+				{
+					receiver->onMissionAck( missionAck );
+				}
+			}
+			break;
+
+		case MAVLINK_MSG_ID_RC_CHANNELS:
+			{
+				mavlink_rc_channels_t rcChannels;
+				mavlink_msg_rc_channels_decode( mavlinkMessage, &rcChannels );
+
+				_systemBootTimeMilliseconds = rcChannels.time_boot_ms;
+				receiver->onRCChannels( rcChannels );
+			}
+			break;
+		default:
+			//Log.trace("Got unhandled message id: %d", mavlinkMessage->msgid);
+			break;
+
+	}
+}
+
+#endif
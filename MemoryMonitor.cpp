@@ -0,0 +1,200 @@
+//
+//
+//
+
+#include "MemoryMonitor.h"
+#include <ArduinoLog.h>
+#include <malloc.h>
+#include <Audio.h>
+#include "AudioPlayer.h"
+
+// Section boundaries from the Teensy 4.1 linker script
+extern unsigned long _stext;
+extern unsigned long _etext;
+extern unsigned long _sdata;
+extern unsigned long _ebss;
+extern unsigned long _estack;
+extern unsigned long _heap_start;
+extern unsigned long _heap_end;
+
+constexpr uintptr_t RAM2_START = 0x20200000;
+
+void MemoryMonitor::paintStack()
+{
+	uint8_t marker = 0;
+	volatile uint32_t* word = (volatile uint32_t*)&_ebss;
+	volatile uint32_t* end = (volatile uint32_t*)((uintptr_t)&marker - STACK_PAINT_MARGIN);
+
+	while ( word < end )
+	{
+		*word++ = STACK_PAINT_PATTERN;
+	}
+
+	_deepestAddress = (uintptr_t)end;
+	memset( _taskStackHighWater, 0, sizeof( _taskStackHighWater ) );
+}
+
+uint32_t MemoryMonitor::getStackHighWater()
+{
+	volatile uint32_t* word = (volatile uint32_t*)&_ebss;
+	volatile uint32_t* top = (volatile uint32_t*)&_estack;
+
+	// The stack grows down, the first word that lost its paint is the deepest it reached
+	while ( word < top && *word == STACK_PAINT_PATTERN )
+	{
+		word++;
+	}
+
+	return (uintptr_t)top - (uintptr_t)word;
+}
+
+uint32_t MemoryMonitor::getStackSize()
+{
+	return (uintptr_t)&_estack - (uintptr_t)&_ebss;
+}
+
+uint32_t MemoryMonitor::getHeapInUse()
+{
+	return mallinfo().uordblks;
+}
+
+void MemoryMonitor::logBudget()
+{
+	Log.trace( "RAM1: %u bytes of code, %u bytes of variables, %u bytes of stack",
+		(uint32_t)((uintptr_t)&_etext - (uintptr_t)&_stext),
+		(uint32_t)((uintptr_t)&_ebss - (uintptr_t)&_sdata),
+		getStackSize() );
+
+	Log.trace( "RAM2: %u bytes of variables, %u bytes of heap of which %u bytes in use",
+		(uint32_t)((uintptr_t)&_heap_start - RAM2_START),
+		(uint32_t)((uintptr_t)&_heap_end - (uintptr_t)&_heap_start),
+		getHeapInUse() );
+
+	Log.trace( "Stack: %u bytes used at most", getStackHighWater() );
+}
+
+void MemoryMonitor::setTaskNames( const char* const* taskNames, uint8_t taskCount )
+{
+	_taskNames = taskNames;
+	_taskCount = taskCount < MEMORY_MONITOR_TASKS ? taskCount : MEMORY_MONITOR_TASKS;
+}
+
+void MemoryMonitor::runTask( uint8_t task, void (*callback)() )
+{
+	uint8_t marker = 0;
+	uintptr_t startAddress = (uintptr_t)&marker;
+	uintptr_t outerDeepestAddress = _runDeepestAddress;
+	bool outerTaskRunning = _taskRunning;
+
+	// The outer task may have been deeper than this one starts, that stack is its own and is collected before this task paints it again
+	if ( outerTaskRunning )
+	{
+		uintptr_t outerAddress = collectStack( startAddress );
+
+		if ( outerAddress < outerDeepestAddress )
+		{
+			outerDeepestAddress = outerAddress;
+		}
+	}
+
+	_taskRunning = true;
+	_runDeepestAddress = UINTPTR_MAX;
+
+	callback();
+
+	uintptr_t deepestAddress = collectStack( startAddress );
+
+	if ( _runDeepestAddress < deepestAddress )
+	{
+		deepestAddress = _runDeepestAddress;
+	}
+
+	if ( deepestAddress != UINTPTR_MAX && task < _taskCount && startAddress - deepestAddress > _taskStackHighWater[task] )
+	{
+		_taskStackHighWater[task] = startAddress - deepestAddress;
+	}
+
+	// The stack of this task is part of the stack of the task it is nested in
+	_taskRunning = outerTaskRunning;
+	_runDeepestAddress = deepestAddress < outerDeepestAddress ? deepestAddress : outerDeepestAddress;
+}
+
+uintptr_t MemoryMonitor::collectStack( uintptr_t startAddress )
+{
+	// Below the deepest point reached so far the paint is intact, unless this task went deeper.
+	// Scanning from a little further down finds that without walking the whole stack on every run,
+	// if the paint is gone there too the task went deeper still and the scan starts from the bottom.
+	uintptr_t bottom = (uintptr_t)&_ebss;
+	uintptr_t scanStart = _deepestAddress > bottom + STACK_SCAN_SLACK ? _deepestAddress - STACK_SCAN_SLACK : bottom;
+	volatile uint32_t* word = (volatile uint32_t*)(scanStart & ~(uintptr_t)3);
+	volatile uint32_t* end = (volatile uint32_t*)((startAddress - STACK_PAINT_MARGIN) & ~(uintptr_t)3);
+
+	if ( word < end && *word != STACK_PAINT_PATTERN )
+	{
+		word = (volatile uint32_t*)bottom;
+	}
+
+	while ( word < end && *word == STACK_PAINT_PATTERN )
+	{
+		word++;
+	}
+
+	if ( word >= end )
+	{
+		return UINTPTR_MAX;
+	}
+
+	uintptr_t deepestAddress = (uintptr_t)word;
+
+	if ( deepestAddress < _deepestAddress )
+	{
+		_deepestAddress = deepestAddress;
+	}
+
+	while ( word < end )
+	{
+		*word++ = STACK_PAINT_PATTERN;
+	}
+
+	return deepestAddress;
+}
+
+uint32_t MemoryMonitor::getTaskStackHighWater( uint8_t task )
+{
+	return task < _taskCount ? _taskStackHighWater[task] : 0;
+}
+
+void MemoryMonitor::sampleHeap()
+{
+	uint32_t heapInUse = getHeapInUse();
+
+	if ( heapInUse > _heapHighWater )
+	{
+		_heapHighWater = heapInUse;
+	}
+}
+
+void MemoryMonitor::tick( uint32_t timeMilliseconds )
+{
+	sampleHeap();
+
+	if ( timeMilliseconds - _lastPublishMilliseconds < MEMORY_MONITOR_PUBLISH_MILLISECONDS )
+	{
+		return;
+	}
+
+	_lastPublishMilliseconds = timeMilliseconds;
+
+	for ( uint8_t i = 0; i < _taskCount; i++ )
+	{
+		Log.trace( "Stack %s: %u bytes at most", _taskNames[i], _taskStackHighWater[i] );
+	}
+
+	Log.trace( "Stack: %u of %u bytes used at most, heap: %u bytes in use, %u bytes at most, audio: %u of %u blocks at most",
+		getStackHighWater(),
+		getStackSize(),
+		getHeapInUse(),
+		_heapHighWater,
+		AudioMemoryUsageMax(),
+		AUDIO_MEMORY_BLOCKS );
+}
@@ -0,0 +1,105 @@
+// MemoryMonitor.h
+
+#ifndef _MEMORYMONITOR_h
+#define _MEMORYMONITOR_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+constexpr uint32_t STACK_PAINT_PATTERN = 0xA5A5A5A5;   ///< Written over the unused stack at boot, stack that was used no longer holds it
+constexpr uint32_t STACK_PAINT_MARGIN = 256;           ///< Bytes below the stack pointer left alone while painting
+constexpr uint32_t STACK_SCAN_SLACK = 4096;            ///< Bytes below the deepest known point a task measurement starts scanning from
+constexpr uint8_t MEMORY_MONITOR_TASKS = 8;            ///< Tasks whose stack use can be measured
+constexpr uint32_t MEMORY_MONITOR_PUBLISH_MILLISECONDS = 10000; ///< How often the memory use is written to the log
+
+/**
+ * @brief MemoryMonitor reports how the RAM of the Teensy 4.1 is used, from the sections laid out by the linker.
+ * Code and variables in RAM1 are fixed at link time, the stack grows down from the top of RAM1 towards the variables,
+ * and RAM2 holds the DMAMEM variables with the heap above them. The stack is painted at boot so the deepest it has
+ * reached can be measured later.
+ * Scheduler tasks run through runTask(), which measures the stack the task used and paints it again for the next task,
+ * so every task gets a high-water mark of its own. A task run from inside another task counts towards both. The heap in use is sampled every tick and reported with the audio blocks.
+*/
+class MemoryMonitor
+{
+public:
+	/**
+	 * @brief Fill the stack below the current stack pointer with STACK_PAINT_PATTERN. Call it first thing in setup().
+	*/
+	void paintStack();
+
+	/**
+	 * @brief Get the deepest the stack has reached since it was painted.
+	 * @return Bytes of stack used at most.
+	*/
+	uint32_t getStackHighWater();
+
+	/**
+	 * @brief Get the room the stack has between the top of RAM1 and the variables.
+	 * @return Bytes of stack.
+	*/
+	uint32_t getStackSize();
+
+	/**
+	 * @brief Get the bytes allocated from the heap and not freed.
+	 * @return Bytes in use.
+	*/
+	uint32_t getHeapInUse();
+
+	/**
+	 * @brief Write the RAM budget to the log: code and variables per RAM bank, the stack high-water mark and the heap in use.
+	*/
+	void logBudget();
+
+	/**
+	 * @brief Name the tasks measured by runTask().
+	 * @param taskNames A name per task, the position of the name is the task index.
+	 * @param taskCount The number of tasks, up to MEMORY_MONITOR_TASKS.
+	*/
+	void setTaskNames( const char* const* taskNames, uint8_t taskCount );
+
+	/**
+	 * @brief Run a task and measure the stack it used. An interrupt taken while the task runs counts towards the task.
+	 * A task may run another task, the stack the inner task used counts towards the outer one as well.
+	 * @param task The index of the task.
+	 * @param callback The task.
+	*/
+	void runTask( uint8_t task, void (*callback)() );
+
+	/**
+	 * @brief Get the deepest the stack reached while a task ran.
+	 * @param task The index of the task.
+	 * @return Bytes of stack below the stack pointer the task started with.
+	*/
+	uint32_t getTaskStackHighWater( uint8_t task );
+
+	/**
+	 * @brief Write the stack high-water mark of every task, the heap and the audio blocks in use to the log when the publish period is over.
+	 * @param timeMilliseconds The current time in milliseconds.
+	*/
+	void tick( uint32_t timeMilliseconds );
+
+private:
+	void sampleHeap();
+
+	/**
+	 * @brief Find the deepest stack used below a task's start and paint it again so the next task is measured on its own.
+	 * @param startAddress The stack pointer the task started with.
+	 * @return The lowest address used, UINTPTR_MAX if the paint is intact.
+	*/
+	uintptr_t collectStack( uintptr_t startAddress );
+
+	const char* const* _taskNames = NULL;
+	uint8_t _taskCount = 0;
+	uint32_t _taskStackHighWater[MEMORY_MONITOR_TASKS];
+	uintptr_t _deepestAddress = 0;       ///< Lowest stack address any task has reached, the paint below it was never touched
+	bool _taskRunning = false;           ///< A task is running, a task run now is nested inside it
+	uintptr_t _runDeepestAddress = UINTPTR_MAX; ///< Lowest stack address the running task reached in the stack its nested tasks painted again
+	uint32_t _heapHighWater = 0;
+	uint32_t _lastPublishMilliseconds = 0;
+};
+
+#endif
@@ -0,0 +1,63 @@
+//
+//
+//
+
+#include "MissionClock.h"
+
+uint32_t MissionClock::now()
+{
+	return _nowMilliseconds;
+}
+
+void MissionClock::setTimer( uint32_t periodMilliseconds, MissionClockTimerCallback callback )
+{
+	_timerPeriodMilliseconds = periodMilliseconds;
+	_timerCallback = callback;
+	_nextTimerMilliseconds = getNextTimerMilliseconds( _nowMilliseconds );
+}
+
+void MissionClock::advanceTo( uint32_t missionTimeMilliseconds )
+{
+	if ( !_started )
+	{
+		// The clock starts at the first recorded time, there is nothing to catch up on before it
+		reset( missionTimeMilliseconds );
+		return;
+	}
+
+	if ( missionTimeMilliseconds <= _nowMilliseconds )
+	{
+		return;
+	}
+
+	if ( _timerCallback != NULL && _timerPeriodMilliseconds > 0 )
+	{
+		while ( _nextTimerMilliseconds <= missionTimeMilliseconds )
+		{
+			_nowMilliseconds = _nextTimerMilliseconds;
+			_nextTimerMilliseconds += _timerPeriodMilliseconds;
+			_timerRuns++;
+			_timerCallback();
+		}
+	}
+
+	_nowMilliseconds = missionTimeMilliseconds;
+}
+
+void MissionClock::reset( uint32_t missionTimeMilliseconds )
+{
+	_started = true;
+	_nowMilliseconds = missionTimeMilliseconds;
+	_nextTimerMilliseconds = getNextTimerMilliseconds( missionTimeMilliseconds );
+}
+
+uint32_t MissionClock::getNextTimerMilliseconds( uint32_t missionTimeMilliseconds )
+{
+	// The timer runs at whole multiples of its period, so a replay started from a snapshot runs it at the same instants
+	return _timerPeriodMilliseconds == 0 ? 0 : (missionTimeMilliseconds / _timerPeriodMilliseconds + 1) * _timerPeriodMilliseconds;
+}
+
+uint32_t MissionClock::getTimerRuns()
+{
+	return _timerRuns;
+}
@@ -0,0 +1,65 @@
+// MissionClock.h
+
+#ifndef _MISSIONCLOCK_h
+#define _MISSIONCLOCK_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+typedef void (*MissionClockTimerCallback)();
+
+/**
+ * @brief MissionClock is the mission time of a replay. It doesn't follow millis(), it is moved forward by the reader to the time
+ * recorded with each message, before the message is handed on. A periodic timer runs at every instant of its period the clock
+ * passes, so the work that depends on time passing, like the timeouts in the mission monitor, happens at the same mission time
+ * between two messages on every replay, however fast the log is read.
+*/
+class MissionClock
+{
+public:
+	/**
+	 * @brief Get the mission time.
+	 * @return Milliseconds since the flight controller started, 0 until the clock is first moved.
+	*/
+	uint32_t now();
+
+	/**
+	 * @brief Run a callback every period of mission time.
+	 * @param periodMilliseconds The period.
+	 * @param callback The callback, the clock reads the instant it runs at.
+	*/
+	void setTimer( uint32_t periodMilliseconds, MissionClockTimerCallback callback );
+
+	/**
+	 * @brief Move the clock forward, running the timer at every instant of its period up to and including the new time.
+	 * A time before the current one leaves the clock where it is, mission time doesn't go back.
+	 * @param missionTimeMilliseconds The recorded time.
+	*/
+	void advanceTo( uint32_t missionTimeMilliseconds );
+
+	/**
+	 * @brief Set the clock without running the timer, for a replay that starts from a snapshot.
+	 * @param missionTimeMilliseconds The mission time of the snapshot.
+	*/
+	void reset( uint32_t missionTimeMilliseconds );
+
+	/**
+	 * @brief Get how many times the timer ran.
+	*/
+	uint32_t getTimerRuns();
+
+private:
+	uint32_t getNextTimerMilliseconds( uint32_t missionTimeMilliseconds );
+
+	uint32_t _nowMilliseconds = 0;
+	uint32_t _nextTimerMilliseconds = 0;
+	uint32_t _timerPeriodMilliseconds = 0;
+	MissionClockTimerCallback _timerCallback = NULL;
+	uint32_t _timerRuns = 0;
+	bool _started = false;
+};
+
+#endif
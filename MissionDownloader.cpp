@@ -0,0 +1,386 @@
+//
+//
+//
+
+#include "MissionDownloader.h"
+#include <ArduinoLog.h>
+
+
+MissionDownloader::MissionDownloader( WaypointStore* waypointStore )
+{
+	_waypointStore = waypointStore;
+}
+
+void MissionDownloader::onMissionCount( mavlink_mission_count_t mavlink_mission_count )
+{
+	if ( mavlink_mission_count.mission_type != MAV_MISSION_TYPE_MISSION )
+	{
+		return;
+	}
+
+	// A count sent to a ground station is just as good as one sent to us
+	if ( _missionChanged || mavlink_mission_count.count != _waypointStore->getCount() )
+	{
+		Log.trace( "Mission has %d items", mavlink_mission_count.count );
+
+		if ( mavlink_mission_count.count > WAYPOINT_STORE_CAPACITY )
+		{
+			Log.warning( "Mission is too large, only the first %d items are monitored", WAYPOINT_STORE_CAPACITY );
+		}
+
+		_waypointStore->reset( mavlink_mission_count.count );
+		_missionChanged = false;
+		_downloadStartMilliseconds = _lastTimeMilliseconds;
+		_requestsSent = 0;
+	}
+
+	if ( _state == MISSION_DOWNLOAD_LIST )
+	{
+		_retries = 0;
+		_pendingCount = 0;
+
+		if ( _waypointStore->isComplete() )
+		{
+			complete();
+		}
+		else
+		{
+			_state = MISSION_DOWNLOAD_ITEMS;
+			requestItems( _lastTimeMilliseconds );
+		}
+	}
+}
+
+void MissionDownloader::onMissionItemInt( mavlink_mission_item_int_t mavlink_mission_item_int )
+{
+	if ( mavlink_mission_item_int.mission_type != MAV_MISSION_TYPE_MISSION || _missionChanged )
+	{
+		return;
+	}
+
+	// Only navigation commands in a global frame are places the rover drives to
+	bool isGlobal = false;
+
+	switch ( mavlink_mission_item_int.frame )
+	{
+		case MAV_FRAME_GLOBAL:
+		case MAV_FRAME_GLOBAL_RELATIVE_ALT:
+		case MAV_FRAME_GLOBAL_INT:
+		case MAV_FRAME_GLOBAL_RELATIVE_ALT_INT:
+		case MAV_FRAME_GLOBAL_TERRAIN_ALT:
+		case MAV_FRAME_GLOBAL_TERRAIN_ALT_INT:
+			isGlobal = true;
+			break;
+		default:
+			break;
+	}
+
+	bool hasPosition = isGlobal && mavlink_mission_item_int.command < MAV_CMD_NAV_LAST && (mavlink_mission_item_int.x != 0 || mavlink_mission_item_int.y != 0);
+
+	// Loiters and delays stop the rover on purpose, and so does a speed change to zero until the next one
+	WAYPOINT_COMMAND command = WAYPOINT_COMMAND_DRIVE;
+
+	switch ( mavlink_mission_item_int.command )
+	{
+		case MAV_CMD_NAV_LOITER_UNLIM:
+		case MAV_CMD_NAV_LOITER_TURNS:
+		case MAV_CMD_NAV_LOITER_TIME:
+		case MAV_CMD_NAV_LOITER_TO_ALT:
+		case MAV_CMD_NAV_DELAY:
+			command = WAYPOINT_COMMAND_HOLD;
+			break;
+		case MAV_CMD_DO_CHANGE_SPEED:
+			// param2 is the speed, -1 leaves it unchanged and -2 restores the default
+			if ( mavlink_mission_item_int.param2 == 0 )
+			{
+				command = WAYPOINT_COMMAND_SPEED_ZERO;
+			}
+			else if ( mavlink_mission_item_int.param2 != -1 )
+			{
+				command = WAYPOINT_COMMAND_SPEED_SET;
+			}
+			break;
+		default:
+			break;
+	}
+
+	if ( !_waypointStore->set( mavlink_mission_item_int.seq, hasPosition, mavlink_mission_item_int.x, mavlink_mission_item_int.y, command ) &&
+		mavlink_mission_item_int.seq < _waypointStore->getCount() )
+	{
+		Log.warning( "Mission item %d is too far from its neighbors to be stored", mavlink_mission_item_int.seq );
+	}
+
+	for ( uint8_t i = 0; i < _pendingCount; i++ )
+	{
+		if ( _pendingSeq[i] == mavlink_mission_item_int.seq )
+		{
+			_pendingCount--;
+			_pendingSeq[i] = _pendingSeq[_pendingCount];
+			_pendingTimeMilliseconds[i] = _pendingTimeMilliseconds[_pendingCount];
+			_retries = 0;
+			break;
+		}
+	}
+
+	if ( _state == MISSION_DOWNLOAD_ITEMS )
+	{
+		if ( _waypointStore->isComplete() )
+		{
+			complete();
+		}
+		else
+		{
+			// Keep the window full, don't wait for the next tick
+			requestItems( _lastTimeMilliseconds );
+		}
+	}
+}
+
+void MissionDownloader::onMissionAck( mavlink_mission_ack_t mavlink_mission_ack )
+{
+	if ( mavlink_mission_ack.mission_type != MAV_MISSION_TYPE_MISSION )
+	{
+		return;
+	}
+
+	if ( mavlink_mission_ack.type != MAV_MISSION_ACCEPTED )
+	{
+		if ( _state != MISSION_DOWNLOAD_LIST && _state != MISSION_DOWNLOAD_ITEMS )
+		{
+			return;
+		}
+
+		// The flight controller refused a request, the mission probably changed under us
+		Log.trace( "Mission request refused: %d", mavlink_mission_ack.type );
+		_missionChanged = true;
+		_state = MISSION_DOWNLOAD_WAIT;
+		_stateTimeMilliseconds = _lastTimeMilliseconds;
+	}
+	else
+	{
+		// The flight controller only accepts uploads, a ground station just changed the mission. The reader passes on acks
+		// from the flight controller only, a ground station acknowledging a mission it read changes nothing
+		Log.trace( "Mission changed by ground station" );
+		_missionChanged = true;
+		start();
+	}
+}
+
+void MissionDownloader::onMissionCurrent( mavlink_mission_current_t mavlink_mission_current )
+{
+	uint16_t seq = mavlink_mission_current.seq;
+
+	// The leg to the current waypoint starts at the one before it
+	_nextSeq = seq > 0 ? seq - 1 : 0;
+
+	if ( _missionChanged || _state != MISSION_DOWNLOAD_IDLE )
+	{
+		return;
+	}
+
+	if ( seq >= _waypointStore->getCount() )
+	{
+		// The mission grew without us seeing the upload
+		_missionChanged = true;
+	}
+	else if ( !_waypointStore->isValid( seq ) || !_waypointStore->isValid( _nextSeq ) )
+	{
+		_state = MISSION_DOWNLOAD_ITEMS;
+		_retries = 0;
+		requestItems( _lastTimeMilliseconds );
+	}
+}
+
+void MissionDownloader::start()
+{
+	_state = MISSION_DOWNLOAD_LIST;
+	_stateTimeMilliseconds = _lastTimeMilliseconds;
+	_pendingCount = 0;
+	_retries = 0;
+
+	sendMissionMessage( MAVLINK_MSG_ID_MISSION_REQUEST_LIST, 0, 0 );
+}
+
+void MissionDownloader::tick( uint32_t timeMilliseconds )
+{
+	_lastTimeMilliseconds = timeMilliseconds;
+
+	switch ( _state )
+	{
+		case MISSION_DOWNLOAD_IDLE:
+			if ( _missionChanged && isFlightControllerFound() )
+			{
+				start();
+			}
+			break;
+
+		case MISSION_DOWNLOAD_LIST:
+			if ( timeMilliseconds - _stateTimeMilliseconds >= MISSION_REQUEST_TIMEOUT_MILLISECONDS )
+			{
+				if ( ++_retries >= MISSION_REQUEST_RETRIES )
+				{
+					Log.trace( "No answer to mission request, trying again in %u milliseconds", MISSION_RETRY_MILLISECONDS );
+					_state = MISSION_DOWNLOAD_WAIT;
+				}
+				else
+				{
+					sendMissionMessage( MAVLINK_MSG_ID_MISSION_REQUEST_LIST, 0, 0 );
+				}
+
+				_stateTimeMilliseconds = timeMilliseconds;
+			}
+			break;
+
+		case MISSION_DOWNLOAD_ITEMS:
+			for ( uint8_t i = 0; i < _pendingCount; i++ )
+			{
+				if ( timeMilliseconds - _pendingTimeMilliseconds[i] >= MISSION_REQUEST_TIMEOUT_MILLISECONDS )
+				{
+					if ( ++_retries >= MISSION_REQUEST_RETRIES )
+					{
+						Log.trace( "No answer to mission item request, trying again in %u milliseconds", MISSION_RETRY_MILLISECONDS );
+						_state = MISSION_DOWNLOAD_WAIT;
+						_stateTimeMilliseconds = timeMilliseconds;
+						_pendingCount = 0;
+						return;
+					}
+
+					_pendingTimeMilliseconds[i] = timeMilliseconds;
+					_requestsSent++;
+					sendMissionMessage( MAVLINK_MSG_ID_MISSION_REQUEST_INT, _pendingSeq[i], 0 );
+				}
+			}
+
+			requestItems( timeMilliseconds );
+			break;
+
+		case MISSION_DOWNLOAD_WAIT:
+			if ( timeMilliseconds - _stateTimeMilliseconds >= MISSION_RETRY_MILLISECONDS )
+			{
+				if ( _missionChanged )
+				{
+					start();
+				}
+				else
+				{
+					_state = MISSION_DOWNLOAD_ITEMS;
+					_retries = 0;
+				}
+			}
+			break;
+	}
+}
+
+void MissionDownloader::requestItems( uint32_t timeMilliseconds )
+{
+	// Every pending request can be skipped once before the search finds nothing new
+	for ( uint8_t attempt = 0; _pendingCount < MISSION_REQUEST_WINDOW && attempt <= MISSION_REQUEST_WINDOW; attempt++ )
+	{
+		uint16_t seq = _waypointStore->findMissing( _nextSeq );
+		bool pending = false;
+
+		if ( seq == _waypointStore->getCount() )
+		{
+			break;
+		}
+
+		_nextSeq = seq + 1 < _waypointStore->getCount() ? seq + 1 : 0;
+
+		for ( uint8_t i = 0; i < _pendingCount; i++ )
+		{
+			pending = pending || _pendingSeq[i] == seq;
+		}
+
+		if ( pending )
+		{
+			continue;
+		}
+
+		_pendingSeq[_pendingCount] = seq;
+		_pendingTimeMilliseconds[_pendingCount] = timeMilliseconds;
+		_pendingCount++;
+		_requestsSent++;
+
+		sendMissionMessage( MAVLINK_MSG_ID_MISSION_REQUEST_INT, seq, 0 );
+	}
+}
+
+void MissionDownloader::complete()
+{
+	// The acknowledgment ends the transaction on the flight controller
+	sendMissionMessage( MAVLINK_MSG_ID_MISSION_ACK, 0, MAV_MISSION_ACCEPTED );
+
+	Log.trace( "Mission of %d items stored after %u milliseconds and %d item requests",
+		_waypointStore->getCount(),
+		_lastTimeMilliseconds - _downloadStartMilliseconds,
+		_requestsSent );
+
+	_state = MISSION_DOWNLOAD_IDLE;
+	_pendingCount = 0;
+	_requestsSent = 0;
+	_downloadStartMilliseconds = _lastTimeMilliseconds;
+}
+
+void MissionDownloader::setSendMissionMessageCallback( void(*sendMissionMessageCallback)(uint32_t msgid, uint16_t seq, uint8_t type) )
+{
+	_sendMissionMessageCallback = sendMissionMessageCallback;
+}
+
+void MissionDownloader::setIsFlightControllerFoundCallback( bool(*isFlightControllerFoundCallback)() )
+{
+	_isFlightControllerFoundCallback = isFlightControllerFoundCallback;
+}
+
+WaypointStore* MissionDownloader::getWaypointStore()
+{
+	return _waypointStore;
+}
+
+MISSION_DOWNLOAD_STATE MissionDownloader::getState()
+{
+	return _state;
+}
+
+uint32_t MissionDownloader::getGeneration()
+{
+	// The flag only goes back to false with a reset of the store, which changes its generation
+	return (_waypointStore->getGeneration() << 1) | (_missionChanged ? 1 : 0);
+}
+
+bool MissionDownloader::saveMission( File* file )
+{
+	uint8_t missionChanged = _missionChanged ? 1 : 0;
+
+	return file->write( &missionChanged, 1 ) == 1 && _waypointStore->save( file );
+}
+
+bool MissionDownloader::restoreMission( File* file )
+{
+	uint8_t missionChanged = 1;
+	bool restored = file->read( &missionChanged, 1 ) == 1 && _waypointStore->restore( file );
+
+	if ( !restored )
+	{
+		_waypointStore->reset( 0 );
+	}
+
+	_missionChanged = !restored || missionChanged != 0;
+	_state = MISSION_DOWNLOAD_IDLE;
+	_pendingCount = 0;
+	_retries = 0;
+
+	return restored;
+}
+
+void MissionDownloader::sendMissionMessage( uint32_t msgid, uint16_t seq, uint8_t type )
+{
+	if ( _sendMissionMessageCallback != NULL )
+	{
+		_sendMissionMessageCallback( msgid, seq, type );
+	}
+}
+
+bool MissionDownloader::isFlightControllerFound()
+{
+	return _isFlightControllerFoundCallback == NULL || _isFlightControllerFoundCallback();
+}
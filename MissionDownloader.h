@@ -0,0 +1,134 @@
+// MissionDownloader.h
+
+#ifndef _MISSIONDOWNLOADER_h
+#define _MISSIONDOWNLOADER_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "MAVLinkDialect.h"
+#include "MAVLinkEventReceiver.h"
+#include "WaypointStore.h"
+
+constexpr uint8_t MISSION_REQUEST_WINDOW = 4;                  ///< Item requests kept in flight at once
+constexpr uint32_t MISSION_REQUEST_TIMEOUT_MILLISECONDS = 1500; ///< Time to wait for an answer before asking again
+constexpr uint8_t MISSION_REQUEST_RETRIES = 5;                 ///< Unanswered requests in a row before giving up for a while
+constexpr uint32_t MISSION_RETRY_MILLISECONDS = 30000;         ///< Time to wait after giving up before starting over
+
+/**
+ * @brief Messages the mission downloader subscribes to on the event bus
+*/
+constexpr uint32_t MISSION_DOWNLOADER_MESSAGE_IDS[] = {
+	MAVLINK_MSG_ID_MISSION_CURRENT,
+	MAVLINK_MSG_ID_MISSION_COUNT,
+	MAVLINK_MSG_ID_MISSION_ITEM_INT,
+	MAVLINK_MSG_ID_MISSION_ACK
+};
+
+/**
+ * @brief States of the mission download.
+*/
+enum MISSION_DOWNLOAD_STATE
+{
+	MISSION_DOWNLOAD_IDLE,     ///< Nothing to do, the store matches the flight controller as far as we know, or it wasn't found yet
+	MISSION_DOWNLOAD_LIST,     ///< Waiting for MISSION_COUNT
+	MISSION_DOWNLOAD_ITEMS,    ///< Requesting missing items
+	MISSION_DOWNLOAD_WAIT      ///< The flight controller didn't answer, waiting before starting over
+};
+
+/**
+ * @brief MissionDownloader reads the mission from the flight controller with the MAVLink mission protocol and keeps it in a WaypointStore.
+ * Several MISSION_REQUEST_INT are kept in flight so a slow link isn't idle while waiting for each answer. Items are requested
+ * starting at the current waypoint, so the legs that matter next arrive first. Mission items the flight controller sends to a
+ * ground station are stored too. After the mission changes or an item is lost, only the missing items are requested.
+ * It receives the mission messages from the event bus next to the mission monitor.
+*/
+class MissionDownloader final : public MAVLinkEventReceiver
+{
+public:
+	/**
+	 * @brief Constructor
+	 * @param waypointStore The store that receives the mission.
+	*/
+	MissionDownloader( WaypointStore* waypointStore );
+
+	virtual void onMissionCount( mavlink_mission_count_t mavlink_mission_count );
+	virtual void onMissionItemInt( mavlink_mission_item_int_t mavlink_mission_item_int );
+	virtual void onMissionAck( mavlink_mission_ack_t mavlink_mission_ack );
+	virtual void onMissionCurrent( mavlink_mission_current_t mavlink_mission_current );
+
+	/**
+	 * @brief Start downloading the mission list.
+	*/
+	void start();
+
+	/**
+	 * @brief Retry requests that weren't answered.
+	 * @param timeMilliseconds The current time in milliseconds.
+	*/
+	void tick( uint32_t timeMilliseconds );
+
+	/**
+	 * @brief Set the function used to send mission protocol messages to the flight controller.
+	 * @param sendMissionMessageCallback Called with MAVLINK_MSG_ID_MISSION_REQUEST_LIST, MAVLINK_MSG_ID_MISSION_REQUEST_INT with the sequence number
+	 * or MAVLINK_MSG_ID_MISSION_ACK with the result.
+	*/
+	void setSendMissionMessageCallback( void(*sendMissionMessageCallback) (uint32_t msgid, uint16_t seq, uint8_t type) );
+
+	/**
+	 * @brief Set the function that tells if the reader found the flight controller. Until it has, requests would go to system 0
+	 * and the answers would be dropped, so the download doesn't start.
+	 * @param isFlightControllerFoundCallback Returns true once the flight controller is found.
+	*/
+	void setIsFlightControllerFoundCallback( bool(*isFlightControllerFoundCallback) () );
+
+	WaypointStore* getWaypointStore();
+	MISSION_DOWNLOAD_STATE getState();
+
+	/**
+	 * @brief Get a number that changes every time the mission or whether it can be trusted changes, to tell when to save it again.
+	 * @return The generation of the mission.
+	*/
+	uint32_t getGeneration();
+
+	/**
+	 * @brief Write the mission and whether it can be trusted to a file, for the tlog index.
+	 * @param file The file, written at its position.
+	 * @return False if the file couldn't be written.
+	*/
+	bool saveMission( File* file );
+
+	/**
+	 * @brief Carry on with a mission written by saveMission(), the download is idle until the next tick.
+	 * @param file The file, read at its position.
+	 * @return False if the mission couldn't be read, the store is empty and the mission is read again then.
+	*/
+	bool restoreMission( File* file );
+
+private:
+	void sendMissionMessage( uint32_t msgid, uint16_t seq, uint8_t type );
+	bool isFlightControllerFound();
+	void requestItems( uint32_t timeMilliseconds );
+	void complete();
+
+	WaypointStore* _waypointStore;
+	MISSION_DOWNLOAD_STATE _state = MISSION_DOWNLOAD_IDLE;
+	bool _missionChanged = true;        ///< The store can't be trusted until the list is read again
+	uint16_t _nextSeq = 0;               ///< The search for missing items starts here
+	uint16_t _pendingSeq[MISSION_REQUEST_WINDOW];
+	uint32_t _pendingTimeMilliseconds[MISSION_REQUEST_WINDOW];
+	uint8_t _pendingCount = 0;
+	uint8_t _retries = 0;
+	uint32_t _stateTimeMilliseconds = 0;
+	uint32_t _lastTimeMilliseconds = 0;
+	uint32_t _downloadStartMilliseconds = 0;
+	uint16_t _requestsSent = 0;
+
+	void( *_sendMissionMessageCallback ) (uint32_t msgid, uint16_t seq, uint8_t type) = NULL;
+	bool( *_isFlightControllerFoundCallback ) () = NULL;
+};
+
+#endif
@@ -8,21 +8,96 @@
 #include "ArduinoLog.h"
 #include "AudioPlayer.h"
 
+constexpr uint16_t PARAMETER_COUNT = 5;
+constexpr uint16_t STOP_SECONDS_PARAMETER = 0;
+constexpr uint16_t GPS_FIX_PARAMETER = 1;
+constexpr uint16_t CORRIDOR_WIDTH_PARAMETER = 2;
+constexpr uint16_t MAX_BEARING_ERROR_PARAMETER = 3;
+constexpr uint16_t DIVERGENCE_TIME_PARAMETER = 4;
+constexpr const char* PARAMETER_IDS[PARAMETER_COUNT] = { "RB_STOP_SECS", "RB_MIN_GPS_FIX", "RB_CORRIDOR_M", "RB_MAX_BRG_ERR", "RB_DIVERGE_MS" };
+constexpr uint32_t MAX_SECONDS_BEFORE_EMERGENCY_STOP = 600;
+constexpr uint16_t MAX_CORRIDOR_WIDTH_METERS = 1000;
+constexpr uint16_t MAX_BEARING_ERROR_DEGREES = 180;
+constexpr uint32_t MIN_DIVERGENCE_MILLISECONDS = 100;
+constexpr uint32_t MAX_DIVERGENCE_MILLISECONDS = 60000;
+constexpr uint32_t AUTO_MODE = 1UL << ROVER_MODE_AUTO;
+constexpr uint32_t HOLD_MODE = 1UL << ROVER_MODE_HOLD;
 
-MissionMonitor::MissionMonitor( uint32_t secondsBeforeEmergencyStop, GPS_FIX_TYPE lowestGpsFixTpye, AudioPlayer* audioPlayer )
+/**
+ * @brief The built in safety rules, in order of priority. Only the first rule that stops or holds the rover acts in an evaluation.
+ * Threshold, persistence, modes, signal, predicate, action, sound, parameter the threshold follows.
+*/
+constexpr SafetyRule SAFETY_RULES[] =
+{
+	// We haven't heard from the flight controller for some time, we can't continue
+	{ 0, 0, SAFETY_ANY_MODE, SAFETY_SIGNAL_HEARTBEAT_AGE, SAFETY_PREDICATE_AT_LEAST, SAFETY_ACTION_FAIL, SAFETY_SOUND_MAVLINK_BAD, STOP_SECONDS_PARAMETER },
+	// Put the rover in hold mode, all of the progress counters are reset by start() once it is
+	{ 0, 0, AUTO_MODE, SAFETY_SIGNAL_GPS_FIX, SAFETY_PREDICATE_BELOW, SAFETY_ACTION_HOLD, SAFETY_SOUND_GPS_SIGNAL_LOW, GPS_FIX_PARAMETER },
+	// We haven't made progress in the correct direction for some time
+	{ 0, 0, AUTO_MODE, SAFETY_SIGNAL_NO_PROGRESS, SAFETY_PREDICATE_AT_LEAST, SAFETY_ACTION_FAIL, SAFETY_SOUND_NONE, STOP_SECONDS_PARAMETER },
+	// Going around in circles or drifting sideways doesn't always change the distance to the waypoint
+	{ 1, 0, AUTO_MODE, SAFETY_SIGNAL_OUTSIDE_CORRIDOR, SAFETY_PREDICATE_EQUAL, SAFETY_ACTION_FAIL, SAFETY_SOUND_NONE, -1 },
+	// Caught within a few NAV_CONTROLLER_OUTPUT readings instead of secondsBeforeEmergencyStop
+	{ 1, 0, AUTO_MODE, SAFETY_SIGNAL_DIVERGING, SAFETY_PREDICATE_EQUAL, SAFETY_ACTION_FAIL, SAFETY_SOUND_NONE, -1 },
+	// Moving away from the waypoint twice in a row
+	{ 2, 0, AUTO_MODE, SAFETY_SIGNAL_WRONG_DIRECTION, SAFETY_PREDICATE_AT_LEAST, SAFETY_ACTION_PROMPT, SAFETY_SOUND_WRONG_DIRECTION, -1 },
+	// The GPS signal is good again after it was lost, carry on with the mission
+	{ 0, 0, HOLD_MODE, SAFETY_SIGNAL_GPS_FIX, SAFETY_PREDICATE_AT_LEAST, SAFETY_ACTION_RESUME, SAFETY_SOUND_NONE, GPS_FIX_PARAMETER }
+};
+
+
+MissionMonitor::MissionMonitor( MissionThresholds thresholds, AudioPlayer* audioPlayer, bool shadow )
+	: _servoRelay( !shadow )
 {
-	_secondsBeforeEmergencyStop = secondsBeforeEmergencyStop;
-	_lowestGpsFixTpye = lowestGpsFixTpye;
+	_thresholds = thresholds;
 	_audioPlayer = audioPlayer;
+	_shadow = shadow;
+	_divergenceDetector.setLimits( _thresholds.maxBearingErrorDegrees, _thresholds.divergenceMilliseconds );
+
+	for ( const SafetyRule& rule : SAFETY_RULES )
+	{
+		_safetyRules.addRule( rule );
+	}
+
+	_builtInSafetyRuleCount = _safetyRules.getRuleCount();
+
+	for ( uint16_t i = 0; i < PARAMETER_COUNT; i++ )
+	{
+		_safetyRules.setParameter( i, getParameter( _thresholds, i ) );
+	}
+}
+
+void MissionMonitor::setSafetyRules( const SafetyRule* rules, uint8_t count )
+{
+	_safetyRules.truncate( _builtInSafetyRuleCount );
+	_unhandledSafetyRules &= (1UL << _builtInSafetyRuleCount) - 1;
+
+	for ( uint8_t i = 0; i < count; i++ )
+	{
+		if ( !_safetyRules.addRule( rules[i] ) )
+		{
+			Log.trace( "Safety rule %d not added, the table is full", _builtInSafetyRuleCount + i );
+		}
+	}
 }
 
 void MissionMonitor::onHeatbeat( mavlink_heartbeat_t mavlink_heartbeat )
 {
-	_lastHeartbeatTimeMilliseconds = getMissionTime();
+	uint32_t missionTime = getMissionTime();
+
+	// A heartbeat after the link was lost counts as the first one again
+	if ( _firstHeartbeat && missionTime - _lastHeartbeatTimeMilliseconds >= (_thresholds.secondsBeforeEmergencyStop * 1000) )
+	{
+		_firstHeartbeat = false;
+	}
+
+	_lastHeartbeatTimeMilliseconds = missionTime;
 
 	// Check for state change
 	if ( mavlink_heartbeat.type == (uint8_t)MAV_TYPE_GROUND_ROVER )
 	{
+		_isArmed = (mavlink_heartbeat.base_mode & MAV_MODE_FLAG_SAFETY_ARMED) != 0;
+
 		if ( mavlink_heartbeat.custom_mode != (uint32_t)_roverMode )
 		{
 			ROVER_MODE roverMode = (ROVER_MODE)mavlink_heartbeat.custom_mode;
@@ -42,14 +117,24 @@ void MissionMonitor::onHeatbeat( mavlink_heartbeat_t mavlink_heartbeat )
 	if ( _firstHeartbeat == false )
 	{
 		_firstHeartbeat = true;
-		_audioPlayer->play( MAVLINK_GOOD_SOUND );
+		playSound( MAVLINK_GOOD_SOUND );
+	}
+
+	if ( !_bootHeartbeatReported )
+	{
+		// millis() starts counting at power on, this is how long the rover ran unmonitored
+		_bootHeartbeatReported = true;
+		Log.trace( "First heartbeat processed %u milliseconds after power on", millis() );
 	}
+
+	publishSafetySnapshot();
 }
 
 void MissionMonitor::onMissionItemReached( mavlink_mission_item_reached_t mavlink_mission_item_reached )
 {
 	Log.trace( "Destination reached: %d", mavlink_mission_item_reached.seq );
 	_lastProgressMadeTimeMilliseconds = getMissionTime();
+	publishSafetySnapshot();
 }
 
 void MissionMonitor::onNavControllerOutput( mavlink_nav_controller_output_t mavlink_nav_controller )
@@ -57,21 +142,29 @@ void MissionMonitor::onNavControllerOutput( mavlink_nav_controller_output_t mavl
 	bool progressMade = false;
 	uint32_t missionTime = getMissionTime();
 
+	_lastNavOutputTimeMilliseconds = missionTime;
+	_navOutputSeen = true;
+
+	// Single readings are too noisy and too coarsely rounded to compare, the trend of the last few decides
+	_progressEstimator.addSample( missionTime, mavlink_nav_controller.wp_dist );
+
 	if ( _lastDistanceToWaypoint == -1 )
 	{
 		Log.trace( "Distance to new waypoint is %d", mavlink_nav_controller.wp_dist );
 		progressMade = true;
 
 	}
-	else if ( _lastDistanceToWaypoint == mavlink_nav_controller.wp_dist )
+	else if ( !_progressEstimator.hasEstimate() )
 	{
-		//Log.trace( "Distance to waypoint is %d Mission Time: %d", mavlink_nav_controller.wp_dist,getMissionTime() );
-
-		// if the last report was going in the wrong direction, don't capture time as progress being made
-		if ( !_wrongDirection )
-			progressMade = true;
+		// Not enough readings on this leg for a verdict yet
+		progressMade = true;
 	}
-	else if ( _lastDistanceToWaypoint < mavlink_nav_controller.wp_dist )
+	else if ( isHolding() )
+	{
+		// Standing still or circling is what the mission asked for
+		progressMade = true;
+	}
+	else if ( _progressEstimator.isReceding() )
 	{
 		// We are making negative progress toward waypoint
 		Log.trace( "Distance to waypoint is %d and growing for %d milliseconds", mavlink_nav_controller.wp_dist, missionTime - _lastProgressMadeTimeMilliseconds );
@@ -79,20 +172,41 @@ void MissionMonitor::onNavControllerOutput( mavlink_nav_controller_output_t mavl
 		_wrongDirectionCount += 1;
 
 	}
+	else if ( _progressEstimator.isStalled() )
+	{
+		Log.trace( "Distance to waypoint is %d and not closing for %d milliseconds", mavlink_nav_controller.wp_dist, missionTime - _lastProgressMadeTimeMilliseconds );
+	}
 	else
 	{
-		Log.trace( "Distance to waypoint is %d and closing Mission Time: %d", mavlink_nav_controller.wp_dist, getMissionTime() );
+		uint32_t etaMilliseconds = _progressEstimator.getEtaMilliseconds();
+
+		if ( etaMilliseconds != UINT32_MAX )
+		{
+			Log.trace( "Distance to waypoint is %d and closing at %F meters per second, arriving in %u milliseconds", mavlink_nav_controller.wp_dist, (double)_progressEstimator.getClosingRate(), etaMilliseconds );
+		}
+
 		progressMade = true;
 	}
 
 	_lastDistanceToWaypoint = mavlink_nav_controller.wp_dist;
 
+	// A rover pointed the wrong way shows up in the heading long before the distance has grown enough to be sure. nav_bearing is where
+	// the controller steers, the bearing to the waypoint swings past a waypoint and around obstacles. Drifting sideways is left to the corridor
+	_divergenceDetector.update( missionTime, _heading - mavlink_nav_controller.nav_bearing );
+
+	if ( _legPending && _hasPosition )
+	{
+		setLeg( mavlink_nav_controller.target_bearing, mavlink_nav_controller.wp_dist );
+	}
+
 	if ( progressMade )
 	{
 		_lastProgressMadeTimeMilliseconds = missionTime;
 		_wrongDirection = false;
 		_wrongDirectionCount = 0;
 	}
+
+	publishSafetySnapshot();
 }
 
 void MissionMonitor::onMissionCurrent( mavlink_mission_current_t mavlink_mission_current )
@@ -102,9 +216,26 @@ void MissionMonitor::onMissionCurrent( mavlink_mission_current_t mavlink_mission
 		Log.trace( "New destination: %d", mavlink_mission_current.seq );
 		_currentWaypointSequenceId = mavlink_mission_current.seq;
 		_lastDistanceToWaypoint = -1;
+		_progressEstimator.reset();
+		_divergenceDetector.reset();
 		_lastProgressMadeTimeMilliseconds = getMissionTime();
+
+		// Without the downloaded mission the leg starts where the rover is now and is completed by the next NAV_CONTROLLER_OUTPUT
+		_crossTrackMonitor.clearLeg();
+		_outsideCorridor = false;
+		_legPending = true;
+		_legStartsAtRover = false;
+		_legStartLatitude = _latitude;
+		_legStartLongitude = _longitude;
 	}
 
+	if ( _legPending )
+	{
+		setLegFromMission();
+	}
+
+	publishSafetySnapshot();
+
 }
 
 void MissionMonitor::onGPSRawInt( mavlink_gps_raw_int_t mavlink_gps_raw_int )
@@ -120,117 +251,717 @@ void MissionMonitor::onGPS2Raw( mavlink_gps2_raw_t mavlink_gps2_raw )
 }
 
 
+void MissionMonitor::onGlobalPositionInt( mavlink_global_position_int_t mavlink_global_position_int )
+{
+	if ( !_hasPosition && _legPending )
+	{
+		_legStartLatitude = mavlink_global_position_int.lat;
+		_legStartLongitude = mavlink_global_position_int.lon;
+	}
+
+	_hasPosition = true;
+	_latitude = mavlink_global_position_int.lat;
+	_longitude = mavlink_global_position_int.lon;
+	_heading = mavlink_global_position_int.hdg == UINT16_MAX ? NAN : mavlink_global_position_int.hdg / 100.0f;
+
+	bool outsideCorridor = _outsideCorridor;
+
+	if ( _crossTrackMonitor.hasLeg() )
+	{
+		float crossTrackError = _crossTrackMonitor.update( _latitude, _longitude );
+
+		outsideCorridor = _thresholds.corridorWidthMeters != 0 && fabsf( crossTrackError ) * 2 > _thresholds.corridorWidthMeters;
+	}
+
+	// The whole mission is known, the rover may cut a corner or skip a waypoint as long as it stays near the legs around the current one
+	if ( _corridorIndex.isBuilt() )
+	{
+		uint16_t leg = _corridorIndex.getLeg( _currentWaypointSequenceId );
+		uint16_t firstLeg = leg > CORRIDOR_LEGS_BEHIND ? leg - CORRIDOR_LEGS_BEHIND : 0;
+
+		outsideCorridor = !_corridorIndex.contains( _latitude, _longitude, firstLeg, leg + CORRIDOR_LEGS_AHEAD );
+	}
+
+	if ( outsideCorridor && !_outsideCorridor )
+	{
+		_outsideCorridorSinceMilliseconds = getMissionTime();
+	}
+
+	_outsideCorridor = outsideCorridor;
+}
+
+void MissionMonitor::setLeg( int16_t targetBearing, uint16_t distanceToWaypoint )
+{
+	int32_t waypointLatitude;
+	int32_t waypointLongitude;
+
+	if ( setLegFromMission() )
+	{
+		return;
+	}
+
+	// Use the waypoint itself if it was downloaded, only the start of the leg is missing
+	if ( _missionDownloader == NULL || !_missionDownloader->getWaypointStore()->getPosition( _currentWaypointSequenceId, &waypointLatitude, &waypointLongitude ) )
+	{
+		CrossTrackMonitor::project( _latitude, _longitude, targetBearing, distanceToWaypoint, &waypointLatitude, &waypointLongitude );
+	}
+
+	_crossTrackMonitor.setLeg( _legStartLatitude, _legStartLongitude, waypointLatitude, waypointLongitude );
+	_legPending = false;
+
+	Log.trace( "Leg to destination %d is %d meters long", _currentWaypointSequenceId, (int32_t)_crossTrackMonitor.getLegLength() );
+}
+
+bool MissionMonitor::setLegFromMission()
+{
+	WaypointStore* waypointStore;
+	uint16_t previousSeq;
+	int32_t startLatitude;
+	int32_t startLongitude;
+	int32_t waypointLatitude;
+	int32_t waypointLongitude;
+
+	// A leg restarted by a mode change begins at the rover, not at the previous waypoint
+	if ( _missionDownloader == NULL || _legStartsAtRover || _currentWaypointSequenceId == 0 )
+	{
+		return false;
+	}
+
+	waypointStore = _missionDownloader->getWaypointStore();
+
+	if ( !waypointStore->getPosition( _currentWaypointSequenceId, &waypointLatitude, &waypointLongitude ) ||
+		!waypointStore->findPrevious( _currentWaypointSequenceId, &previousSeq ) ||
+		!waypointStore->getPosition( previousSeq, &startLatitude, &startLongitude ) )
+	{
+		return false;
+	}
+
+	_crossTrackMonitor.setLeg( startLatitude, startLongitude, waypointLatitude, waypointLongitude );
+	_legPending = false;
+
+	Log.trace( "Leg from waypoint %d to %d is %d meters long", previousSeq, _currentWaypointSequenceId, (int32_t)_crossTrackMonitor.getLegLength() );
+
+	return true;
+}
+
+bool MissionMonitor::isHolding()
+{
+	return _missionDownloader != NULL && _missionDownloader->getWaypointStore()->isHolding( _currentWaypointSequenceId );
+}
+
+void MissionMonitor::updateCorridorIndex()
+{
+	WaypointStore* waypointStore = _missionDownloader->getWaypointStore();
+	bool isCurrent = waypointStore->isComplete() && _thresholds.corridorWidthMeters != 0 &&
+		_corridorIndexGeneration == waypointStore->getGeneration() && _corridorIndexWidthMeters == _thresholds.corridorWidthMeters;
+
+	if ( isCurrent )
+	{
+		if ( _corridorIndex.isBuilding() )
+		{
+			continueCorridorIndex();
+		}
+
+		return;
+	}
+
+	if ( _corridorIndex.isBuilt() )
+	{
+		Log.trace( "Corridor checks averaged %u cycles", _corridorIndex.getAverageQueryCycles() );
+		_outsideCorridor = false;
+	}
+
+	_corridorIndex.clear();
+
+	if ( !waypointStore->isComplete() || _thresholds.corridorWidthMeters == 0 || waypointStore->getCount() == 0 )
+	{
+		return;
+	}
+
+	uint32_t startMicroseconds = micros();
+
+	// Remember what the index was built from even when it fails, so a mission that is too large isn't tried on every tick
+	_corridorIndexGeneration = waypointStore->getGeneration();
+	_corridorIndexWidthMeters = _thresholds.corridorWidthMeters;
+	_corridorIndexBuildTicks = 0;
+
+	if ( !_corridorIndex.beginBuild( waypointStore, _thresholds.corridorWidthMeters ) )
+	{
+		Log.trace( "Corridor index not built, checking the current leg only" );
+		return;
+	}
+
+	_corridorIndexBuildMicroseconds = micros() - startMicroseconds;
+	continueCorridorIndex();
+}
+
+void MissionMonitor::continueCorridorIndex()
+{
+	uint32_t startMicroseconds = micros();
+
+	// The legs are rasterized a slice per tick, the current leg is checked until the index is built
+	bool building = _corridorIndex.continueBuild( CORRIDOR_INDEX_BUILD_SLICE_CELLS );
+
+	_corridorIndexBuildMicroseconds += micros() - startMicroseconds;
+	_corridorIndexBuildTicks++;
+
+	if ( building )
+	{
+		return;
+	}
+
+	if ( _corridorIndex.isBuilt() )
+	{
+		Log.trace( "Corridor index of %d legs built in %u microseconds over %u ticks: %u cells of %F meters, %u entries, %u bytes %s",
+			_corridorIndex.getLegCount(),
+			_corridorIndexBuildMicroseconds,
+			_corridorIndexBuildTicks,
+			_corridorIndex.getCellCount(),
+			(double)_corridorIndex.getCellMeters(),
+			_corridorIndex.getEntryCount(),
+			_corridorIndex.getMemoryBytes(),
+			_corridorIndex.isInExternalMemory() ? "in PSRAM" : "on the heap" );
+
+		uint32_t averageCycles;
+		uint32_t mostCycles;
+		uint16_t queries = _corridorIndex.benchmark( _missionDownloader->getWaypointStore(), &averageCycles, &mostCycles );
+
+		Log.trace( "Corridor index benchmark: %u checks at the waypoints took %u cycles on average, %u at most", queries, averageCycles, mostCycles );
+	}
+	else
+	{
+		Log.trace( "Corridor index not built, checking the current leg only" );
+	}
+}
+
+void MissionMonitor::setMissionDownloader( MissionDownloader* missionDownloader )
+{
+	_missionDownloader = missionDownloader;
+}
+
+void MissionMonitor::onParamRequestRead( mavlink_param_request_read_t mavlink_param_request_read )
+{
+	for ( uint16_t i = 0; i < PARAMETER_COUNT; i++ )
+	{
+		if ( mavlink_param_request_read.param_index == i ||
+			(mavlink_param_request_read.param_index == -1 && strncmp( mavlink_param_request_read.param_id, PARAMETER_IDS[i], sizeof( mavlink_param_request_read.param_id ) ) == 0) )
+		{
+			sendParameter( i );
+		}
+	}
+}
+
+void MissionMonitor::onParamRequestList( mavlink_param_request_list_t mavlink_param_request_list )
+{
+	for ( uint16_t i = 0; i < PARAMETER_COUNT; i++ )
+	{
+		sendParameter( i );
+	}
+}
+
+void MissionMonitor::onParamSet( mavlink_param_set_t mavlink_param_set )
+{
+	MissionThresholds thresholds = _thresholdsPending ? _pendingThresholds : _thresholds;
+	int32_t value = (int32_t)round( mavlink_param_set.param_value );
+
+	for ( uint16_t i = 0; i < PARAMETER_COUNT; i++ )
+	{
+		if ( strncmp( mavlink_param_set.param_id, PARAMETER_IDS[i], sizeof( mavlink_param_set.param_id ) ) != 0 )
+		{
+			continue;
+		}
+
+		// Out of range values are refused, the reply carries the value still in use
+		if ( setParameter( &thresholds, i, value ) )
+		{
+			setThresholds( thresholds );
+		}
+		else
+		{
+			Log.trace( "Refused parameter %s value %d", PARAMETER_IDS[i], value );
+		}
+
+		sendParameter( i );
+	}
+}
+
+int32_t MissionMonitor::getParameter( const MissionThresholds& thresholds, uint16_t index )
+{
+	switch ( index )
+	{
+		case STOP_SECONDS_PARAMETER:
+			return thresholds.secondsBeforeEmergencyStop;
+		case GPS_FIX_PARAMETER:
+			return thresholds.lowestGpsFixType;
+		case CORRIDOR_WIDTH_PARAMETER:
+			return thresholds.corridorWidthMeters;
+		case MAX_BEARING_ERROR_PARAMETER:
+			return thresholds.maxBearingErrorDegrees;
+		case DIVERGENCE_TIME_PARAMETER:
+			return thresholds.divergenceMilliseconds;
+		default:
+			return 0;
+	}
+}
+
+bool MissionMonitor::setParameter( MissionThresholds* thresholds, uint16_t index, int32_t value )
+{
+	if ( index == STOP_SECONDS_PARAMETER && value >= 1 && (uint32_t)value <= MAX_SECONDS_BEFORE_EMERGENCY_STOP )
+	{
+		thresholds->secondsBeforeEmergencyStop = value;
+	}
+	else if ( index == GPS_FIX_PARAMETER && value >= GPS_FIX_TYPE_NO_GPS && value < GPS_FIX_TYPE_ENUM_END )
+	{
+		thresholds->lowestGpsFixType = (GPS_FIX_TYPE)value;
+	}
+	else if ( index == CORRIDOR_WIDTH_PARAMETER && value >= 0 && value <= MAX_CORRIDOR_WIDTH_METERS )
+	{
+		thresholds->corridorWidthMeters = value;
+	}
+	else if ( index == MAX_BEARING_ERROR_PARAMETER && value >= 0 && value <= MAX_BEARING_ERROR_DEGREES )
+	{
+		thresholds->maxBearingErrorDegrees = value;
+	}
+	else if ( index == DIVERGENCE_TIME_PARAMETER && (uint32_t)value >= MIN_DIVERGENCE_MILLISECONDS && (uint32_t)value <= MAX_DIVERGENCE_MILLISECONDS )
+	{
+		thresholds->divergenceMilliseconds = value;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+void MissionMonitor::setThresholds( MissionThresholds thresholds )
+{
+	_pendingThresholds = thresholds;
+	_thresholdsPending = true;
+}
+
+void MissionMonitor::applyPendingThresholds()
+{
+	if ( !_thresholdsPending )
+	{
+		return;
+	}
+
+	if ( _pendingThresholds.secondsBeforeEmergencyStop != _thresholds.secondsBeforeEmergencyStop ||
+		_pendingThresholds.lowestGpsFixType != _thresholds.lowestGpsFixType ||
+		_pendingThresholds.corridorWidthMeters != _thresholds.corridorWidthMeters ||
+		_pendingThresholds.maxBearingErrorDegrees != _thresholds.maxBearingErrorDegrees ||
+		_pendingThresholds.divergenceMilliseconds != _thresholds.divergenceMilliseconds )
+	{
+		Log.trace( "Thresholds changed: %u seconds before emergency stop, lowest GPS fix type %d, corridor %d meters wide, bearing error %d degrees for %u milliseconds",
+			_pendingThresholds.secondsBeforeEmergencyStop,
+			_pendingThresholds.lowestGpsFixType,
+			_pendingThresholds.corridorWidthMeters,
+			_pendingThresholds.maxBearingErrorDegrees,
+			_pendingThresholds.divergenceMilliseconds );
+	}
+
+	if ( _pendingThresholds.corridorWidthMeters != _thresholds.corridorWidthMeters )
+	{
+		// Judge the next position against the new width
+		_outsideCorridor = false;
+	}
+
+	_thresholds = _pendingThresholds;
+	_thresholdsPending = false;
+	_divergenceDetector.setLimits( _thresholds.maxBearingErrorDegrees, _thresholds.divergenceMilliseconds );
+
+	for ( uint16_t i = 0; i < PARAMETER_COUNT; i++ )
+	{
+		_safetyRules.setParameter( i, getParameter( _thresholds, i ) );
+	}
+}
+
+void MissionMonitor::sendParameter( uint16_t index )
+{
+	// Report the value that the next evaluation will use
+	sendParamValue( PARAMETER_IDS[index], getParameter( _thresholdsPending ? _pendingThresholds : _thresholds, index ), index, PARAMETER_COUNT );
+}
+
 void MissionMonitor::tick()
 {
 	evaluateMission();
 
+	if ( _missionDownloader != NULL )
+	{
+		// The downloader is shared, only the monitor in charge asks the flight controller for the mission
+		if ( !_shadow )
+		{
+			_missionDownloader->tick( getMissionTime() );
+		}
+
+		updateCorridorIndex();
+	}
+
 	if ( !_firstTick )
 	{
 		_firstTick = true;
-		_audioPlayer->play( READY_SOUND );
+		playSound( READY_SOUND );
 	}
 
 }
 
 /**
  * @brief
- * This method will monitor the current state of the flight controller. When the flight controller
- * is in AUTO mode, the logic will ensure progress is being made between waypoints. If it detects a problem, this
- * method will call fail mission.
+ * This method will monitor the current state of the flight controller. The signals the safety rules read are updated, and
+ * the rules whose signals changed are evaluated. When a rule holds, its action is taken: the rover can be put in hold mode,
+ * stopped with fail mission, or an alarm or prompt can be sounded.
 */
 void MissionMonitor::evaluateMission()
 {
+	applyPendingThresholds();
+	publishSafetySnapshot();
+
 	uint32_t  missionTime = getMissionTime();
-	uint32_t timeDifference = missionTime - _lastProgressMadeTimeMilliseconds;
 	uint8_t maxGPSFixType = max( _gps1FixType, _gps2FixType );
 
-	// Check if the rover is in auto mode
-	bool isAutoMode = _roverMode == ROVER_MODE_AUTO;
+	// Seconds since the last heartbeat, MAVLink is lost once this reaches secondsBeforeEmergencyStop
+	_safetyRules.setSignal( SAFETY_SIGNAL_HEARTBEAT_AGE, _firstHeartbeat ? (missionTime - _lastHeartbeatTimeMilliseconds) / 1000 : 0 );
 
-	// Check if the rover is in hold mode
-	bool isHoldMode = _roverMode == ROVER_MODE_HOLD;
+	// GPS is lost if the fix type drops below the lowest fix type allowed
+	_safetyRules.setSignal( SAFETY_SIGNAL_GPS_FIX, maxGPSFixType );
 
-	// MAVLink is lost if the last heartbeat was received over _secondsBeforeEmergencyStop seconds ago
-	bool mavlinkLost = _firstHeartbeat && missionTime - _lastHeartbeatTimeMilliseconds >= (_secondsBeforeEmergencyStop * 1000);
+	// Seconds since the rover was last confidently closing on the next waypoint
+	_safetyRules.setSignal( SAFETY_SIGNAL_NO_PROGRESS, _lastProgressMadeTimeMilliseconds != 0 ? (missionTime - _lastProgressMadeTimeMilliseconds) / 1000 : 0 );
 
-	// GPS is lost if the fix type drops below _lowestGpsFixTpye
-	bool gpsLost = maxGPSFixType < _lowestGpsFixTpye;
+	// The rover is off course if it left the corridor around the straight line from the last waypoint to the next one and stayed out
+	// for divergenceMilliseconds, the same as the divergence check, so a single GPS jump or a brief swerve doesn't stop it
+	_safetyRules.setSignal( SAFETY_SIGNAL_OUTSIDE_CORRIDOR,
+		_outsideCorridor && missionTime - _outsideCorridorSinceMilliseconds >= _thresholds.divergenceMilliseconds );
 
-	// The rover is no longer making progress if the last time it closed the distance to the next waypoint was over _secondsBeforeEmergencyStop seconds
-	bool noProgress = _lastProgressMadeTimeMilliseconds != 0 && timeDifference >= (_secondsBeforeEmergencyStop * 1000);
+	// The rover is running away if its heading has been off where it is steered for divergenceMilliseconds
+	_safetyRules.setSignal( SAFETY_SIGNAL_DIVERGING, _divergenceDetector.isDiverging() );
 
+	_safetyRules.setSignal( SAFETY_SIGNAL_WRONG_DIRECTION, _wrongDirectionCount );
+	_safetyRules.setSignal( SAFETY_SIGNAL_CROSS_TRACK_ERROR, _crossTrackMonitor.hasLeg() ? (int32_t)round( fabsf( _crossTrackMonitor.getCrossTrackError() ) ) : 0 );
+	_safetyRules.setSignal( SAFETY_SIGNAL_BEARING_ERROR, (int32_t)round( _divergenceDetector.getBearingError() ) );
+	_safetyRules.setSignal( SAFETY_SIGNAL_DISTANCE_TO_WAYPOINT, max( _lastDistanceToWaypoint, (int16_t)0 ) );
+	_safetyRules.setMode( _roverMode );
 
-	if ( !_isFailed )
+	uint32_t activated = _safetyRules.evaluate( missionTime );
+	uint32_t active = _safetyRules.getActiveRules();
+
+	// A rule that activates while a rule before it acts is handled once that rule lets go
+	_unhandledSafetyRules = (_unhandledSafetyRules | activated) & active;
+
+	if ( _isFailed )
 	{
+		return;
+	}
 
-		if ( mavlinkLost )
+	for ( uint8_t i = 0; i < _safetyRules.getRuleCount(); i++ )
+	{
+		uint32_t bit = 1UL << i;
+		uint8_t action = _safetyRules.getRule( i ).action;
+		bool repeats = action == SAFETY_ACTION_HOLD || action == SAFETY_ACTION_RESUME;
+
+		if ( (_unhandledSafetyRules & bit) || (repeats && (active & bit)) )
 		{
-			// We haven't heard from the flight controller for some time, we can't continue
-			Log.trace( "MAVLink lost" );
+			takeAction( i, !(_unhandledSafetyRules & bit) );
+			_unhandledSafetyRules &= ~bit;
 
-			failMission();
+			if ( action == SAFETY_ACTION_HOLD || action == SAFETY_ACTION_FAIL )
+			{
+				break;
+			}
+		}
+	}
+}
 
-			_firstHeartbeat = false; // Start looking for first heartbeat again
-			_audioPlayer->play( MAVLINK_BAD_SOUND );
+void MissionMonitor::takeAction( uint8_t index, bool repeated )
+{
+	const SafetyRule& rule = _safetyRules.getRule( index );
 
-		}
+	if ( !repeated )
+	{
+		Log.trace( "Safety rule %d: %s is %d, %s", index, SafetyRuleEngine::getSignalName( rule.signal ), _safetyRules.getSignal( (SAFETY_SIGNAL)rule.signal ), SafetyRuleEngine::getActionName( rule.action ) );
+	}
 
-		if ( isAutoMode )
-		{
-			if ( gpsLost )
+	switch ( rule.action )
+	{
+		case SAFETY_ACTION_HOLD:
+			if ( !repeated )
 			{
-				// Put the rover in hold mode
-				// If the rover does go into hold mode all of the progress counters will be reset by the start() function
-				sendModeChange( ROVER_MODE_HOLD );
+				_holdCount++;
+			}
 
-				Log.trace( "GPS lost, current fix type: %d", maxGPSFixType );
+			sendModeChange( ROVER_MODE_HOLD );
+			break;
+		case SAFETY_ACTION_FAIL:
+			failMission();
+			break;
+		case SAFETY_ACTION_ALARM:
+			_servoRelay.alarmRelayOn();
+			break;
+		case SAFETY_ACTION_RESUME:
+			sendModeChange( ROVER_MODE_AUTO );
+			break;
+	}
 
-				_audioPlayer->play( GPS_SIGNAL_LOW_SOUND );
-			}
-			else if ( noProgress )
-			{
-				// We haven't made progress in the correct direction for some time, stop the rover
-				Log.trace( "Last progress time: %d ", round( missionTime - _lastHeartbeatTimeMilliseconds ) );
-				failMission();
+	if ( !repeated && rule.sound != SAFETY_SOUND_NONE )
+	{
+		playSound( SafetyRuleEngine::getSoundFile( rule.sound ) );
+	}
+}
 
-			}
+void MissionMonitor::logSafetyRuleCosts()
+{
+	if ( _safetyRules.getEvaluationCount() == 0 )
+	{
+		return;
+	}
 
-			if ( _wrongDirectionCount == 2 )
-			{
-				// wrong direction detected twice, play sound and bump count to avoid play this sound again, its the only thing this count is being used for
-				_wrongDirectionCount += 1;
-				_audioPlayer->play( WRONG_DIRECTION_SOUND );
-			}
+	Log.trace( "Safety rules: %d rules, %u evaluations at %u cycles each", _safetyRules.getRuleCount(), _safetyRules.getEvaluationCount(), _safetyRules.getAverageEvaluationCycles() );
+
+	for ( uint8_t i = 0; i < _safetyRules.getRuleCount(); i++ )
+	{
+		uint32_t cycles = _safetyRules.getAverageRuleCycles( i );
+
+		if ( cycles != 0 )
+		{
+			Log.trace( "Safety rule %d: %s, %u cycles each", i, SafetyRuleEngine::getSignalName( _safetyRules.getRule( i ).signal ), cycles );
 		}
-		else if ( isHoldMode && !gpsLost )
+	}
+}
+
+ServoRelay* MissionMonitor::getServoRelay()
+{
+	return &_servoRelay;
+}
+
+void MissionMonitor::onMissedDeadline( const char* taskName )
+{
+	Log.error( "Task %s missed its deadline", taskName );
+
+	if ( !_isFailed )
+	{
+		failMission();
+	}
+}
+
+void MissionMonitor::setSafetyInterrupt( SafetyInterrupt* safetyInterrupt )
+{
+	_safetyInterrupt = safetyInterrupt;
+	publishSafetySnapshot();
+}
+
+void MissionMonitor::onSafetyTrip( const char* checkName )
+{
+	Log.error( "Safety interrupt cut the power: %s", checkName );
+
+	if ( !_isFailed )
+	{
+		failMission();
+	}
+}
+
+void MissionMonitor::saveSnapshot( MissionMonitorSnapshot* snapshot )
+{
+	snapshot->roverMode = _roverMode;
+	snapshot->mavModeFlag = _mavModeFlag;
+	snapshot->lastDistanceToWaypoint = _lastDistanceToWaypoint;
+	snapshot->currentWaypointSequenceId = _currentWaypointSequenceId;
+	snapshot->lastProgressMadeTimeMilliseconds = _lastProgressMadeTimeMilliseconds;
+	snapshot->lastHeartbeatTimeMilliseconds = _lastHeartbeatTimeMilliseconds;
+	snapshot->lastNavOutputTimeMilliseconds = _lastNavOutputTimeMilliseconds;
+	snapshot->firstHeartbeat = _firstHeartbeat;
+	snapshot->navOutputSeen = _navOutputSeen;
+	snapshot->isFailed = _isFailed;
+	snapshot->wrongDirection = _wrongDirection;
+	snapshot->hasPosition = _hasPosition;
+	snapshot->legPending = _legPending;
+	snapshot->legStartsAtRover = _legStartsAtRover;
+	snapshot->outsideCorridor = _outsideCorridor;
+	snapshot->outsideCorridorSinceMilliseconds = _outsideCorridorSinceMilliseconds;
+	snapshot->powerOn = _servoRelay.isPowerOn();
+	snapshot->alarmOn = _servoRelay.isAlarmOn();
+	snapshot->wrongDirectionCount = _wrongDirectionCount;
+	snapshot->gps1FixType = _gps1FixType;
+	snapshot->gps2FixType = _gps2FixType;
+	snapshot->latitude = _latitude;
+	snapshot->longitude = _longitude;
+	snapshot->heading = _heading;
+	snapshot->legStartLatitude = _legStartLatitude;
+	snapshot->legStartLongitude = _legStartLongitude;
+	snapshot->unhandledSafetyRules = _unhandledSafetyRules;
+	snapshot->crossTrackMonitor = _crossTrackMonitor;
+	snapshot->progressEstimator = _progressEstimator;
+	snapshot->divergenceDetector = _divergenceDetector;
+	snapshot->safetyRules = _safetyRules;
+}
+
+void MissionMonitor::restoreSnapshot( const MissionMonitorSnapshot& snapshot )
+{
+	_roverMode = snapshot.roverMode;
+	_mavModeFlag = snapshot.mavModeFlag;
+	_lastDistanceToWaypoint = snapshot.lastDistanceToWaypoint;
+	_currentWaypointSequenceId = snapshot.currentWaypointSequenceId;
+	_lastProgressMadeTimeMilliseconds = snapshot.lastProgressMadeTimeMilliseconds;
+	_lastHeartbeatTimeMilliseconds = snapshot.lastHeartbeatTimeMilliseconds;
+	_lastNavOutputTimeMilliseconds = snapshot.lastNavOutputTimeMilliseconds;
+	_firstHeartbeat = snapshot.firstHeartbeat;
+	_navOutputSeen = snapshot.navOutputSeen;
+	_isFailed = snapshot.isFailed;
+	_wrongDirection = snapshot.wrongDirection;
+	_hasPosition = snapshot.hasPosition;
+	_legPending = snapshot.legPending;
+	_legStartsAtRover = snapshot.legStartsAtRover;
+	_outsideCorridor = snapshot.outsideCorridor;
+	_outsideCorridorSinceMilliseconds = snapshot.outsideCorridorSinceMilliseconds;
+	_wrongDirectionCount = snapshot.wrongDirectionCount;
+	_gps1FixType = snapshot.gps1FixType;
+	_gps2FixType = snapshot.gps2FixType;
+	_latitude = snapshot.latitude;
+	_longitude = snapshot.longitude;
+	_heading = snapshot.heading;
+	_legStartLatitude = snapshot.legStartLatitude;
+	_legStartLongitude = snapshot.legStartLongitude;
+	_unhandledSafetyRules = snapshot.unhandledSafetyRules;
+	_crossTrackMonitor = snapshot.crossTrackMonitor;
+	_progressEstimator = snapshot.progressEstimator;
+	_divergenceDetector = snapshot.divergenceDetector;
+	_safetyRules = snapshot.safetyRules;
+
+	// The heartbeats before the snapshot were played back, or skipped, already
+	_bootHeartbeatReported = true;
+
+	if ( _missionDownloader != NULL )
+	{
+		updateCorridorIndex();
+
+		while ( _corridorIndex.isBuilding() )
 		{
-			// We are in hold mode and gps single is good now
-			// Put the rover into auto mode after a gps signal lost
-			sendModeChange( ROVER_MODE_AUTO );
+			continueCorridorIndex();
 		}
 
+		// The flag restored above belongs to the index built then
+		_outsideCorridor = snapshot.outsideCorridor;
 	}
 
+	if ( snapshot.powerOn )
+	{
+		_servoRelay.powerRelayOn();
+	}
+	else
+	{
+		_servoRelay.powerRelayOff();
+	}
+
+	if ( snapshot.alarmOn )
+	{
+		_servoRelay.alarmRelayOn();
+	}
+	else
+	{
+		_servoRelay.alarmRelayOff();
+	}
+
+	publishSafetySnapshot();
+}
+
+uint32_t MissionMonitor::getSnapshotKey()
+{
+	applyPendingThresholds();
+
+	uint16_t crc = crc_calculate( (const uint8_t*)&_thresholds, sizeof( MissionThresholds ) );
+
+	for ( uint8_t i = 0; i < _safetyRules.getRuleCount(); i++ )
+	{
+		const SafetyRule& rule = _safetyRules.getRule( i );
+		crc_accumulate_buffer( &crc, (const char*)&rule, sizeof( SafetyRule ) );
+	}
+
+	return ((uint32_t)_safetyRules.getRuleCount() << 16) | crc;
+}
+
+void MissionMonitor::publishSafetySnapshot()
+{
+	if ( _safetyInterrupt == NULL )
+	{
+		return;
+	}
+
+	SafetySnapshot snapshot;
+
+	snapshot.heartbeatSeen = _firstHeartbeat;
+	snapshot.navOutputSeen = _navOutputSeen;
+	snapshot.lastHeartbeatMilliseconds = _lastHeartbeatTimeMilliseconds;
+	snapshot.lastProgressMilliseconds = _lastProgressMadeTimeMilliseconds;
+	snapshot.lastNavOutputMilliseconds = _lastNavOutputTimeMilliseconds;
 
+	// The interrupt checks the same fail rules the main loop evaluates, with the thresholds and modes they have now
+	snapshot.heartbeatTimeoutMilliseconds = _safetyRules.getFailTimeoutMilliseconds( SAFETY_SIGNAL_HEARTBEAT_AGE, _roverMode );
+	snapshot.progressTimeoutMilliseconds = _safetyRules.getFailTimeoutMilliseconds( SAFETY_SIGNAL_NO_PROGRESS, _roverMode );
+
+	_safetyInterrupt->publish( snapshot );
 }
 
 void MissionMonitor::failMission()
 {
 	Log.trace( "*************** SHUTDOWN *********************************************" );
 	_isFailed = true;
+	_stopCount++;
 	_servoRelay.powerRelayOff();
 	_servoRelay.alarmRelayOn();
-	_audioPlayer->play( EMERGENCY_STOP_SOUND );
+	playSound( EMERGENCY_STOP_SOUND );
 	Log.trace( "**********************************************************************" );
 
 }
 
+bool MissionMonitor::isDriving()
+{
+	return _isArmed && _roverMode == ROVER_MODE_AUTO;
+}
+
+uint32_t MissionMonitor::getStopCount()
+{
+	return _stopCount;
+}
+
+uint32_t MissionMonitor::getHoldCount()
+{
+	return _holdCount;
+}
+
+void MissionMonitor::playSound( const char* fileName )
+{
+	// A shadow monitor has no player
+	if ( _audioPlayer != NULL )
+	{
+		_audioPlayer->play( fileName );
+	}
+}
+
 void MissionMonitor::start()
 {
 	_lastProgressMadeTimeMilliseconds = 0;
 	_isFailed = false;
 	_wrongDirection = false;
 	_wrongDirectionCount = 0;
+	_progressEstimator.reset();
+	_divergenceDetector.reset();
+
+	// Every rule is evaluated afresh in the new drive mode
+	logSafetyRuleCosts();
+	_safetyRules.reset();
+	_unhandledSafetyRules = 0;
+
+	// Measure the leg again from where the rover is now, the drive mode may have been changed to bring it back on course
+	_crossTrackMonitor.clearLeg();
+	_outsideCorridor = false;
+	_legPending = true;
+	_legStartsAtRover = true;
+	_legStartLatitude = _latitude;
+	_legStartLongitude = _longitude;
+
+	// The interrupt must see the new mode before the power is on, or it would judge it by the timeouts of the old one
+	_lastNavOutputTimeMilliseconds = getMissionTime();
+	publishSafetySnapshot();
 
 	_servoRelay.powerRelayOn();
 	_servoRelay.alarmRelayOff();
@@ -243,31 +974,31 @@ void MissionMonitor::play( ROVER_MODE roverMode )
 	switch ( roverMode )
 	{
 		case ROVER_MODE_MANUAL:
-			_audioPlayer->play( MANUAL_MODE_SOUND );
+			playSound( MANUAL_MODE_SOUND );
 			break;
 		case ROVER_MODE_ACRO:
-			_audioPlayer->play( ACRO_MODE_SOUND );
+			playSound( ACRO_MODE_SOUND );
 			break;
 		case ROVER_MODE_STEERING:
-			_audioPlayer->play( STEERING_MODE_SOUND );
+			playSound( STEERING_MODE_SOUND );
 			break;
 		case ROVER_MODE_HOLD:
-			_audioPlayer->play( HOLD_MODE_SOUND );
+			playSound( HOLD_MODE_SOUND );
 			break;
 		case ROVER_MODE_LOITER:
-			_audioPlayer->play( LOITER_MODE_SOUND );
+			playSound( LOITER_MODE_SOUND );
 			break;
 		case ROVER_MODE_AUTO:
-			_audioPlayer->play( AUTO_MODE_SOUND );
+			playSound( AUTO_MODE_SOUND );
 			break;
 		case ROVER_MODE_RTL:
-			_audioPlayer->play( RTL_MODE_SOUND );
+			playSound( RTL_MODE_SOUND );
 			break;
 		case ROVER_MODE_SMART_RTL:
-			_audioPlayer->play( SRTL_MODE_SOUND );
+			playSound( SRTL_MODE_SOUND );
 			break;
 		case ROVER_MODE_GUIDED:
-			_audioPlayer->play( GUIDED_MODE_SOUND );
+			playSound( GUIDED_MODE_SOUND );
 			break;
 		case ROVER_MODE_INITIALIZING:
 			break;
@@ -10,24 +10,114 @@
 #endif
 
 
-#include <mavlink_2_ardupilot.h>
+#include "MAVLinkDialect.h"
 #include "MAVLinkEventReceiver.h"
 #include "ServoRelay.h"
 #include "AudioPlayer.h"
+#include "CrossTrackMonitor.h"
+#include "MissionDownloader.h"
+#include "CorridorIndex.h"
+#include "ProgressEstimator.h"
+#include "DivergenceDetector.h"
+#include "SafetyRuleEngine.h"
+#include "SafetyInterrupt.h"
+
+/**
+ * @brief Messages the mission monitor subscribes to on the event bus
+*/
+constexpr uint32_t MISSION_MONITOR_MESSAGE_IDS[] = {
+	MAVLINK_MSG_ID_HEARTBEAT,
+	MAVLINK_MSG_ID_GPS_RAW_INT,
+	MAVLINK_MSG_ID_GLOBAL_POSITION_INT,
+	MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT,
+	MAVLINK_MSG_ID_MISSION_CURRENT,
+	MAVLINK_MSG_ID_MISSION_ITEM_REACHED,
+	MAVLINK_MSG_ID_GPS2_RAW,
+	MAVLINK_MSG_ID_PARAM_REQUEST_READ,
+	MAVLINK_MSG_ID_PARAM_REQUEST_LIST,
+	MAVLINK_MSG_ID_PARAM_SET
+};
+
+constexpr uint16_t CORRIDOR_LEGS_BEHIND = 1;   ///< Legs before the current one the rover may be near, when it cuts the corner onto the current leg
+constexpr uint16_t CORRIDOR_LEGS_AHEAD = 1;    ///< Legs after the current one the rover may be near, when it cuts the corner at the waypoint or skips it
+
+/**
+ * @brief The limits a mission is evaluated against.
+*/
+struct MissionThresholds
+{
+	uint32_t secondsBeforeEmergencyStop = 20;         ///< Seconds an issue can last before the rover is stopped
+	GPS_FIX_TYPE lowestGpsFixType = GPS_FIX_TYPE_NO_GPS; ///< The lowest GPS fix type that doesn't pause the mission
+	uint16_t corridorWidthMeters = 0;                 ///< Width of the corridor around the current leg the rover must stay in, 0 turns the check off
+	uint16_t maxBearingErrorDegrees = 0;              ///< Largest difference between the heading and where the flight controller steers, 0 turns the check off
+	uint32_t divergenceMilliseconds = 1000;           ///< How long the heading can be beyond its limit, or the rover outside the corridor, before it is stopped
+};
+
+/**
+ * @brief The state of the mission monitor its decisions depend on. It is saved in the tlog index, so a replay can start part way
+ * through a log and carry on as if it had been replayed from the start. The downloaded mission is kept next to it in the index and
+ * restored first, the corridor index is built again from it.
+*/
+struct MissionMonitorSnapshot
+{
+	ROVER_MODE roverMode;
+	MAV_MODE_FLAG mavModeFlag;
+	int16_t lastDistanceToWaypoint;
+	uint16_t currentWaypointSequenceId;
+	uint32_t lastProgressMadeTimeMilliseconds;
+	uint32_t lastHeartbeatTimeMilliseconds;
+	uint32_t lastNavOutputTimeMilliseconds;
+	bool firstHeartbeat;
+	bool navOutputSeen;
+	bool isFailed;
+	bool wrongDirection;
+	bool hasPosition;
+	bool legPending;
+	bool legStartsAtRover;
+	bool outsideCorridor;
+	uint32_t outsideCorridorSinceMilliseconds;
+	bool powerOn;
+	bool alarmOn;
+	uint32_t wrongDirectionCount;
+	GPS_FIX_TYPE gps1FixType;
+	GPS_FIX_TYPE gps2FixType;
+	int32_t latitude;
+	int32_t longitude;
+	float heading;
+	int32_t legStartLatitude;
+	int32_t legStartLongitude;
+	uint32_t unhandledSafetyRules;
+	CrossTrackMonitor crossTrackMonitor;
+	ProgressEstimator progressEstimator;
+	DivergenceDetector divergenceDetector;
+	SafetyRuleEngine safetyRules;
+};
 
 /**
  * @brief Mission monitor receives events from the MAVLink reader and evaluates the condition of a mission. Its purpose is to shutdown the rover if it is off course.
+ * The class is final so a reader bound to it at compile time calls its handlers directly.
 */
-class MissionMonitor : public MAVLinkEventReceiver
+class MissionMonitor final : public MAVLinkEventReceiver
 {
 public:
-	MissionMonitor( uint32_t secondsBeforeEmergencyStop, GPS_FIX_TYPE lowestGpsFixTpye, AudioPlayer* audioPlayer );
+	/**
+	 * @brief Constructor.
+	 * @param thresholds The limits the mission is evaluated against.
+	 * @param audioPlayer The player of the prompts, NULL for a shadow monitor.
+	 * @param shadow True for a monitor that only evaluates the mission, to compare settings: its relays don't drive the pins
+	 * and it leaves the mission downloader to the monitor in charge.
+	*/
+	MissionMonitor( MissionThresholds thresholds, AudioPlayer* audioPlayer, bool shadow = false );
 	virtual void onHeatbeat( mavlink_heartbeat_t  mavlink_heartbeat );
 	virtual void onMissionItemReached( mavlink_mission_item_reached_t mavlink_mission_item_reached );
 	virtual void onNavControllerOutput( mavlink_nav_controller_output_t mavlink_nav_controller );
 	virtual void onMissionCurrent( mavlink_mission_current_t mavlink_mission_current );
 	virtual void onGPSRawInt( mavlink_gps_raw_int_t mavlink_gps_raw_int );
 	virtual void onGPS2Raw( mavlink_gps2_raw_t mavlink_gps2_raw );
+	virtual void onGlobalPositionInt( mavlink_global_position_int_t mavlink_global_position_int );
+	virtual void onParamRequestRead( mavlink_param_request_read_t mavlink_param_request_read );
+	virtual void onParamRequestList( mavlink_param_request_list_t mavlink_param_request_list );
+	virtual void onParamSet( mavlink_param_set_t mavlink_param_set );
 
 
 	/**
@@ -35,12 +125,103 @@ public:
 	*/
 	virtual void tick();
 
+	/**
+	 * @brief Change the thresholds used to evaluate the mission. The new values are applied together before the next evaluation.
+	 * @param thresholds The new thresholds.
+	*/
+	virtual void setThresholds( MissionThresholds thresholds );
+
+	/**
+	 * @brief Set the downloader that keeps a copy of the mission. Legs are then measured between the real waypoints.
+	 * @param missionDownloader The mission downloader, it gets its mission messages from the event bus.
+	*/
+	void setMissionDownloader( MissionDownloader* missionDownloader );
+
+	/**
+	 * @brief Replace the safety rules added to the built in rules, e.g. the rules read from config.ini.
+	 * @param rules The rules.
+	 * @param count The number of rules.
+	*/
+	void setSafetyRules( const SafetyRule* rules, uint8_t count );
+
+	/**
+	 * @brief Get the relays, so the deadline monitor can cut the power from its interrupt.
+	 * @return The relays.
+	*/
+	ServoRelay* getServoRelay();
+
+	/**
+	 * @brief Fail the mission because a task missed its deadline. The deadline monitor has already cut the power.
+	 * @param taskName The name of the task.
+	*/
+	void onMissedDeadline( const char* taskName );
+
+	/**
+	 * @brief Publish the state the timeout checks read to a timer interrupt. Only for a live rover, the interrupt measures
+	 * time with millis() and a replayed mission runs on the time recorded in the file.
+	 * @param safetyInterrupt The interrupt.
+	*/
+	void setSafetyInterrupt( SafetyInterrupt* safetyInterrupt );
+
+	/**
+	 * @brief Fail the mission because a timeout check in the interrupt tripped. The interrupt has already cut the power.
+	 * @param checkName The name of the check.
+	*/
+	void onSafetyTrip( const char* checkName );
+
+	/**
+	 * @brief Save the state the decisions depend on.
+	 * @param snapshot Receives the state.
+	*/
+	void saveSnapshot( MissionMonitorSnapshot* snapshot );
+
+	/**
+	 * @brief Carry on from a saved state, the relays are set as they were when it was saved. The corridor index of the mission the
+	 * downloader holds is built right away, as a replay from the start would have built it by then.
+	 * @param snapshot The state.
+	*/
+	void restoreSnapshot( const MissionMonitorSnapshot& snapshot );
+
+	/**
+	 * @brief Get a checksum of the thresholds and safety rules, a snapshot only leads to the same decisions under the same settings.
+	 * @return The checksum.
+	*/
+	uint32_t getSnapshotKey();
+
+	/**
+	 * @brief Check if the rover is armed and driving a mission, when cutting the power would stop it midway.
+	 * @return True while the latest heartbeat reports the rover armed in AUTO.
+	*/
+	bool isDriving();
+
+	/**
+	 * @brief Get how many times the mission was failed and the rover stopped.
+	*/
+	uint32_t getStopCount();
+
+	/**
+	 * @brief Get how many times a safety rule put the rover in hold.
+	*/
+	uint32_t getHoldCount();
+
 protected:
 	/**
 	 * @brief Used to determine if the mission has gone off course.
 	*/
 	virtual void evaluateMission();
 
+	/**
+	 * @brief Take the action of a safety rule.
+	 * @param index The index of the rule.
+	 * @param repeated True if the action was taken before and the rule still holds.
+	*/
+	virtual void takeAction( uint8_t index, bool repeated );
+
+	/**
+	 * @brief Write the cost of the safety rules to the log.
+	*/
+	void logSafetyRuleCosts();
+
 	/**
 	 * @brief Centrailized logic for stopping the rover during mission failure.
 	*/
@@ -53,27 +234,124 @@ protected:
 
 	virtual void play( ROVER_MODE roverMode);
 
+	/**
+	 * @brief Apply thresholds staged by setThresholds(), called between evaluations so an evaluation never sees half of a change.
+	*/
+	void applyPendingThresholds();
+
+	/**
+	 * @brief Hand the state the timeout checks read to the safety interrupt, if there is one.
+	*/
+	void publishSafetySnapshot();
+
+	/**
+	 * @brief Get the value of a parameter.
+	 * @param thresholds The thresholds the parameter is read from.
+	 * @param index The index of the parameter.
+	*/
+	static int32_t getParameter( const MissionThresholds& thresholds, uint16_t index );
+
+	/**
+	 * @brief Set the value of a parameter.
+	 * @param thresholds The thresholds the parameter is written to.
+	 * @param index The index of the parameter.
+	 * @param value The new value.
+	 * @return False if the value is out of range, the thresholds are left unchanged.
+	*/
+	static bool setParameter( MissionThresholds* thresholds, uint16_t index, int32_t value );
+
+	/**
+	 * @brief Send the value of a parameter to the ground station.
+	 * @param index The index of the parameter.
+	*/
+	void sendParameter( uint16_t index );
+
+	/**
+	 * @brief Set the leg of the current waypoint. The flight controller only reports the distance and bearing to the
+	 * waypoint, so the end of the leg is projected from the rover position along them.
+	 * @param targetBearing Bearing to the waypoint in degrees.
+	 * @param distanceToWaypoint Distance to the waypoint in meters.
+	*/
+	void setLeg( int16_t targetBearing, uint16_t distanceToWaypoint );
+
+	/**
+	 * @brief Set the leg of the current waypoint from the downloaded mission.
+	 * @return False if the waypoint or the one before it hasn't been downloaded.
+	*/
+	bool setLegFromMission();
+
+	/**
+	 * @brief Check if the downloaded mission has the rover stand still at the current waypoint, where the stall and wrong
+	 * direction rules don't apply.
+	 * @return True while the current item is a loiter or a delay, or the ground speed is commanded to zero.
+	*/
+	bool isHolding();
+
+	/**
+	 * @brief Build the corridor index once the whole mission is downloaded, a slice of legs per tick, and drop it when the mission
+	 * or the corridor width changes.
+	*/
+	void updateCorridorIndex();
+
+	/**
+	 * @brief Rasterize the next slice of legs of the corridor index being built.
+	*/
+	void continueCorridorIndex();
+
 	ROVER_MODE _roverMode = ROVER_MODE_INITIALIZING; // Initialize the rover filght mode
 	MAV_MODE_FLAG _mavModeFlag = MAV_MODE_FLAG_ENUM_END;
 	int16_t _lastDistanceToWaypoint = -1;
 	unsigned long _lastProgressMadeTimeMilliseconds = 0;
 	unsigned long _lastHeartbeatTimeMilliseconds = 0;
+	unsigned long _lastNavOutputTimeMilliseconds = 0;
 	uint16_t _currentWaypointSequenceId = 0;
 	bool _firstHeartbeat = false;
+	bool _isArmed = false;
+	bool _navOutputSeen = false;
+	bool _bootHeartbeatReported = false;
 	bool _firstTick = false;
 	bool _isFailed = false;
 	bool _wrongDirection = false;
 	uint32_t _wrongDirectionCount = 0;
-	uint32_t _secondsBeforeEmergencyStop = 20;
 	GPS_FIX_TYPE _gps1FixType = GPS_FIX_TYPE_NO_GPS;
 	GPS_FIX_TYPE _gps2FixType = GPS_FIX_TYPE_NO_GPS;
-	GPS_FIX_TYPE _lowestGpsFixTpye = GPS_FIX_TYPE_NO_GPS;
+	MissionThresholds _thresholds;
+	MissionThresholds _pendingThresholds;
+	bool _thresholdsPending = false;
+	bool _hasPosition = false;
+	int32_t _latitude = 0;              ///< Last rover position in 1e-7 degrees
+	int32_t _longitude = 0;
+	float _heading = NAN;               ///< Last rover heading in degrees, NAN if the flight controller doesn't know it
+	bool _legPending = false;           ///< Waiting for the first NAV_CONTROLLER_OUTPUT of a new waypoint
+	int32_t _legStartLatitude = 0;      ///< Rover position when the waypoint became current
+	int32_t _legStartLongitude = 0;
+	bool _legStartsAtRover = false;     ///< The leg was restarted by a mode change and begins where the rover was
+	bool _outsideCorridor = false;
+	uint32_t _outsideCorridorSinceMilliseconds = 0; ///< Mission time the rover last left the corridor
+	CrossTrackMonitor _crossTrackMonitor;
+	ProgressEstimator _progressEstimator; ///< Closing rate toward the current waypoint
+	DivergenceDetector _divergenceDetector; ///< Heading against where the flight controller steers
+	SafetyRuleEngine _safetyRules;
+	uint8_t _builtInSafetyRuleCount = 0;
+	uint32_t _unhandledSafetyRules = 0; ///< Active rules whose action hasn't been taken yet
+	MissionDownloader* _missionDownloader = NULL;
+	CorridorIndex _corridorIndex;       ///< Corridor around every leg of the mission, used instead of the current leg once built
+	uint32_t _corridorIndexGeneration = 0;
+	uint16_t _corridorIndexWidthMeters = 0;
+	uint32_t _corridorIndexBuildMicroseconds = 0;
+	uint32_t _corridorIndexBuildTicks = 0;
+	SafetyInterrupt* _safetyInterrupt = NULL;
 
 
 
 private:
+	void playSound( const char* fileName );
+
 	ServoRelay _servoRelay;
 	AudioPlayer* _audioPlayer;
+	bool _shadow = false;
+	uint32_t _stopCount = 0;
+	uint32_t _holdCount = 0;
 
 };
 
@@ -0,0 +1,129 @@
+//
+//
+//
+
+#include "ProgressEstimator.h"
+
+
+ProgressEstimator::ProgressEstimator()
+{
+	reset();
+}
+
+void ProgressEstimator::reset()
+{
+	_next = 0;
+	_count = 0;
+	_sumTime = 0;
+	_sumDistance = 0;
+	_sumTimeSquared = 0;
+	_sumTimeDistance = 0;
+	_sumDistanceSquared = 0;
+	_hasEstimate = false;
+	_closingRate = 0;
+	_closingRateError = 0;
+}
+
+void ProgressEstimator::addSample( uint32_t timeMilliseconds, float distanceMeters )
+{
+	if ( _count == 0 )
+	{
+		_originMilliseconds = timeMilliseconds;
+	}
+
+	double time = (timeMilliseconds - _originMilliseconds) / 1000.0;
+	double distance = distanceMeters;
+
+	// The oldest sample leaves the sums when the ring is full
+	if ( _count == PROGRESS_WINDOW_SAMPLES )
+	{
+		double oldTime = _times[_next];
+		double oldDistance = _distances[_next];
+
+		_sumTime -= oldTime;
+		_sumDistance -= oldDistance;
+		_sumTimeSquared -= oldTime * oldTime;
+		_sumTimeDistance -= oldTime * oldDistance;
+		_sumDistanceSquared -= oldDistance * oldDistance;
+	}
+	else
+	{
+		_count++;
+	}
+
+	_times[_next] = time;
+	_distances[_next] = distance;
+	_next = (_next + 1) % PROGRESS_WINDOW_SAMPLES;
+
+	_sumTime += time;
+	_sumDistance += distance;
+	_sumTimeSquared += time * time;
+	_sumTimeDistance += time * distance;
+	_sumDistanceSquared += distance * distance;
+	_lastDistance = distance;
+
+	fit();
+}
+
+void ProgressEstimator::fit()
+{
+	_hasEstimate = false;
+
+	if ( _count < PROGRESS_MIN_SAMPLES )
+	{
+		return;
+	}
+
+	double n = _count;
+	double timeVariance = _sumTimeSquared - _sumTime * _sumTime / n;
+	double covariance = _sumTimeDistance - _sumTime * _sumDistance / n;
+	double distanceVariance = _sumDistanceSquared - _sumDistance * _sumDistance / n;
+
+	// Samples with the same time stamp, e.g. replayed from a log, can't give a rate
+	if ( timeVariance <= 1e-6 )
+	{
+		return;
+	}
+
+	double slope = covariance / timeVariance;
+	double residual = max( distanceVariance - slope * covariance, 0.0 );
+
+	_closingRate = -slope;
+	_closingRateError = sqrt( residual / (n - 2) / timeVariance );
+	_hasEstimate = true;
+}
+
+bool ProgressEstimator::hasEstimate()
+{
+	return _hasEstimate;
+}
+
+float ProgressEstimator::getClosingRate()
+{
+	return _closingRate;
+}
+
+float ProgressEstimator::getClosingRateError()
+{
+	return _closingRateError;
+}
+
+bool ProgressEstimator::isStalled()
+{
+	return _hasEstimate && _closingRate - PROGRESS_CONFIDENCE_SIGMA * _closingRateError < PROGRESS_MIN_CLOSING_RATE;
+}
+
+bool ProgressEstimator::isReceding()
+{
+	return _hasEstimate && _closingRate + PROGRESS_CONFIDENCE_SIGMA * _closingRateError < 0;
+}
+
+uint32_t ProgressEstimator::getEtaMilliseconds()
+{
+	if ( !_hasEstimate || _closingRate - PROGRESS_CONFIDENCE_SIGMA * _closingRateError <= 0 )
+	{
+		return UINT32_MAX;
+	}
+
+	return (uint32_t)min( _lastDistance / _closingRate * 1000.0, (double)UINT32_MAX );
+}
@@ -0,0 +1,97 @@
+// ProgressEstimator.h
+
+#ifndef _PROGRESSESTIMATOR_h
+#define _PROGRESSESTIMATOR_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+constexpr uint8_t PROGRESS_WINDOW_SAMPLES = 16;          ///< Distance samples the closing rate is fitted to
+constexpr uint8_t PROGRESS_MIN_SAMPLES = 4;              ///< Samples needed before the estimator gives a verdict
+constexpr double PROGRESS_CONFIDENCE_SIGMA = 2.0;        ///< Standard errors the closing rate must be clear of, about 95 percent
+constexpr double PROGRESS_MIN_CLOSING_RATE = 0.05;       ///< Meters per second below which the rover is considered stalled
+
+/**
+ * @brief ProgressEstimator fits a straight line to the last distances to the waypoint to tell how fast the rover is closing in.
+ * The sums behind the least squares fit are updated as samples enter and leave a ring buffer, so each sample costs the same
+ * however long the window is. The standard error of the fit says whether a change in distance is real or just noise and rounding.
+*/
+class ProgressEstimator
+{
+public:
+	ProgressEstimator();
+
+	/**
+	 * @brief Forget all samples, used when the rover starts a new leg.
+	*/
+	void reset();
+
+	/**
+	 * @brief Add a distance to the waypoint.
+	 * @param timeMilliseconds Mission time of the sample.
+	 * @param distanceMeters Distance to the waypoint.
+	*/
+	void addSample( uint32_t timeMilliseconds, float distanceMeters );
+
+	/**
+	 * @brief Check if there are enough samples for a verdict.
+	 * @return True if the closing rate can be trusted.
+	*/
+	bool hasEstimate();
+
+	/**
+	 * @brief Get how fast the distance to the waypoint is shrinking.
+	 * @return Meters per second, negative when the rover is moving away.
+	*/
+	float getClosingRate();
+
+	/**
+	 * @brief Get the standard error of the closing rate.
+	 * @return Meters per second.
+	*/
+	float getClosingRateError();
+
+	/**
+	 * @brief Check if the rover can't be shown to be closing in on the waypoint. A noisy stall has a closing rate that
+	 * wanders around zero, so anything short of a confident closing rate counts as stalled.
+	 * @return True if the pessimistic closing rate is below PROGRESS_MIN_CLOSING_RATE.
+	*/
+	bool isStalled();
+
+	/**
+	 * @brief Check if the rover is confidently moving away from the waypoint.
+	 * @return True if even the optimistic closing rate is negative.
+	*/
+	bool isReceding();
+
+	/**
+	 * @brief Estimate the time to reach the waypoint at the current closing rate.
+	 * @return Milliseconds, or UINT32_MAX if the rover isn't confidently closing in.
+	*/
+	uint32_t getEtaMilliseconds();
+
+private:
+	void fit();
+
+	uint32_t _originMilliseconds = 0;   ///< Times are kept relative to the first sample of the leg to keep the sums small
+	double _times[PROGRESS_WINDOW_SAMPLES];
+	double _distances[PROGRESS_WINDOW_SAMPLES];
+	uint8_t _next = 0;
+	uint8_t _count = 0;
+
+	double _sumTime = 0;
+	double _sumDistance = 0;
+	double _sumTimeSquared = 0;
+	double _sumTimeDistance = 0;
+	double _sumDistanceSquared = 0;
+
+	bool _hasEstimate = false;
+	double _closingRate = 0;
+	double _closingRateError = 0;
+	double _lastDistance = 0;
+};
+
+#endif
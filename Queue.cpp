@@ -3,24 +3,16 @@
 // 
 
 #include "Queue.h"
-#include <cstdlib>
 
 // Constructor to initialize queue
-Queue::Queue( int size )
+Queue::Queue()
 {
-	_arr = new const char*[size];
-	_capacity = size;
+	_capacity = QUEUE_SIZE;
 	_front = 0;
 	_rear = -1;
 	_count = 0;
 }
 
-// Destructor to free memory allocated to the queue
-Queue::~Queue()
-{
-	delete _arr;
-}
-
 // Utility function to remove front element from the queue
 const char * Queue::dequeue()
 {
@@ -47,6 +39,7 @@ void Queue::enqueue(const char* item )
 	if ( isFull() )
 	{
 		Log.error( "Queue was full when enqueue attempted" );
+		return;
 	}
 
 	_rear = (_rear + 1) % _capacity;
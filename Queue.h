@@ -13,18 +13,17 @@
 // define default capacity of the queue
 constexpr auto QUEUE_SIZE = 20;
 
-// Class for Queue
+// Class for Queue, the elements are held in the queue itself so nothing is allocated
 class Queue
 {
-	const char** _arr;		// array to store queue elements
+	const char* _arr[QUEUE_SIZE];		// array to store queue elements
 	int _capacity;	// maximum capacity of the queue
 	int _front;		// front points to front element in the queue (if any)
 	int _rear;		// rear points to last element in the queue
 	int _count;		// current size of the queue
 
 public:
-	Queue( int size = QUEUE_SIZE );		// constructor
-	~Queue();					// destructor
+	Queue();		// constructor
 
 	const char* dequeue();
 	void enqueue( const char* item );
@@ -0,0 +1,147 @@
+//
+//
+//
+
+#include "SafetyInterrupt.h"
+#include <ArduinoLog.h>
+
+SafetyInterrupt* SafetyInterrupt::_instance = NULL;
+
+void SafetyInterrupt::begin( ServoRelay* servoRelay )
+{
+	_servoRelay = servoRelay;
+	_instance = this;
+
+	_checkTimer.priority( SAFETY_CHECK_PRIORITY );
+	_checkTimer.begin( &SafetyInterrupt::check, SAFETY_CHECK_MICROSECONDS );
+
+	Log.trace( "Timeout checks run every %u microseconds from a timer interrupt", SAFETY_CHECK_MICROSECONDS );
+}
+
+void SafetyInterrupt::publish( const SafetySnapshot& snapshot )
+{
+	_sequence = _sequence + 1;
+	asm volatile( "dmb" ::: "memory" );
+	_snapshot = snapshot;
+	asm volatile( "dmb" ::: "memory" );
+	_sequence = _sequence + 1;
+}
+
+uint32_t SafetyInterrupt::takeTrips()
+{
+	__disable_irq();
+	uint32_t trips = _trips;
+	_trips = 0;
+	__enable_irq();
+
+	return trips;
+}
+
+void SafetyInterrupt::check()
+{
+	uint32_t startCycles = ARM_DWT_CYCCNT;
+
+	_instance->checkSnapshot();
+
+	uint32_t cycles = ARM_DWT_CYCCNT - startCycles;
+
+	if ( cycles > _instance->_worstCycles )
+	{
+		_instance->_worstCycles = cycles;
+	}
+
+	_instance->_periodRuns = _instance->_periodRuns + 1;
+}
+
+void SafetyInterrupt::checkSnapshot()
+{
+	uint32_t sequence = _sequence;
+
+	if ( (sequence & 1) == 0 )
+	{
+		asm volatile( "dmb" ::: "memory" );
+		SafetySnapshot snapshot = _snapshot;
+		asm volatile( "dmb" ::: "memory" );
+
+		if ( _sequence == sequence )
+		{
+			_checkedSnapshot = snapshot;
+		}
+		else
+		{
+			_periodSkippedSnapshots = _periodSkippedSnapshots + 1;
+		}
+	}
+	else
+	{
+		_periodSkippedSnapshots = _periodSkippedSnapshots + 1;
+	}
+
+	const SafetySnapshot& state = _checkedSnapshot;
+
+	if ( !_servoRelay->isPowerOn() )
+	{
+		return;
+	}
+
+	uint32_t now = millis();
+	uint32_t trips = 0;
+
+	if ( state.heartbeatTimeoutMilliseconds != 0 && state.heartbeatSeen && now - state.lastHeartbeatMilliseconds >= state.heartbeatTimeoutMilliseconds )
+	{
+		trips |= 1UL << SAFETY_TRIP_HEARTBEAT_LOST;
+	}
+
+	if ( state.progressTimeoutMilliseconds != 0 && state.lastProgressMilliseconds != 0 && now - state.lastProgressMilliseconds >= state.progressTimeoutMilliseconds )
+	{
+		trips |= 1UL << SAFETY_TRIP_NO_PROGRESS;
+	}
+
+	if ( state.progressTimeoutMilliseconds != 0 && state.navOutputSeen && now - state.lastNavOutputMilliseconds >= state.progressTimeoutMilliseconds )
+	{
+		trips |= 1UL << SAFETY_TRIP_STALE_NAV_OUTPUT;
+	}
+
+	if ( trips == 0 )
+	{
+		return;
+	}
+
+	_servoRelay->cutPower();
+	_trips = _trips | trips;
+
+	for ( uint8_t i = 0; i < SAFETY_TRIP_COUNT; i++ )
+	{
+		if ( trips & (1UL << i) )
+		{
+			_tripCounts[i] = _tripCounts[i] + 1;
+		}
+	}
+}
+
+void SafetyInterrupt::tick( uint32_t timeMilliseconds )
+{
+	if ( timeMilliseconds - _lastPublishMilliseconds < SAFETY_INTERRUPT_PUBLISH_MILLISECONDS )
+	{
+		return;
+	}
+
+	_lastPublishMilliseconds = timeMilliseconds;
+
+	__disable_irq();
+	uint32_t runs = _periodRuns;
+	uint32_t skippedSnapshots = _periodSkippedSnapshots;
+	uint32_t worstCycles = _worstCycles;
+	_periodRuns = 0;
+	_periodSkippedSnapshots = 0;
+	_worstCycles = 0;
+	__enable_irq();
+
+	Log.trace( "Safety interrupt: %u runs, %u cycles at most, %u snapshots skipped during a write, tripped %u times on heartbeat lost, %u on no progress, %u on stale nav output",
+		runs,
+		worstCycles,
+		skippedSnapshots,
+		_tripCounts[SAFETY_TRIP_HEARTBEAT_LOST],
+		_tripCounts[SAFETY_TRIP_NO_PROGRESS],
+		_tripCounts[SAFETY_TRIP_STALE_NAV_OUTPUT] );
+}
@@ -0,0 +1,103 @@
+// SafetyInterrupt.h
+
+#ifndef _SAFETYINTERRUPT_h
+#define _SAFETYINTERRUPT_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "ServoRelay.h"
+
+constexpr uint32_t SAFETY_CHECK_MICROSECONDS = 10000;              ///< How often the timer interrupt runs the timeout checks
+constexpr uint8_t SAFETY_CHECK_PRIORITY = 32;                       ///< Interrupt priority of the checks, above the serial ports and the audio library
+constexpr uint32_t SAFETY_INTERRUPT_PUBLISH_MILLISECONDS = 10000;   ///< How often the checks are written to the log
+
+/**
+ * @brief The timeout checks run by the interrupt.
+*/
+enum SAFETY_TRIP : uint8_t
+{
+	SAFETY_TRIP_HEARTBEAT_LOST,     ///< No heartbeat for as long as the fail rules on the heartbeat age allow in the current mode
+	SAFETY_TRIP_NO_PROGRESS,        ///< Not closing in on the waypoint for as long as the fail rules on no progress allow in the current mode
+	SAFETY_TRIP_STALE_NAV_OUTPUT,   ///< No NAV_CONTROLLER_OUTPUT for as long, progress can't be judged without it
+	SAFETY_TRIP_COUNT
+};
+
+constexpr const char* SAFETY_TRIP_NAMES[SAFETY_TRIP_COUNT] = { "heartbeat lost", "no progress", "stale nav output" };
+
+/**
+ * @brief The mission monitor state the timeout checks read, published by the main loop.
+ * Times are in milliseconds from millis(), which is the mission time of a live rover. The timeouts come from the safety rule table
+ * for the current mode, a check whose timeout is 0 is off.
+*/
+struct SafetySnapshot
+{
+	bool heartbeatSeen = false;
+	bool navOutputSeen = false;                 ///< A NAV_CONTROLLER_OUTPUT was received, a flight controller that doesn't send it isn't judged by it
+	uint32_t lastHeartbeatMilliseconds = 0;
+	uint32_t lastProgressMilliseconds = 0;      ///< 0 until the rover made progress in the current mode
+	uint32_t lastNavOutputMilliseconds = 0;     ///< Last NAV_CONTROLLER_OUTPUT, or the moment the current mode started
+	uint32_t heartbeatTimeoutMilliseconds = 0;  ///< Earliest fail rule on the heartbeat age
+	uint32_t progressTimeoutMilliseconds = 0;   ///< Earliest fail rule on no progress, also used for the NAV_CONTROLLER_OUTPUT
+};
+
+/**
+ * @brief SafetyInterrupt runs the timeout checks of the mission monitor from a timer interrupt, so a runaway is stopped within
+ * SAFETY_CHECK_MICROSECONDS of a timeout even when a slow task holds up the main loop. The checks follow the fail rules of the
+ * rule table on the heartbeat age and on no progress, so they act in the same modes and after the same time as the main loop would. The interrupt cuts the power relay
+ * itself and the main loop fails the mission for the checks returned by takeTrips().
+ * The state is handed over with a sequence lock: the main loop makes the sequence odd while it writes a snapshot. The interrupt
+ * can't wait for a write it interrupted, so it keeps using the last complete snapshot until the write is done.
+ * The execution time of the interrupt is measured in processor cycles.
+*/
+class SafetyInterrupt
+{
+public:
+	/**
+	 * @brief Start the timer interrupt.
+	 * @param servoRelay The relay to cut when a check trips.
+	*/
+	void begin( ServoRelay* servoRelay );
+
+	/**
+	 * @brief Publish the state the checks read. Called from the main loop only.
+	 * @param snapshot The state.
+	*/
+	void publish( const SafetySnapshot& snapshot );
+
+	/**
+	 * @brief Get the checks that cut the power since the last call.
+	 * @return One bit per SAFETY_TRIP.
+	*/
+	uint32_t takeTrips();
+
+	/**
+	 * @brief Write the trips, the snapshots skipped during a write and the execution time of the interrupt to the log when the publish period is over.
+	 * @param timeMilliseconds The current time in milliseconds.
+	*/
+	void tick( uint32_t timeMilliseconds );
+
+private:
+	static void check();
+
+	void checkSnapshot();
+
+	static SafetyInterrupt* _instance;
+
+	IntervalTimer _checkTimer;
+	ServoRelay* _servoRelay = NULL;
+	volatile uint32_t _sequence = 0;
+	SafetySnapshot _snapshot;                 ///< Written by publish() while the sequence is odd
+	SafetySnapshot _checkedSnapshot;          ///< Last complete snapshot read by the interrupt
+	volatile uint32_t _trips = 0;
+	volatile uint32_t _tripCounts[SAFETY_TRIP_COUNT] = {};
+	volatile uint32_t _periodRuns = 0;
+	volatile uint32_t _periodSkippedSnapshots = 0;
+	volatile uint32_t _worstCycles = 0;
+	uint32_t _lastPublishMilliseconds = 0;
+};
+
+#endif
@@ -0,0 +1,406 @@
+//
+//
+//
+
+#include "SafetyRuleEngine.h"
+#include "EnumHelper.h"
+#include "AudioPlayer.h"
+
+constexpr const char* SIGNAL_NAMES[SAFETY_SIGNAL_COUNT] = { "heartbeatAge", "gpsFix", "noProgress", "outsideCorridor", "diverging", "wrongDirection", "crossTrackError", "bearingError", "distanceToWaypoint" };
+constexpr const char* PREDICATE_NAMES[SAFETY_PREDICATE_COUNT] = { "below", "atLeast", "equal" };
+constexpr const char* ACTION_NAMES[SAFETY_ACTION_COUNT] = { "hold", "fail", "alarm", "prompt", "resume" };
+constexpr const char* SOUND_FILES[SAFETY_SOUND_COUNT] = { NULL, MAVLINK_BAD_SOUND, GPS_SIGNAL_LOW_SOUND, WRONG_DIRECTION_SOUND, PROGRESS_STOPPED_SOUND, EMERGENCY_STOP_SOUND };
+constexpr uint8_t SAFETY_RULE_TEXT_SIZE = 128;
+constexpr uint8_t SAFETY_RULE_FIELDS = 7;
+
+
+SafetyRuleEngine::SafetyRuleEngine()
+{
+	memset( _signals, 0, sizeof( _signals ) );
+	memset( _parameters, 0, sizeof( _parameters ) );
+	memset( _signalRules, 0, sizeof( _signalRules ) );
+	memset( _parameterRules, 0, sizeof( _parameterRules ) );
+	reset();
+}
+
+bool SafetyRuleEngine::addRule( const SafetyRule& rule )
+{
+	if ( _ruleCount >= SAFETY_RULE_CAPACITY || rule.signal >= SAFETY_SIGNAL_COUNT || rule.predicate >= SAFETY_PREDICATE_COUNT ||
+		rule.action >= SAFETY_ACTION_COUNT || rule.sound >= SAFETY_SOUND_COUNT || rule.parameter >= SAFETY_PARAMETER_CAPACITY )
+	{
+		return false;
+	}
+
+	uint32_t bit = 1UL << _ruleCount;
+
+	_rules[_ruleCount] = rule;
+	_signalRules[rule.signal] |= bit;
+
+	if ( rule.parameter >= 0 )
+	{
+		_parameterRules[rule.parameter] |= bit;
+	}
+
+	_ruleCycles[_ruleCount] = 0;
+	_ruleEvaluations[_ruleCount] = 0;
+	_dirtyRules |= bit;
+	_ruleCount++;
+
+	return true;
+}
+
+void SafetyRuleEngine::truncate( uint8_t count )
+{
+	if ( count >= _ruleCount )
+	{
+		return;
+	}
+
+	uint32_t keep = (1UL << count) - 1;
+
+	for ( uint8_t i = 0; i < SAFETY_SIGNAL_COUNT; i++ )
+	{
+		_signalRules[i] &= keep;
+	}
+
+	for ( uint8_t i = 0; i < SAFETY_PARAMETER_CAPACITY; i++ )
+	{
+		_parameterRules[i] &= keep;
+	}
+
+	_dirtyRules &= keep;
+	_waitingRules &= keep;
+	_matchingRules &= keep;
+	_activeRules &= keep;
+	_ruleCount = count;
+}
+
+void SafetyRuleEngine::reset()
+{
+	_dirtyRules = _ruleCount == SAFETY_RULE_CAPACITY ? 0xFFFFFFFF : (1UL << _ruleCount) - 1;
+	_waitingRules = 0;
+	_matchingRules = 0;
+	_activeRules = 0;
+	_evaluationCycles = 0;
+	_evaluationCount = 0;
+
+	memset( _ruleCycles, 0, sizeof( _ruleCycles ) );
+	memset( _ruleEvaluations, 0, sizeof( _ruleEvaluations ) );
+}
+
+void SafetyRuleEngine::setSignal( SAFETY_SIGNAL signal, int32_t value )
+{
+	if ( _signals[signal] != value )
+	{
+		_signals[signal] = value;
+		_dirtyRules |= _signalRules[signal];
+	}
+}
+
+void SafetyRuleEngine::setParameter( uint8_t parameter, int32_t value )
+{
+	if ( parameter < SAFETY_PARAMETER_CAPACITY && _parameters[parameter] != value )
+	{
+		_parameters[parameter] = value;
+		_dirtyRules |= _parameterRules[parameter];
+	}
+}
+
+void SafetyRuleEngine::setMode( uint8_t mode )
+{
+	if ( _mode != mode )
+	{
+		_mode = mode;
+
+		// Only rules limited to some modes can change
+		for ( uint8_t i = 0; i < _ruleCount; i++ )
+		{
+			if ( _rules[i].modeMask != SAFETY_ANY_MODE )
+			{
+				_dirtyRules |= 1UL << i;
+			}
+		}
+	}
+}
+
+bool SafetyRuleEngine::matches( const SafetyRule& rule )
+{
+	if ( _mode >= 32 || !(rule.modeMask & (1UL << _mode)) )
+	{
+		return false;
+	}
+
+	int32_t value = _signals[rule.signal];
+	int32_t threshold = rule.parameter >= 0 ? _parameters[rule.parameter] : rule.threshold;
+
+	switch ( rule.predicate )
+	{
+		case SAFETY_PREDICATE_BELOW:
+			return value < threshold;
+		case SAFETY_PREDICATE_AT_LEAST:
+			return value >= threshold;
+		case SAFETY_PREDICATE_EQUAL:
+			return value == threshold;
+		default:
+			return false;
+	}
+}
+
+uint32_t SafetyRuleEngine::evaluate( uint32_t timeMilliseconds )
+{
+	uint32_t startCycles = ARM_DWT_CYCCNT;
+	uint32_t candidates = _dirtyRules | _waitingRules;
+	uint32_t activated = 0;
+
+	_dirtyRules = 0;
+
+	while ( candidates != 0 )
+	{
+		uint32_t ruleCycles = ARM_DWT_CYCCNT;
+		uint8_t i = __builtin_ctz( candidates );
+		uint32_t bit = 1UL << i;
+
+		candidates &= ~bit;
+
+		if ( !matches( _rules[i] ) )
+		{
+			_matchingRules &= ~bit;
+			_waitingRules &= ~bit;
+			_activeRules &= ~bit;
+		}
+		else
+		{
+			if ( !(_matchingRules & bit) )
+			{
+				_matchingRules |= bit;
+				_matchingSinceMilliseconds[i] = timeMilliseconds;
+			}
+
+			if ( timeMilliseconds - _matchingSinceMilliseconds[i] < _rules[i].persistenceMilliseconds )
+			{
+				_waitingRules |= bit;
+			}
+			else
+			{
+				_waitingRules &= ~bit;
+
+				if ( !(_activeRules & bit) )
+				{
+					_activeRules |= bit;
+					activated |= bit;
+				}
+			}
+		}
+
+		_ruleCycles[i] += ARM_DWT_CYCCNT - ruleCycles;
+		_ruleEvaluations[i]++;
+	}
+
+	_evaluationCycles += ARM_DWT_CYCCNT - startCycles;
+	_evaluationCount++;
+
+	return activated;
+}
+
+uint32_t SafetyRuleEngine::getActiveRules()
+{
+	return _activeRules;
+}
+
+uint8_t SafetyRuleEngine::getRuleCount()
+{
+	return _ruleCount;
+}
+
+const SafetyRule& SafetyRuleEngine::getRule( uint8_t index )
+{
+	return _rules[index];
+}
+
+int32_t SafetyRuleEngine::getSignal( SAFETY_SIGNAL signal )
+{
+	return _signals[signal];
+}
+
+uint32_t SafetyRuleEngine::getFailTimeoutMilliseconds( SAFETY_SIGNAL signal, uint8_t mode )
+{
+	uint32_t timeoutMilliseconds = 0;
+
+	if ( mode >= 32 )
+	{
+		return 0;
+	}
+
+	for ( uint8_t i = 0; i < _ruleCount; i++ )
+	{
+		const SafetyRule& rule = _rules[i];
+
+		if ( !(_signalRules[signal] & (1UL << i)) || rule.action != SAFETY_ACTION_FAIL || rule.predicate != SAFETY_PREDICATE_AT_LEAST ||
+			!(rule.modeMask & (1UL << mode)) )
+		{
+			continue;
+		}
+
+		int32_t threshold = rule.parameter >= 0 ? _parameters[rule.parameter] : rule.threshold;
+		uint32_t ruleMilliseconds = max( (uint32_t)max( threshold, (int32_t)0 ) * 1000 + rule.persistenceMilliseconds, (uint32_t)1 );
+
+		if ( timeoutMilliseconds == 0 || ruleMilliseconds < timeoutMilliseconds )
+		{
+			timeoutMilliseconds = ruleMilliseconds;
+		}
+	}
+
+	return timeoutMilliseconds;
+}
+
+uint32_t SafetyRuleEngine::getAverageRuleCycles( uint8_t index )
+{
+	return _ruleEvaluations[index] == 0 ? 0 : (uint32_t)(_ruleCycles[index] / _ruleEvaluations[index]);
+}
+
+uint32_t SafetyRuleEngine::getAverageEvaluationCycles()
+{
+	return _evaluationCount == 0 ? 0 : (uint32_t)(_evaluationCycles / _evaluationCount);
+}
+
+uint32_t SafetyRuleEngine::getEvaluationCount()
+{
+	return _evaluationCount;
+}
+
+/**
+ * @brief Find a name in a table of names.
+ * @return The index of the name, or -1 if it isn't there.
+*/
+static int16_t findName( const char* name, const char* const* names, uint8_t count )
+{
+	for ( uint8_t i = 0; i < count; i++ )
+	{
+		if ( names[i] != NULL && strcasecmp( name, names[i] ) == 0 )
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * @brief Read a mode mask: ROVER_MODE names or numbers separated by |, or any.
+ * @return False if a mode isn't known.
+*/
+static bool parseModes( char* text, uint32_t* modeMask )
+{
+	*modeMask = 0;
+
+	for ( char* mode = text; mode != NULL; )
+	{
+		char* next = strchr( mode, '|' );
+
+		if ( next != NULL )
+		{
+			*next++ = 0;
+		}
+
+		if ( strcasecmp( mode, "any" ) == 0 )
+		{
+			*modeMask = SAFETY_ANY_MODE;
+		}
+		else if ( isdigit( mode[0] ) && atoi( mode ) < 32 )
+		{
+			*modeMask |= 1UL << atoi( mode );
+		}
+		else
+		{
+			uint8_t roverMode = 0;
+
+			while ( roverMode < ROVER_MODE_ENUM_END && strcasecmp( mode, EnumHelper::convert( (ROVER_MODE)roverMode ) ) != 0 )
+			{
+				roverMode++;
+			}
+
+			if ( roverMode == ROVER_MODE_ENUM_END )
+			{
+				return false;
+			}
+
+			*modeMask |= 1UL << roverMode;
+		}
+
+		mode = next;
+	}
+
+	return *modeMask != 0;
+}
+
+bool SafetyRuleEngine::parse( const char* text, SafetyRule* rule )
+{
+	char buffer[SAFETY_RULE_TEXT_SIZE];
+	char* fields[SAFETY_RULE_FIELDS];
+	uint8_t fieldCount = 0;
+
+	strncpy( buffer, text, SAFETY_RULE_TEXT_SIZE - 1 );
+	buffer[SAFETY_RULE_TEXT_SIZE - 1] = 0;
+
+	for ( char* field = buffer; field != NULL && fieldCount < SAFETY_RULE_FIELDS; fieldCount++ )
+	{
+		fields[fieldCount] = field;
+		field = strchr( field, ',' );
+
+		if ( field != NULL )
+		{
+			*field++ = 0;
+		}
+	}
+
+	if ( fieldCount < SAFETY_RULE_FIELDS - 1 )
+	{
+		return false;
+	}
+
+	int16_t signal = findName( fields[0], SIGNAL_NAMES, SAFETY_SIGNAL_COUNT );
+	int16_t predicate = findName( fields[1], PREDICATE_NAMES, SAFETY_PREDICATE_COUNT );
+	int16_t action = findName( fields[5], ACTION_NAMES, SAFETY_ACTION_COUNT );
+	int16_t sound = SAFETY_SOUND_NONE;
+
+	if ( fieldCount == SAFETY_RULE_FIELDS )
+	{
+		// Sounds are named by their file without the folder and extension, e.g. estop for sounds/estop.wav
+		char soundFile[SAFETY_RULE_TEXT_SIZE];
+
+		snprintf( soundFile, sizeof( soundFile ), "sounds/%s.wav", fields[6] );
+		sound = findName( soundFile, SOUND_FILES, SAFETY_SOUND_COUNT );
+	}
+
+	memset( rule, 0, sizeof( SafetyRule ) );
+
+	if ( signal < 0 || predicate < 0 || action < 0 || sound < 0 || !parseModes( fields[4], &rule->modeMask ) )
+	{
+		return false;
+	}
+
+	rule->threshold = atol( fields[2] );
+	rule->persistenceMilliseconds = strtoul( fields[3], NULL, 10 );
+	rule->signal = signal;
+	rule->predicate = predicate;
+	rule->action = action;
+	rule->sound = sound;
+	rule->parameter = -1;
+
+	return true;
+}
+
+const char* SafetyRuleEngine::getSignalName( uint8_t signal )
+{
+	return signal < SAFETY_SIGNAL_COUNT ? SIGNAL_NAMES[signal] : "unknown";
+}
+
+const char* SafetyRuleEngine::getActionName( uint8_t action )
+{
+	return action < SAFETY_ACTION_COUNT ? ACTION_NAMES[action] : "unknown";
+}
+
+const char* SafetyRuleEngine::getSoundFile( uint8_t sound )
+{
+	return sound < SAFETY_SOUND_COUNT ? SOUND_FILES[sound] : NULL;
+}
@@ -0,0 +1,203 @@
+// SafetyRuleEngine.h
+
+#ifndef _SAFETYRULEENGINE_h
+#define _SAFETYRULEENGINE_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+constexpr uint8_t SAFETY_RULE_CAPACITY = 32;          ///< Rules the engine can hold, one bit per rule in the masks
+constexpr uint8_t SAFETY_PARAMETER_CAPACITY = 8;      ///< Parameters a rule threshold can follow
+constexpr uint32_t SAFETY_ANY_MODE = 0xFFFFFFFF;      ///< Mode mask of a rule that applies in every mode
+
+/**
+ * @brief The values rules are evaluated against, set by the mission monitor before every evaluation.
+*/
+enum SAFETY_SIGNAL : uint8_t
+{
+	SAFETY_SIGNAL_HEARTBEAT_AGE,         ///< Seconds since the last heartbeat, 0 before the first one
+	SAFETY_SIGNAL_GPS_FIX,               ///< Best fix type of the two GPS
+	SAFETY_SIGNAL_NO_PROGRESS,           ///< Seconds since the rover was last confidently closing in on the waypoint
+	SAFETY_SIGNAL_OUTSIDE_CORRIDOR,      ///< 1 when the rover is outside the corridor
+	SAFETY_SIGNAL_DIVERGING,             ///< 1 when the heading is off where the flight controller steers for long enough
+	SAFETY_SIGNAL_WRONG_DIRECTION,       ///< Readings in a row with the rover moving away from the waypoint
+	SAFETY_SIGNAL_CROSS_TRACK_ERROR,     ///< Meters from the current leg
+	SAFETY_SIGNAL_BEARING_ERROR,         ///< Degrees between the heading and where the flight controller steers, nav_bearing
+	SAFETY_SIGNAL_DISTANCE_TO_WAYPOINT,  ///< Meters to the current waypoint
+	SAFETY_SIGNAL_COUNT
+};
+
+enum SAFETY_PREDICATE : uint8_t
+{
+	SAFETY_PREDICATE_BELOW,
+	SAFETY_PREDICATE_AT_LEAST,
+	SAFETY_PREDICATE_EQUAL,
+	SAFETY_PREDICATE_COUNT
+};
+
+enum SAFETY_ACTION : uint8_t
+{
+	SAFETY_ACTION_HOLD,      ///< Put the rover in hold mode, repeated while the rule holds
+	SAFETY_ACTION_FAIL,      ///< Stop the rover
+	SAFETY_ACTION_ALARM,     ///< Turn the alarm relay on and leave the rover running
+	SAFETY_ACTION_PROMPT,    ///< Only play the sound of the rule
+	SAFETY_ACTION_RESUME,    ///< Put the rover back in auto mode, repeated while the rule holds
+	SAFETY_ACTION_COUNT
+};
+
+enum SAFETY_SOUND : uint8_t
+{
+	SAFETY_SOUND_NONE,
+	SAFETY_SOUND_MAVLINK_BAD,
+	SAFETY_SOUND_GPS_SIGNAL_LOW,
+	SAFETY_SOUND_WRONG_DIRECTION,
+	SAFETY_SOUND_PROGRESS_STOPPED,
+	SAFETY_SOUND_EMERGENCY_STOP,
+	SAFETY_SOUND_COUNT
+};
+
+/**
+ * @brief One row of the rule table: when a signal matches a threshold for long enough in one of the modes, take an action.
+ * Rules are plain data so they can be compiled into a table, read from config.ini and persisted to EEPROM alike.
+*/
+struct SafetyRule
+{
+	int32_t threshold;                  ///< Used when parameter is -1
+	uint32_t persistenceMilliseconds;   ///< How long the signal must match before the action is taken
+	uint32_t modeMask;                  ///< One bit per ROVER_MODE the rule applies in
+	uint8_t signal;                     ///< SAFETY_SIGNAL
+	uint8_t predicate;                  ///< SAFETY_PREDICATE
+	uint8_t action;                     ///< SAFETY_ACTION
+	uint8_t sound;                      ///< SAFETY_SOUND played when the action is taken
+	int8_t parameter;                   ///< Index of the parameter the threshold follows, -1 for a fixed threshold
+};
+
+/**
+ * @brief SafetyRuleEngine evaluates a table of safety rules. Each signal keeps a mask of the rules that read it, so setting a signal
+ * to a new value marks only those rules. An evaluation visits the marked rules and the rules waiting out their persistence time,
+ * so its cost follows what changed rather than the length of the table. Every rule counts the processor cycles it costs.
+*/
+class SafetyRuleEngine
+{
+public:
+	SafetyRuleEngine();
+
+	/**
+	 * @brief Add a rule to the end of the table.
+	 * @param rule The rule.
+	 * @return False if the table is full or the rule isn't valid.
+	*/
+	bool addRule( const SafetyRule& rule );
+
+	/**
+	 * @brief Remove the rules from an index to the end of the table.
+	 * @param count The number of rules to keep.
+	*/
+	void truncate( uint8_t count );
+
+	/**
+	 * @brief Forget the state of every rule so they are all evaluated afresh, used when monitoring restarts.
+	*/
+	void reset();
+
+	/**
+	 * @brief Set the value of a signal. Rules that read it are evaluated next time only if the value changed.
+	*/
+	void setSignal( SAFETY_SIGNAL signal, int32_t value );
+
+	/**
+	 * @brief Set the value of a parameter rule thresholds can follow.
+	*/
+	void setParameter( uint8_t parameter, int32_t value );
+
+	/**
+	 * @brief Set the drive mode of the rover.
+	 * @param mode The ROVER_MODE.
+	*/
+	void setMode( uint8_t mode );
+
+	/**
+	 * @brief Evaluate the rules whose signals changed and the rules waiting out their persistence time.
+	 * @param timeMilliseconds Mission time.
+	 * @return Mask of the rules that became active in this evaluation.
+	*/
+	uint32_t evaluate( uint32_t timeMilliseconds );
+
+	/**
+	 * @brief Get the rules whose signal has matched for their persistence time.
+	 * @return Mask of the active rules.
+	*/
+	uint32_t getActiveRules();
+
+	uint8_t getRuleCount();
+	const SafetyRule& getRule( uint8_t index );
+	int32_t getSignal( SAFETY_SIGNAL signal );
+
+	/**
+	 * @brief Find how long a signal that counts seconds can grow before a rule stops the rover: the earliest of the fail rules
+	 * that read the signal with atLeast and apply in a mode, threshold and persistence time together.
+	 * @param signal The signal.
+	 * @param mode The ROVER_MODE.
+	 * @return Milliseconds, 0 if no such rule applies in the mode.
+	*/
+	uint32_t getFailTimeoutMilliseconds( SAFETY_SIGNAL signal, uint8_t mode );
+
+	/**
+	 * @brief Get the average cost of evaluating a rule since the engine was reset.
+	 * @return Processor cycles per evaluation of the rule.
+	*/
+	uint32_t getAverageRuleCycles( uint8_t index );
+
+	/**
+	 * @brief Get the average cost of evaluate() since the engine was reset.
+	 * @return Processor cycles per evaluation.
+	*/
+	uint32_t getAverageEvaluationCycles();
+
+	uint32_t getEvaluationCount();
+
+	/**
+	 * @brief Read a rule from text: signal,predicate,threshold,persistenceMilliseconds,modes,action[,sound]
+	 * e.g. crossTrackError,atLeast,8,2000,Auto,fail,estop. Modes are ROVER_MODE names or numbers separated by |, or any.
+	 * @param text The text to read.
+	 * @param rule Receives the rule.
+	 * @return False if the text isn't a valid rule.
+	*/
+	static bool parse( const char* text, SafetyRule* rule );
+
+	static const char* getSignalName( uint8_t signal );
+	static const char* getActionName( uint8_t action );
+
+	/**
+	 * @brief Get the file of a rule sound.
+	 * @return The sound file, or NULL for SAFETY_SOUND_NONE.
+	*/
+	static const char* getSoundFile( uint8_t sound );
+
+private:
+	bool matches( const SafetyRule& rule );
+
+	SafetyRule _rules[SAFETY_RULE_CAPACITY];
+	uint8_t _ruleCount = 0;
+	int32_t _signals[SAFETY_SIGNAL_COUNT];
+	int32_t _parameters[SAFETY_PARAMETER_CAPACITY];
+	uint32_t _signalRules[SAFETY_SIGNAL_COUNT];          ///< Rules that read each signal
+	uint32_t _parameterRules[SAFETY_PARAMETER_CAPACITY]; ///< Rules whose threshold follows each parameter
+	uint8_t _mode = 0;
+
+	uint32_t _dirtyRules = 0;      ///< Rules to evaluate because an input changed
+	uint32_t _waitingRules = 0;    ///< Rules that match and are waiting out their persistence time
+	uint32_t _matchingRules = 0;
+	uint32_t _activeRules = 0;
+	uint32_t _matchingSinceMilliseconds[SAFETY_RULE_CAPACITY];
+
+	uint64_t _ruleCycles[SAFETY_RULE_CAPACITY];
+	uint32_t _ruleEvaluations[SAFETY_RULE_CAPACITY];
+	uint64_t _evaluationCycles = 0;
+	uint32_t _evaluationCount = 0;
+};
+
+#endif
@@ -17,29 +17,23 @@
 
 #include "SerialMAVLinkReader.h"
 #include <ArduinoLog.h>
+#include "EnumHelper.h"
 
+constexpr size_t SERIAL_READ_BUFFER_SIZE = 1024; ///< Extra receive buffer so bytes aren't lost while other tasks block, e.g. on SD card access
 
-SerialMAVLinkReader::SerialMAVLinkReader( HardwareSerial* serial, MAVLinkEventReceiver* mavlinkEvebtReceiver )
-	: MAVLinkReader( mavlinkEvebtReceiver )
+uint8_t serialReadBuffer[SERIAL_READ_BUFFER_SIZE];
+
+SerialMAVLinkReader::SerialMAVLinkReader( HardwareSerial* serial, MAVLinkEventReceiver* mavlinkEvebtReceiver, uint32_t baudRate )
+	: MAVLinkReader( mavlinkEvebtReceiver, "serial" )
 {
 	_serial = serial;
 	
-	Log.trace( "Starting MAVLink serial reader" );
-	_serial->begin( 57600, SERIAL_8N1 );
+	Log.trace( "Starting MAVLink serial reader at %u baud", baudRate );
+	_serial->begin( baudRate, SERIAL_8N1 );
+	_serial->addMemoryForRead( serialReadBuffer, SERIAL_READ_BUFFER_SIZE );
 }
 
 
-bool SerialMAVLinkReader::readByte( uint8_t* buffer )
-{
-
-	if ( _serial->available() > 0 )
-	{
-		return _serial->readBytes( buffer, 1 ) == 1;
-	}
-
-	return false;
-}
-
 void SerialMAVLinkReader::tick()
 {
 	unsigned long currentMillisMAVLink = millis();
@@ -56,8 +50,8 @@ void SerialMAVLinkReader::tick()
 
 		_cycleCount += 1;
 
-		// If ready to send data request
-		if ( _cycleCount >= _numberOfCyclesToWait )
+		// If ready to send data request, streams can only be asked of a flight controller that has been found
+		if ( _cycleCount >= _numberOfCyclesToWait && _flightControllerFound )
 		{
 			// Request streams from Pixhawk
 			Log.trace( "Requesting stream data" );
@@ -65,9 +59,19 @@ void SerialMAVLinkReader::tick()
 			_cycleCount = 0;
 		}
 
+		// A mode change asked for before the flight controller was found goes out once it is
+		if ( _changeModePending && _flightControllerFound )
+		{
+			Log.trace( "Sending the mode change held back until the flight controller was found" );
+			_changeModePending = false;
+			sendChangeMode( _pendingRoverMode );
+		}
+
 
 	}
 
+	MAVLinkReader::tick();
+
 }
 
 void SerialMAVLinkReader::requestMAVLinkStreams()
@@ -89,7 +93,7 @@ void SerialMAVLinkReader::requestMAVLinkStreams()
 	 */
 	for ( int i = 0; i < maxStreams; i++ )
 	{
-		mavlink_msg_request_data_stream_pack( _sysid, _compid, &mavlinkMessage, 1, 0, MAVStreams[i], MAVRates[i], 1 );
+		mavlink_msg_request_data_stream_pack( _systemId, _componentId, &mavlinkMessage, _flightControllerSystemId, _flightControllerComponentId, MAVStreams[i], MAVRates[i], 1 );
 		messageLength = mavlink_msg_to_send_buffer( buffer, &mavlinkMessage );
 		_serial->write( buffer, messageLength );
 	}
@@ -104,7 +108,7 @@ void SerialMAVLinkReader::sendMAVLinkHeartbeat()
 	//Log.trace( "Sending heartbeat message" );
 
 	// Pack the MAVLink heartbeat message
-	mavlink_msg_heartbeat_pack( _sysid, _compid, &mavlinkMessage, _type, _autopilotType, _systemMode, _customMode, _systemState );
+	mavlink_msg_heartbeat_pack( _systemId, _componentId, &mavlinkMessage, _type, _autopilotType, _systemMode, _customMode, _systemState );
 
 	// Copy the message to the send buffer
 	messageLength = mavlink_msg_to_send_buffer( buffer, &mavlinkMessage );
@@ -121,10 +125,18 @@ void SerialMAVLinkReader::sendChangeMode( ROVER_MODE roverMode)
 	uint16_t messageLength = 0;
 	mavlink_message_t mavlinkMessage;
 
-	//Log.trace( "Sending heartbeat message" );
+	// Until the flight controller is found its ids aren't known, and a SET_MODE to system 0 would go to every system on the link
+	if ( !_flightControllerFound )
+	{
+		Log.warning( "Flight controller not found yet, mode change to %s held back", EnumHelper::convert( roverMode ) );
+		_pendingRoverMode = roverMode;
+		_changeModePending = true;
+		return;
+	}
 
-	// Pack the MAVLink change mode message
-	mavlink_msg_set_mode_pack( _sysid, _compid, &mavlinkMessage, _flight_controller_sysid,  roverMode, 1 );
+	// Pack the MAVLink change mode message, SET_MODE has no target component, so COMMAND_LONG carries it to the autopilot
+	mavlink_msg_command_long_pack( _systemId, _componentId, &mavlinkMessage, _flightControllerSystemId, _flightControllerComponentId, MAV_CMD_DO_SET_MODE, 0,
+		MAV_MODE_FLAG_CUSTOM_MODE_ENABLED, roverMode, 0, 0, 0, 0, 0 );
 
 	// Copy the message to the send buffer
 	messageLength = mavlink_msg_to_send_buffer( buffer, &mavlinkMessage );
@@ -135,9 +147,47 @@ void SerialMAVLinkReader::sendChangeMode( ROVER_MODE roverMode)
 
 }
 
+void SerialMAVLinkReader::sendParamValue( const char* parameterId, float value, uint16_t index, uint16_t count )
+{
+	uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
+	uint16_t messageLength = 0;
+	mavlink_message_t mavlinkMessage;
+
+	// Pack the MAVLink parameter value message
+	mavlink_msg_param_value_pack( _systemId, _componentId, &mavlinkMessage, parameterId, value, MAV_PARAM_TYPE_REAL32, count, index );
 
+	// Copy the message to the send buffer
+	messageLength = mavlink_msg_to_send_buffer( buffer, &mavlinkMessage );
 
+	// Write buffer containing parameter value message
+	_serial->write( buffer, messageLength );
+}
 
+void SerialMAVLinkReader::sendMissionMessage( uint32_t msgid, uint16_t seq, uint8_t type )
+{
+	uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
+	uint16_t messageLength = 0;
+	mavlink_message_t mavlinkMessage;
 
+	// Pack the MAVLink mission message
+	switch ( msgid )
+	{
+		case MAVLINK_MSG_ID_MISSION_REQUEST_LIST:
+			mavlink_msg_mission_request_list_pack( _systemId, _componentId, &mavlinkMessage, _flightControllerSystemId, _flightControllerComponentId, MAV_MISSION_TYPE_MISSION );
+			break;
+		case MAVLINK_MSG_ID_MISSION_REQUEST_INT:
+			mavlink_msg_mission_request_int_pack( _systemId, _componentId, &mavlinkMessage, _flightControllerSystemId, _flightControllerComponentId, seq, MAV_MISSION_TYPE_MISSION );
+			break;
+		case MAVLINK_MSG_ID_MISSION_ACK:
+			mavlink_msg_mission_ack_pack( _systemId, _componentId, &mavlinkMessage, _flightControllerSystemId, _flightControllerComponentId, type, MAV_MISSION_TYPE_MISSION );
+			break;
+		default:
+			return;
+	}
 
+	// Copy the message to the send buffer
+	messageLength = mavlink_msg_to_send_buffer( buffer, &mavlinkMessage );
 
+	// Write buffer containing mission message
+	_serial->write( buffer, messageLength );
+}
@@ -12,7 +12,7 @@
 #endif
 #include "MAVLinkReader.h"
 
-
+constexpr uint32_t MAVLINK_SERIAL_BAUD = 57600;   ///< Speed of the flight controller link, SERIALn_BAUD on the flight controller
 
 class SerialMAVLinkReader : public MAVLinkReader
 {
@@ -28,24 +28,42 @@ public:
 	 * @brief Constructor
 	 * @param serial The serail interface to receive MAVLink message from.
 	 * @param mavlinkEvebtReceiver The event receiver to send captured messages to.
-	 * 
+	 * @param baudRate The speed of the link.
 	*/
-	SerialMAVLinkReader( HardwareSerial* serial, MAVLinkEventReceiver* mavlinkEvebtReceiver );
+	SerialMAVLinkReader( HardwareSerial* serial, MAVLinkEventReceiver* mavlinkEvebtReceiver, uint32_t baudRate = MAVLINK_SERIAL_BAUD );
 
 	/**
 	 * @brief Read a single btye from MAVLink serial line.
 	 * @param buffer The buffer to copy the byte to.
 	 * @return True is a byte was read.
 	*/
-	virtual bool readByte( uint8_t* buffer );
+	virtual bool readByte( uint8_t* buffer )
+	{
+		// Defined here so a reader bound to this source at compile time can inline it
+		if ( _serial->available() > 0 )
+		{
+			return _serial->readBytes( buffer, 1 ) == 1;
+		}
+
+		return false;
+	}
 
 	/**
 	 * @brief Used by the scheduling system to pass execution to the serial MAVLink reader.
 	*/
 	virtual void tick();
 
+	virtual bool hasBytes()
+	{
+		return _serial->available() > 0;
+	}
+
 	virtual void sendChangeMode( ROVER_MODE roverMode);
 
+	virtual void sendParamValue( const char* parameterId, float value, uint16_t index, uint16_t count );
+
+	virtual void sendMissionMessage( uint32_t msgid, uint16_t seq, uint8_t type );
+
 private:
 
 	// Heartbeat timer fields
@@ -55,8 +73,6 @@ private:
 	int _cycleCount = 60;          ///< Number of cycles before a data request
 
 	// MAVLink configuration fields
-	int _sysid = 4;                          ///< ID 4 for this companion computer. 1 flight controller, 255 ground station
-	int _compid = MAV_COMP_ID_PERIPHERAL;    ///< The component sending the message
 	int _type = MAV_TYPE_ONBOARD_CONTROLLER; ///< This system is a companion computer
 
 	uint8_t _systemType = MAV_TYPE_ONBOARD_CONTROLLER; ///< System type is onboard compainion computer
@@ -66,9 +82,11 @@ private:
 	uint32_t _customMode = 0;                  ///< Custom mode, can be defined by user/adopter
 	uint8_t _systemState = MAV_STATE_STANDBY;  ///< System ready for flight
 
-	uint8_t _flight_controller_sysid = 1; ///< Id # of the flight controller
 	uint8_t _flight_controller_component = 0; ///< Target component, 0 = all
 
+	bool _changeModePending = false;          ///< A mode change was asked for before the flight controller was found
+	ROVER_MODE _pendingRoverMode = ROVER_MODE_HOLD;
+
 };
 #endif
 
@@ -10,35 +10,86 @@ constexpr int ALARM_RELAY_PIN = 36;
 constexpr int ON = 180;
 constexpr int OFF = 0;
 
-ServoRelay::ServoRelay()
+ServoRelay::ServoRelay( bool attached )
 {
-	_pwmPowerSystemRelay.attach( POWER_SYSTEM_RELAY_PIN,900,2200 );
-	_pwmPowerSystemRelay.attach( ALARM_RELAY_PIN,900,2200 );
-	alarmRelayOff();
-	powerRelayOff();
+	_attached = attached;
+
+	if ( _attached )
+	{
+		_pwmPowerSystemRelay.attach( POWER_SYSTEM_RELAY_PIN,900,2200 );
+		_pwmAlarmRelay.attach( ALARM_RELAY_PIN,900,2200 );
+		alarmRelayOff();
+		powerRelayOff();
+	}
 
 }
 
 void ServoRelay::powerRelayOff()
 {
 	Log.trace( "Turning off power" );
-	_pwmPowerSystemRelay.write( OFF );
+	writePower( OFF );
 }
 
 void ServoRelay::powerRelayOn()
 {
 	Log.trace( "Turning on power" );
-	_pwmPowerSystemRelay.write( ON );
+	writePower( ON );
+}
+
+void ServoRelay::writePower( int angle )
+{
+	// The deadline and safety interrupts can cut the power, they mustn't land in the middle of this write
+	__disable_irq();
+
+	if ( _attached )
+	{
+		_pwmPowerSystemRelay.write( angle );
+	}
+
+	_isPowerOn = angle != OFF;
+	__enable_irq();
+}
+
+void ServoRelay::cutPower()
+{
+	if ( _attached )
+	{
+		_pwmPowerSystemRelay.write( OFF );
+	}
+
+	_isPowerOn = false;
+}
+
+bool ServoRelay::isPowerOn()
+{
+	return _isPowerOn;
 }
 
 void ServoRelay::alarmRelayOff()
 {
 	Log.trace( "Turning off alarm" );
-	_pwmAlarmRelay.write( OFF );
+
+	if ( _attached )
+	{
+		_pwmAlarmRelay.write( OFF );
+	}
+
+	_isAlarmOn = false;
 }
 
 void ServoRelay::alarmRelayOn()
 {
 	Log.trace( "Turning on alarm" );
-	_pwmAlarmRelay.write( ON );
+
+	if ( _attached )
+	{
+		_pwmAlarmRelay.write( ON );
+	}
+
+	_isAlarmOn = true;
+}
+
+bool ServoRelay::isAlarmOn()
+{
+	return _isAlarmOn;
 }
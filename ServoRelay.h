@@ -13,18 +13,39 @@
 
 
 
+/**
+ * @brief ServoRelay drives the RC relays for the power system and the alarm. The power relay is on only while the PWM signal
+ * commands it on: if the signal stops, because the board resets or an interrupt cuts it, the relay drops out.
+*/
 class ServoRelay
 {
 public:
-	ServoRelay();
+	/**
+	 * @brief Constructor.
+	 * @param attached False for relays that only keep their state, without driving the pins, e.g. for a shadow mission monitor.
+	*/
+	ServoRelay( bool attached = true );
 	void powerRelayOff();
 	void powerRelayOn();
 	void alarmRelayOff();
 	void alarmRelayOn();
 
+	/**
+	 * @brief Turn the power relay off from an interrupt, without logging.
+	*/
+	void cutPower();
+
+	bool isPowerOn();
+	bool isAlarmOn();
+
 private:
+	void writePower( int angle );
+
 	PWMServo _pwmPowerSystemRelay;  
 	PWMServo _pwmAlarmRelay;
+	volatile bool _isPowerOn = false;
+	bool _isAlarmOn = false;
+	bool _attached;
 };
 #endif
 
@@ -0,0 +1,45 @@
+// StaticMAVLinkReader.h
+
+#ifndef _STATICMAVLINKREADER_h
+#define _STATICMAVLINKREADER_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "MAVLinkReader.h"
+
+/**
+ * @brief A MAVLink reader bound to its byte source and event receiver at compile time. The source is a reader class such as
+ * SerialMAVLinkReader, which it derives from, and the receiver is a final event receiver such as MAVLinkEventBus.
+ * Bytes are read with a direct call to the readByte() of the source and messages go straight to the handlers of the receiver,
+ * so the compiler can inline the hot handlers into the parse loop and drop the ones the receiver doesn't override.
+ * Everywhere else it behaves like its source, the virtual reader remains for configurations chosen at run time.
+*/
+template <class Source, class Receiver>
+class StaticMAVLinkReader final : public Source
+{
+public:
+	/**
+	 * @brief Constructor
+	 * @param receiver The event receiver to send events to, also passed to the source among its own arguments.
+	 * @param arguments The arguments of the source constructor.
+	*/
+	template <class... Arguments>
+	StaticMAVLinkReader( Receiver* receiver, Arguments... arguments ) : Source( arguments... )
+	{
+		_receiver = receiver;
+	}
+
+	virtual bool receiveMAVLinkMessages()
+	{
+		return this->receiveMessages( _receiver, [this]( uint8_t* byteBuffer ) { return this->Source::readByte( byteBuffer ); } );
+	}
+
+private:
+	Receiver* _receiver;
+};
+
+#endif
@@ -0,0 +1,63 @@
+// StaticStorage.h
+
+#ifndef _STATICSTORAGE_h
+#define _STATICSTORAGE_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include <new>
+
+/**
+ * @brief The size of the largest of several classes, for storage that holds whichever of them is chosen at run time.
+*/
+template <class Object>
+constexpr size_t largestSize()
+{
+	return sizeof( Object );
+}
+
+template <class First, class Second, class... Others>
+constexpr size_t largestSize()
+{
+	return sizeof( First ) > largestSize<Second, Others...>() ? sizeof( First ) : largestSize<Second, Others...>();
+}
+
+/**
+ * @brief Statically allocated room for one object that is constructed at boot, once its arguments are known.
+ * The storage is sized when the firmware is compiled and creating an object that doesn't fit is a compile error,
+ * so the firmware never allocates from the heap and its memory use is fixed by the linker.
+ * Declare it DMAMEM to place the object in the second RAM bank.
+ * @tparam Size The size of the largest object the storage holds.
+*/
+template <size_t Size>
+class StaticStorage
+{
+public:
+	/**
+	 * @brief Construct an object in the storage. Call it once, the object is never destroyed.
+	 * @param arguments The arguments of the object constructor.
+	 * @return The object.
+	*/
+	template <class Object, class... Arguments>
+	Object* create( Arguments... arguments )
+	{
+		static_assert(sizeof( Object ) <= Size, "The object doesn't fit its static storage");
+		static_assert(alignof(Object) <= alignof(max_align_t), "The object needs more alignment than its static storage has");
+
+		return new (_storage) Object( arguments... );
+	}
+
+	static constexpr size_t size()
+	{
+		return Size;
+	}
+
+private:
+	alignas(max_align_t) uint8_t _storage[Size];
+};
+
+#endif
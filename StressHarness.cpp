@@ -0,0 +1,188 @@
+//
+//
+//
+
+#include "StressHarness.h"
+#include <ArduinoLog.h>
+
+StressHarness::StressHarness( TrafficGenerator* trafficGenerator, LinkStatistics* linkStatistics, DeadlineMonitor* deadlineMonitor, const TrafficLoad& load, uint32_t baudRate )
+{
+	_trafficGenerator = trafficGenerator;
+	_linkStatistics = linkStatistics;
+	_deadlineMonitor = deadlineMonitor;
+	_load = load;
+	_lineBytesPerSecond = baudRate / STRESS_BITS_PER_BYTE;
+
+	Log.trace( "Stress test at %u baud, the line carries %u bytes per second", baudRate, _lineBytesPerSecond );
+}
+
+void StressHarness::onHeatbeat( mavlink_heartbeat_t mavlink_heartbeat )
+{
+	_framesDelivered++;
+}
+
+void StressHarness::onGlobalPositionInt( mavlink_global_position_int_t mavlink_global_position_int )
+{
+	_framesDelivered++;
+}
+
+void StressHarness::onNavControllerOutput( mavlink_nav_controller_output_t mavlink_nav_controller )
+{
+	_framesDelivered++;
+}
+
+void StressHarness::onGPSRawInt( mavlink_gps_raw_int_t mavlink_gps_raw_int )
+{
+	_framesDelivered++;
+}
+
+void StressHarness::onGPS2Raw( mavlink_gps2_raw_t mavlink_gps2_raw )
+{
+	_framesDelivered++;
+}
+
+void StressHarness::onMissionCurrent( mavlink_mission_current_t mavlink_mission_current )
+{
+	_framesDelivered++;
+}
+
+void StressHarness::onSystemTime( mavlink_system_time_t mavlink_system_time )
+{
+	_framesDelivered++;
+
+	// The generator wrote its micros() here, it runs on the same board so the clocks are the same
+	uint32_t latencyMicroseconds = micros() - (uint32_t)mavlink_system_time.time_unix_usec;
+
+	_latencySamples++;
+	_latencyTotalMicroseconds += latencyMicroseconds;
+
+	if ( latencyMicroseconds > _worstLatencyMicroseconds )
+	{
+		_worstLatencyMicroseconds = latencyMicroseconds;
+	}
+}
+
+void StressHarness::tick()
+{
+	if ( _finished )
+	{
+		return;
+	}
+
+	uint32_t timeMilliseconds = millis();
+
+	if ( _levelStartMilliseconds == 0 )
+	{
+		startLevel();
+		return;
+	}
+
+	_trafficGenerator->tick();
+
+	if ( !_draining && timeMilliseconds - _levelStartMilliseconds >= STRESS_LEVEL_MILLISECONDS )
+	{
+		// Stop sending and let the reader catch up with what is queued before counting
+		_levelCounters = _trafficGenerator->getCounters();
+		_trafficGenerator->setLoad( TrafficLoad() );
+		_draining = true;
+		_drainStartMilliseconds = timeMilliseconds;
+	}
+	else if ( _draining && timeMilliseconds - _drainStartMilliseconds >= STRESS_DRAIN_MILLISECONDS )
+	{
+		reportLevel();
+		_draining = false;
+		_level++;
+
+		if ( _level < STRESS_LEVEL_COUNT )
+		{
+			startLevel();
+		}
+		else
+		{
+			finish();
+		}
+	}
+}
+
+void StressHarness::finish()
+{
+	_finished = true;
+	Log.trace( "Stress test finished, highest sustainable rate %u messages per second", _sustainableMessagesPerSecond );
+}
+
+void StressHarness::startLevel()
+{
+	TrafficLoad load = _load;
+	load.messagesPerSecond = STRESS_START_MESSAGES_PER_SECOND << _level;
+
+	// Past the line rate the port would be the bottleneck, not the reader
+	uint32_t bytesPerSecond = load.messagesPerSecond * _bytesPerFrame;
+
+	if ( bytesPerSecond > _lineBytesPerSecond )
+	{
+		Log.trace( "Stress level %d: %u messages per second would need %u bytes per second, more than the line carries, the ladder stops here",
+			_level,
+			load.messagesPerSecond,
+			bytesPerSecond );
+		finish();
+		return;
+	}
+
+	_framesDelivered = 0;
+	_latencySamples = 0;
+	_latencyTotalMicroseconds = 0;
+	_worstLatencyMicroseconds = 0;
+	_crcErrorsAtStart = _linkStatistics->getCrcErrors();
+	_bytesDiscardedAtStart = _linkStatistics->getBytesDiscarded();
+	_framesLostAtStart = _linkStatistics->getFramesLost();
+	_deadlineMissesAtStart = _deadlineMonitor->getMisses();
+
+	Log.trace( "Stress level %d: %u messages per second in bursts of %d", _level, load.messagesPerSecond, load.burstMessages );
+
+	_trafficGenerator->setLoad( load );
+	_levelStartMilliseconds = millis();
+}
+
+void StressHarness::reportLevel()
+{
+	uint32_t messagesPerSecond = STRESS_START_MESSAGES_PER_SECOND << _level;
+	uint32_t framesDropped = _levelCounters.framesIntact > _framesDelivered ? _levelCounters.framesIntact - _framesDelivered : 0;
+	uint32_t dropPermille = _levelCounters.framesIntact == 0 ? 0 : (uint32_t)((uint64_t)framesDropped * 1000 / _levelCounters.framesIntact);
+	uint32_t deadlineMisses = _deadlineMonitor->getMisses() - _deadlineMissesAtStart;
+	bool sustainable = _levelCounters.messagesBlocked == 0 && dropPermille <= STRESS_MAX_DROP_PERMILLE && deadlineMisses == 0;
+
+	if ( sustainable )
+	{
+		_sustainableMessagesPerSecond = messagesPerSecond;
+	}
+
+	if ( _levelCounters.framesSent > 0 )
+	{
+		_bytesPerFrame = _levelCounters.bytesSent / _levelCounters.framesSent;
+	}
+
+	Log.trace( "Stress level %d: %u messages per second offered, %u sent, %u blocked by the port, %u bytes per second",
+		_level,
+		messagesPerSecond,
+		_levelCounters.framesSent * 1000 / STRESS_LEVEL_MILLISECONDS,
+		_levelCounters.messagesBlocked,
+		_levelCounters.bytesSent * 1000 / STRESS_LEVEL_MILLISECONDS );
+	Log.trace( "Stress level %d: %u corrupted, %u truncated, %u foreign, %u intact frames, %u delivered, %u dropped, %u per mille",
+		_level,
+		_levelCounters.framesCorrupted,
+		_levelCounters.framesTruncated,
+		_levelCounters.framesForeign,
+		_levelCounters.framesIntact,
+		_framesDelivered,
+		framesDropped,
+		dropPermille );
+	Log.trace( "Stress level %d: %u CRC errors, %u bytes discarded, %u frames lost by sequence, %u deadlines missed, latency %u microseconds average, %u at most, %s",
+		_level,
+		_linkStatistics->getCrcErrors() - _crcErrorsAtStart,
+		_linkStatistics->getBytesDiscarded() - _bytesDiscardedAtStart,
+		_linkStatistics->getFramesLost() - _framesLostAtStart,
+		deadlineMisses,
+		_latencySamples == 0 ? 0 : (uint32_t)(_latencyTotalMicroseconds / _latencySamples),
+		_worstLatencyMicroseconds,
+		sustainable ? "sustainable" : "not sustainable" );
+}
@@ -0,0 +1,104 @@
+// StressHarness.h
+
+#ifndef _STRESSHARNESS_h
+#define _STRESSHARNESS_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "MAVLinkEventReceiver.h"
+#include "TrafficGenerator.h"
+#include "LinkStatistics.h"
+#include "DeadlineMonitor.h"
+
+constexpr uint32_t STRESS_START_MESSAGES_PER_SECOND = 25;    ///< Rate of the first load level, each level doubles it
+constexpr uint8_t STRESS_LEVEL_COUNT = 10;                   ///< Load levels, up to 12800 messages per second
+constexpr uint32_t STRESS_LEVEL_MILLISECONDS = 10000;        ///< How long each load level is sent
+constexpr uint32_t STRESS_DRAIN_MILLISECONDS = 500;          ///< Quiet time after a level so the frames still queued are read before counting
+constexpr uint32_t STRESS_MAX_DROP_PERMILLE = 10;            ///< Most intact frames a sustainable level may lose, in thousandths
+constexpr uint8_t STRESS_BITS_PER_BYTE = 10;                 ///< A start bit, 8 data bits and a stop bit
+
+/**
+ * @brief The message ids the harness counts, the ones the traffic generator sends.
+*/
+constexpr uint32_t STRESS_HARNESS_MESSAGE_IDS[] = {
+	MAVLINK_MSG_ID_HEARTBEAT,
+	MAVLINK_MSG_ID_GLOBAL_POSITION_INT,
+	MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT,
+	MAVLINK_MSG_ID_GPS_RAW_INT,
+	MAVLINK_MSG_ID_GPS2_RAW,
+	MAVLINK_MSG_ID_MISSION_CURRENT,
+	MAVLINK_MSG_ID_SYSTEM_TIME
+};
+
+/**
+ * @brief StressHarness steps the traffic generator through load levels while the serial reader, the event bus and the mission monitor
+ * run as they do on a rover, with the generator port wired to the flight controller port. It subscribes to the event bus after the
+ * other receivers and counts the frames delivered. At the end of each level it writes to the log the rate offered and sent, the share
+ * of intact frames that weren't delivered, the link errors, the deadlines missed and the latency from writing a SYSTEM_TIME frame to
+ * its delivery. A level is sustainable when the port kept up, at most STRESS_MAX_DROP_PERMILLE of the frames were lost and no deadline
+ * was missed. After the last level the highest sustainable rate is written to the log.
+ * A level the line can't carry would measure the line rather than the reader, so the ladder stops before a level whose bytes,
+ * at the frame size seen so far, wouldn't fit the line rate.
+*/
+class StressHarness final : public MAVLinkEventReceiver
+{
+public:
+	/**
+	 * @brief Constructor.
+	 * @param trafficGenerator The generator, already started.
+	 * @param linkStatistics The statistics of the reader on the port the generator is wired to.
+	 * @param deadlineMonitor The deadline monitor of the critical tasks.
+	 * @param load The burst size, corruption, truncation and foreign share used at every level, the rate is set by the harness.
+	 * @param baudRate The speed of the loopback, the levels are capped at what it carries.
+	*/
+	StressHarness( TrafficGenerator* trafficGenerator, LinkStatistics* linkStatistics, DeadlineMonitor* deadlineMonitor, const TrafficLoad& load, uint32_t baudRate );
+
+	virtual void onHeatbeat( mavlink_heartbeat_t mavlink_heartbeat );
+	virtual void onGlobalPositionInt( mavlink_global_position_int_t mavlink_global_position_int );
+	virtual void onNavControllerOutput( mavlink_nav_controller_output_t mavlink_nav_controller );
+	virtual void onGPSRawInt( mavlink_gps_raw_int_t mavlink_gps_raw_int );
+	virtual void onGPS2Raw( mavlink_gps2_raw_t mavlink_gps2_raw );
+	virtual void onMissionCurrent( mavlink_mission_current_t mavlink_mission_current );
+	virtual void onSystemTime( mavlink_system_time_t mavlink_system_time );
+
+	/**
+	 * @brief Send the traffic that is due and move to the next level when a level is over.
+	*/
+	virtual void tick();
+
+private:
+	void startLevel();
+	void reportLevel();
+	void finish();
+
+	TrafficGenerator* _trafficGenerator;
+	LinkStatistics* _linkStatistics;
+	DeadlineMonitor* _deadlineMonitor;
+	TrafficLoad _load;
+	TrafficCounters _levelCounters;
+	uint32_t _lineBytesPerSecond;
+	uint32_t _bytesPerFrame = 0;         ///< Average frame size sent at the last level, 0 before the first level is over
+
+	uint8_t _level = 0;
+	bool _draining = false;
+	bool _finished = false;
+	uint32_t _levelStartMilliseconds = 0;
+	uint32_t _drainStartMilliseconds = 0;
+	uint32_t _sustainableMessagesPerSecond = 0;
+
+	// Counted since the level started
+	uint32_t _framesDelivered = 0;
+	uint32_t _latencySamples = 0;
+	uint64_t _latencyTotalMicroseconds = 0;
+	uint32_t _worstLatencyMicroseconds = 0;
+	uint32_t _crcErrorsAtStart = 0;
+	uint32_t _bytesDiscardedAtStart = 0;
+	uint32_t _framesLostAtStart = 0;
+	uint32_t _deadlineMissesAtStart = 0;
+};
+
+#endif
@@ -0,0 +1,190 @@
+//
+//
+//
+
+#include "ThresholdSweep.h"
+
+ThresholdSweep::ThresholdSweep( MissionMonitor* missionMonitor, MissionThresholds thresholds, const SweepSetting* settings, uint8_t count, uint32_t faultMilliseconds )
+{
+	_missionMonitor = missionMonitor;
+	_thresholds = thresholds;
+	_count = min( count, THRESHOLD_SWEEP_CAPACITY );
+	_faultMilliseconds = faultMilliseconds;
+
+	for ( uint8_t i = 0; i < _count; i++ )
+	{
+		_settings[i] = settings[i];
+
+		MissionThresholds shadowThresholds = _thresholds;
+		shadowThresholds.secondsBeforeEmergencyStop = _settings[i].secondsBeforeEmergencyStop;
+		shadowThresholds.lowestGpsFixType = _settings[i].lowestGpsFixType;
+
+		_monitors[i] = _monitorStorage[i].create<MissionMonitor>( shadowThresholds, (AudioPlayer*)NULL, true );
+	}
+
+	Log.trace( "Threshold sweep of %d settings uses %d bytes, fault at %u milliseconds", _count, sizeof( ThresholdSweep ), _faultMilliseconds );
+}
+
+void ThresholdSweep::setMissionTimeCallback( uint32_t( *missionTimeCallback ) () )
+{
+	MAVLinkEventReceiver::setMissionTimeCallback( missionTimeCallback );
+
+	for ( uint8_t i = 0; i < _count; i++ )
+	{
+		_monitors[i]->setMissionTimeCallback( missionTimeCallback );
+	}
+}
+
+void ThresholdSweep::setMissionDownloader( MissionDownloader* missionDownloader )
+{
+	for ( uint8_t i = 0; i < _count; i++ )
+	{
+		_monitors[i]->setMissionDownloader( missionDownloader );
+	}
+}
+
+void ThresholdSweep::setSafetyRules( const SafetyRule* rules, uint8_t count )
+{
+	for ( uint8_t i = 0; i < _count; i++ )
+	{
+		_monitors[i]->setSafetyRules( rules, count );
+	}
+}
+
+void ThresholdSweep::onHeatbeat( mavlink_heartbeat_t mavlink_heartbeat )
+{
+	forward( &MissionMonitor::onHeatbeat, mavlink_heartbeat );
+}
+
+void ThresholdSweep::onMissionItemReached( mavlink_mission_item_reached_t mavlink_mission_item_reached )
+{
+	forward( &MissionMonitor::onMissionItemReached, mavlink_mission_item_reached );
+}
+
+void ThresholdSweep::onNavControllerOutput( mavlink_nav_controller_output_t mavlink_nav_controller )
+{
+	forward( &MissionMonitor::onNavControllerOutput, mavlink_nav_controller );
+}
+
+void ThresholdSweep::onMissionCurrent( mavlink_mission_current_t mavlink_mission_current )
+{
+	forward( &MissionMonitor::onMissionCurrent, mavlink_mission_current );
+}
+
+void ThresholdSweep::onGPSRawInt( mavlink_gps_raw_int_t mavlink_gps_raw_int )
+{
+	forward( &MissionMonitor::onGPSRawInt, mavlink_gps_raw_int );
+}
+
+void ThresholdSweep::onGPS2Raw( mavlink_gps2_raw_t mavlink_gps2_raw )
+{
+	forward( &MissionMonitor::onGPS2Raw, mavlink_gps2_raw );
+}
+
+void ThresholdSweep::onGlobalPositionInt( mavlink_global_position_int_t mavlink_global_position_int )
+{
+	forward( &MissionMonitor::onGlobalPositionInt, mavlink_global_position_int );
+}
+
+void ThresholdSweep::tick()
+{
+	int logLevel = Log.getLevel();
+	Log.setLevel( LOG_LEVEL_SILENT );
+
+	for ( uint8_t i = 0; i < _count; i++ )
+	{
+		_monitors[i]->tick();
+	}
+
+	Log.setLevel( logLevel );
+	countDecisions();
+
+	uint32_t missionTime = getMissionTime();
+
+	if ( _nextPublishMilliseconds == 0 )
+	{
+		_nextPublishMilliseconds = missionTime + THRESHOLD_SWEEP_PUBLISH_MILLISECONDS;
+	}
+	else if ( (int32_t)(missionTime - _nextPublishMilliseconds) >= 0 )
+	{
+		_nextPublishMilliseconds = missionTime + THRESHOLD_SWEEP_PUBLISH_MILLISECONDS;
+		publish();
+	}
+}
+
+void ThresholdSweep::countDecisions()
+{
+	uint32_t missionTime = getMissionTime();
+
+	countDecisions( 0, _missionMonitor, missionTime );
+
+	for ( uint8_t i = 0; i < _count; i++ )
+	{
+		countDecisions( i + 1, _monitors[i], missionTime );
+	}
+}
+
+void ThresholdSweep::countDecisions( uint8_t row, MissionMonitor* monitor, uint32_t missionTime )
+{
+	// Several decisions can be taken between two calls, each of them counts
+	uint32_t stops = monitor->getStopCount();
+	uint32_t holds = monitor->getHoldCount();
+	uint32_t newStops = stops - _stops[row];
+	uint32_t newHolds = holds - _holds[row];
+	bool beforeFault = _faultMilliseconds == 0 || missionTime < _faultMilliseconds;
+
+	_stops[row] = stops;
+	_holds[row] = holds;
+
+	if ( beforeFault )
+	{
+		_falseStops[row] += newStops;
+		_falseHolds[row] += newHolds;
+	}
+	else if ( newStops != 0 && _detectionMilliseconds[row] == 0 )
+	{
+		_detectionMilliseconds[row] = missionTime;
+	}
+}
+
+void ThresholdSweep::publish()
+{
+	Log.trace( "Threshold sweep at %u milliseconds of mission time", (uint32_t)getMissionTime() );
+	publishRow( 0, "configured", _thresholds );
+
+	for ( uint8_t i = 0; i < _count; i++ )
+	{
+		MissionThresholds shadowThresholds = _thresholds;
+		shadowThresholds.secondsBeforeEmergencyStop = _settings[i].secondsBeforeEmergencyStop;
+		shadowThresholds.lowestGpsFixType = _settings[i].lowestGpsFixType;
+		publishRow( i + 1, "sweep", shadowThresholds );
+	}
+}
+
+void ThresholdSweep::publishRow( uint8_t row, const char* name, const MissionThresholds& thresholds )
+{
+	if ( _detectionMilliseconds[row] != 0 )
+	{
+		Log.trace( "  %s %d seconds, fix type %d: %u stops, %u holds, %u false stops, %u false holds, fault detected after %u milliseconds",
+			name,
+			thresholds.secondsBeforeEmergencyStop,
+			thresholds.lowestGpsFixType,
+			_stops[row],
+			_holds[row],
+			_falseStops[row],
+			_falseHolds[row],
+			_detectionMilliseconds[row] - _faultMilliseconds );
+	}
+	else
+	{
+		Log.trace( "  %s %d seconds, fix type %d: %u stops, %u holds, %u false stops, %u false holds, %s",
+			name,
+			thresholds.secondsBeforeEmergencyStop,
+			thresholds.lowestGpsFixType,
+			_stops[row],
+			_holds[row],
+			_falseStops[row],
+			_falseHolds[row],
+			_faultMilliseconds == 0 ? "no fault in the log" : "fault not detected" );
+	}
+}
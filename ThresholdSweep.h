@@ -0,0 +1,123 @@
+// ThresholdSweep.h
+
+#ifndef _THRESHOLDSWEEP_h
+#define _THRESHOLDSWEEP_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include <ArduinoLog.h>
+#include "MissionMonitor.h"
+#include "StaticStorage.h"
+
+constexpr uint8_t THRESHOLD_SWEEP_CAPACITY = 6;                    ///< Shadow monitors at most, each evaluates the mission under one setting
+constexpr uint32_t THRESHOLD_SWEEP_PUBLISH_MILLISECONDS = 60000;   ///< Mission time between two tables in the log
+
+/**
+ * @brief The thresholds a shadow monitor uses instead of the configured ones.
+*/
+struct SweepSetting
+{
+	uint32_t secondsBeforeEmergencyStop;
+	GPS_FIX_TYPE lowestGpsFixType;
+};
+
+/**
+ * @brief The messages the shadow monitors are given, those of the mission monitor less the parameter protocol.
+*/
+constexpr uint32_t THRESHOLD_SWEEP_MESSAGE_IDS[] = {
+	MAVLINK_MSG_ID_HEARTBEAT,
+	MAVLINK_MSG_ID_GPS_RAW_INT,
+	MAVLINK_MSG_ID_GLOBAL_POSITION_INT,
+	MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT,
+	MAVLINK_MSG_ID_MISSION_CURRENT,
+	MAVLINK_MSG_ID_MISSION_ITEM_REACHED,
+	MAVLINK_MSG_ID_GPS2_RAW
+};
+
+/**
+ * @brief ThresholdSweep evaluates the same mission under several settings in one pass over the log. It subscribes to the event bus
+ * once, so each message is parsed and decoded once, and hands it to a shadow mission monitor per setting. The shadow monitors
+ * differ from the configured one in secondsBeforeEmergencyStop and lowestGpsFixType, drive no relays, play no prompts and write
+ * nothing to the log. The sweep counts the stops and holds of every monitor, the configured one included. A stop or hold before
+ * the mission time the fault began is a false one, the first stop after it gives the detection delay. A log without a fault makes
+ * every stop and hold a false one. The table is written to the log every THRESHOLD_SWEEP_PUBLISH_MILLISECONDS of mission time.
+*/
+class ThresholdSweep final : public MAVLinkEventReceiver
+{
+public:
+	/**
+	 * @brief Constructor.
+	 * @param missionMonitor The configured monitor, only read.
+	 * @param thresholds The configured thresholds, the shadow monitors change two of them.
+	 * @param settings The setting of each shadow monitor.
+	 * @param count The number of settings, up to THRESHOLD_SWEEP_CAPACITY.
+	 * @param faultMilliseconds Mission time the fault in the log began, 0 if there is none.
+	*/
+	ThresholdSweep( MissionMonitor* missionMonitor, MissionThresholds thresholds, const SweepSetting* settings, uint8_t count, uint32_t faultMilliseconds );
+
+	/**
+	 * @brief Give the shadow monitors the same mission time, mission and safety rules as the configured monitor.
+	*/
+	void setMissionTimeCallback( uint32_t( *missionTimeCallback ) () );
+	void setMissionDownloader( MissionDownloader* missionDownloader );
+	void setSafetyRules( const SafetyRule* rules, uint8_t count );
+
+	virtual void onHeatbeat( mavlink_heartbeat_t mavlink_heartbeat );
+	virtual void onMissionItemReached( mavlink_mission_item_reached_t mavlink_mission_item_reached );
+	virtual void onNavControllerOutput( mavlink_nav_controller_output_t mavlink_nav_controller );
+	virtual void onMissionCurrent( mavlink_mission_current_t mavlink_mission_current );
+	virtual void onGPSRawInt( mavlink_gps_raw_int_t mavlink_gps_raw_int );
+	virtual void onGPS2Raw( mavlink_gps2_raw_t mavlink_gps2_raw );
+	virtual void onGlobalPositionInt( mavlink_global_position_int_t mavlink_global_position_int );
+
+	/**
+	 * @brief Evaluate the mission in every shadow monitor, call it with the tick of the configured monitor.
+	*/
+	virtual void tick();
+
+private:
+	/**
+	 * @brief Hand a message to every shadow monitor, with the log silenced, and count the stops it led to.
+	*/
+	template <class Message>
+	void forward( void (MissionMonitor::*handler)( Message ), const Message& message )
+	{
+		int logLevel = Log.getLevel();
+		Log.setLevel( LOG_LEVEL_SILENT );
+
+		for ( uint8_t i = 0; i < _count; i++ )
+		{
+			(_monitors[i]->*handler)( message );
+		}
+
+		Log.setLevel( logLevel );
+		countDecisions();
+	}
+
+	void countDecisions();
+	void countDecisions( uint8_t row, MissionMonitor* monitor, uint32_t missionTime );
+	void publish();
+	void publishRow( uint8_t row, const char* name, const MissionThresholds& thresholds );
+
+	MissionMonitor* _missionMonitor;
+	MissionThresholds _thresholds;
+	SweepSetting _settings[THRESHOLD_SWEEP_CAPACITY];
+	uint8_t _count = 0;
+	uint32_t _faultMilliseconds;
+	StaticStorage<sizeof( MissionMonitor )> _monitorStorage[THRESHOLD_SWEEP_CAPACITY];
+	MissionMonitor* _monitors[THRESHOLD_SWEEP_CAPACITY];
+
+	// Row 0 is the configured monitor, then one row per shadow monitor
+	uint32_t _stops[THRESHOLD_SWEEP_CAPACITY + 1] = {};
+	uint32_t _holds[THRESHOLD_SWEEP_CAPACITY + 1] = {};
+	uint32_t _falseStops[THRESHOLD_SWEEP_CAPACITY + 1] = {};    ///< Stops before the fault
+	uint32_t _falseHolds[THRESHOLD_SWEEP_CAPACITY + 1] = {};    ///< Holds before the fault
+	uint32_t _detectionMilliseconds[THRESHOLD_SWEEP_CAPACITY + 1] = {};   ///< Mission time of the first stop after the fault, 0 until then
+	uint32_t _nextPublishMilliseconds = 0;
+};
+
+#endif
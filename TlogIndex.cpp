@@ -0,0 +1,239 @@
+//
+//
+//
+
+#include "TlogIndex.h"
+#include <ArduinoLog.h>
+
+constexpr auto TLOG_INDEX_EXTENSION = ".idx";
+constexpr auto TLOG_INDEX_MISSION_EXTENSION = ".idm";
+constexpr auto TLOG_INDEX_BUILD = __DATE__ " " __TIME__;
+
+void TlogIndex::makePath( const char* tlogPath, const char* extension, char* path )
+{
+	// Same name as the log with the extension replaced
+	strncpy( path, tlogPath, TLOG_INDEX_PATH_SIZE - 1 );
+	path[TLOG_INDEX_PATH_SIZE - 1] = 0;
+
+	char* tlogExtension = strrchr( path, '.' );
+	size_t baseLength = tlogExtension != NULL && strchr( tlogExtension, '/' ) == NULL ? (size_t)(tlogExtension - path) : strlen( path );
+	baseLength = min( baseLength, (size_t)(TLOG_INDEX_PATH_SIZE - strlen( extension ) - 1) );
+	strcpy( path + baseLength, extension );
+}
+
+bool TlogIndex::open( const char* tlogPath, uint32_t tlogSize, uint16_t snapshotSize, uint32_t snapshotKey )
+{
+	makePath( tlogPath, TLOG_INDEX_EXTENSION, _path );
+	makePath( tlogPath, TLOG_INDEX_MISSION_EXTENSION, _missionPath );
+
+	memset( &_header, 0, sizeof( TlogIndexHeader ) );
+	_header.magic = TLOG_INDEX_MAGIC;
+	_header.version = TLOG_INDEX_VERSION;
+	_header.snapshotSize = snapshotSize;
+	_header.snapshotKey = snapshotKey;
+	_header.tlogSize = tlogSize;
+	_header.intervalMilliseconds = TLOG_INDEX_INTERVAL_MILLISECONDS;
+	strncpy( _header.build, TLOG_INDEX_BUILD, TLOG_INDEX_BUILD_SIZE - 1 );
+
+	if ( snapshotSize > TLOG_SNAPSHOT_CAPACITY || !SD.exists( _path ) )
+	{
+		return false;
+	}
+
+	_file = SD.open( _path, FILE_READ );
+
+	TlogIndexHeader stored;
+
+	if ( !_file || _file.read( &stored, sizeof( TlogIndexHeader ) ) != sizeof( TlogIndexHeader ) )
+	{
+		_file.close();
+		return false;
+	}
+
+	_header.entryCount = stored.entryCount;
+	_header.complete = stored.complete;
+
+	// Anything but the entries differing means the log, the firmware or the settings changed since the index was built
+	if ( stored.complete == 0 || memcmp( &stored, &_header, sizeof( TlogIndexHeader ) ) != 0 )
+	{
+		Log.trace( "Tlog index %s is out of date", _path );
+		_file.close();
+		return false;
+	}
+
+	Log.trace( "Tlog index %s has %u entries", _path, _header.entryCount );
+
+	return true;
+}
+
+bool TlogIndex::readEntry( uint32_t index, TlogIndexEntry* entry )
+{
+	uint32_t offset = sizeof( TlogIndexHeader ) + index * (sizeof( TlogIndexEntry ) + _header.snapshotSize);
+
+	return _file.seek( offset ) && _file.read( entry, sizeof( TlogIndexEntry ) ) == sizeof( TlogIndexEntry );
+}
+
+bool TlogIndex::find( uint32_t missionTimeMilliseconds, TlogIndexEntry* entry, uint8_t* snapshot )
+{
+	if ( !_file || _building || _header.entryCount == 0 )
+	{
+		return false;
+	}
+
+	// Last entry at or before the mission time
+	uint32_t low = 0;
+	uint32_t high = _header.entryCount;
+	TlogIndexEntry probe;
+
+	while ( low < high )
+	{
+		uint32_t middle = low + (high - low) / 2;
+
+		if ( !readEntry( middle, &probe ) )
+		{
+			return false;
+		}
+
+		if ( probe.missionTimeMilliseconds <= missionTimeMilliseconds )
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	if ( low == 0 )
+	{
+		return false;
+	}
+
+	return readEntry( low - 1, entry ) && _file.read( snapshot, _header.snapshotSize ) == _header.snapshotSize;
+}
+
+bool TlogIndex::beginBuild()
+{
+	_file.close();
+	SD.remove( _path );
+	_file = SD.open( _path, FILE_WRITE );
+
+	if ( !_file )
+	{
+		Log.error( "Could not create tlog index %s", _path );
+		return false;
+	}
+
+	// Without the mission file the entries are still written, a replay from them starts without the mission
+	_missionFile.close();
+	SD.remove( _missionPath );
+	_missionFile = SD.open( _missionPath, FILE_WRITE );
+	_missionRecords = 0;
+
+	if ( !_missionFile )
+	{
+		Log.error( "Could not create tlog mission file %s", _missionPath );
+	}
+
+	_header.entryCount = 0;
+	_header.complete = 0;
+	_file.write( (const uint8_t*)&_header, sizeof( TlogIndexHeader ) );
+
+	_building = true;
+	_buildCycles = 0;
+	_worstAddCycles = 0;
+
+	Log.trace( "Building tlog index %s", _path );
+
+	return true;
+}
+
+void TlogIndex::add( const TlogIndexEntry& entry, const uint8_t* snapshot )
+{
+	if ( !_building )
+	{
+		return;
+	}
+
+	uint32_t startCycles = ARM_DWT_CYCCNT;
+
+	_file.write( (const uint8_t*)&entry, sizeof( TlogIndexEntry ) );
+	_file.write( snapshot, _header.snapshotSize );
+	_header.entryCount++;
+
+	uint32_t cycles = ARM_DWT_CYCCNT - startCycles;
+
+	_buildCycles += cycles;
+
+	if ( cycles > _worstAddCycles )
+	{
+		_worstAddCycles = cycles;
+	}
+}
+
+uint32_t TlogIndex::addMission( SaveMissionCallback saveMission )
+{
+	if ( !_building || !_missionFile )
+	{
+		return TLOG_INDEX_NO_MISSION;
+	}
+
+	uint32_t startCycles = ARM_DWT_CYCCNT;
+	uint32_t missionOffset = _missionFile.position();
+
+	if ( !saveMission( &_missionFile ) )
+	{
+		// The next record overwrites what was written of this one
+		Log.error( "Could not write the mission to %s", _missionPath );
+		_missionFile.seek( missionOffset );
+		return TLOG_INDEX_NO_MISSION;
+	}
+
+	_missionRecords++;
+	_buildCycles += ARM_DWT_CYCCNT - startCycles;
+
+	return missionOffset;
+}
+
+bool TlogIndex::restoreMission( uint32_t missionOffset, RestoreMissionCallback restoreMission )
+{
+	File missionFile = SD.open( _missionPath, FILE_READ );
+	bool restored = missionFile && missionFile.seek( missionOffset ) && restoreMission( &missionFile );
+
+	missionFile.close();
+
+	return restored;
+}
+
+void TlogIndex::finishBuild()
+{
+	if ( !_building )
+	{
+		return;
+	}
+
+	_building = false;
+	_header.complete = 1;
+	_file.seek( 0 );
+	_file.write( (const uint8_t*)&_header, sizeof( TlogIndexHeader ) );
+	_file.close();
+
+	if ( _missionFile )
+	{
+		Log.trace( "Tlog mission file %s: %u missions, %u bytes", _missionPath, _missionRecords, _missionFile.position() );
+		_missionFile.close();
+	}
+
+	Log.trace( "Tlog index %s: %u entries, %u bytes for %u bytes of log, %u cycles per entry, %u cycles at most",
+		_path,
+		_header.entryCount,
+		(uint32_t)(sizeof( TlogIndexHeader ) + _header.entryCount * (sizeof( TlogIndexEntry ) + _header.snapshotSize)),
+		_header.tlogSize,
+		_header.entryCount == 0 ? 0 : (uint32_t)(_buildCycles / _header.entryCount),
+		_worstAddCycles );
+}
+
+bool TlogIndex::isBuilding()
+{
+	return _building;
+}
@@ -0,0 +1,139 @@
+// TlogIndex.h
+
+#ifndef _TLOGINDEX_h
+#define _TLOGINDEX_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include <SD.h>
+
+constexpr uint32_t TLOG_INDEX_MAGIC = 0x58494252;                 ///< "RBIX"
+constexpr uint16_t TLOG_INDEX_VERSION = 4;                        ///< Change when the index layout changes
+constexpr uint32_t TLOG_INDEX_INTERVAL_MILLISECONDS = 10000;      ///< Mission time between two index entries
+constexpr uint16_t TLOG_SNAPSHOT_CAPACITY = 2048;                 ///< Largest snapshot an index entry can hold
+constexpr uint8_t TLOG_INDEX_PATH_SIZE = 40;                      ///< Longest index file name including terminator
+constexpr uint8_t TLOG_INDEX_BUILD_SIZE = 24;                     ///< Room for the date and time the firmware was built
+constexpr uint32_t TLOG_INDEX_NO_MISSION = UINT32_MAX;            ///< Mission offset of an entry that has no mission record
+
+typedef bool (*SaveMissionCallback)( File* file );
+typedef bool (*RestoreMissionCallback)( File* file );              ///< Returns false if the mission couldn't be read
+
+/**
+ * @brief The header at the start of an index file. The index is only used for the log, the snapshot layout and the settings it was built with.
+*/
+struct __attribute__( (packed) ) TlogIndexHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t snapshotSize;
+	uint32_t snapshotKey;              ///< Settings the snapshots were taken under
+	uint32_t tlogSize;
+	uint32_t intervalMilliseconds;
+	uint32_t entryCount;
+	uint8_t complete;                  ///< Set once the whole log was replayed, an interrupted build isn't used
+	char build[TLOG_INDEX_BUILD_SIZE]; ///< Firmware the snapshots were taken by
+};
+
+/**
+ * @brief An index entry, followed in the file by the snapshot.
+*/
+struct __attribute__( (packed) ) TlogIndexEntry
+{
+	uint32_t missionTimeMilliseconds;
+	uint32_t fileOffset;               ///< Offset of the first byte after the last message the snapshot includes
+	uint32_t clockAnchorMilliseconds;  ///< Mission time the tlog timestamps are counted from, 0 if there are no timestamps
+	uint64_t clockAnchorMicroseconds;  ///< Tlog timestamp of that mission time
+	uint8_t flightControllerSystemId;  ///< The flight controller found by its heartbeat, 0 if it wasn't found yet
+	uint8_t flightControllerComponentId;
+	uint32_t missionOffset;            ///< Offset of the mission record in the mission file, TLOG_INDEX_NO_MISSION if there is none
+};
+
+/**
+ * @brief TlogIndex keeps an index file next to a telemetry log, with the file offset, the mission time and a snapshot of the mission
+ * monitor every TLOG_INDEX_INTERVAL_MILLISECONDS of mission time. The index is written while the log is replayed from the start,
+ * and afterwards a replay can start at any mission time from the entry before it. The entries have a fixed size and are
+ * ordered by mission time, so an entry is found with a binary search on the SD card.
+ * The mission downloaded from the flight controller is too large to copy into every entry. It is written to a second file, with the
+ * extension idm, only when it changed since the last entry, and each entry points at the mission record it was taken with.
+*/
+class TlogIndex
+{
+public:
+	/**
+	 * @brief Open the index of a log.
+	 * @param tlogPath The log, the index has the same name with the extension idx.
+	 * @param tlogSize The size of the log.
+	 * @param snapshotSize The size of a snapshot.
+	 * @param snapshotKey The settings the snapshots are taken under.
+	 * @return True if there is a complete index for this log, snapshot and settings.
+	*/
+	bool open( const char* tlogPath, uint32_t tlogSize, uint16_t snapshotSize, uint32_t snapshotKey );
+
+	/**
+	 * @brief Find the last entry at or before a mission time.
+	 * @param missionTimeMilliseconds The mission time.
+	 * @param entry Receives the entry.
+	 * @param snapshot Receives the snapshot.
+	 * @return False if the index has no entry that early.
+	*/
+	bool find( uint32_t missionTimeMilliseconds, TlogIndexEntry* entry, uint8_t* snapshot );
+
+	/**
+	 * @brief Start a new index, replacing the one there is.
+	 * @return False if the index file can't be written.
+	*/
+	bool beginBuild();
+
+	/**
+	 * @brief Append an entry.
+	 * @param entry The entry.
+	 * @param snapshot The snapshot.
+	*/
+	void add( const TlogIndexEntry& entry, const uint8_t* snapshot );
+
+	/**
+	 * @brief Append a mission record to the mission file.
+	 * @param saveMission Writes the mission.
+	 * @return The offset of the record for the entries taken with it, TLOG_INDEX_NO_MISSION if it couldn't be written.
+	*/
+	uint32_t addMission( SaveMissionCallback saveMission );
+
+	/**
+	 * @brief Read the mission record of an entry.
+	 * @param missionOffset The mission offset of the entry.
+	 * @param restoreMission Reads the mission.
+	 * @return False if the record couldn't be read.
+	*/
+	bool restoreMission( uint32_t missionOffset, RestoreMissionCallback restoreMission );
+
+	/**
+	 * @brief Mark the index complete, once the whole log was replayed, and write the cost of building it to the log.
+	*/
+	void finishBuild();
+
+	bool isBuilding();
+
+private:
+	bool readEntry( uint32_t index, TlogIndexEntry* entry );
+
+	/**
+	 * @brief Give the path of the log with its extension replaced.
+	*/
+	static void makePath( const char* tlogPath, const char* extension, char* path );
+
+	char _path[TLOG_INDEX_PATH_SIZE];
+	char _missionPath[TLOG_INDEX_PATH_SIZE];
+	File _file;
+	File _missionFile;
+	uint32_t _missionRecords = 0;
+	TlogIndexHeader _header;
+	bool _building = false;
+	uint64_t _buildCycles = 0;
+	uint32_t _worstAddCycles = 0;
+};
+
+#endif
@@ -0,0 +1,217 @@
+//
+//
+//
+
+#include "TrafficGenerator.h"
+
+/**
+ * @brief One round of the messages sent, in the proportions of the streams a rover sends by default.
+*/
+constexpr uint32_t TRAFFIC_MIX[] = {
+	MAVLINK_MSG_ID_HEARTBEAT,
+	MAVLINK_MSG_ID_GLOBAL_POSITION_INT,
+	MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT,
+	MAVLINK_MSG_ID_GPS_RAW_INT,
+	MAVLINK_MSG_ID_GLOBAL_POSITION_INT,
+	MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT,
+	MAVLINK_MSG_ID_MISSION_CURRENT,
+	MAVLINK_MSG_ID_GPS2_RAW,
+	MAVLINK_MSG_ID_SYSTEM_TIME
+};
+
+constexpr uint8_t TRAFFIC_MIX_COUNT = sizeof( TRAFFIC_MIX ) / sizeof( TRAFFIC_MIX[0] );
+constexpr uint8_t TRAFFIC_FOREIGN_COUNT = sizeof( TRAFFIC_FOREIGN_SYSTEM_IDS ) / sizeof( TRAFFIC_FOREIGN_SYSTEM_IDS[0] );
+
+void TrafficGenerator::begin( HardwareSerial* serial, uint32_t seed, uint32_t baudRate )
+{
+	_serial = serial;
+	_randomState = seed != 0 ? seed : 1;
+	_serial->begin( baudRate, SERIAL_8N1 );
+	_serial->addMemoryForWrite( _writeBuffer, TRAFFIC_WRITE_BUFFER_SIZE );
+}
+
+void TrafficGenerator::setLoad( const TrafficLoad& load )
+{
+	_load = load;
+	_load.burstMessages = max( _load.burstMessages, (uint8_t)1 );
+	_counters = TrafficCounters();
+	_loadStartMicroseconds = micros();
+}
+
+const TrafficCounters& TrafficGenerator::getCounters()
+{
+	return _counters;
+}
+
+void TrafficGenerator::tick()
+{
+	if ( _serial == NULL || _load.messagesPerSecond == 0 )
+	{
+		return;
+	}
+
+	// Messages due since the load started, rounded down to whole bursts
+	uint32_t elapsedMicroseconds = micros() - _loadStartMicroseconds;
+	uint32_t due = (uint64_t)elapsedMicroseconds * _load.messagesPerSecond / 1000000;
+	due -= due % _load.burstMessages;
+
+	while ( _counters.messagesOffered < due )
+	{
+		_counters.messagesOffered++;
+		sendMessage();
+	}
+}
+
+void TrafficGenerator::sendMessage()
+{
+	uint8_t systemId = TRAFFIC_SYSTEM_ID;
+	uint8_t componentId = MAV_COMP_ID_AUTOPILOT1;
+	mavlink_channel_t channel = TRAFFIC_CHANNEL;
+
+	if ( random() % 100 < _load.foreignPercent )
+	{
+		uint8_t foreign = random() % TRAFFIC_FOREIGN_COUNT;
+
+		// Each foreign system counts its own sequence numbers
+		systemId = TRAFFIC_FOREIGN_SYSTEM_IDS[foreign];
+		channel = (mavlink_channel_t)(TRAFFIC_FOREIGN_CHANNEL + foreign);
+	}
+
+	mavlink_message_t message;
+	uint32_t msgid = TRAFFIC_MIX[_mixIndex];
+	_mixIndex = (_mixIndex + 1) % TRAFFIC_MIX_COUNT;
+
+	switch ( msgid )
+	{
+		case MAVLINK_MSG_ID_HEARTBEAT:
+			{
+				// A rover in manual mode, the mission monitor watches it without acting on a mission
+				mavlink_heartbeat_t heartbeat = {};
+				heartbeat.type = MAV_TYPE_GROUND_ROVER;
+				heartbeat.autopilot = MAV_AUTOPILOT_ARDUPILOTMEGA;
+				heartbeat.base_mode = MAV_MODE_FLAG_CUSTOM_MODE_ENABLED;
+				heartbeat.custom_mode = ROVER_MODE_MANUAL;
+				heartbeat.system_status = MAV_STATE_STANDBY;
+				mavlink_msg_heartbeat_encode_chan( systemId, componentId, channel, &message, &heartbeat );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
+			{
+				mavlink_global_position_int_t globalPositionInt = {};
+				globalPositionInt.time_boot_ms = millis();
+				globalPositionInt.lat = 473977420 + (int32_t)(random() % 100);
+				globalPositionInt.lon = 85455940 + (int32_t)(random() % 100);
+				globalPositionInt.hdg = random() % 36000;
+				mavlink_msg_global_position_int_encode_chan( systemId, componentId, channel, &message, &globalPositionInt );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT:
+			{
+				mavlink_nav_controller_output_t navControllerOutput = {};
+				navControllerOutput.wp_dist = random() % 100;
+				navControllerOutput.target_bearing = random() % 360;
+				navControllerOutput.nav_bearing = navControllerOutput.target_bearing;
+				mavlink_msg_nav_controller_output_encode_chan( systemId, componentId, channel, &message, &navControllerOutput );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_GPS_RAW_INT:
+			{
+				mavlink_gps_raw_int_t gpsRawInt = {};
+				gpsRawInt.time_usec = micros();
+				gpsRawInt.fix_type = GPS_FIX_TYPE_RTK_FIXED;
+				gpsRawInt.satellites_visible = 20;
+				mavlink_msg_gps_raw_int_encode_chan( systemId, componentId, channel, &message, &gpsRawInt );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_GPS2_RAW:
+			{
+				mavlink_gps2_raw_t gps2Raw = {};
+				gps2Raw.time_usec = micros();
+				gps2Raw.fix_type = GPS_FIX_TYPE_RTK_FLOAT;
+				gps2Raw.satellites_visible = 18;
+				mavlink_msg_gps2_raw_encode_chan( systemId, componentId, channel, &message, &gps2Raw );
+			}
+			break;
+
+		case MAVLINK_MSG_ID_MISSION_CURRENT:
+			{
+				mavlink_mission_current_t missionCurrent = {};
+				mavlink_msg_mission_current_encode_chan( systemId, componentId, channel, &message, &missionCurrent );
+			}
+			break;
+
+		default:
+			{
+				// The latency probe, the receiver compares the time it was written with its own clock
+				mavlink_system_time_t systemTime = {};
+				systemTime.time_unix_usec = micros();
+				systemTime.time_boot_ms = millis();
+				mavlink_msg_system_time_encode_chan( systemId, componentId, channel, &message, &systemTime );
+			}
+			break;
+	}
+
+	uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
+	uint16_t length = mavlink_msg_to_send_buffer( buffer, &message );
+	bool intact = systemId == TRAFFIC_SYSTEM_ID;
+
+	if ( _load.truncationPercent > 0 && random() % 100 < _load.truncationPercent )
+	{
+		length = 1 + random() % (length - 1);
+		_counters.framesTruncated++;
+		intact = false;
+	}
+
+	if ( _load.corruptionPerMillion > 0 )
+	{
+		bool corrupted = false;
+
+		for ( uint16_t i = 0; i < length; i++ )
+		{
+			if ( random() % 1000000 < _load.corruptionPerMillion )
+			{
+				buffer[i] ^= 1 << (random() & 7);
+				corrupted = true;
+			}
+		}
+
+		if ( corrupted )
+		{
+			_counters.framesCorrupted++;
+			intact = false;
+		}
+	}
+
+	// Writing more than fits would block the loop, a frame that doesn't fit is counted as the port being saturated
+	if ( _serial->availableForWrite() < length )
+	{
+		_counters.messagesBlocked++;
+		return;
+	}
+
+	_serial->write( buffer, length );
+	_counters.framesSent++;
+	_counters.bytesSent += length;
+
+	if ( systemId != TRAFFIC_SYSTEM_ID )
+	{
+		_counters.framesForeign++;
+	}
+	else if ( intact )
+	{
+		_counters.framesIntact++;
+	}
+}
+
+uint32_t TrafficGenerator::random()
+{
+	// xorshift32, the same seed gives the same traffic
+	_randomState ^= _randomState << 13;
+	_randomState ^= _randomState >> 17;
+	_randomState ^= _randomState << 5;
+	return _randomState;
+}
@@ -0,0 +1,91 @@
+// TrafficGenerator.h
+
+#ifndef _TRAFFICGENERATOR_h
+#define _TRAFFICGENERATOR_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include "MAVLinkDialect.h"
+
+constexpr uint8_t TRAFFIC_SYSTEM_ID = 1;                          ///< Sent as the flight controller
+constexpr uint8_t TRAFFIC_FOREIGN_SYSTEM_IDS[] = { 2, 255 };     ///< Other systems on a shared link, another vehicle and a ground station
+constexpr mavlink_channel_t TRAFFIC_CHANNEL = MAVLINK_COMM_1;     ///< Sequence numbers of the flight controller, the reader parses on channel 0
+constexpr mavlink_channel_t TRAFFIC_FOREIGN_CHANNEL = MAVLINK_COMM_2;   ///< First of the channels of the foreign systems, one each
+constexpr size_t TRAFFIC_WRITE_BUFFER_SIZE = 1024;                ///< Extra transmit buffer so a burst can be queued at once
+
+/**
+ * @brief The load the generator puts on the link.
+*/
+struct TrafficLoad
+{
+	uint32_t messagesPerSecond = 0;
+	uint8_t burstMessages = 1;           ///< Messages written back to back, the rate is kept on average
+	uint32_t corruptionPerMillion = 0;   ///< Chance of each byte getting a bit flipped
+	uint8_t truncationPercent = 0;       ///< Chance of a frame being cut short
+	uint8_t foreignPercent = 0;          ///< Share of frames sent from the foreign systems
+};
+
+/**
+ * @brief Counters of what the generator sent.
+*/
+struct TrafficCounters
+{
+	uint32_t messagesOffered = 0;        ///< Messages due at the rate asked for
+	uint32_t messagesBlocked = 0;        ///< Due messages that didn't fit the transmit buffer, the port is saturated
+	uint32_t framesSent = 0;
+	uint32_t framesIntact = 0;           ///< Sent from the flight controller without corruption or truncation
+	uint32_t framesCorrupted = 0;
+	uint32_t framesTruncated = 0;
+	uint32_t framesForeign = 0;
+	uint32_t bytesSent = 0;
+};
+
+/**
+ * @brief TrafficGenerator writes MAVLink frames to a serial port, as a stand-in for the flight controller when the port is wired back
+ * to the port the reader listens on. The frames are a mix of the messages Restraining Bolt handles, in the proportions a rover sends
+ * them, at a rate and in bursts that are set per load. Bytes can be corrupted, frames cut short and frames from other systems mixed in.
+ * A SYSTEM_TIME frame carries the time it was written in time_unix_usec, so the latency to its handler can be measured.
+ * The random choices come from a seeded generator, the same seed gives the same traffic.
+*/
+class TrafficGenerator
+{
+public:
+	/**
+	 * @brief Start writing to a serial port.
+	 * @param serial The port.
+	 * @param seed Seed of the random choices.
+	 * @param baudRate The speed of the port, the same as the port it is wired to.
+	*/
+	void begin( HardwareSerial* serial, uint32_t seed, uint32_t baudRate );
+
+	/**
+	 * @brief Change the load and start counting again.
+	 * @param load The load, 0 messages per second stops the traffic.
+	*/
+	void setLoad( const TrafficLoad& load );
+
+	/**
+	 * @brief Write the frames that are due.
+	*/
+	void tick();
+
+	const TrafficCounters& getCounters();
+
+private:
+	void sendMessage();
+	uint32_t random();
+
+	HardwareSerial* _serial = NULL;
+	TrafficLoad _load;
+	TrafficCounters _counters;
+	uint32_t _loadStartMicroseconds = 0;
+	uint32_t _randomState = 1;
+	uint8_t _mixIndex = 0;
+	uint8_t _writeBuffer[TRAFFIC_WRITE_BUFFER_SIZE];
+};
+
+#endif
@@ -0,0 +1,305 @@
+//
+//
+//
+
+#include "WaypointStore.h"
+
+/**
+ * @brief The counts in front of a mission saved to a file, the tables follow with as many entries as the mission uses.
+*/
+struct __attribute__( (packed) ) WaypointStoreRecord
+{
+	uint16_t count;
+	uint16_t validCount;
+	uint16_t overflowCount;
+};
+
+static bool writeTable( File* file, const void* table, size_t size )
+{
+	return file->write( (const uint8_t*)table, size ) == size;
+}
+
+static bool readTable( File* file, void* table, size_t size )
+{
+	return size == 0 || file->read( table, size ) == (int)size;
+}
+
+WaypointStore::WaypointStore()
+{
+	reset( 0 );
+}
+
+void WaypointStore::reset( uint16_t count )
+{
+	_count = min( count, WAYPOINT_STORE_CAPACITY );
+	_validCount = 0;
+	_overflowCount = 0;
+	_generation++;
+
+	memset( _flags, 0, sizeof( _flags ) );
+	memset( _keyframeValid, 0, sizeof( _keyframeValid ) );
+}
+
+bool WaypointStore::set( uint16_t seq, bool hasPosition, int32_t latitude, int32_t longitude, WAYPOINT_COMMAND command )
+{
+	if ( seq >= _count )
+	{
+		return false;
+	}
+
+	int32_t oldLatitude = 0;
+	int32_t oldLongitude = 0;
+	bool wasValid = _flags[seq] & WAYPOINT_VALID;
+	bool hadPosition = getPosition( seq, &oldLatitude, &oldLongitude );
+	bool stored = true;
+
+	if ( !wasValid )
+	{
+		_validCount++;
+	}
+
+	if ( hasPosition )
+	{
+		stored = encode( seq, latitude, longitude, hadPosition && _latitudeDeltas[seq] == WAYPOINT_DELTA_OVERFLOW );
+	}
+	else
+	{
+		_flags[seq] = WAYPOINT_VALID;
+	}
+
+	switch ( command )
+	{
+		case WAYPOINT_COMMAND_HOLD:
+			_flags[seq] |= WAYPOINT_HOLD;
+			break;
+		case WAYPOINT_COMMAND_SPEED_ZERO:
+			_flags[seq] |= WAYPOINT_SPEED_ZERO;
+			break;
+		case WAYPOINT_COMMAND_SPEED_SET:
+			_flags[seq] |= WAYPOINT_SPEED_SET;
+			break;
+		default:
+			break;
+	}
+
+	// The same item sent again, e.g. to a ground station, leaves everything built from the mission up to date
+	int32_t newLatitude = 0;
+	int32_t newLongitude = 0;
+	bool hasNewPosition = getPosition( seq, &newLatitude, &newLongitude );
+
+	if ( !wasValid || hadPosition != hasNewPosition || oldLatitude != newLatitude || oldLongitude != newLongitude )
+	{
+		_generation++;
+	}
+
+	return stored;
+}
+
+bool WaypointStore::encode( uint16_t seq, int32_t latitude, int32_t longitude, bool wasOverflow )
+{
+	uint16_t keyframe = seq / WAYPOINT_KEYFRAME_INTERVAL;
+
+	_flags[seq] = WAYPOINT_VALID;
+
+	if ( !(_keyframeValid[keyframe / 32] & (1UL << (keyframe % 32))) )
+	{
+		_keyframeLatitudes[keyframe] = latitude;
+		_keyframeLongitudes[keyframe] = longitude;
+		_keyframeValid[keyframe / 32] |= 1UL << (keyframe % 32);
+	}
+
+	// Round to the nearest delta unit
+	int32_t latitudeDelta = latitude - _keyframeLatitudes[keyframe];
+	int32_t longitudeDelta = longitude - _keyframeLongitudes[keyframe];
+	latitudeDelta = (latitudeDelta + (latitudeDelta < 0 ? -WAYPOINT_DELTA_SCALE : WAYPOINT_DELTA_SCALE) / 2) / WAYPOINT_DELTA_SCALE;
+	longitudeDelta = (longitudeDelta + (longitudeDelta < 0 ? -WAYPOINT_DELTA_SCALE : WAYPOINT_DELTA_SCALE) / 2) / WAYPOINT_DELTA_SCALE;
+
+	if ( latitudeDelta > WAYPOINT_DELTA_OVERFLOW && latitudeDelta <= INT16_MAX &&
+		longitudeDelta >= INT16_MIN && longitudeDelta <= INT16_MAX )
+	{
+		_latitudeDeltas[seq] = latitudeDelta;
+		_longitudeDeltas[seq] = longitudeDelta;
+		_flags[seq] |= WAYPOINT_POSITION;
+
+		return true;
+	}
+
+	// An item sent again keeps its overflow entry
+	uint16_t overflowIndex = wasOverflow ? _longitudeDeltas[seq] : _overflowCount;
+
+	if ( overflowIndex >= WAYPOINT_OVERFLOW_CAPACITY )
+	{
+		return false;
+	}
+
+	if ( !wasOverflow )
+	{
+		_overflowCount++;
+	}
+
+	_overflowLatitudes[overflowIndex] = latitude;
+	_overflowLongitudes[overflowIndex] = longitude;
+	_latitudeDeltas[seq] = WAYPOINT_DELTA_OVERFLOW;
+	_longitudeDeltas[seq] = overflowIndex;
+	_flags[seq] |= WAYPOINT_POSITION;
+
+	return true;
+}
+
+bool WaypointStore::isValid( uint16_t seq )
+{
+	return seq < _count && (_flags[seq] & WAYPOINT_VALID);
+}
+
+bool WaypointStore::getPosition( uint16_t seq, int32_t* latitude, int32_t* longitude )
+{
+	if ( seq >= _count || !(_flags[seq] & WAYPOINT_POSITION) )
+	{
+		return false;
+	}
+
+	if ( _latitudeDeltas[seq] == WAYPOINT_DELTA_OVERFLOW )
+	{
+		*latitude = _overflowLatitudes[_longitudeDeltas[seq]];
+		*longitude = _overflowLongitudes[_longitudeDeltas[seq]];
+	}
+	else
+	{
+		uint16_t keyframe = seq / WAYPOINT_KEYFRAME_INTERVAL;
+
+		*latitude = _keyframeLatitudes[keyframe] + _latitudeDeltas[seq] * WAYPOINT_DELTA_SCALE;
+		*longitude = _keyframeLongitudes[keyframe] + _longitudeDeltas[seq] * WAYPOINT_DELTA_SCALE;
+	}
+
+	return true;
+}
+
+bool WaypointStore::findPrevious( uint16_t seq, uint16_t* previousSeq )
+{
+	for ( uint16_t i = min( seq, _count ); i > 0; i-- )
+	{
+		if ( _flags[i - 1] & WAYPOINT_POSITION )
+		{
+			*previousSeq = i - 1;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+uint16_t WaypointStore::findMissing( uint16_t seq )
+{
+	if ( _validCount == _count )
+	{
+		return _count;
+	}
+
+	for ( uint16_t i = 0; i < _count; i++ )
+	{
+		uint16_t candidate = (seq + i) % _count;
+
+		if ( !(_flags[candidate] & WAYPOINT_VALID) )
+		{
+			return candidate;
+		}
+	}
+
+	return _count;
+}
+
+bool WaypointStore::isHolding( uint16_t seq )
+{
+	if ( seq >= _count )
+	{
+		return false;
+	}
+
+	if ( _flags[seq] & WAYPOINT_HOLD )
+	{
+		return true;
+	}
+
+	// Speed changes are done before the rover moves on to the next item, the last one before this item is in force
+	for ( uint16_t i = seq; i > 0; i-- )
+	{
+		if ( _flags[i - 1] & (WAYPOINT_SPEED_ZERO | WAYPOINT_SPEED_SET) )
+		{
+			return (_flags[i - 1] & WAYPOINT_SPEED_ZERO) != 0;
+		}
+	}
+
+	return false;
+}
+
+uint16_t WaypointStore::getCount()
+{
+	return _count;
+}
+
+uint16_t WaypointStore::getValidCount()
+{
+	return _validCount;
+}
+
+bool WaypointStore::isComplete()
+{
+	return _validCount == _count;
+}
+
+uint32_t WaypointStore::getGeneration()
+{
+	return _generation;
+}
+
+bool WaypointStore::save( File* file )
+{
+	WaypointStoreRecord record = { _count, _validCount, _overflowCount };
+	uint16_t keyframes = (_count + WAYPOINT_KEYFRAME_INTERVAL - 1) / WAYPOINT_KEYFRAME_INTERVAL;
+
+	return writeTable( file, &record, sizeof( WaypointStoreRecord ) ) &&
+		writeTable( file, _flags, _count * sizeof( _flags[0] ) ) &&
+		writeTable( file, _latitudeDeltas, _count * sizeof( _latitudeDeltas[0] ) ) &&
+		writeTable( file, _longitudeDeltas, _count * sizeof( _longitudeDeltas[0] ) ) &&
+		writeTable( file, _keyframeLatitudes, keyframes * sizeof( _keyframeLatitudes[0] ) ) &&
+		writeTable( file, _keyframeLongitudes, keyframes * sizeof( _keyframeLongitudes[0] ) ) &&
+		writeTable( file, _keyframeValid, (keyframes + 31) / 32 * sizeof( _keyframeValid[0] ) ) &&
+		writeTable( file, _overflowLatitudes, _overflowCount * sizeof( _overflowLatitudes[0] ) ) &&
+		writeTable( file, _overflowLongitudes, _overflowCount * sizeof( _overflowLongitudes[0] ) );
+}
+
+bool WaypointStore::restore( File* file )
+{
+	WaypointStoreRecord record;
+
+	if ( !readTable( file, &record, sizeof( WaypointStoreRecord ) ) ||
+		record.count > WAYPOINT_STORE_CAPACITY || record.validCount > record.count || record.overflowCount > WAYPOINT_OVERFLOW_CAPACITY )
+	{
+		reset( 0 );
+		return false;
+	}
+
+	// The tables past the end of the mission are left cleared, as reset() leaves them
+	reset( record.count );
+
+	uint16_t keyframes = (_count + WAYPOINT_KEYFRAME_INTERVAL - 1) / WAYPOINT_KEYFRAME_INTERVAL;
+	bool restored = readTable( file, _flags, _count * sizeof( _flags[0] ) ) &&
+		readTable( file, _latitudeDeltas, _count * sizeof( _latitudeDeltas[0] ) ) &&
+		readTable( file, _longitudeDeltas, _count * sizeof( _longitudeDeltas[0] ) ) &&
+		readTable( file, _keyframeLatitudes, keyframes * sizeof( _keyframeLatitudes[0] ) ) &&
+		readTable( file, _keyframeLongitudes, keyframes * sizeof( _keyframeLongitudes[0] ) ) &&
+		readTable( file, _keyframeValid, (keyframes + 31) / 32 * sizeof( _keyframeValid[0] ) ) &&
+		readTable( file, _overflowLatitudes, record.overflowCount * sizeof( _overflowLatitudes[0] ) ) &&
+		readTable( file, _overflowLongitudes, record.overflowCount * sizeof( _overflowLongitudes[0] ) );
+
+	if ( !restored )
+	{
+		reset( 0 );
+		return false;
+	}
+
+	_validCount = record.validCount;
+	_overflowCount = record.overflowCount;
+
+	return true;
+}
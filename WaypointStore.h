@@ -0,0 +1,155 @@
+// WaypointStore.h
+
+#ifndef _WAYPOINTSTORE_h
+#define _WAYPOINTSTORE_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#include <SD.h>
+
+constexpr uint16_t WAYPOINT_STORE_CAPACITY = 10000;      ///< Largest mission that can be held, enough for mowing and survey patterns
+constexpr uint16_t WAYPOINT_KEYFRAME_INTERVAL = 32;      ///< Waypoints that share one full resolution keyframe
+constexpr uint16_t WAYPOINT_KEYFRAMES = (WAYPOINT_STORE_CAPACITY + WAYPOINT_KEYFRAME_INTERVAL - 1) / WAYPOINT_KEYFRAME_INTERVAL;
+constexpr int32_t WAYPOINT_DELTA_SCALE = 32;             ///< 1e-7 degrees per delta unit, about 36 cm, so deltas reach about 11.7 km from the keyframe
+constexpr int16_t WAYPOINT_DELTA_OVERFLOW = INT16_MIN;   ///< Latitude delta marking a waypoint kept in the overflow table
+constexpr uint16_t WAYPOINT_OVERFLOW_CAPACITY = 256;     ///< Waypoints too far from their keyframe, kept at full resolution
+
+/**
+ * @brief What a mission item makes the rover do besides driving to its position, as far as the progress checks care.
+*/
+enum WAYPOINT_COMMAND : uint8_t
+{
+	WAYPOINT_COMMAND_DRIVE,        ///< Drives on, or a command that doesn't change the speed
+	WAYPOINT_COMMAND_HOLD,         ///< Holds at the item on purpose, a loiter or a delay
+	WAYPOINT_COMMAND_SPEED_ZERO,   ///< Sets the ground speed to zero
+	WAYPOINT_COMMAND_SPEED_SET     ///< Sets the ground speed to something other than zero
+};
+
+/**
+ * @brief WaypointStore holds the positions of a mission indexed by sequence number.
+ * Every block of WAYPOINT_KEYFRAME_INTERVAL waypoints has one full resolution keyframe, the first position stored in the block.
+ * The other positions are 16 bit deltas from it, so a waypoint costs 5 bytes instead of 12. Waypoints too far from their
+ * keyframe to fit a delta are kept at full resolution in a small overflow table. Waypoints can be stored in any order,
+ * which lets the mission be downloaded out of order and repaired one item at a time.
+*/
+class WaypointStore
+{
+public:
+	WaypointStore();
+
+	/**
+	 * @brief Forget all waypoints and prepare for a mission.
+	 * @param count The number of items in the mission, items beyond the capacity are ignored.
+	*/
+	void reset( uint16_t count );
+
+	/**
+	 * @brief Store a mission item.
+	 * @param seq The sequence number of the item.
+	 * @param hasPosition False for commands that don't go anywhere, their position is ignored.
+	 * @param latitude Latitude in 1e-7 degrees.
+	 * @param longitude Longitude in 1e-7 degrees.
+	 * @param command What the item makes the rover do besides driving to its position.
+	 * @return False if the item is outside the mission or its position couldn't be kept.
+	*/
+	bool set( uint16_t seq, bool hasPosition, int32_t latitude, int32_t longitude, WAYPOINT_COMMAND command = WAYPOINT_COMMAND_DRIVE );
+
+	/**
+	 * @brief Check if an item has been stored.
+	 * @param seq The sequence number of the item.
+	 * @return True if the item was stored since the last reset.
+	*/
+	bool isValid( uint16_t seq );
+
+	/**
+	 * @brief Get the position of an item.
+	 * @param seq The sequence number of the item.
+	 * @param latitude Receives the latitude in 1e-7 degrees.
+	 * @param longitude Receives the longitude in 1e-7 degrees.
+	 * @return False if the item isn't stored or has no position.
+	*/
+	bool getPosition( uint16_t seq, int32_t* latitude, int32_t* longitude );
+
+	/**
+	 * @brief Find the closest item before an item that has a position.
+	 * @param seq The sequence number to search back from.
+	 * @param previousSeq Receives the sequence number found.
+	 * @return False if no earlier item with a position is stored.
+	*/
+	bool findPrevious( uint16_t seq, uint16_t* previousSeq );
+
+	/**
+	 * @brief Find the next item that hasn't been stored, wrapping around the end of the mission.
+	 * @param seq The sequence number to start searching from.
+	 * @return The sequence number of the missing item, or the item count if the mission is complete.
+	*/
+	uint16_t findMissing( uint16_t seq );
+
+	/**
+	 * @brief Check if the rover is meant to stand still while an item is current: the item is a loiter or a delay,
+	 * or the last speed change stored before it set the ground speed to zero.
+	 * @param seq The sequence number of the current item.
+	 * @return True if no progress toward the item is expected.
+	*/
+	bool isHolding( uint16_t seq );
+
+	uint16_t getCount();
+	uint16_t getValidCount();
+	bool isComplete();
+
+	/**
+	 * @brief Get a number that changes every time the store changes, to tell whether something built from the mission is out of date.
+	 * @return The generation of the store.
+	*/
+	uint32_t getGeneration();
+
+	/**
+	 * @brief Write the mission to a file, only the part of the tables the mission uses.
+	 * @param file The file, written at its position.
+	 * @return False if the file couldn't be written.
+	*/
+	bool save( File* file );
+
+	/**
+	 * @brief Replace the mission with one written by save(). The generation changes, so everything built from the mission is rebuilt.
+	 * @param file The file, read at its position.
+	 * @return False if the record couldn't be read, the store is empty then.
+	*/
+	bool restore( File* file );
+
+private:
+	/**
+	 * @brief Keep the position of an item as a delta from its keyframe, or in the overflow table when it is too far away.
+	 * @return False if the overflow table is full.
+	*/
+	bool encode( uint16_t seq, int32_t latitude, int32_t longitude, bool wasOverflow );
+
+	enum WAYPOINT_FLAGS : uint8_t
+	{
+		WAYPOINT_VALID = 0x01,
+		WAYPOINT_POSITION = 0x02,
+		WAYPOINT_HOLD = 0x04,
+		WAYPOINT_SPEED_ZERO = 0x08,
+		WAYPOINT_SPEED_SET = 0x10
+	};
+
+	uint16_t _count = 0;
+	uint16_t _validCount = 0;
+	uint16_t _overflowCount = 0;
+	uint32_t _generation = 0;
+
+	uint8_t _flags[WAYPOINT_STORE_CAPACITY];
+	int16_t _latitudeDeltas[WAYPOINT_STORE_CAPACITY];
+	int16_t _longitudeDeltas[WAYPOINT_STORE_CAPACITY];    ///< Holds the overflow table index for overflow waypoints
+	int32_t _keyframeLatitudes[WAYPOINT_KEYFRAMES];
+	int32_t _keyframeLongitudes[WAYPOINT_KEYFRAMES];
+	uint32_t _keyframeValid[(WAYPOINT_KEYFRAMES + 31) / 32];
+	int32_t _overflowLatitudes[WAYPOINT_OVERFLOW_CAPACITY];
+	int32_t _overflowLongitudes[WAYPOINT_OVERFLOW_CAPACITY];
+};
+
+#endif
@@ -48,6 +48,8 @@
 #include <SerialFlash.h>
 
 #include <ArduinoLog.h>
+#define _TASK_SLEEP_ON_IDLE_RUN // Sleep until the next interrupt after a scheduler pass in which no task ran
+#define _TASK_TIMECRITICAL      // Measure the time spent in the scheduler and asleep
 #include <TaskScheduler.h>
 
   /*
@@ -59,7 +61,21 @@
 #include "EnumHelper.h"
 #include "SerialMAVLinkReader.h"
 #include "FileMAVLinkReader.h"
+#include "DataFlashReader.h"
 #include "MissionMonitor.h"
+#include "MissionDownloader.h"
+#include "MAVLinkEventBus.h"
+#include "StaticMAVLinkReader.h"
+#include "StaticStorage.h"
+#include "MemoryMonitor.h"
+#include "CpuMonitor.h"
+#include "DeadlineMonitor.h"
+#include "SafetyInterrupt.h"
+#include "MissionClock.h"
+#include "TrafficGenerator.h"
+#include "StressHarness.h"
+#include "ThresholdSweep.h"
+#include "FlightControllerSimulator.h"
 
 constexpr int FAILED_NO_SD = -1;
 constexpr int FAILED_NO_TEST_FILE = -2;
@@ -67,9 +83,37 @@ constexpr int FAILED_NO_TEST_FILE = -2;
 constexpr int LOG_LEVEL = LOG_LEVEL_VERBOSE; // Log level
 constexpr Stream* LOG_TARGET = &Serial; // Target USB serial port for log messages
 constexpr auto CONFIG_FILE_NAME = "config.ini";
+constexpr int STORAGE_MOUNT_ATTEMPTS = 10; // Times to try the SD card before giving up, one attempt every storage tick
+constexpr unsigned long CONFIGURATION_RELOAD_MILLISECONDS = 5000; // How often to look for changes to the configuration file
+constexpr unsigned long READ_MAVLINK_MILLISECONDS = 1; // How often the MAVLink reader polls its source
+constexpr unsigned long SLEEP_READ_MAVLINK_MILLISECONDS = 10; // How often the MAVLink reader runs while sleeping, received bytes wake it right away
+constexpr unsigned long STRESS_TICK_MILLISECONDS = 1; // How often the stress test traffic generator writes the frames that are due
+constexpr uint32_t STRESS_SEED = 0x52424F4C; // Seed of the stress test traffic, the same on every run
+constexpr uint32_t STRESS_BAUD = 2000000; // Speed of both ends of the stress test loopback, fast enough that the reader rather than the line is measured
+constexpr unsigned long SIMULATOR_TICK_MILLISECONDS = 1; // How often the simulated flight controller reads, moves the rover and sends
+constexpr unsigned long MISSION_MONITOR_MILLISECONDS = 250; // How often the mission monitor evaluates the mission, in mission time on the mission clock
+constexpr uint32_t READ_MAVLINK_DEADLINE_MILLISECONDS = 500; // Most time allowed between two runs of the MAVLink reader before the power is cut
+constexpr uint32_t MISSION_MONITOR_DEADLINE_MILLISECONDS = 1000; // Most time allowed between two runs of the mission monitor before the power is cut
 
 bool setupStatus = -1;
 
+/**
+ * @brief Steps taken by the storage task while the rover is already being monitored
+*/
+enum STORAGE_STATE
+{
+	STORAGE_MOUNT,
+	STORAGE_CONFIGURATION,
+	STORAGE_PROMPTS
+};
+
+STORAGE_STATE storageState = STORAGE_MOUNT;
+int storageMountAttempts = 0;
+bool monitoringStarted = false;
+
+// Test mode the reader and monitor were started in, config.ini may ask for the other one until the board restarts
+bool runningTesting = false;
+bool restartPending = false;
 
 
 //Configuration file settings
@@ -79,37 +123,118 @@ Configuration* configuration;
 AudioPlayer* audioPlayer;
 
 //MAVLink event receiverand reader
-MAVLinkEventReceiver* eventReceiver;
+MissionMonitor* missionMonitor;
 MAVLinkReader* mavlinkReader;
 
+// Hands every decoded message to the receivers that subscribed to it
+MAVLinkEventBus* eventBus;
+
+// Copy of the mission on the flight controller
+WaypointStore* waypointStore;
+MissionDownloader* missionDownloader;
+
 // Scheduler
 Scheduler scheduler;
 Task blinkTask;
 Task readMAVLinkTask;
 Task missionMonitorTask;
 Task audioPlayerTask;
+Task storageTask;
+Task configurationReloadTask;
+Task memoryMonitorTask;
+Task cpuMonitorTask;
+Task stressTask;
+Task simulatorTask;
+
+/**
+ * @brief Tasks whose stack use is measured by the memory monitor
+*/
+enum MEMORY_TASK
+{
+	MEMORY_TASK_BLINK,
+	MEMORY_TASK_READ_MAVLINK,
+	MEMORY_TASK_MISSION_MONITOR,
+	MEMORY_TASK_AUDIO_PLAYER,
+	MEMORY_TASK_STORAGE,
+	MEMORY_TASK_CONFIGURATION_RELOAD,
+	MEMORY_TASK_COUNT
+};
+
+constexpr const char* MEMORY_TASK_NAMES[MEMORY_TASK_COUNT] = { "blink", "read MAVLink", "mission monitor", "audio player", "storage", "configuration reload" };
+constexpr unsigned long MEMORY_MONITOR_TICK_MILLISECONDS = 1000; // How often the heap is sampled
 
 //Blinker
 Blinker blinker;
 
+// Every object above lives in storage sized when the firmware is compiled. The only memory taken at run time is the corridor index
+// of each mission monitor, from PSRAM when it is fitted and from the heap otherwise, the log tells which when the index is built.
+StaticStorage<sizeof( Configuration )> configurationStorage;
+StaticStorage<sizeof( AudioPlayer )> audioPlayerStorage;
+StaticStorage<sizeof( MissionMonitor )> missionMonitorStorage;
+StaticStorage<sizeof( MAVLinkEventBus )> eventBusStorage;
+StaticStorage<sizeof( MissionDownloader )> missionDownloaderStorage;
+StaticStorage<sizeof( StressHarness )> stressHarnessStorage;
+StaticStorage<largestSize<SerialMAVLinkReader, FileMAVLinkReader, DataFlashReader,
+	StaticMAVLinkReader<SerialMAVLinkReader, MAVLinkEventBus>, StaticMAVLinkReader<FileMAVLinkReader, MAVLinkEventBus>>()> mavlinkReaderStorage;
+
+// The waypoint store is large, in the second RAM bank it doesn't take memory away from the stack and the other variables
+DMAMEM StaticStorage<sizeof( WaypointStore )> waypointStoreStorage;
+
+// The shadow monitors of a threshold sweep are as large, they only run on a replay
+DMAMEM StaticStorage<sizeof( ThresholdSweep )> thresholdSweepStorage;
+
+// RAM budget
+MemoryMonitor memoryMonitor;
+
+// Processor use and wake latency
+CpuMonitor cpuMonitor;
+
+// Cuts the power when a critical task stops running, the watchdog resets the board when the main loop stops
+DeadlineMonitor deadlineMonitor;
+uint8_t readMAVLinkDeadline = DEADLINE_MONITOR_CAPACITY;
+uint8_t missionMonitorDeadline = DEADLINE_MONITOR_CAPACITY;
+
+// Recorded time of a replay, the mission monitor runs on its timer instead of the scheduler when it is used
+MissionClock missionClock;
+bool useMissionClock = false;
+
+// Stand-in for the flight controller on Serial2, wired to Serial1, when the stress test is on
+TrafficGenerator trafficGenerator;
+StressHarness* stressHarness = NULL;
+
+// Stand-in for the flight controller on Serial2, wired to Serial1 both ways, when the simulator is on
+FlightControllerSimulator flightControllerSimulator;
+bool useSimulator = false;
+
+// Evaluates a replay under the sweep settings of config.ini besides the configured thresholds
+ThresholdSweep* thresholdSweep = NULL;
+
+// Runs the timeout checks of the mission monitor from a timer interrupt
+SafetyInterrupt safetyInterrupt;
+
 
 /**
 * @Brief
-* Initialize logging, onboard LED, and start task scheduler
+* Initialize logging, onboard LED, and start task scheduler.
+* Monitoring starts right away from the configuration saved in EEPROM, the SD card is read afterwards by the storage task.
 *
 */
 void setup()
 {
+	// Before anything else uses the stack, so its high-water mark can be measured
+	memoryMonitor.paintStack();
+	memoryMonitor.setTaskNames( MEMORY_TASK_NAMES, MEMORY_TASK_COUNT );
 
 	// Run audio player task
-	AudioMemory( 40 );
-	audioPlayer = new AudioPlayer();
+	AudioMemory( AUDIO_MEMORY_BLOCKS );
+	audioPlayer = audioPlayerStorage.create<AudioPlayer>();
 	audioPlayerTask.set( TASK_MILLISECOND * 250, TASK_FOREVER, &audioPlayerTick );
 	scheduler.addTask( audioPlayerTask );
 	audioPlayerTask.enable();
 
 	// Inialize onboard LED
 	pinMode( LED_BUILTIN, OUTPUT );
+	scheduler.addTask( blinkTask );
 
 	/// Serial debug logging setup	
 	Serial.begin( 115200 );
@@ -119,89 +244,448 @@ void setup()
 	Log.trace( "" ); // Create a new line before starting timestamp
 	Log.setPrefix( printTimestamp );
 
+	// Start from the last good configuration, the SD card can take a while or be missing altogether
+	configuration = configurationStorage.create<Configuration>();
 
-	// Check for SD Card
-	if ( !SD.begin( BUILTIN_SDCARD ) )
+	if ( configuration->load() )
 	{
-		Log.error( "Could not read SD card" );
-		setupFailed( FAILED_NO_SD );
-		audioPlayer->play( NO_STORAGE_CARD_SOUND );
-		return;
+		Log.trace( "Loaded saved configuration" );
+		audioPlayer->setPromptIndex( configuration->getPromptIndex() );
 	}
 	else
 	{
-		Log.trace( "Found SD card" );
+		Log.trace( "Using defaults, no saved configuration found" );
+	}
 
-		// Read configuration if it exists
-		configuration = new Configuration();
+	// Sleep between interrupts when no task is due
+	scheduler.setSleepMethod( &idleSleep );
+	scheduler.allowSleep( configuration->getIdleSleep() );
 
-		if ( !configuration->init( CONFIG_FILE_NAME ) )
-		{
-			Log.trace( "Using defaults, configuration file not found: %s", CONFIG_FILE_NAME );
-		}
-		else
-		{
-			Log.trace( "Loaded configuration file: %s", CONFIG_FILE_NAME );
-		}
+	// Replaying from a test file has to wait for the SD card
+	if ( !configuration->getTesting() )
+	{
+		startMonitoring();
+	}
+
+	// Read the SD card in the background
+	storageTask.set( TASK_MILLISECOND * 100, TASK_FOREVER, &measuredStorageTick );
+	scheduler.addTask( storageTask );
+	storageTask.enable();
+
+	// Report stack, heap and audio memory use
+	memoryMonitorTask.set( TASK_MILLISECOND * MEMORY_MONITOR_TICK_MILLISECONDS, TASK_FOREVER, &memoryMonitorTick );
+	scheduler.addTask( memoryMonitorTask );
+	memoryMonitorTask.enable();
 
+	// Report processor use
+	cpuMonitorTask.set( TASK_MILLISECOND * CPU_MONITOR_PUBLISH_MILLISECONDS, TASK_FOREVER, &cpuMonitorTick );
+	scheduler.addTask( cpuMonitorTask );
+	cpuMonitorTask.enable();
 
-		// Setup the mavlink reader and monitor
-		eventReceiver = new MissionMonitor( configuration->getSecondsBeforeEmergencyStop(), (GPS_FIX_TYPE)configuration->getLowestGPSFixType(), audioPlayer );
+}
 
-		if ( configuration->getTesting() == true )
+/**
+ * @brief Collect the thresholds the mission is evaluated against from the current configuration.
+ * @return The thresholds.
+*/
+MissionThresholds getMissionThresholds()
+{
+	MissionThresholds thresholds;
+
+	thresholds.secondsBeforeEmergencyStop = configuration->getSecondsBeforeEmergencyStop();
+	thresholds.lowestGpsFixType = (GPS_FIX_TYPE)configuration->getLowestGPSFixType();
+	thresholds.corridorWidthMeters = configuration->getCorridorWidthMeters();
+	thresholds.maxBearingErrorDegrees = configuration->getMaxBearingErrorDegrees();
+	thresholds.divergenceMilliseconds = configuration->getDivergenceMilliseconds();
+
+	return thresholds;
+}
+
+/**
+ * @brief Create the MAVLink reader and mission monitor from the current configuration and schedule them.
+ * @return False if the test file could not be found.
+*/
+bool startMonitoring()
+{
+	runningTesting = configuration->getTesting();
+
+	// Setup the mavlink reader and monitor
+	missionMonitor = missionMonitorStorage.create<MissionMonitor>( getMissionThresholds(), audioPlayer );
+	missionMonitor->setSafetyRules( configuration->getSafetyRules(), configuration->getSafetyRuleCount() );
+
+	waypointStore = waypointStoreStorage.create<WaypointStore>();
+	missionDownloader = missionDownloaderStorage.create<MissionDownloader>( waypointStore );
+	missionDownloader->setSendMissionMessageCallback( []( uint32_t msgid, uint16_t seq, uint8_t type ) { mavlinkReader->sendMissionMessage( msgid, seq, type ); } );
+	missionDownloader->setIsFlightControllerFoundCallback( []() { return mavlinkReader->isFlightControllerFound(); } );
+	missionMonitor->setMissionDownloader( missionDownloader );
+	Log.trace( "Waypoint store for %d mission items uses %d bytes", WAYPOINT_STORE_CAPACITY, sizeof( WaypointStore ) );
+
+	// Messages are decoded once by the reader and delivered to each subscriber in this order
+	eventBus = eventBusStorage.create<MAVLinkEventBus>();
+	eventBus->subscribe( missionMonitor, "mission monitor", MISSION_MONITOR_MESSAGE_IDS );
+	eventBus->subscribe( missionDownloader, "mission downloader", MISSION_DOWNLOADER_MESSAGE_IDS );
+
+	if ( runningTesting == true )
+	{
+		if ( SD.exists( configuration->getTestFileName() ) )
 		{
-			if ( SD.exists( configuration->getTestFileName() ) )
-			{
-				Log.trace( "Using MAVLink test file: %s at %d milliseconds per message", configuration->getTestFileName(), configuration->getFileSpeedMilliseconds() );
-				Log.trace( "Restraining bolt starting...." );
-				audioPlayer->play( REPLAY_FROM_FILE_SOUND );
-				mavlinkReader = new FileMAVLinkReader( configuration->getTestFileName(), eventReceiver, configuration->getFileSpeedMilliseconds() );
+			Log.trace( "Using MAVLink test file: %s at %d milliseconds per message", configuration->getTestFileName(), configuration->getFileSpeedMilliseconds() );
+			Log.trace( "Restraining bolt starting...." );
+			audioPlayer->play( REPLAY_FROM_FILE_SOUND );
+			FileMAVLinkReader* fileMAVLinkReader;
 
+			if ( DataFlashReader::isDataFlashLog( configuration->getTestFileName() ) )
+			{
+				// The DataFlash reader turns records into events itself, it has no frames to dispatch statically
+				fileMAVLinkReader = mavlinkReaderStorage.create<DataFlashReader>( configuration->getTestFileName(), eventBus, configuration->getFileSpeedMilliseconds() );
+			}
+			else if ( configuration->getStaticDispatch() )
+			{
+				fileMAVLinkReader = mavlinkReaderStorage.create<StaticMAVLinkReader<FileMAVLinkReader, MAVLinkEventBus>>( eventBus, configuration->getTestFileName(), eventBus, configuration->getFileSpeedMilliseconds() );
 			}
 			else
 			{
-				Log.error( "Could not find test file: %s", configuration->getTestFileName() );
-				setupFailed( FAILED_NO_TEST_FILE );
-				audioPlayer->play( NO_TEST_FILE );
+				fileMAVLinkReader = mavlinkReaderStorage.create<FileMAVLinkReader>( configuration->getTestFileName(), eventBus, configuration->getFileSpeedMilliseconds() );
+			}
 
-				return;
+			// The index next to the test file holds snapshots of the mission monitor, so the replay can start part way through.
+			// A DataFlash log can't be entered part way through, its record layouts are in the FMT records before that point.
+			static_assert(sizeof( MissionMonitorSnapshot ) <= TLOG_SNAPSHOT_CAPACITY, "The mission monitor snapshot doesn't fit a tlog index entry");
 
+			if ( configuration->getSweepSettingCount() > 0 )
+			{
+				// One pass over the file, each message is decoded once and evaluated by a shadow monitor per setting
+				thresholdSweep = thresholdSweepStorage.create<ThresholdSweep>( missionMonitor, getMissionThresholds(),
+					configuration->getSweepSettings(), configuration->getSweepSettingCount(), configuration->getSweepFaultMilliseconds() );
+				thresholdSweep->setSafetyRules( configuration->getSafetyRules(), configuration->getSafetyRuleCount() );
+				thresholdSweep->setMissionDownloader( missionDownloader );
+				eventBus->subscribe( thresholdSweep, "threshold sweep", THRESHOLD_SWEEP_MESSAGE_IDS );
 			}
+
+			// The shadow monitors of a sweep have no snapshots, a sweep replays the whole file
+			if ( !DataFlashReader::isDataFlashLog( configuration->getTestFileName() ) && thresholdSweep == NULL )
+			{
+				fileMAVLinkReader->setSnapshotCallbacks(
+					[]( uint8_t* snapshot ) { missionMonitor->saveSnapshot( (MissionMonitorSnapshot*)snapshot ); },
+					[]( const uint8_t* snapshot ) { missionMonitor->restoreSnapshot( *(const MissionMonitorSnapshot*)snapshot ); },
+					sizeof( MissionMonitorSnapshot ),
+					missionMonitor->getSnapshotKey() );
+				fileMAVLinkReader->setMissionCallbacks(
+					[]() { return missionDownloader->getGeneration(); },
+					[]( File* file ) { return missionDownloader->saveMission( file ); },
+					[]( File* file ) { return missionDownloader->restoreMission( file ); } );
+			}
+
+			fileMAVLinkReader->setReplayStart( configuration->getReplayStartMilliseconds() );
+
+			if ( configuration->getMissionClock() )
+			{
+				Log.trace( "Replaying on the mission clock" );
+				missionClock.setTimer( MISSION_MONITOR_MILLISECONDS, &missionClockTick );
+				fileMAVLinkReader->setMissionClock( &missionClock );
+				useMissionClock = true;
+			}
+
+			mavlinkReader = fileMAVLinkReader;
+			mavlinkReader->setFlightControllerSystemId( configuration->getFlightControllerSystemId() );
+
 		}
 		else
 		{
-			Log.trace( "Using real time MAVLink over serial 1" );
-			Log.trace( "Restraining bolt starting...." );
-			mavlinkReader = new SerialMAVLinkReader( &Serial1, eventReceiver );
+			Log.error( "Could not find test file: %s", configuration->getTestFileName() );
+			setupFailed( FAILED_NO_TEST_FILE );
+			audioPlayer->play( NO_TEST_FILE );
+
+			return false;
 
 		}
+	}
+	else
+	{
+		Log.trace( "Using real time MAVLink over serial 1" );
+		Log.trace( "Restraining bolt starting...." );
+
+		// The stress test loopback runs faster than a flight controller link, the ports at both ends must match
+		uint32_t baudRate = configuration->getStressTest() ? STRESS_BAUD : MAVLINK_SERIAL_BAUD;
+
+		if ( configuration->getStaticDispatch() )
+		{
+			mavlinkReader = mavlinkReaderStorage.create<StaticMAVLinkReader<SerialMAVLinkReader, MAVLinkEventBus>>( eventBus, &Serial1, eventBus, baudRate );
+		}
+		else
+		{
+			mavlinkReader = mavlinkReaderStorage.create<SerialMAVLinkReader>( &Serial1, eventBus, baudRate );
+		}
+
+		mavlinkReader->setFlightControllerSystemId( configuration->getFlightControllerSystemId() );
+
+		if ( configuration->getStressTest() )
+		{
+			// Bench only: the flight controller is disconnected and Serial2 TX, pin 8, is wired to Serial1 RX, pin 0
+			Log.trace( "Stress test, the traffic generator on serial 2 stands in for the flight controller" );
+			trafficGenerator.begin( &Serial2, STRESS_SEED, STRESS_BAUD );
+			mavlinkReader->setFlightControllerSystemId( TRAFFIC_SYSTEM_ID );
+			stressHarness = stressHarnessStorage.create<StressHarness>( &trafficGenerator, mavlinkReader->getLinkStatistics(), &deadlineMonitor, configuration->getStressLoad(), STRESS_BAUD );
+			eventBus->subscribe( stressHarness, "stress harness", STRESS_HARNESS_MESSAGE_IDS );
+		}
+		else if ( configuration->getSimulator() )
+		{
+			// Bench only: the flight controller is disconnected, Serial2 TX, pin 8, is wired to Serial1 RX, pin 0, and Serial1 TX, pin 1, to Serial2 RX, pin 7
+			Log.trace( "Simulator, the simulated flight controller on serial 2 stands in for the flight controller" );
+			flightControllerSimulator.begin( &Serial2, missionMonitor->getServoRelay(), configuration->getSimulatorFault(), configuration->getSimulatorFaultMilliseconds(), MAVLINK_SERIAL_BAUD );
+			trafficGenerator.begin( &Serial2, STRESS_SEED, MAVLINK_SERIAL_BAUD );
+			trafficGenerator.setLoad( configuration->getSimulatorLoad() );
+			mavlinkReader->setFlightControllerSystemId( TRAFFIC_SYSTEM_ID );
+			useSimulator = true;
+		}
+	}
+
+	Log.trace( "MAVLink messages dispatched %s", configuration->getStaticDispatch() ? "statically" : "through virtual calls" );
+	mavlinkReader->setFrameFilter( configuration->getFilterFrames() );
+	mavlinkReader->setSubscribedMessages( eventBus->getMessageMask() );
+
+	/**
+	 * @brief
+	 * Running a mission live or from file require to different mission timing solutions.
+	 * File uses the recorded time in MAVLink packets while live uses local millis()
+	*/
+	missionMonitor->setMissionTimeCallback( []() {return mavlinkReader->getMissionTime(); } );
+
+	if ( thresholdSweep != NULL )
+	{
+		thresholdSweep->setMissionTimeCallback( []() {return mavlinkReader->getMissionTime(); } );
+	}
+
+
+	missionMonitor->setSendModeChangeCallback( []( ROVER_MODE roverMode ) { mavlinkReader->sendChangeMode(roverMode); } );
+
+	missionMonitor->setSendParamValueCallback( []( const char* parameterId, float value, uint16_t index, uint16_t count ) { mavlinkReader->sendParamValue( parameterId, value, index, count ); } );
+
+
+	// Read from MAVLink task
+	readMAVLinkTask.set( TASK_MILLISECOND * READ_MAVLINK_MILLISECONDS, TASK_FOREVER, &mavlinkReaderTick );
+	scheduler.addTask( readMAVLinkTask );
+	readMAVLinkTask.enable();
+	applyIdleSleep();
+
+	// Run mission task
+	missionMonitorTask.set( TASK_MILLISECOND * MISSION_MONITOR_MILLISECONDS, TASK_FOREVER, &eventReceiverTick );
+	scheduler.addTask( missionMonitorTask );
+	missionMonitorTask.enable();
+
+	if ( stressHarness != NULL )
+	{
+		stressTask.set( TASK_MILLISECOND * STRESS_TICK_MILLISECONDS, TASK_FOREVER, &stressTick );
+		scheduler.addTask( stressTask );
+		stressTask.enable();
+	}
+
+	if ( useSimulator )
+	{
+		simulatorTask.set( TASK_MILLISECOND * SIMULATOR_TICK_MILLISECONDS, TASK_FOREVER, &simulatorTick );
+		scheduler.addTask( simulatorTask );
+		simulatorTask.enable();
+	}
+
+	// The relay is off until the mission monitor starts, from here on it is cut if either task stops running
+	readMAVLinkDeadline = deadlineMonitor.addTask( "read MAVLink", READ_MAVLINK_DEADLINE_MILLISECONDS );
+	missionMonitorDeadline = deadlineMonitor.addTask( "mission monitor", MISSION_MONITOR_DEADLINE_MILLISECONDS );
+	deadlineMonitor.begin( missionMonitor->getServoRelay() );
+
+	// A replayed mission runs on recorded time, the interrupt only watches a live rover
+	if ( !runningTesting )
+	{
+		missionMonitor->setSafetyInterrupt( &safetyInterrupt );
+		safetyInterrupt.begin( missionMonitor->getServoRelay() );
+	}
+
+	monitoringStarted = true;
+	Log.trace( "Monitoring started %u milliseconds after power on", millis() );
+	memoryMonitor.logBudget();
+	logMAVLinkDialect();
+
+	return true;
+}
+
+/**
+ * @brief Storage task callback. Mounts the SD card, rereads the configuration and indexes the prompts, one step per tick.
+*/
+void storageTick()
+{
+	switch ( storageState )
+	{
+		case STORAGE_MOUNT:
+			if ( SD.begin( BUILTIN_SDCARD ) )
+			{
+				Log.trace( "Found SD card %u milliseconds after power on", millis() );
+				storageState = STORAGE_CONFIGURATION;
+			}
+			else if ( ++storageMountAttempts >= STORAGE_MOUNT_ATTEMPTS )
+			{
+				Log.error( "Could not read SD card" );
+				storageTask.disable();
+				setupFailed( FAILED_NO_SD );
+				audioPlayer->play( NO_STORAGE_CARD_SOUND );
+
+				if ( monitoringStarted )
+				{
+					Log.trace( "Monitoring continues with the saved configuration" );
+				}
+			}
+			break;
 
-		/**
-		 * @brief
-		 * Running a mission live or from file require to different mission timing solutions.
-		 * File uses the recorded time in MAVLink packets while live uses local millis()
-		*/
-		eventReceiver->setMissionTimeCallback( []() {return mavlinkReader->getMissionTime(); } );
+		case STORAGE_CONFIGURATION:
+			{
+				// Read configuration if it exists
+				if ( !configuration->init( CONFIG_FILE_NAME ) )
+				{
+					Log.trace( "Using saved configuration, configuration file not found: %s", CONFIG_FILE_NAME );
+				}
+				else
+				{
+					Log.trace( "Loaded configuration file: %s", CONFIG_FILE_NAME );
+				}
+
+				if ( configuration->save() )
+				{
+					Log.trace( "Saved configuration for next power on" );
+				}
+
+				if ( !monitoringStarted )
+				{
+					if ( !startMonitoring() )
+					{
+						audioPlayer->setStorageReady( true );
+						storageTask.disable();
+						return;
+					}
+				}
+				else
+				{
+					applyConfiguration();
+				}
+
+				storageState = STORAGE_PROMPTS;
+			}
+			break;
 
+		case STORAGE_PROMPTS:
+			audioPlayer->setStorageReady( true );
+			configuration->setPromptIndex( audioPlayer->indexPrompts() );
 
-		eventReceiver->setSendModeChangeCallback( []( ROVER_MODE roverMode ) { mavlinkReader->sendChangeMode(roverMode); } );
+			if ( configuration->save() )
+			{
+				Log.trace( "Saved prompt index for next power on" );
+			}
 
+			Log.trace( "SD card ready %u milliseconds after power on", millis() );
+			storageTask.disable();
+			setupSucceeded();
 
-		// Read from MAVLink task
-		readMAVLinkTask.set( TASK_MILLISECOND * 1, TASK_FOREVER, &mavlinkReaderTick );
-		scheduler.addTask( readMAVLinkTask );
-		readMAVLinkTask.enable();
+			// Watch the configuration file for changes from now on
+			configurationReloadTask.set( TASK_MILLISECOND * CONFIGURATION_RELOAD_MILLISECONDS, TASK_FOREVER, &measuredConfigurationReloadTick );
+			scheduler.addTask( configurationReloadTask );
+			configurationReloadTask.enable();
+			break;
+	}
+}
 
-		// Run mission task
-		missionMonitorTask.set( TASK_MILLISECOND * 250, TASK_FOREVER, &eventReceiverTick );
-		scheduler.addTask( missionMonitorTask );
-		missionMonitorTask.enable();
+/**
+ * @brief Apply a reread configuration to the reader and monitor that are already running.
+*/
+void applyConfiguration()
+{
+	// The reader and mission time source can't be swapped under a running monitor, the board starts over from the saved configuration.
+	// Restarting cuts the power to the drivetrain, so it waits until the rover isn't driving a mission.
+	bool restartNeeded = configuration->getTesting() != runningTesting;
 
-		setupSucceeded();
+	if ( restartNeeded != restartPending )
+	{
+		restartPending = restartNeeded;
+		Log.trace( restartNeeded ? "Test mode changed, restarting once the rover is disarmed or out of AUTO" : "Test mode changed back, restart cancelled" );
 	}
 
+	// Thresholds are staged by the monitor and take effect together before its next evaluation
+	missionMonitor->setThresholds( getMissionThresholds() );
+	missionMonitor->setSafetyRules( configuration->getSafetyRules(), configuration->getSafetyRuleCount() );
+	mavlinkReader->setFrameFilter( configuration->getFilterFrames() );
+	applyIdleSleep();
+}
+
+/**
+ * @brief Turn idle sleep on or off from the configuration. While sleeping the MAVLink reader is woken by the bytes it receives,
+ * so it doesn't need to poll every millisecond.
+*/
+void applyIdleSleep()
+{
+	bool idleSleep = configuration->getIdleSleep();
+
+	// A test file doesn't interrupt, its reader keeps polling at the pace of the file
+	bool wokenByBytes = idleSleep && !runningTesting;
+
+	scheduler.allowSleep( idleSleep );
+	readMAVLinkTask.setInterval( TASK_MILLISECOND * (wokenByBytes ? SLEEP_READ_MAVLINK_MILLISECONDS : READ_MAVLINK_MILLISECONDS) );
+}
 
+/**
+ * @brief Scheduler sleep callback, called after a pass in which no task ran. Sleeps until the next interrupt: the 1 millisecond
+ * system tick, a byte received from the flight controller or the audio library.
+ * @param passMicroseconds The length of the pass.
+*/
+void idleSleep( unsigned long passMicroseconds )
+{
+	// Interrupts are masked between the check and WFI, a byte arriving in between still ends WFI and is handled right after
+	__disable_irq();
 
+	if ( mavlinkReader == NULL || !mavlinkReader->hasBytes() )
+	{
+		asm volatile( "wfi" );
+	}
+
+	__enable_irq();
+
+	if ( mavlinkReader != NULL && mavlinkReader->hasBytes() )
+	{
+		cpuMonitor.onBytesWaiting();
+		readMAVLinkTask.forceNextIteration();
+	}
+}
+
+/**
+ * @brief Configuration reload task callback. Rereads and applies the configuration file when it changed, and restarts the board
+ * for a change of test mode once the rover allows it.
+*/
+void configurationReloadTick()
+{
+	if ( restartPending && !missionMonitor->isDriving() )
+	{
+		Log.trace( "Restarting for the new test mode" );
+		delay( 100 );
+		SCB_AIRCR = 0x05FA0004;
+	}
+
+	if ( !configuration->hasChanged( CONFIG_FILE_NAME ) )
+	{
+		// The file is hashed a slice per run so the check doesn't hold up the MAVLink reader, the next slice runs right away
+		if ( configuration->isCheckingForChanges() )
+		{
+			configurationReloadTask.forceNextIteration();
+		}
+
+		return;
+	}
+
+	if ( configuration->init( CONFIG_FILE_NAME ) )
+	{
+		Log.trace( "Reloaded configuration file: %s", CONFIG_FILE_NAME );
+
+		if ( configuration->save() )
+		{
+			Log.trace( "Saved configuration for next power on" );
+		}
+
+		applyConfiguration();
+	}
 }
 
 /**
@@ -212,6 +696,38 @@ void loop()
 {
 	scheduler.execute();
 
+	if ( monitoringStarted )
+	{
+		deadlineMonitor.feed();
+
+		// The deadline interrupt already cut the power, failing the mission keeps it off and raises the alarm
+		uint32_t missedDeadlines = deadlineMonitor.takeMissedDeadlines();
+
+		for ( uint8_t i = 0; missedDeadlines != 0; i++, missedDeadlines >>= 1 )
+		{
+			if ( missedDeadlines & 1 )
+			{
+				missionMonitor->onMissedDeadline( deadlineMonitor.getTaskName( i ) );
+			}
+		}
+
+		deadlineMonitor.tick( millis() );
+
+		uint32_t trips = safetyInterrupt.takeTrips();
+
+		for ( uint8_t i = 0; i < SAFETY_TRIP_COUNT; i++ )
+		{
+			if ( trips & (1UL << i) )
+			{
+				missionMonitor->onSafetyTrip( SAFETY_TRIP_NAMES[i] );
+			}
+		}
+
+		if ( !runningTesting )
+		{
+			safetyInterrupt.tick( millis() );
+		}
+	}
 }
 
 /**
@@ -222,7 +738,6 @@ void setupFailed( int errorCode )
 {
 	// Blink Task
 	blinkTask.set( TASK_MILLISECOND * 250, TASK_FOREVER, &blinkTick );
-	scheduler.addTask( blinkTask );
 	blinkTask.enable();
 
 }
@@ -231,7 +746,6 @@ void setupSucceeded()
 {
 	// Blink Task
 	blinkTask.set( TASK_MILLISECOND * 1000, TASK_FOREVER, &blinkTick );
-	scheduler.addTask( blinkTask );
 	blinkTask.enable();
 }
 
@@ -240,7 +754,15 @@ void setupSucceeded()
 */
 void mavlinkReaderTick()
 {
-	mavlinkReader->tick();
+	memoryMonitor.runTask( MEMORY_TASK_READ_MAVLINK, []() { mavlinkReader->tick(); } );
+	deadlineMonitor.onTaskRun( readMAVLinkDeadline );
+	cpuMonitor.onBytesHandled();
+
+	// The reader handles a message per run, while sleeping it runs again right away until the bytes waiting are read
+	if ( configuration->getIdleSleep() && mavlinkReader->hasBytes() )
+	{
+		readMAVLinkTask.forceNextIteration();
+	}
 }
 
 /**
@@ -248,7 +770,50 @@ void mavlinkReaderTick()
 */
 void eventReceiverTick()
 {
-	eventReceiver->tick();
+	// On the mission clock the monitor runs at the recorded instants the replay passes, running it here too would make the
+	// decisions depend on how fast the file is read
+	if ( !useMissionClock )
+	{
+		memoryMonitor.runTask( MEMORY_TASK_MISSION_MONITOR, []() { missionMonitor->tick(); tickThresholdSweep(); eventBus->tick(); } );
+	}
+
+	deadlineMonitor.onTaskRun( missionMonitorDeadline );
+}
+
+/**
+ * @brief Mission clock timer callback, runs the mission monitor at a recorded instant
+*/
+void missionClockTick()
+{
+	memoryMonitor.runTask( MEMORY_TASK_MISSION_MONITOR, []() { missionMonitor->tick(); tickThresholdSweep(); eventBus->tick(); } );
+}
+
+/**
+ * @brief Evaluate the mission in the shadow monitors of the threshold sweep, right after the configured monitor
+*/
+void tickThresholdSweep()
+{
+	if ( thresholdSweep != NULL )
+	{
+		thresholdSweep->tick();
+	}
+}
+
+/**
+ * @brief Stress test callback, writes the generated traffic and steps the load
+*/
+void stressTick()
+{
+	stressHarness->tick();
+}
+
+/**
+ * @brief Simulator callback, runs the simulated flight controller and writes the traffic from other systems that is due
+*/
+void simulatorTick()
+{
+	flightControllerSimulator.tick();
+	trafficGenerator.tick();
 }
 
 /**
@@ -256,7 +821,7 @@ void eventReceiverTick()
 */
 void blinkTick()
 {
-	blinker.tick();
+	memoryMonitor.runTask( MEMORY_TASK_BLINK, []() { blinker.tick(); } );
 }
 
 /**
@@ -264,5 +829,38 @@ void blinkTick()
 */
 void audioPlayerTick()
 {
-	audioPlayer->tick();
+	memoryMonitor.runTask( MEMORY_TASK_AUDIO_PLAYER, []() { audioPlayer->tick(); } );
+}
+
+/**
+ * @brief Storage task callback, measured by the memory monitor
+*/
+void measuredStorageTick()
+{
+	memoryMonitor.runTask( MEMORY_TASK_STORAGE, &storageTick );
+}
+
+/**
+ * @brief Configuration reload task callback, measured by the memory monitor
+*/
+void measuredConfigurationReloadTick()
+{
+	memoryMonitor.runTask( MEMORY_TASK_CONFIGURATION_RELOAD, &configurationReloadTick );
+}
+
+/**
+ * @brief Callback for processor use reports
+*/
+void cpuMonitorTick()
+{
+	cpuMonitor.publish( scheduler.getCpuLoadTotal(), scheduler.getCpuLoadCycle(), scheduler.getCpuLoadIdle() );
+	scheduler.cpuLoadReset();
+}
+
+/**
+ * @brief Callback for memory use reports
+*/
+void memoryMonitorTick()
+{
+	memoryMonitor.tick( millis() );
 }
\ No newline at end of file